@@ -0,0 +1,208 @@
+/**
+ * @brief Asteroid belts, from a counter-based random generator
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Asteroid n draws its four random numbers from Philox, with n as the
+ * counter and the seed as the key: no generator state is carried from one
+ * asteroid to the next, so any thread may build any range of the belt.
+ *
+ * The logarithm, sine and cosine are polynomials here instead of libm's,
+ * so the belt comes out bit for bit the same on every platform (libm
+ * results vary in the last bit between implementations), and the loops
+ * vectorize. They are good to a few float ulps, plenty for placing
+ * asteroids.
+ */
+
+// Enables M_PI #define in Windows
+#define _USE_MATH_DEFINES
+
+#include <string.h>
+#include <math.h>
+
+#include "AsteroidBelt.h"
+#include "ForceKernel.h"
+
+/**
+ * @brief What the pool threads need to build a range of the belt
+ */
+struct BeltChunk
+{
+    const AsteroidBelt *belt;
+    OrbitalBodies *bodies;
+    unsigned int first;         // index of asteroid 0
+    float gravitational_parameter;  // G times the center mass [m^3/s^2]
+};
+
+/**
+ * @brief The default belt: the one the simulation always had
+ */
+void setDefaultAsteroidBelt(AsteroidBelt *belt)
+{
+    belt->seed = DEFAULT_ASTEROID_SEED;
+    belt->mean_radius = ASTEROIDS_MEAN_RADIUS;
+    belt->arc = 2.0F * (float)M_PI;
+    belt->min_speed = 0.6F;
+    belt->max_speed = 1.2F;
+    belt->vertical_speed = 1E2F;
+    belt->mass = 1E12F;         // Typical asteroid weight: 1 billion tons
+    belt->radius = 2E3F;        // Typical asteroid radius: 2km
+}
+
+/**
+ * @brief A random word as a float uniform in (0, 1), never either end
+ */
+static inline float getUnitFloat(unsigned int word)
+{
+    return (float)(int)((word >> 9) * 2 + 1) * (1.0F / 16777216.0F);
+}
+
+/**
+ * @brief Natural logarithm of a positive, normal float
+ */
+static inline float getLogarithm(float x)
+{
+    unsigned int bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    // x = m 2^e, with m in [sqrt(1/2), sqrt(2)): shifting the bits by those
+    // of sqrt(1/2) makes the exponent field e, without a branch (as musl does)
+    bits += 0x3F800000u - 0x3F3504F3u;
+    int exponent = (int)(bits >> 23) - 127;
+    bits = (bits & 0x007FFFFFu) + 0x3F3504F3u;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+
+    // log(m) = 2 atanh(s), s = (m - 1) / (m + 1), |s| < 0.172
+    float s = (m - 1) / (m + 1);
+    float s2 = s * s;
+    float series = 2.0F + s2 * (2.0F / 3 + s2 * (2.0F / 5 + s2 * (2.0F / 7 + s2 * (2.0F / 9))));
+    return s * series + (float)exponent * 0.693147181F;
+}
+
+/**
+ * @brief Sine and cosine of a non-negative angle
+ */
+static inline void getSineCosine(float angle, float *sine, float *cosine)
+{
+    // angle = q pi / 2 + r, |r| <= pi / 4; pi / 2 split in two, the first
+    // with 12 bits, so q times it is exact (Cody-Waite)
+    int quadrant = (int)(angle * 0.636619772F + 0.5F);
+    float r = (angle - (float)quadrant * 1.5703125F) - (float)quadrant * 4.83826792E-4F;
+    float r2 = r * r;
+
+    float s = r * (1 + r2 * (-1.0F / 6 + r2 * (1.0F / 120 + r2 * (-1.0F / 5040 + r2 * (1.0F / 362880)))));
+    float c = 1 + r2 * (-1.0F / 2 + r2 * (1.0F / 24 + r2 * (-1.0F / 720 + r2 * (1.0F / 40320))));
+
+    float swapped_s = quadrant & 1 ? c : s;
+    float swapped_c = quadrant & 1 ? s : c;
+    *sine = quadrant & 2 ? -swapped_s : swapped_s;
+    *cosine = (quadrant + 1) & 2 ? -swapped_c : swapped_c;
+}
+
+/**
+ * @brief Builds up to ASTEROID_BELT_TILE asteroids: their random words
+ * first, then everything they set out with
+ *
+ * @param chunk The belt, and where it goes
+ * @param number The belt number of the first asteroid of the tile
+ * @param count How many asteroids
+ */
+static void generateTile(const BeltChunk *chunk, unsigned int number, unsigned int count)
+{
+    const AsteroidBelt *belt = chunk->belt;
+    OrbitalBodies *bodies = chunk->bodies;
+    unsigned int key0 = (unsigned int)belt->seed, key1 = (unsigned int)(belt->seed >> 32);
+    unsigned int words[4][ASTEROID_BELT_TILE];
+
+    for (unsigned int k = 0; k < count; k++)
+    {
+        unsigned int counter[4] = {number + k, 0, 0, 0};
+        getPhiloxWords(counter, key0, key1);
+        words[0][k] = counter[0];
+        words[1][k] = counter[1];
+        words[2][k] = counter[2];
+        words[3][k] = counter[3];
+    }
+
+    float speed_range = belt->max_speed - belt->min_speed;
+    float x[ASTEROID_BELT_TILE], z[ASTEROID_BELT_TILE];
+    float vx[ASTEROID_BELT_TILE], vy[ASTEROID_BELT_TILE], vz[ASTEROID_BELT_TILE];
+    for (unsigned int k = 0; k < count; k++)
+    {
+        // Logit distribution
+        float u = getUnitFloat(words[0][k]);
+        float l = getLogarithm(u / (1 - u)) + 1;
+        float spread = fabsf(l) > 1E-6F ? fabsf(l) : 1E-6F;
+
+        // https://mathworld.wolfram.com/DiskPointPicking.html
+        float r = belt->mean_radius * sqrtf(spread);
+        float phi = belt->arc * getUnitFloat(words[1][k]);
+        float sine, cosine;
+        getSineCosine(phi, &sine, &cosine);
+
+        // https://en.wikipedia.org/wiki/Circular_orbit#Velocity
+        float v = sqrtf(chunk->gravitational_parameter / r) *
+                  (belt->min_speed + speed_range * getUnitFloat(words[2][k]));
+
+        x[k] = r * cosine;
+        z[k] = r * sine;
+        vx[k] = -v * sine;
+        vy[k] = belt->vertical_speed * (2 * getUnitFloat(words[3][k]) - 1);
+        vz[k] = v * cosine;
+    }
+
+    unsigned int first = chunk->first + number;
+    for (unsigned int k = 0; k < count; k++)
+    {
+        bodies->x[first + k] = x[k];
+        bodies->y[first + k] = 0;
+        bodies->z[first + k] = z[k];
+        bodies->vx[first + k] = vx[k];
+        bodies->vy[first + k] = vy[k];
+        bodies->vz[first + k] = vz[k];
+    }
+
+    for (unsigned int i = first; i < first + count; i++)
+    {
+        bodies->mass[i] = belt->mass;
+        bodies->radius[i] = belt->radius;
+        bodies->color[i] = BodyColor COLOR_GRAY;
+        bodies->name[i] = NULL;
+    }
+}
+
+/**
+ * @brief Builds a range of the belt, a tile at a time. Run by the thread pool.
+ */
+static void generateChunk(void *context, unsigned int begin, unsigned int end)
+{
+    const BeltChunk *chunk = (const BeltChunk *)context;
+
+    for (unsigned int i = begin; i < end; i += ASTEROID_BELT_TILE)
+    {
+        unsigned int count = end - i < ASTEROID_BELT_TILE ? end - i : ASTEROID_BELT_TILE;
+        generateTile(chunk, i - chunk->first, count);
+    }
+}
+
+/**
+ * @brief Fills a range of a body store with asteroids orbiting a center
+ * mass at the origin, in the y = 0 plane. The body at begin is asteroid 0
+ * of the belt.
+ *
+ * @param belt How the belt is drawn
+ * @param bodies The body store
+ * @param begin First asteroid
+ * @param end One past the last asteroid
+ * @param centerMass The mass of the most massive object in the star system [kg]
+ * @param pool Builds the belt in parallel, NULL: on this thread
+ */
+void generateAsteroidBelt(const AsteroidBelt *belt, OrbitalBodies *bodies, unsigned int begin,
+                          unsigned int end, double centerMass, ThreadPool *pool)
+{
+    BeltChunk chunk = {belt, bodies, begin, (float)(GRAVITATIONAL_CONSTANT * centerMass)};
+
+    runThreadPool(pool, generateChunk, &chunk, begin, end, ASTEROID_BELT_CHUNK_SIZE);
+}
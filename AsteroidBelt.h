@@ -0,0 +1,77 @@
+/**
+ * @brief Asteroid belts, from a counter-based random generator
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef ASTEROIDBELT_H
+#define ASTEROIDBELT_H
+
+#include "OrbitalBodies.h"
+#include "ThreadPool.h"
+
+/**
+ * The seed of the belt when none is given
+ */
+#define DEFAULT_ASTEROID_SEED 1
+
+/**
+ * This value was originally 2E11F, was changed to have greater sparsity between asteroids,
+ * all of them would be cluttered and close to the Sun otherwise.
+*/
+#define ASTEROIDS_MEAN_RADIUS 9E11F
+
+/**
+ * Asteroids generated together, from one batch of random numbers
+ */
+#define ASTEROID_BELT_TILE 256
+
+/**
+ * Asteroids handed out to the pool threads at a time, a multiple of the tile
+ */
+#define ASTEROID_BELT_CHUNK_SIZE 16384
+
+/**
+ * @brief How a belt is drawn. Asteroid n of a belt depends only on these and
+ * on n, so a seed gives the same belt however many threads build it.
+ */
+struct AsteroidBelt
+{
+    unsigned long long seed;
+    float mean_radius;          // [m], scale of the logit distribution of distances
+    float arc;                  // [rad] of the circle the asteroids spread over, 2 pi: all of it
+    float min_speed, max_speed; // times the circular orbit speed
+    float vertical_speed;       // [m/s], most speed out of the plane, either way
+    float mass;                 // [kg]
+    float radius;               // [m]
+};
+
+/**
+ * @brief Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+ * 1, 2, 3"): four random words out of a counter and a key. Plain integer
+ * operations, so it gives the same words everywhere, and vectorizes.
+ */
+inline void getPhiloxWords(unsigned int counter[4], unsigned int key0, unsigned int key1)
+{
+    for (int round = 0; round < 10; round++)
+    {
+        unsigned long long product0 = (unsigned long long)0xD2511F53u * counter[0];
+        unsigned long long product1 = (unsigned long long)0xCD9E8D57u * counter[2];
+        unsigned int word0 = (unsigned int)(product1 >> 32) ^ counter[1] ^ key0;
+        unsigned int word2 = (unsigned int)(product0 >> 32) ^ counter[3] ^ key1;
+
+        counter[0] = word0;
+        counter[1] = (unsigned int)product1;
+        counter[2] = word2;
+        counter[3] = (unsigned int)product0;
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+}
+
+void setDefaultAsteroidBelt(AsteroidBelt *belt);
+void generateAsteroidBelt(const AsteroidBelt *belt, OrbitalBodies *bodies, unsigned int begin,
+                          unsigned int end, double centerMass, ThreadPool *pool);
+
+#endif
@@ -0,0 +1,759 @@
+/**
+ * @brief Barnes-Hut octree, for full N-body forces in O(n log n)
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Every body feels every other one, asteroids included. Far away groups of
+ * bodies are replaced by their center of mass, once the node holding them
+ * looks smaller than the opening angle from where the body is.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "BarnesHut.h"
+#include "ForceKernel.h"
+
+#define BARNES_HUT_MAX_DEPTH 32
+
+/**
+ * Softening length [m]. Keeps two asteroids that end up almost on top of
+ * each other from kicking themselves out of the system.
+ */
+#define BARNES_HUT_SOFTENING 1E6
+
+#define BARNES_HUT_CHUNK_SIZE 1024
+
+/**
+ * Bodies per chunk of a parallel partition. Nodes this small are built
+ * whole by one thread.
+ */
+#define BARNES_HUT_PARTITION_SIZE 8192
+
+/**
+ * @brief What the pool threads need to walk the tree
+ */
+struct BarnesHutWalk
+{
+    const BarnesHutTree *tree;
+    OrbitalBodies *bodies;
+    double opening_angle_sqr;
+};
+
+/**
+ * @brief What the pool threads need to build the tree
+ */
+struct BarnesHutBuild
+{
+    BarnesHutTree *tree;
+    const OrbitalBodies *bodies;
+
+    // The node being partitioned
+    unsigned int begin, end;
+    double cx, cy, cz;
+};
+
+static bool reserveBodies(BarnesHutTree *tree, unsigned int count);
+static bool reserveNodes(BarnesHutTree *tree, unsigned int count);
+static bool splitNode(BarnesHutBuild *build, ThreadPool *pool,
+                      unsigned int begin, unsigned int end,
+                      double cx, double cy, double cz, double half, unsigned int depth);
+static const BarnesHutNode *placeNode(BarnesHutTree *tree, unsigned int *split, unsigned int *arena);
+static long buildNode(BarnesHutArena *arena, unsigned int *indices, unsigned int *scratch,
+                      const OrbitalBodies *bodies, unsigned int begin, unsigned int end,
+                      double cx, double cy, double cz, double half, unsigned int depth);
+static void boundChunks(void *context, unsigned int begin, unsigned int end);
+static void countOctants(void *context, unsigned int begin, unsigned int end);
+static void scatterOctants(void *context, unsigned int begin, unsigned int end);
+static void copyScratch(void *context, unsigned int begin, unsigned int end);
+static void buildSubtrees(void *context, unsigned int begin, unsigned int end);
+static void copySubtrees(void *context, unsigned int begin, unsigned int end);
+static void gatherBodies(void *context, unsigned int begin, unsigned int end);
+static void walkTree(void *context, unsigned int begin, unsigned int end);
+
+/**
+ * @brief Constructs an empty tree. The arena grows on the first build.
+ */
+BarnesHutTree *constructBarnesHutTree()
+{
+    return (BarnesHutTree *)calloc(1, sizeof(BarnesHutTree));
+}
+
+/**
+ * @brief Destroys a tree and its arena
+ */
+void destroyBarnesHutTree(BarnesHutTree *tree)
+{
+    for (unsigned int i = 0; i < tree->arena_capacity; i++)
+        free(tree->arenas[i].nodes);
+    free(tree->arenas);
+    free(tree->splits);
+    free(tree->chunks);
+    free(tree->nodes);
+    free(tree->indices);
+    free(tree->scratch);
+    free(tree->x);
+    free(tree->y);
+    free(tree->z);
+    free(tree->mass);
+    free(tree);
+}
+
+/**
+ * @brief Rebuilds the tree over the first count bodies, in parallel
+ *
+ * The top of the tree is split with every thread partitioning each node,
+ * then the subtrees below it are built one per thread, each in an arena of
+ * its own, and copied into place. Every node comes out the same as building
+ * the whole tree depth-first on one thread.
+ *
+ * @param tree The tree
+ * @param bodies The body store
+ * @param count How many bodies to insert
+ * @param pool The thread pool, may be NULL
+ * @return false if the arena couldn't grow
+ */
+bool buildBarnesHutTree(BarnesHutTree *tree, const OrbitalBodies *bodies, unsigned int count,
+                        ThreadPool *pool)
+{
+    BarnesHutBuild build = {tree, bodies, 0, count, 0, 0, 0};
+    double min[3], max[3], half;
+    unsigned int chunk_count, node_count, split, arena, i;
+
+    tree->node_count = 0;
+    tree->split_count = 0;
+    tree->arena_count = 0;
+    if (count == 0)
+        return true;
+    if (!reserveBodies(tree, count))
+        return false;
+
+    //Bounding cube of every body
+    chunk_count = (count + BARNES_HUT_PARTITION_SIZE - 1) / BARNES_HUT_PARTITION_SIZE;
+    runThreadPool(pool, boundChunks, &build, 0, chunk_count, 1);
+    for (int k = 0; k < 3; k++)
+    {
+        min[k] = tree->chunks[0].min[k];
+        max[k] = tree->chunks[0].max[k];
+        for (i = 1; i < chunk_count; i++)
+        {
+            min[k] = fmin(min[k], tree->chunks[i].min[k]);
+            max[k] = fmax(max[k], tree->chunks[i].max[k]);
+        }
+    }
+    half = 0.5 * fmax(max[0] - min[0], fmax(max[1] - min[1], max[2] - min[2]));
+    half = half * (1 + 1E-9) + 1.0; // keeps the bodies on the edge inside
+
+    if (!splitNode(&build, pool, 0, count,
+                   0.5 * (min[0] + max[0]), 0.5 * (min[1] + max[1]), 0.5 * (min[2] + max[2]),
+                   half, 0))
+        return false;
+
+    runThreadPool(pool, buildSubtrees, &build, 0, tree->arena_count, 1);
+    node_count = 0;
+    for (i = 0; i < tree->split_count; i++)
+        node_count += tree->splits[i].children > 0;
+    for (i = 0; i < tree->arena_count; i++)
+    {
+        if (tree->arenas[i].failed)
+            return false;
+        node_count += tree->arenas[i].node_count;
+    }
+
+    //Lays the top and the subtrees out depth-first
+    if (!reserveNodes(tree, node_count))
+        return false;
+    split = 0;
+    arena = 0;
+    placeNode(tree, &split, &arena);
+    runThreadPool(pool, copySubtrees, &build, 0, tree->arena_count, 1);
+
+    //Copies the bodies in tree order, so walking a leaf reads contiguous memory
+    runThreadPool(pool, gatherBodies, &build, 0, count, BARNES_HUT_PARTITION_SIZE);
+    return true;
+}
+
+/**
+ * @brief Fills in ax/ay/az of every body in the tree, walking it in parallel
+ *
+ * @param tree A tree built over the bodies
+ * @param bodies The body store
+ * @param openingAngle theta: a node is opened if its size over its distance is larger than this
+ * @param pool The thread pool, may be NULL
+ */
+void computeBarnesHutAccelerations(const BarnesHutTree *tree, OrbitalBodies *bodies,
+                                   double openingAngle, ThreadPool *pool)
+{
+    BarnesHutWalk walk = {tree, bodies, openingAngle * openingAngle};
+
+    if (tree->node_count == 0)
+        return;
+
+    //Walks in tree order, so neighbouring bodies go through the same nodes
+    runThreadPool(pool, walkTree, &walk, 0, tree->nodes[0].end, BARNES_HUT_CHUNK_SIZE);
+}
+
+/**
+ * @brief Grows the per-body arrays of the arena
+ */
+static bool reserveBodies(BarnesHutTree *tree, unsigned int count)
+{
+    if (count <= tree->body_capacity)
+        return true;
+
+    free(tree->indices);
+    free(tree->scratch);
+    free(tree->chunks);
+    free(tree->x);
+    free(tree->y);
+    free(tree->z);
+    free(tree->mass);
+
+    tree->indices = (unsigned int *)malloc(count * sizeof(unsigned int));
+    tree->scratch = (unsigned int *)malloc(count * sizeof(unsigned int));
+    tree->chunks = (BarnesHutChunk *)malloc((count / BARNES_HUT_PARTITION_SIZE + 1) * sizeof(BarnesHutChunk));
+    tree->x = (double *)malloc(count * sizeof(double));
+    tree->y = (double *)malloc(count * sizeof(double));
+    tree->z = (double *)malloc(count * sizeof(double));
+    tree->mass = (double *)malloc(count * sizeof(double));
+    if (!tree->indices || !tree->scratch || !tree->chunks ||
+        !tree->x || !tree->y || !tree->z || !tree->mass)
+    {
+        tree->body_capacity = 0;
+        return false;
+    }
+
+    tree->body_capacity = count;
+    return true;
+}
+
+/**
+ * @brief Grows the nodes of the tree to hold count nodes
+ */
+static bool reserveNodes(BarnesHutTree *tree, unsigned int count)
+{
+    if (count <= tree->node_capacity)
+        return true;
+
+    BarnesHutNode *nodes = (BarnesHutNode *)realloc(tree->nodes, count * sizeof(BarnesHutNode));
+    if (nodes == NULL)
+        return false;
+
+    tree->nodes = nodes;
+    tree->node_capacity = count;
+    return true;
+}
+
+/**
+ * @brief Takes a top node, growing the array if needed
+ *
+ * @return The top node index, -1 if the array couldn't grow
+ */
+static long allocateSplit(BarnesHutTree *tree)
+{
+    if (tree->split_count == tree->split_capacity)
+    {
+        unsigned int capacity = tree->split_capacity ? 2 * tree->split_capacity : 64;
+        BarnesHutSplit *splits = (BarnesHutSplit *)realloc(tree->splits, capacity * sizeof(BarnesHutSplit));
+        if (splits == NULL)
+            return -1;
+
+        tree->splits = splits;
+        tree->split_capacity = capacity;
+    }
+    return tree->split_count++;
+}
+
+/**
+ * @brief Takes a subtree arena, growing the array if needed. Arenas are kept
+ * with their nodes from build to build.
+ *
+ * @return The arena index, -1 if the array couldn't grow
+ */
+static long allocateArena(BarnesHutTree *tree)
+{
+    if (tree->arena_count == tree->arena_capacity)
+    {
+        unsigned int capacity = tree->arena_capacity ? 2 * tree->arena_capacity : 64;
+        BarnesHutArena *arenas = (BarnesHutArena *)realloc(tree->arenas, capacity * sizeof(BarnesHutArena));
+        if (arenas == NULL)
+            return -1;
+
+        memset(arenas + tree->arena_capacity, 0,
+               (capacity - tree->arena_capacity) * sizeof(BarnesHutArena));
+        tree->arenas = arenas;
+        tree->arena_capacity = capacity;
+    }
+    return tree->arena_count++;
+}
+
+/**
+ * @brief Takes a node from a subtree arena, growing it if needed
+ *
+ * @return The node index, -1 if the arena couldn't grow
+ */
+static long allocateNode(BarnesHutArena *arena)
+{
+    if (arena->node_count == arena->node_capacity)
+    {
+        unsigned int capacity = arena->node_capacity ? 2 * arena->node_capacity : 1024;
+        BarnesHutNode *nodes = (BarnesHutNode *)realloc(arena->nodes, capacity * sizeof(BarnesHutNode));
+        if (nodes == NULL)
+            return -1;
+
+        arena->nodes = nodes;
+        arena->node_capacity = capacity;
+    }
+    return arena->node_count++;
+}
+
+/**
+ * @brief Fills in a node, once its mass weighted position sums are known
+ */
+static void finishNode(BarnesHutNode *node, double mass, double x, double y, double z,
+                       double cx, double cy, double cz, double half,
+                       unsigned int begin, unsigned int end, unsigned int next, bool leaf)
+{
+    node->mass = mass;
+    node->x = mass > 0 ? x / mass : cx;
+    node->y = mass > 0 ? y / mass : cy;
+    node->z = mass > 0 ? z / mass : cz;
+    node->size_sqr = 4 * half * half;
+    node->begin = begin;
+    node->end = end;
+    node->next = next;
+    node->leaf = leaf;
+}
+
+/**
+ * @brief Splits the top of the tree over indices [begin, end), depth-first.
+ * Nodes too small to split in parallel become subtrees, built later.
+ *
+ * @param cx, cy, cz Center of the node's cube [m]
+ * @param half Half the edge of the node's cube [m]
+ * @return false if an array couldn't grow
+ */
+static bool splitNode(BarnesHutBuild *build, ThreadPool *pool,
+                      unsigned int begin, unsigned int end,
+                      double cx, double cy, double cz, double half, unsigned int depth)
+{
+    BarnesHutTree *tree = build->tree;
+    long split = allocateSplit(tree);
+    unsigned int octant_ends[8], chunk_count, position, children;
+    unsigned char octant;
+
+    if (split < 0)
+        return false;
+
+    BarnesHutSplit top = {begin, end, cx, cy, cz, half, depth, 0};
+    tree->splits[split] = top;
+    if (end - begin <= BARNES_HUT_PARTITION_SIZE || depth == BARNES_HUT_MAX_DEPTH)
+    {
+        long arena = allocateArena(tree);
+        if (arena < 0)
+            return false;
+
+        tree->arenas[arena].split = (unsigned int)split;
+        return true;
+    }
+
+    //Counting sort of the bodies by octant, a chunk per thread. Chunk by chunk,
+    //each octant keeps the order of the serial sort.
+    build->begin = begin;
+    build->end = end;
+    build->cx = cx;
+    build->cy = cy;
+    build->cz = cz;
+    chunk_count = (end - begin + BARNES_HUT_PARTITION_SIZE - 1) / BARNES_HUT_PARTITION_SIZE;
+    runThreadPool(pool, countOctants, build, 0, chunk_count, 1);
+    position = begin;
+    for (octant = 0; octant < 8; octant++)
+    {
+        for (unsigned int i = 0; i < chunk_count; i++)
+        {
+            unsigned int count = tree->chunks[i].offsets[octant];
+            tree->chunks[i].offsets[octant] = position;
+            position += count;
+        }
+        octant_ends[octant] = position;
+    }
+    runThreadPool(pool, scatterOctants, build, 0, chunk_count, 1);
+    runThreadPool(pool, copyScratch, build, 0, chunk_count, 1);
+
+    unsigned int child_begin = begin;
+    children = 0;
+    for (octant = 0; octant < 8; octant++)
+    {
+        unsigned int child_end = octant_ends[octant];
+        if (child_end == child_begin)
+            continue;
+
+        double quarter = 0.5 * half;
+        if (!splitNode(build, pool, child_begin, child_end,
+                       cx + ((octant & 1) ? quarter : -quarter),
+                       cy + ((octant & 2) ? quarter : -quarter),
+                       cz + ((octant & 4) ? quarter : -quarter),
+                       quarter, depth + 1))
+            return false;
+
+        children++;
+        child_begin = child_end;
+    }
+    tree->splits[split].children = children;
+    return true;
+}
+
+/**
+ * @brief Gives the next top node, and everything below it, its place in the
+ * tree, depth-first. Split nodes are filled in; subtrees only get an offset.
+ *
+ * @param split The next top node to place
+ * @param arena The next subtree to place
+ * @return The node placed, or the root of the subtree in its arena
+ */
+static const BarnesHutNode *placeNode(BarnesHutTree *tree, unsigned int *split, unsigned int *arena)
+{
+    const BarnesHutSplit *top = &tree->splits[(*split)++];
+    double mass = 0, x = 0, y = 0, z = 0;
+
+    if (top->children == 0)
+    {
+        BarnesHutArena *subtree = &tree->arenas[(*arena)++];
+        subtree->offset = tree->node_count;
+        tree->node_count += subtree->node_count;
+        return &subtree->nodes[0];
+    }
+
+    unsigned int node = tree->node_count++;
+    for (unsigned int i = 0; i < top->children; i++)
+    {
+        const BarnesHutNode *child = placeNode(tree, split, arena);
+        mass += child->mass;
+        x += child->mass * child->x;
+        y += child->mass * child->y;
+        z += child->mass * child->z;
+    }
+    finishNode(&tree->nodes[node], mass, x, y, z, top->cx, top->cy, top->cz, top->half,
+               top->begin, top->end, tree->node_count, false);
+    return &tree->nodes[node];
+}
+
+/**
+ * @brief Builds the subtree over indices [begin, end), depth-first
+ *
+ * @param cx, cy, cz Center of the node's cube [m]
+ * @param half Half the edge of the node's cube [m]
+ * @return The node index in the arena, -1 if the arena couldn't grow
+ */
+static long buildNode(BarnesHutArena *arena, unsigned int *indices, unsigned int *scratch,
+                      const OrbitalBodies *bodies, unsigned int begin, unsigned int end,
+                      double cx, double cy, double cz, double half, unsigned int depth)
+{
+    long node = allocateNode(arena);
+    double mass = 0, x = 0, y = 0, z = 0;
+    unsigned int i;
+    bool leaf;
+
+    if (node < 0)
+        return -1;
+
+    leaf = end - begin <= BARNES_HUT_LEAF_SIZE || depth == BARNES_HUT_MAX_DEPTH;
+    if (leaf)
+    {
+        for (i = begin; i < end; i++)
+        {
+            unsigned int index = indices[i];
+            mass += bodies->mass[index];
+            x += bodies->mass[index] * bodies->x[index];
+            y += bodies->mass[index] * bodies->y[index];
+            z += bodies->mass[index] * bodies->z[index];
+        }
+    }
+    else
+    {
+        unsigned int offsets[9] = {0};
+        unsigned char octant;
+
+        //Counting sort of the bodies by octant, through the scratch buffer
+        for (i = begin; i < end; i++)
+        {
+            unsigned int index = indices[i];
+            octant = (bodies->x[index] >= cx) | (bodies->y[index] >= cy) << 1 | (bodies->z[index] >= cz) << 2;
+            offsets[octant + 1]++;
+        }
+        for (octant = 0; octant < 8; octant++)
+            offsets[octant + 1] += offsets[octant];
+        for (i = begin; i < end; i++)
+        {
+            unsigned int index = indices[i];
+            octant = (bodies->x[index] >= cx) | (bodies->y[index] >= cy) << 1 | (bodies->z[index] >= cz) << 2;
+            scratch[begin + offsets[octant]++] = index;
+        }
+        memcpy(indices + begin, scratch + begin, (end - begin) * sizeof(unsigned int));
+
+        //offsets[octant] now holds the end of each octant
+        unsigned int child_begin = begin;
+        for (octant = 0; octant < 8; octant++)
+        {
+            unsigned int child_end = begin + offsets[octant];
+            if (child_end == child_begin)
+                continue;
+
+            double quarter = 0.5 * half;
+            long child = buildNode(arena, indices, scratch, bodies, child_begin, child_end,
+                                   cx + ((octant & 1) ? quarter : -quarter),
+                                   cy + ((octant & 2) ? quarter : -quarter),
+                                   cz + ((octant & 4) ? quarter : -quarter),
+                                   quarter, depth + 1);
+            if (child < 0)
+                return -1;
+
+            //The arena may have moved while building the child
+            mass += arena->nodes[child].mass;
+            x += arena->nodes[child].mass * arena->nodes[child].x;
+            y += arena->nodes[child].mass * arena->nodes[child].y;
+            z += arena->nodes[child].mass * arena->nodes[child].z;
+            child_begin = child_end;
+        }
+    }
+
+    finishNode(&arena->nodes[node], mass, x, y, z, cx, cy, cz, half,
+               begin, end, arena->node_count, leaf);
+    return node;
+}
+
+/**
+ * @brief Bounding box of a range of chunks, numbering the bodies on the way.
+ * Run by the thread pool.
+ */
+static void boundChunks(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutBuild *build = (BarnesHutBuild *)context;
+    const OrbitalBodies *bodies = build->bodies;
+
+    for (unsigned int c = begin; c < end; c++)
+    {
+        BarnesHutChunk *chunk = &build->tree->chunks[c];
+        unsigned int first = c * BARNES_HUT_PARTITION_SIZE;
+        unsigned int last = first + BARNES_HUT_PARTITION_SIZE < build->end
+                                ? first + BARNES_HUT_PARTITION_SIZE
+                                : build->end;
+
+        chunk->min[0] = chunk->max[0] = bodies->x[first];
+        chunk->min[1] = chunk->max[1] = bodies->y[first];
+        chunk->min[2] = chunk->max[2] = bodies->z[first];
+        for (unsigned int i = first; i < last; i++)
+        {
+            build->tree->indices[i] = i;
+            chunk->min[0] = fmin(chunk->min[0], bodies->x[i]); chunk->max[0] = fmax(chunk->max[0], bodies->x[i]);
+            chunk->min[1] = fmin(chunk->min[1], bodies->y[i]); chunk->max[1] = fmax(chunk->max[1], bodies->y[i]);
+            chunk->min[2] = fmin(chunk->min[2], bodies->z[i]); chunk->max[2] = fmax(chunk->max[2], bodies->z[i]);
+        }
+    }
+}
+
+/**
+ * @brief Counts the bodies of a range of chunks of the node being partitioned,
+ * by octant. Run by the thread pool.
+ */
+static void countOctants(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutBuild *build = (BarnesHutBuild *)context;
+    const OrbitalBodies *bodies = build->bodies;
+    const unsigned int *indices = build->tree->indices;
+
+    for (unsigned int c = begin; c < end; c++)
+    {
+        BarnesHutChunk *chunk = &build->tree->chunks[c];
+        unsigned int first = build->begin + c * BARNES_HUT_PARTITION_SIZE;
+        unsigned int last = first + BARNES_HUT_PARTITION_SIZE < build->end
+                                ? first + BARNES_HUT_PARTITION_SIZE
+                                : build->end;
+
+        memset(chunk->offsets, 0, sizeof(chunk->offsets));
+        for (unsigned int i = first; i < last; i++)
+        {
+            unsigned int index = indices[i];
+            unsigned char octant = (bodies->x[index] >= build->cx) |
+                                   (bodies->y[index] >= build->cy) << 1 |
+                                   (bodies->z[index] >= build->cz) << 2;
+            chunk->offsets[octant]++;
+        }
+    }
+}
+
+/**
+ * @brief Moves the bodies of a range of chunks to where their octants go,
+ * in the scratch buffer. Run by the thread pool.
+ */
+static void scatterOctants(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutBuild *build = (BarnesHutBuild *)context;
+    const OrbitalBodies *bodies = build->bodies;
+    const unsigned int *indices = build->tree->indices;
+    unsigned int *scratch = build->tree->scratch;
+
+    for (unsigned int c = begin; c < end; c++)
+    {
+        BarnesHutChunk *chunk = &build->tree->chunks[c];
+        unsigned int first = build->begin + c * BARNES_HUT_PARTITION_SIZE;
+        unsigned int last = first + BARNES_HUT_PARTITION_SIZE < build->end
+                                ? first + BARNES_HUT_PARTITION_SIZE
+                                : build->end;
+
+        for (unsigned int i = first; i < last; i++)
+        {
+            unsigned int index = indices[i];
+            unsigned char octant = (bodies->x[index] >= build->cx) |
+                                   (bodies->y[index] >= build->cy) << 1 |
+                                   (bodies->z[index] >= build->cz) << 2;
+            scratch[chunk->offsets[octant]++] = index;
+        }
+    }
+}
+
+/**
+ * @brief Copies a range of chunks of the partitioned node back from the
+ * scratch buffer. Run by the thread pool.
+ */
+static void copyScratch(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutBuild *build = (BarnesHutBuild *)context;
+    unsigned int first = build->begin + begin * BARNES_HUT_PARTITION_SIZE;
+    unsigned int last = build->begin + end * BARNES_HUT_PARTITION_SIZE < build->end
+                            ? build->begin + end * BARNES_HUT_PARTITION_SIZE
+                            : build->end;
+
+    memcpy(build->tree->indices + first, build->tree->scratch + first,
+           (last - first) * sizeof(unsigned int));
+}
+
+/**
+ * @brief Builds a range of subtrees, each in its own arena. Run by the thread pool.
+ */
+static void buildSubtrees(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutBuild *build = (BarnesHutBuild *)context;
+    BarnesHutTree *tree = build->tree;
+
+    for (unsigned int a = begin; a < end; a++)
+    {
+        BarnesHutArena *arena = &tree->arenas[a];
+        const BarnesHutSplit *top = &tree->splits[arena->split];
+
+        arena->node_count = 0;
+        arena->failed = buildNode(arena, tree->indices, tree->scratch, build->bodies,
+                                  top->begin, top->end, top->cx, top->cy, top->cz,
+                                  top->half, top->depth) < 0;
+    }
+}
+
+/**
+ * @brief Copies a range of subtrees into the tree, moving their next indices
+ * along. Run by the thread pool.
+ */
+static void copySubtrees(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutTree *tree = ((BarnesHutBuild *)context)->tree;
+
+    for (unsigned int a = begin; a < end; a++)
+    {
+        const BarnesHutArena *arena = &tree->arenas[a];
+        BarnesHutNode *nodes = tree->nodes + arena->offset;
+
+        for (unsigned int i = 0; i < arena->node_count; i++)
+        {
+            nodes[i] = arena->nodes[i];
+            nodes[i].next += arena->offset;
+        }
+    }
+}
+
+/**
+ * @brief Copies a range of bodies in tree order. Run by the thread pool.
+ */
+static void gatherBodies(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutBuild *build = (BarnesHutBuild *)context;
+    BarnesHutTree *tree = build->tree;
+    const OrbitalBodies *bodies = build->bodies;
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        unsigned int index = tree->indices[i];
+        tree->x[i] = bodies->x[index];
+        tree->y[i] = bodies->y[index];
+        tree->z[i] = bodies->z[index];
+        tree->mass[i] = bodies->mass[index];
+    }
+}
+
+/**
+ * @brief Walks the tree for a range of bodies, in tree order. Run by the thread pool.
+ */
+static void walkTree(void *context, unsigned int begin, unsigned int end)
+{
+    BarnesHutWalk *walk = (BarnesHutWalk *)context;
+    const BarnesHutTree *tree = walk->tree;
+    const double softening_sqr = BARNES_HUT_SOFTENING * BARNES_HUT_SOFTENING;
+
+    for (unsigned int k = begin; k < end; k++)
+    {
+        double px = tree->x[k], py = tree->y[k], pz = tree->z[k];
+        double ax = 0.0, ay = 0.0, az = 0.0;
+        double dx, dy, dz, distance_sqr, coefficient;
+        unsigned int n = 0;
+
+        while (n < tree->node_count)
+        {
+            const BarnesHutNode *node = &tree->nodes[n];
+
+            dx = px - node->x;
+            dy = py - node->y;
+            dz = pz - node->z;
+            distance_sqr = dx * dx + dy * dy + dz * dz;
+
+            //A node holding body k is always opened: with a wide enough angle, its
+            //center of mass could look far enough, and k would pull on itself
+            if ((k < node->begin || k >= node->end) && node->size_sqr < walk->opening_angle_sqr * distance_sqr)
+            {
+                //Far enough: the whole node pulls from its center of mass
+                distance_sqr += softening_sqr;
+                coefficient = -GRAVITATIONAL_CONSTANT * node->mass /
+                              (distance_sqr * sqrt(distance_sqr));
+                ax += coefficient * dx;
+                ay += coefficient * dy;
+                az += coefficient * dz;
+                n = node->next;
+            }
+            else if (node->leaf)
+            {
+                for (unsigned int j = node->begin; j < node->end; j++)
+                {
+                    if (j == k)
+                        continue;
+
+                    dx = px - tree->x[j];
+                    dy = py - tree->y[j];
+                    dz = pz - tree->z[j];
+                    distance_sqr = dx * dx + dy * dy + dz * dz + softening_sqr;
+                    coefficient = -GRAVITATIONAL_CONSTANT * tree->mass[j] /
+                                  (distance_sqr * sqrt(distance_sqr));
+                    ax += coefficient * dx;
+                    ay += coefficient * dy;
+                    az += coefficient * dz;
+                }
+                n = node->next;
+            }
+            else
+                n++; // opens the node: its first child comes right after it
+        }
+
+        unsigned int index = tree->indices[k];
+        walk->bodies->ax[index] = ax;
+        walk->bodies->ay[index] = ay;
+        walk->bodies->az[index] = az;
+    }
+}
@@ -0,0 +1,98 @@
+/**
+ * @brief Barnes-Hut octree, for full N-body forces in O(n log n)
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef BARNESHUT_H
+#define BARNESHUT_H
+
+#include "OrbitalBodies.h"
+#include "ThreadPool.h"
+
+/**
+ * Nodes holding this many bodies or fewer aren't split any further
+ */
+#define BARNES_HUT_LEAF_SIZE 8
+
+/**
+ * @brief Octree node. Nodes are stored depth-first, so the first child of an
+ * inner node is the node right after it, and next skips the whole subtree.
+ * That makes walking the tree a plain loop, without a stack.
+ */
+struct BarnesHutNode
+{
+    double x, y, z;             // center of mass [m]
+    double mass;                // total mass [kg]
+    double size_sqr;            // edge of the node's cube, squared [m^2]
+    unsigned int begin, end;    // bodies of the node, in tree order
+    unsigned int next;          // the node after this subtree
+    bool leaf;
+};
+
+/**
+ * @brief The nodes of one subtree, built by one thread, depth-first from 0
+ */
+struct BarnesHutArena
+{
+    BarnesHutNode *nodes;
+    unsigned int node_count, node_capacity;
+    unsigned int split;         // the top node it's built from
+    unsigned int offset;        // where its nodes go in the tree
+    bool failed;                // the arena couldn't grow
+};
+
+/**
+ * @brief A node at the top of the tree. Big ones have their bodies partitioned
+ * by every thread at once; the rest are the roots of subtrees, one per thread.
+ */
+struct BarnesHutSplit
+{
+    unsigned int begin, end;    // bodies of the node, in tree order
+    double cx, cy, cz, half;    // center and half edge of the node's cube [m]
+    unsigned int depth;
+    unsigned int children;      // 0 if the node is small enough to be a subtree of its own
+};
+
+/**
+ * @brief Per chunk share of a parallel partition
+ */
+struct BarnesHutChunk
+{
+    unsigned int offsets[8];    // bodies of the chunk in each octant, then where they go
+    double min[3], max[3];      // bounding box of the chunk [m]
+};
+
+/**
+ * @brief The tree, plus the arena it's built in. Rebuilt every step,
+ * the arena only ever grows, so after the first steps nothing is allocated.
+ */
+struct BarnesHutTree
+{
+    BarnesHutNode *nodes;
+    unsigned int node_count, node_capacity;
+
+    // Bodies, sorted in tree order, so each leaf is contiguous
+    unsigned int *indices;
+    double *x, *y, *z, *mass;
+    unsigned int body_capacity;
+
+    unsigned int *scratch;      // used while partitioning indices
+    BarnesHutChunk *chunks;
+
+    // The top of the tree and the subtrees below it, depth-first
+    BarnesHutSplit *splits;
+    unsigned int split_count, split_capacity;
+    BarnesHutArena *arenas;
+    unsigned int arena_count, arena_capacity;
+};
+
+BarnesHutTree *constructBarnesHutTree();
+void destroyBarnesHutTree(BarnesHutTree *tree);
+bool buildBarnesHutTree(BarnesHutTree *tree, const OrbitalBodies *bodies, unsigned int count,
+                        ThreadPool *pool);
+void computeBarnesHutAccelerations(const BarnesHutTree *tree, OrbitalBodies *bodies,
+                                   double openingAngle, ThreadPool *pool);
+
+#endif
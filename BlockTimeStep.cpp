@@ -0,0 +1,430 @@
+/**
+ * @brief Hierarchical block time steps
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * With a single time_step, one asteroid in a close pass by the Sun would force
+ * every body down to its step. Here each body gets a level, and moves in
+ * 2^level kick-drift-kick sub-steps of time_step / 2^level, so only the few
+ * bodies that need it pay for the small steps.
+ *
+ * Every time_step:
+ *  1. The planets move together, at the finest level any of them needs,
+ *     and their positions and velocities are recorded along the way.
+ *  2. For each level some asteroid is on, the planet positions at each of its
+ *     sub-steps are taken from that record (interpolated with cubic Hermite
+ *     polynomials when the level is finer than the planets').
+ *  3. Every asteroid moves through its own sub-steps, in parallel, and picks
+ *     its level for the next time_step from its acceleration and jerk.
+ *
+ * Only FORCE_MODEL_PLANETS is supported; with any other force model the step
+ * falls back to the plain leapfrog.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+#include "OrbitalSim.h"
+#include "BlockTimeStep.h"
+
+/**
+ * @brief What the pool threads need to move asteroids through their levels
+ */
+struct BlockChunk
+{
+    OrbitalSim *sim;
+    BlockTimeStep *block;
+    const double *gm;                           // -G * mass of each planet
+    std::atomic<unsigned long long> evaluations;
+};
+
+/**
+ * @brief Constructs the integrator state. Levels are picked on its first step.
+ */
+BlockTimeStep *constructBlockTimeStep()
+{
+    BlockTimeStep *block = (BlockTimeStep *)calloc(1, sizeof(BlockTimeStep));
+    if (block != NULL)
+        block->eta = DEFAULT_BLOCK_ETA;
+    return block;
+}
+
+/**
+ * @brief Destroys the integrator state
+ */
+void destroyBlockTimeStep(BlockTimeStep *block)
+{
+    free(block->planet_trajectory);
+    free(block->planet_gm);
+    for (int level = 0; level <= BLOCK_MAX_LEVEL; level++)
+        free(block->level_positions[level]);
+    free(block);
+}
+
+/**
+ * @brief Picks the level of a body from its acceleration and jerk due to the
+ *        planets, as they are now: the step is eta * |a| / |da/dt|
+ *
+ * @param sim The simulation
+ * @param eta Accuracy parameter
+ * @param index The body
+ * @return The level
+ */
+static unsigned int chooseLevel(const OrbitalSim *sim, double eta, unsigned int index)
+{
+    const OrbitalBodies *bodies = &sim->bodies;
+    double a[3] = {0, 0, 0}, jerk[3] = {0, 0, 0};
+    double a_norm, jerk_norm, step;
+    unsigned int level;
+
+    for (unsigned int walker = 0; walker < sim->planets_range; walker++)
+    {
+        if (walker == index)
+            continue;
+
+        double dx = bodies->x[index] - bodies->x[walker];
+        double dy = bodies->y[index] - bodies->y[walker];
+        double dz = bodies->z[index] - bodies->z[walker];
+        double dvx = bodies->vx[index] - bodies->vx[walker];
+        double dvy = bodies->vy[index] - bodies->vy[walker];
+        double dvz = bodies->vz[index] - bodies->vz[walker];
+        double distance_sqr = dx * dx + dy * dy + dz * dz;
+        double coefficient = -GRAVITATIONAL_CONSTANT * bodies->mass[walker] /
+                             (distance_sqr * sqrt(distance_sqr));
+        double radial = 3 * (dx * dvx + dy * dvy + dz * dvz) / distance_sqr;
+
+        a[0] += coefficient * dx;
+        a[1] += coefficient * dy;
+        a[2] += coefficient * dz;
+        jerk[0] += coefficient * (dvx - radial * dx);
+        jerk[1] += coefficient * (dvy - radial * dy);
+        jerk[2] += coefficient * (dvz - radial * dz);
+    }
+
+    a_norm = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    jerk_norm = sqrt(jerk[0] * jerk[0] + jerk[1] * jerk[1] + jerk[2] * jerk[2]);
+    if (jerk_norm == 0)
+        return 0;
+
+    step = eta * a_norm / jerk_norm;
+    for (level = 0; level < BLOCK_MAX_LEVEL && step < sim->time_step / (double)(1u << level); level++)
+        ;
+    return level;
+}
+
+/**
+ * @brief Picks the level of a chunk of bodies. Run by the thread pool on the first step.
+ */
+static void chooseLevelsChunk(void *context, unsigned int begin, unsigned int end)
+{
+    BlockChunk *chunk = (BlockChunk *)context;
+
+    for (unsigned int i = begin; i < end; i++)
+        chunk->sim->bodies.level[i] = (unsigned char)chooseLevel(chunk->sim, chunk->block->eta, i);
+}
+
+/**
+ * @brief Records the planets' state at a planet sub-step
+ */
+static void recordPlanets(const OrbitalSim *sim, BlockTimeStep *block, unsigned int substep)
+{
+    const OrbitalBodies *bodies = &sim->bodies;
+    double *record = block->planet_trajectory + (size_t)substep * sim->planets_range * 6;
+
+    for (unsigned int p = 0; p < sim->planets_range; p++)
+    {
+        record[6 * p + 0] = bodies->x[p];
+        record[6 * p + 1] = bodies->y[p];
+        record[6 * p + 2] = bodies->z[p];
+        record[6 * p + 3] = bodies->vx[p];
+        record[6 * p + 4] = bodies->vy[p];
+        record[6 * p + 5] = bodies->vz[p];
+    }
+}
+
+/**
+ * @brief Allocates everything this step needs, before anything moves: the
+ *        planets' trajectory record and the position table of every level in use
+ *
+ * @return false if something couldn't be allocated
+ */
+static bool reserveStep(OrbitalSim *sim, BlockTimeStep *block)
+{
+    const OrbitalBodies *bodies = &sim->bodies;
+    unsigned int planets = sim->planets_range;
+    unsigned int level = 0;
+
+    for (unsigned int p = 0; p < planets; p++)
+        if (bodies->level[p] > level)
+            level = bodies->level[p];
+    block->planet_level = level;
+
+    if (block->trajectory_capacity < (1u << level) + 1 || block->planet_capacity < planets)
+    {
+        free(block->planet_trajectory);
+        free(block->planet_gm);
+        for (unsigned int table = 0; table <= BLOCK_MAX_LEVEL; table++)
+        {
+            free(block->level_positions[table]);
+            block->level_positions[table] = NULL;
+        }
+        block->planet_trajectory = (double *)malloc((size_t)((1u << level) + 1) * planets * 6 * sizeof(double));
+        block->planet_gm = (double *)malloc(planets * sizeof(double));
+        if (block->planet_trajectory == NULL || block->planet_gm == NULL)
+        {
+            block->trajectory_capacity = block->planet_capacity = 0;
+            return false;
+        }
+        block->trajectory_capacity = (1u << level) + 1;
+        block->planet_capacity = planets;
+    }
+
+    for (level = 0; level <= BLOCK_MAX_LEVEL; level++)
+    {
+        if (block->level_histogram[level] == 0 || block->level_positions[level] != NULL)
+            continue;
+
+        //Sized for the most planets seen so far, so it never needs to grow
+        block->level_positions[level] = (double *)malloc((size_t)((1u << level) + 1) *
+                                                         block->planet_capacity * 3 * sizeof(double));
+        if (block->level_positions[level] == NULL)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Moves the planets through 2^planet_level leapfrog sub-steps, recording
+ *        their trajectory
+ */
+static void advancePlanets(OrbitalSim *sim, BlockTimeStep *block)
+{
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int planets = sim->planets_range;
+    unsigned int substeps = 1u << block->planet_level;
+    double h = sim->time_step / substeps;
+
+    if (!sim->accelerations_valid)
+    {
+        computePlanetAccelerations(sim);
+        block->body_evaluations += planets;
+    }
+    recordPlanets(sim, block, 0);
+
+    for (unsigned int s = 0; s < substeps; s++)
+    {
+        for (unsigned int p = 0; p < planets; p++)
+        {
+            bodies->vx[p] += 0.5 * h * bodies->ax[p];
+            bodies->vy[p] += 0.5 * h * bodies->ay[p];
+            bodies->vz[p] += 0.5 * h * bodies->az[p];
+            bodies->x[p] += h * bodies->vx[p];
+            bodies->y[p] += h * bodies->vy[p];
+            bodies->z[p] += h * bodies->vz[p];
+        }
+        computePlanetAccelerations(sim);
+        for (unsigned int p = 0; p < planets; p++)
+        {
+            bodies->vx[p] += 0.5 * h * bodies->ax[p];
+            bodies->vy[p] += 0.5 * h * bodies->ay[p];
+            bodies->vz[p] += 0.5 * h * bodies->az[p];
+        }
+        recordPlanets(sim, block, s + 1);
+    }
+    block->body_evaluations += (unsigned long long)substeps * planets;
+}
+
+/**
+ * @brief Fills in the planet positions at every sub-step of a level, from the
+ *        planets' recorded trajectory
+ */
+static void buildLevelPositions(OrbitalSim *sim, BlockTimeStep *block, unsigned int level)
+{
+    unsigned int planets = sim->planets_range;
+    unsigned int substeps = 1u << level;
+    double planet_step = sim->time_step / (1u << block->planet_level);
+    double *table = block->level_positions[level];
+
+    for (unsigned int j = 0; j <= substeps; j++)
+    {
+        unsigned int grid, offset, shift;
+        double *row = table + (size_t)j * planets * 3;
+
+        //Where sub-step j falls on the planets' record: a grid point plus a fraction
+        if (level <= block->planet_level)
+        {
+            grid = j << (block->planet_level - level);
+            offset = 0;
+            shift = 0;
+        }
+        else
+        {
+            shift = level - block->planet_level;
+            grid = j >> shift;
+            offset = j & ((1u << shift) - 1);
+        }
+
+        const double *start = block->planet_trajectory + (size_t)grid * planets * 6;
+        if (offset == 0)
+        {
+            for (unsigned int p = 0; p < planets; p++)
+                memcpy(row + 3 * p, start + 6 * p, 3 * sizeof(double));
+            continue;
+        }
+
+        //Cubic Hermite between the two grid points around it
+        const double *stop = start + planets * 6;
+        double s = offset / (double)(1u << shift);
+        double h00 = (1 + 2 * s) * (1 - s) * (1 - s);
+        double h10 = s * (1 - s) * (1 - s) * planet_step;
+        double h01 = s * s * (3 - 2 * s);
+        double h11 = s * s * (s - 1) * planet_step;
+
+        for (unsigned int p = 0; p < planets; p++)
+            for (int axis = 0; axis < 3; axis++)
+                row[3 * p + axis] = h00 * start[6 * p + axis] + h10 * start[6 * p + 3 + axis] +
+                                    h01 * stop[6 * p + axis] + h11 * stop[6 * p + 3 + axis];
+    }
+}
+
+/**
+ * @brief Acceleration on an asteroid from planets at the given positions
+ */
+static inline void pullFromPlanets(const double *positions, const double *gm, unsigned int planets,
+                                   double x, double y, double z, double *a)
+{
+    a[0] = a[1] = a[2] = 0.0;
+    for (unsigned int p = 0; p < planets; p++)
+    {
+        double dx = x - positions[3 * p + 0];
+        double dy = y - positions[3 * p + 1];
+        double dz = z - positions[3 * p + 2];
+        double distance_sqr = dx * dx + dy * dy + dz * dz;
+        double coefficient = gm[p] / (distance_sqr * sqrt(distance_sqr));
+
+        a[0] += coefficient * dx;
+        a[1] += coefficient * dy;
+        a[2] += coefficient * dz;
+    }
+}
+
+/**
+ * @brief Moves a chunk of asteroids through the sub-steps of their levels,
+ *        and picks their next levels. Run by the thread pool.
+ */
+static void advanceAsteroidsChunk(void *context, unsigned int begin, unsigned int end)
+{
+    BlockChunk *chunk = (BlockChunk *)context;
+    OrbitalSim *sim = chunk->sim;
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int planets = sim->planets_range;
+    unsigned long long evaluations = 0;
+    //Too interleaved to split: all of it counts as force time, the bulk of it
+    INSTRUMENT_START(timer);
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        unsigned int level = bodies->level[i];
+        unsigned int substeps = 1u << level;
+        double h = sim->time_step / substeps;
+        const double *table = chunk->block->level_positions[level];
+        double x = bodies->x[i], y = bodies->y[i], z = bodies->z[i];
+        double vx = bodies->vx[i], vy = bodies->vy[i], vz = bodies->vz[i];
+        double a[3] = {bodies->ax[i], bodies->ay[i], bodies->az[i]};
+
+        if (!sim->accelerations_valid)
+        {
+            pullFromPlanets(table, chunk->gm, planets, x, y, z, a);
+            evaluations++;
+        }
+
+        for (unsigned int s = 1; s <= substeps; s++)
+        {
+            vx += 0.5 * h * a[0];
+            vy += 0.5 * h * a[1];
+            vz += 0.5 * h * a[2];
+            x += h * vx;
+            y += h * vy;
+            z += h * vz;
+            pullFromPlanets(table + (size_t)s * planets * 3, chunk->gm, planets, x, y, z, a);
+            vx += 0.5 * h * a[0];
+            vy += 0.5 * h * a[1];
+            vz += 0.5 * h * a[2];
+        }
+        evaluations += substeps;
+
+        bodies->x[i] = x; bodies->y[i] = y; bodies->z[i] = z;
+        bodies->vx[i] = vx; bodies->vy[i] = vy; bodies->vz[i] = vz;
+        bodies->ax[i] = a[0]; bodies->ay[i] = a[1]; bodies->az[i] = a[2];
+
+        //Levels may deepen at once, but only come back up one at a time
+        unsigned int next = chooseLevel(sim, chunk->block->eta, i);
+        bodies->level[i] = (unsigned char)(next + 1 < level ? level - 1 : next);
+    }
+    chunk->evaluations += evaluations;
+
+    INSTRUMENT_STOP(sim->instrumentation, PHASE_FORCE, timer);
+    INSTRUMENT_PAIRS(sim->instrumentation, evaluations * planets);
+}
+
+/**
+ * @brief Advances a simulation one time_step with block time steps
+ *
+ * @param sim The simulation
+ */
+void stepBlockTimeStep(OrbitalSim *sim)
+{
+    OrbitalBodies *bodies = &sim->bodies;
+    BlockTimeStep *block = sim->block;
+    unsigned int planets = sim->planets_range;
+    BlockChunk chunk;
+
+    if (block == NULL)
+        block = sim->block = constructBlockTimeStep();
+    if (block == NULL || sim->force_model != FORCE_MODEL_PLANETS)
+    {
+        getIntegrator(INTEGRATOR_LEAPFROG)->step(sim);
+        return;
+    }
+
+    chunk.sim = sim;
+    chunk.block = block;
+    chunk.evaluations = 0;
+
+    if (!block->initialized)
+    {
+        runThreadPool(sim->pool, chooseLevelsChunk, &chunk, 0, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+        block->initialized = true;
+    }
+
+    memset(block->level_histogram, 0, sizeof(block->level_histogram));
+    for (unsigned int i = planets; i < sim->bodies_count; i++)
+        block->level_histogram[bodies->level[i]]++;
+
+    if (!reserveStep(sim, block))
+    {
+        //Out of memory: this step goes with the plain leapfrog
+        getIntegrator(INTEGRATOR_LEAPFROG)->step(sim);
+        return;
+    }
+    chunk.gm = block->planet_gm;
+    for (unsigned int p = 0; p < planets; p++)
+        block->planet_gm[p] = -GRAVITATIONAL_CONSTANT * bodies->mass[p];
+
+    advancePlanets(sim, block);
+    for (unsigned int level = 0; level <= BLOCK_MAX_LEVEL; level++)
+        if (block->level_histogram[level])
+            buildLevelPositions(sim, block, level);
+
+    runThreadPool(sim->pool, advanceAsteroidsChunk, &chunk, planets, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+    block->body_evaluations += chunk.evaluations;
+
+    for (unsigned int p = 0; p < planets; p++)
+        bodies->level[p] = (unsigned char)chooseLevel(sim, block->eta, p);
+
+    sim->force_evaluations++;
+    sim->accelerations_valid = true;
+}
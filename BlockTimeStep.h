@@ -0,0 +1,50 @@
+/**
+ * @brief Hierarchical block time steps
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef BLOCKTIMESTEP_H
+#define BLOCKTIMESTEP_H
+
+struct OrbitalSim;
+
+/**
+ * Deepest level: a body never moves in steps shorter than time_step / 2^BLOCK_MAX_LEVEL
+ */
+#define BLOCK_MAX_LEVEL 12
+
+/**
+ * Default accuracy parameter: a body's step is about eta * |a| / |da/dt|
+ */
+#define DEFAULT_BLOCK_ETA 0.05
+
+/**
+ * @brief State of the block time step integrator. Each body moves in
+ * power-of-two fractions of time_step, picked from its acceleration and jerk
+ * (Aarseth's criterion). Planets all share the finest planet level; asteroids
+ * read planet positions interpolated along the planets' trajectory.
+ */
+struct BlockTimeStep
+{
+    double eta;
+    bool initialized;                   // levels were picked at least once
+
+    unsigned int planet_level;          // level all planets moved at, last step
+    double *planet_trajectory;          // x, y, z, vx, vy, vz of each planet at each planet sub-step
+    unsigned int trajectory_capacity;   // sub-steps it holds
+    double *planet_gm;                  // -G * mass of each planet
+    unsigned int planet_capacity;       // planets planet_gm and the position tables hold
+
+    double *level_positions[BLOCK_MAX_LEVEL + 1];   // planet positions at each sub-step of a level
+    unsigned int level_histogram[BLOCK_MAX_LEVEL + 1];  // asteroids on each level, last step
+
+    unsigned long long body_evaluations;    // forces evaluated on single bodies, in total
+};
+
+BlockTimeStep *constructBlockTimeStep();
+void destroyBlockTimeStep(BlockTimeStep *block);
+void stepBlockTimeStep(OrbitalSim *sim);
+
+#endif
@@ -0,0 +1,837 @@
+/**
+ * @brief Body catalogs: JPL Horizons vector tables and MPC orbital elements
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * A catalog is mapped, not read: opening one walks it once to find where
+ * its rows start (that walk is what reads the file from disk), and loading
+ * it parses the rows straight into the body arrays, a chunk of rows per
+ * pool thread. Nothing is allocated per row.
+ *
+ * Catalogs are in the ecliptic frame of J2000, x and y on the ecliptic; the
+ * simulation has y up, so it takes x = X, y = Z, z = Y, as the ephemerides do.
+ */
+
+// Enables M_PI #define in Windows
+#define _USE_MATH_DEFINES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <atomic>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Catalog.h"
+#include "ForceKernel.h"
+
+#define ASTRONOMICAL_UNIT 1.495978707E11        // [m]
+#define SECONDS_PER_DAY 86400.0
+#define OBLIQUITY_J2000 (23.4392911 * M_PI / 180)   // of the ecliptic, to the ICRF equator
+
+/**
+ * @brief A minor planet's osculating elements, as an MPCORB row gives them
+ */
+struct OrbitalElements
+{
+    double epoch;               // Julian date
+    double mean_anomaly;        // [rad], at the epoch
+    double periapsis;           // argument of perihelion [rad]
+    double node;                // longitude of the ascending node [rad]
+    double inclination;         // [rad]
+    double eccentricity;
+    double mean_motion;         // [rad/day]
+    double semi_major_axis;     // [m]
+    double magnitude;           // absolute magnitude H, NAN if not given
+};
+
+/**
+ * @brief What the pool threads need to load a range of the catalog
+ */
+struct CatalogLoad
+{
+    const Catalog *catalog;
+    OrbitalBodies *bodies;
+    unsigned int first;         // index of the catalog's body 0
+    double epoch;               // Julian date the bodies are wanted at
+    double gravitational_parameter; // G times the mass of body 0 [m^3/s^2]
+    std::atomic<unsigned int> failures; // rows that wouldn't parse
+};
+
+/**
+ * Powers of ten that are exact doubles
+ */
+static const double powersOfTen[] = {
+    1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9, 1E10, 1E11,
+    1E12, 1E13, 1E14, 1E15, 1E16, 1E17, 1E18, 1E19, 1E20, 1E21, 1E22,
+};
+
+/**
+ * @brief Eight bytes of text as an integer, the first byte lowest
+ */
+static inline uint64_t loadEightBytes(const char *text)
+{
+    uint64_t chunk;
+    memcpy(&chunk, text, sizeof(chunk));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    chunk = __builtin_bswap64(chunk);
+#endif
+    return chunk;
+}
+
+/**
+ * @brief How many of the eight bytes are digits before the first that isn't.
+ * A byte is '0' to '9' if its high nibble is 3, and still is after adding 6;
+ * any other byte is left nonzero.
+ */
+static inline int getLeadingDigitCount(uint64_t chunk)
+{
+    uint64_t non_digits = ((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+                           (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ^
+                          0x3333333333333333ULL;
+    if (non_digits == 0)
+        return 8;
+#ifdef __GNUC__
+    return __builtin_ctzll(non_digits) / 8;
+#else
+    int count = 0;
+    for (; (non_digits & 0xFF) == 0; non_digits >>= 8)
+        count++;
+    return count;
+#endif
+}
+
+/**
+ * @brief The value of eight digits, combined in pairs, then fours, then all
+ * eight, one multiply each (SWAR)
+ */
+static inline uint32_t getEightDigits(uint64_t chunk)
+{
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return (uint32_t)(((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+
+/**
+ * @brief Reads digits into a mantissa, up to eight at a time: the digits
+ * that lead eight bytes are shifted to the low end (the bytes shifted in
+ * read as zeros) and converted together. Digits past the 19th don't fit;
+ * they only count in dropped.
+ *
+ * @return Past the digits
+ */
+static const char *parseDigits(const char *p, const char *end, uint64_t *mantissa,
+                               int *count, int *dropped)
+{
+    static const uint64_t scales[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+    while (end - p >= 8 && *count <= 11)
+    {
+        uint64_t chunk = loadEightBytes(p);
+        int digits = getLeadingDigitCount(chunk);
+        if (digits == 0)
+            return p;
+        *mantissa = *mantissa * scales[digits] + getEightDigits(chunk << (64 - 8 * digits));
+        *count += digits;
+        p += digits;
+        if (digits < 8)
+            return p;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        if (*count < 19)
+        {
+            *mantissa = *mantissa * 10 + (uint64_t)(*p - '0');
+            (*count)++;
+        }
+        else
+            (*dropped)++;
+    }
+    return p;
+}
+
+/**
+ * @brief Parses a decimal number, as "-2.741147560901964E+07" or "0.0794013",
+ * after any blanks. Exact for up to 15 digits with a power of ten up to 22
+ * either way, which covers every number these catalogs hold; within an ulp
+ * or two otherwise.
+ *
+ * @return Past the number, NULL if there is none
+ */
+static const char *parseNumber(const char *p, const char *end, double *value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+'))
+        p++;
+
+    uint64_t mantissa = 0;
+    int count = 0, dropped = 0;
+    p = parseDigits(p, end, &mantissa, &count, &dropped);
+    int exponent = dropped;
+    if (p < end && *p == '.')
+    {
+        int before = count;
+        p = parseDigits(p + 1, end, &mantissa, &count, &dropped);
+        exponent -= count - before;
+    }
+    if (count + dropped == 0)
+        return NULL;
+
+    if (p < end && (*p == 'E' || *p == 'e'))
+    {
+        const char *q = p + 1;
+        bool negative_exponent = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+'))
+            q++;
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            int power = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; q++)
+                power = power < 10000 ? power * 10 + (*q - '0') : power;
+            exponent += negative_exponent ? -power : power;
+            p = q;
+        }
+    }
+
+    double number = (double)mantissa;
+    if (exponent >= 0 && exponent <= 22)
+        number *= powersOfTen[exponent];
+    else if (exponent < 0 && exponent >= -22)
+        number /= powersOfTen[-exponent];
+    else
+        number *= pow(10.0, exponent);
+
+    *value = negative ? -number : number;
+    return p;
+}
+
+/**
+ * @brief Parses the number filling a fixed-width field, [first, last) of a
+ * line. The number may be read up to the line end, eight bytes at a time; it
+ * only counts if it ends inside the field.
+ */
+static bool parseField(const char *line, const char *lineEnd, int first, int last, double *value)
+{
+    const char *end = parseNumber(line + first, lineEnd, value);
+    if (end == NULL)
+        return false;
+    while (end < line + last && *end == ' ')
+        end++;
+    return end == line + last;
+}
+
+/**
+ * @brief Finds text in [p, end)
+ *
+ * @return Where it starts, NULL if it isn't there
+ */
+static const char *findText(const char *p, const char *end, const char *text)
+{
+    size_t length = strlen(text);
+
+    while ((size_t)(end - p) >= length)
+    {
+        p = (const char *)memchr(p, text[0], (size_t)(end - p) - length + 1);
+        if (p == NULL)
+            return NULL;
+        if (memcmp(p, text, length) == 0)
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Where the line starting at p ends, at its '\n' or the end of the file
+ */
+static const char *findLineEnd(const char *p, const char *end)
+{
+    const char *newline = (const char *)memchr(p, '\n', (size_t)(end - p));
+    return newline != NULL ? newline : end;
+}
+
+/**
+ * @brief Julian date of 0h of a Gregorian calendar date
+ */
+static double getJulianDate(int year, int month, int day)
+{
+    int a = (14 - month) / 12;
+    long y = year + 4800 - a;
+    long m = month + 12 * a - 3;
+    long day_number = day + (153 * m + 2) / 5 + 365 * y + y / 4 - y / 100 + y / 400 - 32045;
+
+    return (double)day_number - 0.5;
+}
+
+/**
+ * @brief A packed MPC month or day: 1 to 9, then A for 10 up to V for 31
+ *
+ * @return The number, 0 if malformed
+ */
+static int getPackedNumber(char c)
+{
+    if (c >= '1' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'V')
+        return c - 'A' + 10;
+    return 0;
+}
+
+/**
+ * @brief Whether a line is an MPCORB row: the decimal points of the angles,
+ * the eccentricity (under 1), the mean motion and the semi-major axis are
+ * where the format puts them. Header and blank lines never pass.
+ */
+static bool isMpcRow(const char *line, size_t length)
+{
+    return length >= 103 && line[29] == '.' && line[40] == '.' && line[51] == '.' &&
+           line[62] == '.' && line[70] == '0' && line[71] == '.' && line[82] == '.' &&
+           line[95] == '.';
+}
+
+/**
+ * @brief Parses an MPCORB row (https://minorplanetcenter.net/iau/info/MPOrbitFormat.html)
+ *
+ * @return false if a field is malformed
+ */
+static bool parseMpcRow(const char *line, const char *lineEnd, OrbitalElements *elements)
+{
+    const double radians = M_PI / 180;
+
+    // Packed epoch, as K2555: century (I = 18), year, month, day
+    int year = (line[20] - 'I' + 18) * 100 + (line[21] - '0') * 10 + (line[22] - '0');
+    int month = getPackedNumber(line[23]);
+    int day = getPackedNumber(line[24]);
+    if (line[20] < 'I' || line[20] > 'L' || line[21] < '0' || line[21] > '9' ||
+        line[22] < '0' || line[22] > '9' || month == 0 || month > 12 || day == 0)
+        return false;
+    elements->epoch = getJulianDate(year, month, day);
+
+    bool ok = parseField(line, lineEnd, 26, 35, &elements->mean_anomaly) &&
+              parseField(line, lineEnd, 37, 46, &elements->periapsis) &&
+              parseField(line, lineEnd, 48, 57, &elements->node) &&
+              parseField(line, lineEnd, 59, 68, &elements->inclination) &&
+              parseField(line, lineEnd, 70, 79, &elements->eccentricity) &&
+              parseField(line, lineEnd, 80, 91, &elements->mean_motion) &&
+              parseField(line, lineEnd, 92, 103, &elements->semi_major_axis);
+    if (!ok || !(elements->semi_major_axis > 0))
+        return false;
+
+    elements->mean_anomaly *= radians;
+    elements->periapsis *= radians;
+    elements->node *= radians;
+    elements->inclination *= radians;
+    elements->mean_motion *= radians;
+    elements->semi_major_axis *= ASTRONOMICAL_UNIT;
+    if (!parseField(line, lineEnd, 8, 13, &elements->magnitude))
+        elements->magnitude = NAN;
+    return true;
+}
+
+/**
+ * @brief Position and velocity of an elliptic orbit at a Julian date,
+ * ecliptic, relative to the body it orbits
+ *
+ * @param elements The orbit
+ * @param mu G times the mass it orbits [m^3/s^2]
+ * @param epoch The date
+ * @param state x, y, z [m], vx, vy, vz [m/s], ecliptic
+ */
+static void getStateFromElements(const OrbitalElements *elements, double mu, double epoch,
+                                 double state[6])
+{
+    double e = elements->eccentricity;
+    double a = elements->semi_major_axis;
+
+    // Kepler's equation, E - e sin E = M, by Newton's method
+    double mean_anomaly = fmod(elements->mean_anomaly + elements->mean_motion * (epoch - elements->epoch),
+                               2 * M_PI);
+    double E = e < 0.8 ? mean_anomaly : M_PI;
+    for (int iteration = 0; iteration < 32; iteration++)
+    {
+        double delta = (E - e * sin(E) - mean_anomaly) / (1 - e * cos(E));
+        E -= delta;
+        if (fabs(delta) < 1E-14)
+            break;
+    }
+
+    // In the orbital plane, x towards perihelion
+    double sin_E = sin(E), cos_E = cos(E);
+    double root = sqrt(1 - e * e);
+    double r = a * (1 - e * cos_E);
+    double speed = sqrt(mu * a) / r;
+    double px = a * (cos_E - e), py = a * root * sin_E;
+    double pvx = -speed * sin_E, pvy = speed * root * cos_E;
+
+    // Rotated by the argument of perihelion, the inclination and the node
+    double sin_w = sin(elements->periapsis), cos_w = cos(elements->periapsis);
+    double sin_n = sin(elements->node), cos_n = cos(elements->node);
+    double sin_i = sin(elements->inclination), cos_i = cos(elements->inclination);
+    double P[3] = {cos_w * cos_n - sin_w * sin_n * cos_i, cos_w * sin_n + sin_w * cos_n * cos_i, sin_w * sin_i};
+    double Q[3] = {-sin_w * cos_n - cos_w * sin_n * cos_i, -sin_w * sin_n + cos_w * cos_n * cos_i, cos_w * sin_i};
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        state[axis] = px * P[axis] + py * Q[axis];
+        state[3 + axis] = pvx * P[axis] + pvy * Q[axis];
+    }
+}
+
+/**
+ * @brief Writes a body, from an ecliptic state relative to body 0 (or to
+ * the barycenter, if barycentric)
+ */
+static void storeBody(const CatalogLoad *load, unsigned int i, const double state[6],
+                      bool barycentric, double mass, float radius)
+{
+    OrbitalBodies *bodies = load->bodies;
+    double center[6] = {0, 0, 0, 0, 0, 0};
+
+    if (!barycentric)
+    {
+        center[0] = bodies->x[0];
+        center[1] = bodies->y[0];
+        center[2] = bodies->z[0];
+        center[3] = bodies->vx[0];
+        center[4] = bodies->vy[0];
+        center[5] = bodies->vz[0];
+    }
+
+    bodies->x[i] = center[0] + state[0];
+    bodies->y[i] = center[1] + state[2];
+    bodies->z[i] = center[2] + state[1];
+    bodies->vx[i] = center[3] + state[3];
+    bodies->vy[i] = center[4] + state[5];
+    bodies->vz[i] = center[5] + state[4];
+    bodies->mass[i] = mass;
+    bodies->radius[i] = radius;
+    bodies->color[i] = BodyColor COLOR_GRAY;
+}
+
+/**
+ * @brief Names a body after some text of the catalog, spaces trimmed and cut
+ * to its slot of the name table. Bodies with no text stay unnamed.
+ */
+static void storeName(const CatalogLoad *load, unsigned int i, const char *text, const char *end)
+{
+    char *name = load->bodies->names + (size_t)(i - load->first) * CATALOG_NAME_SIZE;
+
+    while (text < end && (*text == ' ' || *text == '\t'))
+        text++;
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        end--;
+    size_t length = (size_t)(end - text) < CATALOG_NAME_SIZE - 1 ? (size_t)(end - text) : CATALOG_NAME_SIZE - 1;
+
+    memcpy(name, text, length);
+    name[length] = '\0';
+    load->bodies->name[i] = length ? name : NULL;
+}
+
+/**
+ * @brief Loads a range of MPCORB rows. Run by the thread pool.
+ */
+static void loadMpcChunk(void *context, unsigned int begin, unsigned int end)
+{
+    CatalogLoad *load = (CatalogLoad *)context;
+    const Catalog *catalog = load->catalog;
+    const char *p = catalog->data + catalog->chunk_offsets[begin / CATALOG_CHUNK_ROWS];
+    const char *file_end = catalog->data + catalog->size;
+    unsigned int failures = 0;
+
+    for (unsigned int row = begin; row < end && p < file_end;)
+    {
+        const char *line_end = findLineEnd(p, file_end);
+        if (isMpcRow(p, (size_t)(line_end - p)))
+        {
+            OrbitalElements elements;
+            double state[6] = {NAN, NAN, NAN, NAN, NAN, NAN};
+            double mass = CATALOG_DEFAULT_MASS;
+            float radius = CATALOG_DEFAULT_RADIUS;
+
+            if (parseMpcRow(p, line_end, &elements))
+            {
+                getStateFromElements(&elements, load->gravitational_parameter, load->epoch, state);
+
+                // Diameter from H and the albedo; 1329 km is that of H = 0 at albedo 1
+                if (elements.magnitude == elements.magnitude)
+                {
+                    double r = 0.5 * 1329E3 / sqrt(CATALOG_ALBEDO) * pow(10, -elements.magnitude / 5);
+                    radius = (float)r;
+                    mass = 4.0 / 3 * M_PI * r * r * r * CATALOG_DENSITY;
+                }
+            }
+            else
+                failures++;
+
+            storeBody(load, load->first + row, state, false, mass, radius);
+
+            // The readable designation, as (1) Ceres, or the packed one of short rows
+            if (line_end - p >= 194)
+                storeName(load, load->first + row, p + 166, p + 194);
+            else
+                storeName(load, load->first + row, p, p + 7);
+            row++;
+        }
+        p = line_end + 1;
+    }
+
+    if (failures)
+        load->failures += failures;
+}
+
+/**
+ * @brief Finds a line in a Horizons header, by its label
+ *
+ * @return Where the line ends, and in *line where its value starts; false if it isn't there
+ */
+static bool findHeaderLine(const char *header, const char *end, const char *label,
+                           const char **line, const char **lineEnd)
+{
+    *line = findText(header, end, label);
+    if (*line == NULL)
+        return false;
+    *lineEnd = findLineEnd(*line, end);
+    return true;
+}
+
+/**
+ * @brief Loads one body from a Horizons vector table: the row nearest the
+ * epoch, in the units, frame and center the header before it declares
+ *
+ * @param header Where the table's header starts
+ * @param soe Its $$SOE
+ * @param eoe Its $$EOE
+ * @return false if no row parses
+ */
+static bool loadHorizonsBlock(const CatalogLoad *load, unsigned int i, const char *header,
+                              const char *soe, const char *eoe)
+{
+    const char *line, *line_end;
+
+    // Output units: KM-S (the default), KM-D or AU-D
+    double length = 1E3, time = 1;
+    if (findHeaderLine(header, soe, "Output units", &line, &line_end))
+    {
+        if (findText(line, line_end, "AU") != NULL)
+            length = ASTRONOMICAL_UNIT;
+        if (findText(line, line_end, "-D") != NULL)
+            time = SECONDS_PER_DAY;
+    }
+    bool barycentric = findHeaderLine(header, soe, "Center body name", &line, &line_end) &&
+                       findText(line, line_end, "Barycenter") != NULL;
+    bool equatorial = (findHeaderLine(header, soe, "Reference plane", &line, &line_end) ||
+                       findHeaderLine(header, soe, "Coordinate systm", &line, &line_end)) &&
+                      (findText(line, line_end, "quator") != NULL || findText(line, line_end, "FRAME") != NULL);
+
+    // Rows start with their Julian date; keep the nearest one
+    const char *best = NULL;
+    double best_distance = INFINITY;
+    for (const char *p = findLineEnd(soe, eoe); p < eoe; p = findLineEnd(p, eoe))
+    {
+        double date;
+        p++;
+        while (p < eoe && *p == ' ')
+            p++;
+        if (p < eoe && *p >= '0' && *p <= '9' && parseNumber(p, eoe, &date) != NULL &&
+            fabs(date - load->epoch) < best_distance)
+        {
+            best = p;
+            best_distance = fabs(date - load->epoch);
+        }
+    }
+    if (best == NULL)
+        return false;
+
+    // CSV rows: date, calendar date, X, Y, Z, VX, VY, VZ, ...; plain ones label each value
+    double state[6];
+    const char *row_end = findLineEnd(best, eoe);
+    if (memchr(best, ',', (size_t)(row_end - best)) != NULL)
+    {
+        const char *p = best;
+        for (int field = 0; field < 8; field++)
+        {
+            if (field >= 2 && (p = parseNumber(p, row_end, &state[field - 2])) == NULL)
+                return false;
+            if (field == 7)
+                break;
+            p = (const char *)memchr(p, ',', (size_t)(row_end - p));
+            if (p == NULL)
+                return false;
+            p++;
+        }
+    }
+    else
+    {
+        static const char *const labels[6] = {"X =", "Y =", "Z =", "VX=", "VY=", "VZ="};
+        const char *next_row = row_end;
+        while (next_row < eoe)
+        {
+            const char *p = next_row + 1;
+            while (p < eoe && *p == ' ')
+                p++;
+            if (p < eoe && *p >= '0' && *p <= '9')
+                break;
+            next_row = findLineEnd(p, eoe);
+        }
+        for (int value = 0; value < 6; value++)
+        {
+            const char *label = findText(best, next_row, labels[value]);
+            if (label == NULL || parseNumber(label + 3, next_row, &state[value]) == NULL)
+                return false;
+        }
+    }
+
+    for (int value = 0; value < 6; value++)
+        state[value] *= value < 3 ? length : length / time;
+    if (equatorial)
+    {
+        double c = cos(OBLIQUITY_J2000), s = sin(OBLIQUITY_J2000);
+        for (int offset = 0; offset < 6; offset += 3)
+        {
+            double y = state[offset + 1], z = state[offset + 2];
+            state[offset + 1] = c * y + s * z;
+            state[offset + 2] = -s * y + c * z;
+        }
+    }
+
+    storeBody(load, i, state, barycentric, CATALOG_DEFAULT_MASS, CATALOG_DEFAULT_RADIUS);
+    return true;
+}
+
+/**
+ * @brief Loads a range of Horizons tables. Run by the thread pool.
+ */
+static void loadHorizonsChunk(void *context, unsigned int begin, unsigned int end)
+{
+    CatalogLoad *load = (CatalogLoad *)context;
+    const Catalog *catalog = load->catalog;
+    const char *header = catalog->data + catalog->chunk_offsets[begin / CATALOG_CHUNK_ROWS];
+    const char *file_end = catalog->data + catalog->size;
+    unsigned int failures = 0;
+
+    for (unsigned int table = begin; table < end; table++)
+    {
+        const char *soe = findText(header, file_end, "$$SOE");
+        const char *eoe = soe != NULL ? findText(soe, file_end, "$$EOE") : NULL;
+        if (eoe == NULL)
+            eoe = file_end;
+
+        if (soe == NULL || !loadHorizonsBlock(load, load->first + table, header, soe, eoe))
+        {
+            double state[6] = {NAN, NAN, NAN, NAN, NAN, NAN};
+            storeBody(load, load->first + table, state, true, CATALOG_DEFAULT_MASS, CATALOG_DEFAULT_RADIUS);
+            failures++;
+        }
+
+        // Target body name: Ceres (A801 AA)      {source: ...}
+        const char *line, *line_end;
+        if (findHeaderLine(header, soe != NULL ? soe : eoe, "Target body name:", &line, &line_end))
+        {
+            const char *source = (const char *)memchr(line, '{', (size_t)(line_end - line));
+            storeName(load, load->first + table, line + strlen("Target body name:"),
+                      source != NULL ? source : line_end);
+        }
+        else
+            load->bodies->name[load->first + table] = NULL;
+        header = eoe;
+    }
+
+    if (failures)
+        load->failures += failures;
+}
+
+/**
+ * @brief Brings a catalog file into memory: mapped where the platform can,
+ * read otherwise
+ *
+ * @return false on error
+ */
+static bool mapCatalog(const char *path, Catalog *catalog)
+{
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    _fseeki64(file, 0, SEEK_END);
+    catalog->size = (size_t)_ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+
+    catalog->buffer = malloc(catalog->size + 1);
+    bool ok = catalog->buffer != NULL && fread(catalog->buffer, 1, catalog->size, file) == catalog->size;
+    fclose(file);
+    catalog->data = (const char *)catalog->buffer;
+    return ok && catalog->size > 0;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+    {
+        close(descriptor);
+        return false;
+    }
+    catalog->size = (size_t)status.st_size;
+
+    void *mapping = mmap(NULL, catalog->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    // Read once front to back to find the rows, then once more in chunks
+    madvise(mapping, catalog->size, MADV_SEQUENTIAL);
+    catalog->mapping = mapping;
+    catalog->data = (const char *)mapping;
+    return true;
+#endif
+}
+
+/**
+ * @brief Notes a body, and where its chunk starts if it is the first of one
+ *
+ * @return false if out of memory
+ */
+static bool addCatalogBody(Catalog *catalog, size_t offset, unsigned int *chunkCapacity)
+{
+    if (catalog->body_count % CATALOG_CHUNK_ROWS == 0)
+    {
+        unsigned int chunk = catalog->body_count / CATALOG_CHUNK_ROWS;
+        if (chunk == *chunkCapacity)
+        {
+            unsigned int capacity = *chunkCapacity ? 2 * *chunkCapacity : 64;
+            size_t *offsets = (size_t *)realloc(catalog->chunk_offsets, capacity * sizeof(size_t));
+            if (offsets == NULL)
+                return false;
+            catalog->chunk_offsets = offsets;
+            *chunkCapacity = capacity;
+        }
+        catalog->chunk_offsets[chunk] = offset;
+    }
+    catalog->body_count++;
+    return catalog->body_count != 0;
+}
+
+/**
+ * @brief Opens a catalog: JPL Horizons vector tables (one or more, each
+ * output concatenated after the other) or MPCORB orbital elements, told
+ * apart by the $$SOE marks of the first
+ *
+ * @param path The catalog file
+ * @return The catalog, NULL on error
+ */
+Catalog *openCatalog(const char *path)
+{
+    Catalog *catalog = (Catalog *)calloc(1, sizeof(Catalog));
+    if (catalog == NULL)
+        return NULL;
+
+    if (!mapCatalog(path, catalog))
+    {
+        fprintf(stderr, "%s: cannot read catalog\n", path);
+        closeCatalog(catalog);
+        return NULL;
+    }
+
+    const char *p = catalog->data;
+    const char *end = catalog->data + catalog->size;
+    unsigned int chunk_capacity = 0;
+    bool ok = true;
+
+    catalog->format = findText(p, end, "$$SOE") != NULL ? CATALOG_FORMAT_HORIZONS : CATALOG_FORMAT_MPCORB;
+    if (catalog->format == CATALOG_FORMAT_HORIZONS)
+    {
+        // A table's header starts where the one before ended
+        const char *header = p;
+        const char *soe;
+        while (ok && (soe = findText(p, end, "$$SOE")) != NULL)
+        {
+            ok = addCatalogBody(catalog, (size_t)(header - catalog->data), &chunk_capacity);
+            const char *eoe = findText(soe, end, "$$EOE");
+            header = p = eoe != NULL ? eoe : end;
+        }
+    }
+    else
+    {
+        while (ok && p < end)
+        {
+            const char *line_end = findLineEnd(p, end);
+            if (isMpcRow(p, (size_t)(line_end - p)))
+                ok = addCatalogBody(catalog, (size_t)(p - catalog->data), &chunk_capacity);
+            p = line_end + 1;
+        }
+    }
+
+    if (!ok || catalog->body_count == 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, ok ? "no bodies in catalog" : "too many bodies in catalog");
+        closeCatalog(catalog);
+        return NULL;
+    }
+    return catalog;
+}
+
+void closeCatalog(Catalog *catalog)
+{
+#ifndef _WIN32
+    if (catalog->mapping != NULL)
+        munmap(catalog->mapping, catalog->size);
+#endif
+    free(catalog->buffer);
+    free(catalog->chunk_offsets);
+    free(catalog);
+}
+
+const char *getCatalogFormatName(CatalogFormat format)
+{
+    return format == CATALOG_FORMAT_HORIZONS ? "Horizons" : "MPCORB";
+}
+
+/**
+ * @brief Fills a range of a body store with a catalog's bodies, at a date.
+ * Orbital elements are taken around body 0 (the star), and propagated along
+ * their orbit from their own epoch to the date; vector tables give the row
+ * nearest the date. Bodies get their size from their absolute magnitude,
+ * the default asteroid's if the catalog doesn't give it. Their names go in
+ * a table the store owns (bodies->names).
+ *
+ * @param catalog The catalog
+ * @param bodies The body store, with body 0 already in place
+ * @param begin Where the catalog's body 0 goes; the store holds body_count more
+ * @param epoch The Julian date
+ * @param pool Parses and converts the rows in parallel, NULL: on this thread
+ * @return false if any row didn't parse (its body is left NAN), or the
+ *         name table didn't fit in memory
+ */
+bool loadCatalogBodies(const Catalog *catalog, OrbitalBodies *bodies, unsigned int begin,
+                       double epoch, ThreadPool *pool)
+{
+    CatalogLoad load;
+    load.catalog = catalog;
+    load.bodies = bodies;
+    load.first = begin;
+    load.epoch = epoch;
+    load.gravitational_parameter = GRAVITATIONAL_CONSTANT * bodies->mass[0];
+    load.failures = 0;
+
+    free(bodies->names);
+    bodies->names = (char *)malloc((size_t)catalog->body_count * CATALOG_NAME_SIZE);
+    if (bodies->names == NULL)
+        return false;
+
+    runThreadPool(pool, catalog->format == CATALOG_FORMAT_HORIZONS ? loadHorizonsChunk : loadMpcChunk,
+                  &load, 0, catalog->body_count, CATALOG_CHUNK_ROWS);
+    return load.failures == 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * @brief Body catalogs: JPL Horizons vector tables and MPC orbital elements
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+
+#include "OrbitalBodies.h"
+#include "ThreadPool.h"
+
+/**
+ * Catalog rows handed out to the pool threads at a time
+ */
+#define CATALOG_CHUNK_ROWS 8192
+
+/**
+ * Mass [kg] and radius [m] of bodies whose size the catalog doesn't give:
+ * a typical asteroid, as in the default belt
+ */
+#define CATALOG_DEFAULT_MASS 1E12
+#define CATALOG_DEFAULT_RADIUS 2E3F
+
+/**
+ * Bytes of each body's name, NUL included: longer names are cut
+ */
+#define CATALOG_NAME_SIZE 32
+
+/**
+ * Sizes from the absolute magnitude H: geometric albedo and density assumed
+ * for every minor planet [kg/m^3]
+ */
+#define CATALOG_ALBEDO 0.14
+#define CATALOG_DENSITY 2000.0
+
+enum CatalogFormat
+{
+    CATALOG_FORMAT_HORIZONS,    // JPL Horizons vector tables, one body per $$SOE ... $$EOE block
+    CATALOG_FORMAT_MPCORB,      // MPC orbital elements, one body per row (MPCORB.DAT)
+};
+
+/**
+ * @brief An open catalog: the file, mapped, and where its rows start. Rows
+ * are found in one pass at open; they are parsed when loaded.
+ */
+struct Catalog
+{
+    const char *data;
+    size_t size;
+    CatalogFormat format;
+    unsigned int body_count;
+
+    size_t *chunk_offsets;      // byte offset of every CATALOG_CHUNK_ROWS-th body
+
+    void *mapping;              // the file mapping, or
+    void *buffer;               // the file, read, where it can't be mapped
+};
+
+Catalog *openCatalog(const char *path);
+void closeCatalog(Catalog *catalog);
+const char *getCatalogFormatName(CatalogFormat format);
+bool loadCatalogBodies(const Catalog *catalog, OrbitalBodies *bodies, unsigned int begin,
+                       double epoch, ThreadPool *pool);
+
+#endif
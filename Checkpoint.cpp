@@ -0,0 +1,523 @@
+/**
+ * @brief Checkpoint files: save and restart a simulation
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * A checkpoint is a header followed by the body store exactly as it sits in
+ * memory, so loading one is mapping the file and pointing the arrays into it:
+ * pages are read in as the first steps touch them. The mapping is private,
+ * so the simulation writes to its own copy and the file is never modified.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <stdint.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "OrbitalSim.h"
+#include "Checkpoint.h"
+
+/**
+ * Bytes the checksum consumes at a time; every section is a multiple of it
+ */
+#define CHECKSUM_BLOCK_SIZE 32
+
+#define CHECKSUM_PRIME1 0x9E3779B185EBCA87ULL
+#define CHECKSUM_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define CHECKSUM_PRIME3 0x165667B19E3779F9ULL
+
+/**
+ * Zeroes written in place of the name pointers, per fwrite
+ */
+#define ZERO_CHUNK_SIZE 65536
+
+/**
+ * @brief Running checksum: four 64-bit lanes, multiply-rotate mixed, so it
+ * goes about as fast as memory can be read
+ */
+struct ChecksumState
+{
+    uint64_t lanes[4];
+    uint64_t length;
+};
+
+/**
+ * @brief A name table entry: body index and offset of its name in the table
+ */
+struct CheckpointName
+{
+    uint32_t index;
+    uint32_t offset;
+};
+
+static size_t alignOffset(size_t offset)
+{
+    return (offset + ORBITALBODIES_ALIGNMENT - 1) & ~(size_t)(ORBITALBODIES_ALIGNMENT - 1);
+}
+
+static uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static void startChecksum(ChecksumState *state)
+{
+    state->lanes[0] = CHECKSUM_PRIME1 + CHECKSUM_PRIME2;
+    state->lanes[1] = CHECKSUM_PRIME2;
+    state->lanes[2] = 0;
+    state->lanes[3] = 0 - CHECKSUM_PRIME1;
+    state->length = 0;
+}
+
+/**
+ * @brief Feeds bytes to a checksum. Only the last call may pass a size that
+ * is not a multiple of CHECKSUM_BLOCK_SIZE; its tail is zero-padded.
+ */
+static void updateChecksum(ChecksumState *state, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t words[4];
+
+    state->length += size;
+    while (size > 0)
+    {
+        if (size >= CHECKSUM_BLOCK_SIZE)
+        {
+            memcpy(words, bytes, CHECKSUM_BLOCK_SIZE);
+            bytes += CHECKSUM_BLOCK_SIZE;
+            size -= CHECKSUM_BLOCK_SIZE;
+        }
+        else
+        {
+            memset(words, 0, sizeof(words));
+            memcpy(words, bytes, size);
+            size = 0;
+        }
+
+        for (int lane = 0; lane < 4; lane++)
+            state->lanes[lane] = rotateLeft(state->lanes[lane] + words[lane] * CHECKSUM_PRIME2, 31) *
+                                 CHECKSUM_PRIME1;
+    }
+}
+
+static uint64_t finishChecksum(const ChecksumState *state)
+{
+    uint64_t hash = rotateLeft(state->lanes[0], 1) + rotateLeft(state->lanes[1], 7) +
+                    rotateLeft(state->lanes[2], 12) + rotateLeft(state->lanes[3], 18);
+
+    hash ^= state->length;
+    hash ^= hash >> 33;
+    hash *= CHECKSUM_PRIME2;
+    hash ^= hash >> 29;
+    hash *= CHECKSUM_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static uint64_t checksumBytes(const void *data, size_t size)
+{
+    ChecksumState state;
+
+    startChecksum(&state);
+    updateChecksum(&state, data, size);
+    return finishChecksum(&state);
+}
+
+static uint64_t checksumHeader(const CheckpointHeader *header)
+{
+    CheckpointHeader copy = *header;
+
+    copy.header_checksum = 0;
+    return checksumBytes(&copy, sizeof(copy));
+}
+
+/**
+ * @brief Builds the name table: a count, an entry per named body, and the
+ * names themselves, NUL-terminated. Padded to ORBITALBODIES_ALIGNMENT.
+ *
+ * @return The table (malloc'ed), NULL if out of memory
+ */
+static char *buildNameTable(const OrbitalSim *sim, size_t *size)
+{
+    const OrbitalBodies *bodies = &sim->bodies;
+    uint32_t count = 0;
+    size_t strings_size = 0;
+
+    for (unsigned int i = 0; i < sim->bodies_count; i++)
+    {
+        if (bodies->name[i] != NULL)
+        {
+            count++;
+            strings_size += strlen(bodies->name[i]) + 1;
+        }
+    }
+
+    size_t entries_offset = 2 * sizeof(uint32_t);
+    size_t strings_offset = entries_offset + count * sizeof(CheckpointName);
+    *size = alignOffset(strings_offset + strings_size);
+
+    char *table = (char *)calloc(1, *size);
+    if (table == NULL)
+        return NULL;
+    memcpy(table, &count, sizeof(count));
+
+    CheckpointName *entries = (CheckpointName *)(table + entries_offset);
+    size_t offset = strings_offset;
+    for (unsigned int i = 0; i < sim->bodies_count; i++)
+    {
+        if (bodies->name[i] == NULL)
+            continue;
+
+        size_t length = strlen(bodies->name[i]) + 1;
+        entries->index = i;
+        entries->offset = (uint32_t)offset;
+        entries++;
+        memcpy(table + offset, bodies->name[i], length);
+        offset += length;
+    }
+    return table;
+}
+
+/**
+ * @brief Writes bytes to a file and feeds them to a checksum
+ */
+static bool writeSection(FILE *file, ChecksumState *state, const void *data, size_t size)
+{
+    updateChecksum(state, data, size);
+    return fwrite(data, 1, size, file) == size;
+}
+
+/**
+ * @brief Writes zeroes to a file and feeds them to a checksum
+ */
+static bool writeZeros(FILE *file, ChecksumState *state, size_t size)
+{
+    static const char zeros[ZERO_CHUNK_SIZE] = {0};
+
+    while (size > 0)
+    {
+        size_t chunk = size < ZERO_CHUNK_SIZE ? size : ZERO_CHUNK_SIZE;
+        if (!writeSection(file, state, zeros, chunk))
+            return false;
+        size -= chunk;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a simulation's whole state to a checkpoint file. The file is
+ * written next to its destination and renamed over it once complete, so a
+ * run killed while saving leaves the previous checkpoint intact.
+ *
+ * @param sim The simulation
+ * @param path Where to write the checkpoint
+ * @return true on success
+ */
+bool saveCheckpoint(const OrbitalSim *sim, const char *path)
+{
+    const OrbitalBodies *bodies = &sim->bodies;
+    CheckpointHeader header;
+    ChecksumState state;
+    size_t hot_size, cold_size, names_size;
+    bool ok = true;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.byte_order = CHECKPOINT_BYTE_ORDER;
+    header.header_size = sizeof(CheckpointHeader);
+    header.bodies_count = sim->bodies_count;
+    header.planets_range = sim->planets_range;
+    header.capacity = bodies->capacity;
+    header.force_model = sim->force_model;
+    header.accelerations_valid = sim->accelerations_valid;
+    header.force_precision = sim->force_precision;
+    strncpy(header.integrator, sim->integrator->name, sizeof(header.integrator) - 1);
+    header.time_step = sim->time_step;
+    header.time_elapsed = sim->time_elapsed;
+    header.tolerance = sim->tolerance;
+    header.adaptive_step = sim->adaptive_step;
+    header.opening_angle = sim->opening_angle;
+    header.force_evaluations = sim->force_evaluations;
+
+    char *names = buildNameTable(sim, &names_size);
+    char *temporary_path = (char *)malloc(strlen(path) + sizeof(".tmp"));
+    if (names == NULL || temporary_path == NULL)
+    {
+        free(names);
+        free(temporary_path);
+        return false;
+    }
+    strcpy(temporary_path, path);
+    strcat(temporary_path, ".tmp");
+
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == NULL)
+    {
+        free(names);
+        free(temporary_path);
+        return false;
+    }
+
+    getOrbitalBodiesImageSizes(bodies->capacity, &hot_size, &cold_size);
+    header.hot_offset = alignOffset(sizeof(CheckpointHeader));
+    header.hot_size = hot_size;
+    header.cold_offset = header.hot_offset + hot_size;
+    header.cold_size = cold_size;
+    header.names_offset = header.cold_offset + cold_size;
+    header.names_size = names_size;
+
+    // Header placeholder, rewritten once the checksums are known
+    startChecksum(&state);
+    ok = ok && writeZeros(file, &state, header.hot_offset);
+
+    // The images start at x and radius; name pointers mean nothing in another process
+    size_t unnamed_size = (const char *)bodies->name - (const char *)bodies->radius;
+
+    startChecksum(&state);
+    ok = ok && writeSection(file, &state, bodies->x, hot_size);
+    header.hot_checksum = finishChecksum(&state);
+
+    startChecksum(&state);
+    ok = ok && writeSection(file, &state, bodies->radius, unnamed_size);
+    ok = ok && writeZeros(file, &state, cold_size - unnamed_size);
+    header.cold_checksum = finishChecksum(&state);
+
+    startChecksum(&state);
+    ok = ok && writeSection(file, &state, names, names_size);
+    header.names_checksum = finishChecksum(&state);
+
+    header.header_checksum = checksumHeader(&header);
+    ok = ok && fseek(file, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = (fclose(file) == 0) && ok;
+
+#ifdef _WIN32
+    // rename doesn't replace an existing file here
+    if (ok)
+        remove(path);
+#endif
+    ok = ok && rename(temporary_path, path) == 0;
+    if (!ok)
+        remove(temporary_path);
+
+    free(names);
+    free(temporary_path);
+    return ok;
+}
+
+/**
+ * @brief Brings a checkpoint file into memory: mapped where the platform
+ * can, read otherwise. The body store takes ownership of the memory.
+ *
+ * @return The file contents, ORBITALBODIES_ALIGNMENT-aligned, NULL on error
+ */
+static char *openCheckpointImage(const char *path, OrbitalBodies *bodies, size_t *size)
+{
+    memset(bodies, 0, sizeof(OrbitalBodies));
+
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    _fseeki64(file, 0, SEEK_END);
+    *size = (size_t)_ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+
+    bodies->hot_block = malloc(*size + ORBITALBODIES_ALIGNMENT);
+    if (bodies->hot_block == NULL)
+    {
+        fclose(file);
+        return NULL;
+    }
+    char *image = (char *)alignOffset((size_t)bodies->hot_block);
+    bool ok = fread(image, 1, *size, file) == *size;
+    fclose(file);
+    if (!ok)
+    {
+        freeOrbitalBodies(bodies);
+        return NULL;
+    }
+    return image;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+        return NULL;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+    {
+        close(descriptor);
+        return NULL;
+    }
+    *size = (size_t)status.st_size;
+
+    // Private and writable: the simulation moves bodies in its own copy of each page
+    void *mapping = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+        return NULL;
+
+    bodies->mapping = mapping;
+    bodies->mapping_size = *size;
+    return (char *)mapping;
+#endif
+}
+
+/**
+ * @brief Checks a section lies inside the file and is aligned as bindOrbitalBodies needs
+ */
+static bool isSectionValid(uint64_t offset, uint64_t size, size_t fileSize)
+{
+    return offset % ORBITALBODIES_ALIGNMENT == 0 && offset <= fileSize && size <= fileSize - offset;
+}
+
+/**
+ * @brief Checks a checkpoint header against the file it came from
+ *
+ * @return NULL if it is valid, otherwise what is wrong with it
+ */
+static const char *checkHeader(const CheckpointHeader *header, size_t fileSize)
+{
+    size_t hot_size, cold_size;
+
+    if (fileSize < sizeof(CheckpointHeader) ||
+        memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+        return "not a checkpoint";
+    if (header->byte_order != CHECKPOINT_BYTE_ORDER)
+        return "written on a machine of a different byte order";
+    if (header->version != CHECKPOINT_VERSION || header->header_size != sizeof(CheckpointHeader))
+        return "unsupported version";
+    if (header->header_checksum != checksumHeader(header))
+        return "corrupted header";
+
+    getOrbitalBodiesImageSizes(header->capacity, &hot_size, &cold_size);
+    if (header->bodies_count > header->capacity || header->planets_range > header->bodies_count ||
+        header->hot_size != hot_size || header->cold_size != cold_size ||
+        !isSectionValid(header->hot_offset, header->hot_size, fileSize) ||
+        !isSectionValid(header->cold_offset, header->cold_size, fileSize) ||
+        !isSectionValid(header->names_offset, header->names_size, fileSize) ||
+        header->names_size < 2 * sizeof(uint32_t))
+        return "truncated or inconsistent";
+
+    if (header->integrator[sizeof(header->integrator) - 1] != '\0' ||
+        findIntegrator(header->integrator) == NULL)
+        return "unknown integrator";
+    if (header->force_model > FORCE_MODEL_BARNES_HUT || header->force_precision >= FORCE_PRECISION_COUNT ||
+        !(header->time_step > 0))
+        return "invalid simulation parameters";
+    return NULL;
+}
+
+/**
+ * @brief Points each named body's name into the name table
+ *
+ * @return false if the table is malformed
+ */
+static bool bindNames(OrbitalBodies *bodies, unsigned int bodiesCount,
+                      const char *table, size_t size)
+{
+    uint32_t count;
+
+    memcpy(&count, table, sizeof(count));
+    size_t entries_offset = 2 * sizeof(uint32_t);
+    if (count > (size - entries_offset) / sizeof(CheckpointName))
+        return false;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        CheckpointName entry;
+        memcpy(&entry, table + entries_offset + i * sizeof(CheckpointName), sizeof(entry));
+
+        if (entry.index >= bodiesCount || entry.offset >= size ||
+            memchr(table + entry.offset, '\0', size - entry.offset) == NULL)
+            return false;
+        bodies->name[entry.index] = table + entry.offset;
+    }
+    return true;
+}
+
+/**
+ * @brief Restarts a simulation from a checkpoint file. The body arrays are
+ * used in place from the mapped file, so this takes about as long as the
+ * header checks, whatever the body count.
+ *
+ * @param path The checkpoint file
+ * @param threadCount How many threads update the simulation, 0 for one per hardware thread
+ * @param flags CHECKPOINT_VERIFY to checksum the body arrays too
+ * @return The simulation, as it was saved. NULL on error.
+ */
+OrbitalSim *loadCheckpoint(const char *path, unsigned int threadCount, int flags)
+{
+    OrbitalBodies bodies;
+    CheckpointHeader header;
+    size_t size;
+
+    char *image = openCheckpointImage(path, &bodies, &size);
+    if (image == NULL)
+    {
+        fprintf(stderr, "%s: cannot read checkpoint\n", path);
+        return NULL;
+    }
+
+    const char *error = NULL;
+    if (size >= sizeof(header))
+        memcpy(&header, image, sizeof(header));
+    error = checkHeader(&header, size);
+
+    if (error == NULL && (flags & CHECKPOINT_VERIFY) &&
+        (checksumBytes(image + header.hot_offset, header.hot_size) != header.hot_checksum ||
+         checksumBytes(image + header.cold_offset, header.cold_size) != header.cold_checksum))
+        error = "corrupted body arrays";
+    if (error == NULL &&
+        checksumBytes(image + header.names_offset, header.names_size) != header.names_checksum)
+        error = "corrupted name table";
+
+    if (error == NULL)
+    {
+        bindOrbitalBodies(&bodies, header.capacity, image + header.hot_offset,
+                          image + header.cold_offset);
+        if (!bindNames(&bodies, header.bodies_count, image + header.names_offset, header.names_size))
+            error = "corrupted name table";
+    }
+    if (error != NULL)
+    {
+        fprintf(stderr, "%s: %s\n", path, error);
+        freeOrbitalBodies(&bodies);
+        return NULL;
+    }
+
+    OrbitalSim *sim = constructOrbitalSimFromBodies(header.time_step, &bodies, header.bodies_count,
+                                                    header.planets_range, threadCount);
+    if (sim == NULL)
+    {
+        freeOrbitalBodies(&bodies);
+        return NULL;
+    }
+
+    const Integrator *integrator = findIntegrator(header.integrator);
+    setOrbitalSimIntegrator(sim, (IntegratorType)(integrator - getIntegrator(INTEGRATOR_EULER)));
+    sim->accelerations_valid = header.accelerations_valid != 0;
+    sim->adaptive_step = header.adaptive_step;
+    sim->tolerance = header.tolerance;
+    sim->force_model = (ForceModel)header.force_model;
+    setOrbitalSimPrecision(sim, (ForcePrecision)header.force_precision);
+    sim->opening_angle = header.opening_angle;
+    sim->time_elapsed = header.time_elapsed;
+    sim->force_evaluations = header.force_evaluations;
+    return sim;
+}
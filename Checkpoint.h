@@ -0,0 +1,61 @@
+/**
+ * @brief Checkpoint files: save and restart a simulation
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+struct OrbitalSim;
+
+#define CHECKPOINT_MAGIC "ORBCKPT"      // 8 bytes, with the terminator
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_BYTE_ORDER 0x01020304
+
+/**
+ * Load flag: checksum the body arrays too, not just the header. Reads the
+ * whole file, so a restart is no longer instant.
+ */
+#define CHECKPOINT_VERIFY 1
+
+/**
+ * @brief File header. Every section starts ORBITALBODIES_ALIGNMENT-aligned,
+ * and the hot and cold sections are byte for byte the images
+ * bindOrbitalBodies expects, so a mapped file is used in place.
+ */
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        // CHECKPOINT_BYTE_ORDER, as written by this machine
+    uint32_t header_size;
+
+    uint32_t bodies_count;
+    uint32_t planets_range;
+    uint32_t capacity;          // bodies each array of the images holds
+    uint32_t force_model;
+    uint32_t accelerations_valid;
+    uint32_t force_precision;   // ForcePrecision of the asteroid kernel
+    char integrator[16];        // Integrator::name
+    double time_step;           // [s]
+    double time_elapsed;        // [s]
+    double tolerance;
+    double adaptive_step;       // [s]
+    double opening_angle;
+    uint64_t force_evaluations;
+
+    uint64_t hot_offset, hot_size;
+    uint64_t cold_offset, cold_size;        // name pointers are stored zeroed
+    uint64_t names_offset, names_size;      // name table, see saveCheckpoint
+    uint64_t hot_checksum, cold_checksum, names_checksum;
+    uint64_t header_checksum;               // of this header, with this field zeroed
+};
+
+bool saveCheckpoint(const OrbitalSim *sim, const char *path);
+OrbitalSim *loadCheckpoint(const char *path, unsigned int threadCount = 0, int flags = 0);
+
+#endif
@@ -0,0 +1,504 @@
+/**
+ * @brief Close approach queries: which bodies pass within a distance of a target
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Each step only screens the bodies due: with a million asteroids, a few
+ * percent of them. The pool screens them; filing them into buckets, and
+ * refining the few watched, runs on the stepping thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <new>
+
+#include "OrbitalSim.h"
+#include "CloseApproaches.h"
+
+/**
+ * @brief Per target, what checking a body against it needs, for one step
+ */
+struct TargetReach
+{
+    double x, y, z;
+    double threshold;
+    double speed;               // [m/s], of the target
+    double escape_speed;        // [m/s], from its threshold
+};
+
+/**
+ * Bodies ahead the screening prefetches
+ */
+#define APPROACH_PREFETCH_DISTANCE 16
+
+/**
+ * Bodies due the pool threads screen at a time
+ */
+#define APPROACH_SCREEN_CHUNK_SIZE 1024
+
+/**
+ * @brief Starts loading what checking a body reads
+ */
+static inline void prefetchBody(const OrbitalBodies *bodies, unsigned int body)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(bodies->x + body);
+    __builtin_prefetch(bodies->y + body);
+    __builtin_prefetch(bodies->z + body);
+    __builtin_prefetch(bodies->vx + body);
+    __builtin_prefetch(bodies->vy + body);
+    __builtin_prefetch(bodies->vz + body);
+#endif
+}
+
+/**
+ * @brief Adds a body to a bucket, growing it if needed
+ *
+ * @return false if out of memory
+ */
+static bool pushBucket(ApproachBucket *bucket, unsigned int body)
+{
+    if (bucket->count == bucket->capacity)
+    {
+        unsigned int capacity = bucket->capacity ? 2 * bucket->capacity : 256;
+        unsigned int *bodies = (unsigned int *)realloc(bucket->bodies, capacity * sizeof(unsigned int));
+        if (bodies == NULL)
+            return false;
+        bucket->bodies = bodies;
+        bucket->capacity = capacity;
+    }
+    bucket->bodies[bucket->count++] = body;
+    return true;
+}
+
+/**
+ * @brief Makes room to watch one more body
+ *
+ * @return false if out of memory
+ */
+static bool reserveWatched(ApproachQuery *query)
+{
+    if (query->watched_count == query->watched_capacity)
+    {
+        unsigned int capacity = query->watched_capacity ? 2 * query->watched_capacity : 256;
+        WatchedBody *watched = (WatchedBody *)realloc(query->watched, capacity * sizeof(WatchedBody));
+        if (watched == NULL)
+            return false;
+        query->watched = watched;
+        query->watched_capacity = capacity;
+    }
+    return true;
+}
+
+/**
+ * @brief How many steps a body can't reach any target's threshold in
+ *
+ * @return The steps, up to APPROACH_MAX_SKIP; 0 if it could during the next one
+ */
+static unsigned int getSafeSteps(const ApproachQuery *query, const TargetReach *reaches, unsigned int body)
+{
+    const OrbitalBodies *bodies = &query->sim->bodies;
+    double time_step = query->sim->time_step;
+    double speed = sqrt(bodies->vx[body] * bodies->vx[body] + bodies->vy[body] * bodies->vy[body] +
+                        bodies->vz[body] * bodies->vz[body]);
+    unsigned int safe = APPROACH_MAX_SKIP;
+
+    for (unsigned int t = 0; t < query->target_count; t++)
+    {
+        const TargetReach *target = &reaches[t];
+        if (body == query->targets[t].body || query->targets[t].body == COLLISION_BODY_REMOVED)
+            continue;
+
+        double dx = bodies->x[body] - target->x;
+        double dy = bodies->y[body] - target->y;
+        double dz = bodies->z[body] - target->z;
+        double gap = sqrt(dx * dx + dy * dy + dz * dz) - target->threshold;
+        double reach = time_step * (APPROACH_SPEED_MARGIN * (speed + target->speed) + target->escape_speed);
+        if (gap <= reach)
+            return 0;
+        if (gap < safe * reach)
+            safe = (unsigned int)(gap / reach);
+    }
+    return safe;
+}
+
+/**
+ * @brief What screenChunk screens, and where it leaves what it found
+ */
+struct ScreenPass
+{
+    const ApproachQuery *query;
+    const TargetReach *reaches;
+    const unsigned int *due;    // the bodies, NULL: all of them, by index
+};
+
+/**
+ * @brief Finds how many steps each of a range of the bodies due is safe
+ * for, into query->safe_steps (a ThreadPoolTask)
+ */
+static void screenChunk(void *context, unsigned int begin, unsigned int end)
+{
+    ScreenPass *pass = (ScreenPass *)context;
+    const OrbitalBodies *bodies = &pass->query->sim->bodies;
+
+    //The bodies due are scattered over the arrays: ask for them ahead
+    for (unsigned int i = begin; i < end; i++)
+    {
+        if (pass->due != NULL && i + APPROACH_PREFETCH_DISTANCE < end)
+            prefetchBody(bodies, pass->due[i + APPROACH_PREFETCH_DISTANCE]);
+        pass->query->safe_steps[i] = (unsigned char)getSafeSteps(pass->query, pass->reaches,
+                                                                 pass->due != NULL ? pass->due[i] : i);
+    }
+}
+
+/**
+ * @brief Files a screened body: watches it through the next step, or puts
+ * it in the bucket of the step it's next due at
+ *
+ * @return false if out of memory
+ */
+static bool fileBody(ApproachQuery *query, unsigned int body, unsigned int safe)
+{
+    const OrbitalBodies *bodies = &query->sim->bodies;
+
+    if (safe > 0)
+        return pushBucket(&query->buckets[(query->step + safe) % (APPROACH_MAX_SKIP + 1)], body);
+    if (!reserveWatched(query))
+        return false;
+
+    WatchedBody *watched = &query->watched[query->watched_count++];
+    watched->body = body;
+    watched->x = bodies->x[body];
+    watched->y = bodies->y[body];
+    watched->z = bodies->z[body];
+    watched->vx = bodies->vx[body];
+    watched->vy = bodies->vy[body];
+    watched->vz = bodies->vz[body];
+    return true;
+}
+
+/**
+ * @brief Looks for a minimum of the distance between two bodies during a
+ * step, on the cubic Hermite through both ends of their relative motion
+ *
+ * @param p0, v0 Relative position [m] and velocity [m/s] at the start
+ * @param p1, v1 And at the end
+ * @param timeStep The step [s]
+ * @param approach Filled in with the time, as a fraction of the step, the
+ *                 distance and the relative speed, if there is a minimum
+ * @return Whether there is a minimum: the relative radial speed turns from
+ *         negative to positive during the step
+ */
+static bool refineApproach(const double p0[3], const double v0[3], const double p1[3], const double v1[3],
+                           double timeStep, CloseApproach *approach)
+{
+    double start_radial = p0[0] * v0[0] + p0[1] * v0[1] + p0[2] * v0[2];
+    double end_radial = p1[0] * v1[0] + p1[1] * v1[1] + p1[2] * v1[2];
+    if (!(start_radial < 0 && end_radial >= 0))
+        return false;
+
+    // r(s) = a + b s + c s^2 + d s^3, for s from 0 to 1
+    double a[3], b[3], c[3], d[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        a[axis] = p0[axis];
+        b[axis] = timeStep * v0[axis];
+        c[axis] = 3 * (p1[axis] - p0[axis]) - timeStep * (2 * v0[axis] + v1[axis]);
+        d[axis] = 2 * (p0[axis] - p1[axis]) + timeStep * (v0[axis] + v1[axis]);
+    }
+
+    //r . r' goes from negative to positive: bisect on it
+    double low = 0, high = 1, r[3], dr[3];
+    for (int iteration = 0; iteration < APPROACH_REFINE_ITERATIONS; iteration++)
+    {
+        double s = 0.5 * (low + high), radial = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            r[axis] = a[axis] + s * (b[axis] + s * (c[axis] + s * d[axis]));
+            dr[axis] = b[axis] + s * (2 * c[axis] + 3 * s * d[axis]);
+            radial += r[axis] * dr[axis];
+        }
+        if (radial < 0)
+            low = s;
+        else
+            high = s;
+    }
+
+    double s = high;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        r[axis] = a[axis] + s * (b[axis] + s * (c[axis] + s * d[axis]));
+        dr[axis] = b[axis] + s * (2 * c[axis] + 3 * s * d[axis]);
+    }
+    approach->time = s;
+    approach->distance = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    approach->speed = sqrt(dr[0] * dr[0] + dr[1] * dr[1] + dr[2] * dr[2]) / timeStep;
+    return true;
+}
+
+static int compareApproaches(const void *a, const void *b)
+{
+    const CloseApproach *first = (const CloseApproach *)a;
+    const CloseApproach *second = (const CloseApproach *)b;
+
+    if (first->time != second->time)
+        return first->time < second->time ? -1 : 1;
+    if (first->body != second->body)
+        return first->body < second->body ? -1 : 1;
+    return first->target < second->target ? -1 : first->target > second->target;
+}
+
+/**
+ * @brief Attaches a close approach query to a simulation, with no targets
+ * yet. The simulation owns it from then on, destroyOrbitalSim destroys it.
+ *
+ * @param sim The simulation, which must not have a query already
+ * @return The query, NULL if out of memory
+ */
+ApproachQuery *constructApproachQuery(OrbitalSim *sim)
+{
+    if (sim->approaches != NULL)
+        return NULL;
+
+    ApproachQuery *query = new (std::nothrow) ApproachQuery();
+    if (query == NULL)
+        return NULL;
+    query->sim = sim;
+
+    sim->approaches = query;
+    return query;
+}
+
+/**
+ * @brief Detaches a query from its simulation
+ */
+void destroyApproachQuery(ApproachQuery *query)
+{
+    query->sim->approaches = NULL;
+
+    for (unsigned int i = 0; i <= APPROACH_MAX_SKIP; i++)
+        free(query->buckets[i].bodies);
+    free(query->safe_steps);
+    free(query->watched);
+    free(query->events);
+    delete query;
+}
+
+/**
+ * @brief Looks for bodies passing close to one more target, from the next
+ * step on. Every body is checked afresh then.
+ *
+ * @param query The query
+ * @param body The target
+ * @param threshold How close, between centers [m]
+ * @return false if there are APPROACH_MAX_TARGETS targets already, or the
+ *         arguments are out of range
+ */
+bool addApproachTarget(ApproachQuery *query, unsigned int body, double threshold)
+{
+    if (query->target_count == APPROACH_MAX_TARGETS || body >= query->sim->bodies_count || !(threshold > 0))
+        return false;
+
+    query->targets[query->target_count].body = body;
+    query->targets[query->target_count].threshold = threshold;
+    query->target_count++;
+    query->bodies_count = 0;
+    return true;
+}
+
+/**
+ * @brief Checks the bodies due this step, and keeps where the ones it
+ * watches start it. Called by updateOrbitalSim.
+ */
+void beginApproachStep(ApproachQuery *query)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    OrbitalSim *sim = query->sim;
+    const OrbitalBodies *bodies = &sim->bodies;
+    TargetReach reaches[APPROACH_MAX_TARGETS];
+
+    query->start_time = sim->time_elapsed;
+    query->watched_count = 0;
+    for (unsigned int t = 0; t < query->target_count; t++)
+    {
+        //A target collisions took out is skipped
+        unsigned int target = query->targets[t].body;
+        double *state = query->target_start[t];
+        if (target == COLLISION_BODY_REMOVED)
+            continue;
+
+        state[0] = reaches[t].x = bodies->x[target];
+        state[1] = reaches[t].y = bodies->y[target];
+        state[2] = reaches[t].z = bodies->z[target];
+        state[3] = bodies->vx[target];
+        state[4] = bodies->vy[target];
+        state[5] = bodies->vz[target];
+        reaches[t].threshold = query->targets[t].threshold;
+        reaches[t].speed = sqrt(state[3] * state[3] + state[4] * state[4] + state[5] * state[5]);
+        reaches[t].escape_speed = sqrt(2 * GRAVITATIONAL_CONSTANT * bodies->mass[target] / reaches[t].threshold);
+    }
+
+    //After bodies were taken out (or at first), all of them are due
+    ApproachBucket *due = &query->buckets[query->step % (APPROACH_MAX_SKIP + 1)];
+    ScreenPass pass = {query, reaches, due->bodies};
+    unsigned int count = due->count;
+    if (query->bodies_count != sim->bodies_count)
+    {
+        for (unsigned int i = 0; i <= APPROACH_MAX_SKIP; i++)
+            query->buckets[i].count = 0;
+        query->step = 0;
+        query->bodies_count = sim->bodies_count;
+        due = NULL;
+        pass.due = NULL;
+        count = sim->bodies_count;
+    }
+
+    if (query->safe_steps_capacity < count)
+    {
+        free(query->safe_steps);
+        query->safe_steps = (unsigned char *)malloc(count);
+        query->safe_steps_capacity = query->safe_steps != NULL ? count : 0;
+    }
+    if (query->safe_steps == NULL)
+    {
+        query->out_of_memory = true;
+        query->bodies_count = 0;
+        count = 0;
+    }
+
+    //Screening runs on the pool; filing, which appends to shared lists, doesn't
+    runThreadPool(sim->pool, screenChunk, &pass, 0, count, APPROACH_SCREEN_CHUNK_SIZE);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        //A body dropped here would never be checked again: start over with all of them
+        if (!fileBody(query, pass.due != NULL ? pass.due[i] : i, query->safe_steps[i]))
+        {
+            query->out_of_memory = true;
+            query->bodies_count = 0;
+        }
+    }
+    if (due != NULL)
+        due->count = 0;
+    query->checks += count;
+
+    query->watches += query->watched_count;
+    query->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Finds the close approaches of the bodies watched through the step
+ * just taken, and makes them due again next step. Called by updateOrbitalSim,
+ * before collisions take any body out.
+ */
+void findCloseApproaches(ApproachQuery *query)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    OrbitalSim *sim = query->sim;
+    const OrbitalBodies *bodies = &sim->bodies;
+    unsigned int first_event = query->event_count;
+
+    for (unsigned int w = 0; w < query->watched_count; w++)
+    {
+        const WatchedBody *watched = &query->watched[w];
+        unsigned int body = watched->body;
+
+        for (unsigned int t = 0; t < query->target_count; t++)
+        {
+            unsigned int target = query->targets[t].body;
+            const double *target_start = query->target_start[t];
+            if (target == body || target == COLLISION_BODY_REMOVED)
+                continue;
+
+            double p0[3] = {watched->x - target_start[0], watched->y - target_start[1],
+                            watched->z - target_start[2]};
+            double v0[3] = {watched->vx - target_start[3], watched->vy - target_start[4],
+                            watched->vz - target_start[5]};
+            double p1[3] = {bodies->x[body] - bodies->x[target], bodies->y[body] - bodies->y[target],
+                            bodies->z[body] - bodies->z[target]};
+            double v1[3] = {bodies->vx[body] - bodies->vx[target], bodies->vy[body] - bodies->vy[target],
+                            bodies->vz[body] - bodies->vz[target]};
+
+            CloseApproach approach;
+            if (!refineApproach(p0, v0, p1, v1, sim->time_step, &approach) ||
+                approach.distance > query->targets[t].threshold)
+                continue;
+
+            if (query->event_count == query->event_capacity)
+            {
+                unsigned int capacity = query->event_capacity ? 2 * query->event_capacity : 64;
+                CloseApproach *events =
+                    (CloseApproach *)realloc(query->events, capacity * sizeof(CloseApproach));
+                if (events == NULL)
+                {
+                    query->out_of_memory = true;
+                    continue;
+                }
+                query->events = events;
+                query->event_capacity = capacity;
+            }
+            approach.body = body;
+            approach.target = target;
+            approach.target_name = bodies->name != NULL ? bodies->name[target] : NULL;
+            approach.time = query->start_time + approach.time * sim->time_step;
+            query->events[query->event_count++] = approach;
+        }
+
+        if (!pushBucket(&query->buckets[(query->step + 1) % (APPROACH_MAX_SKIP + 1)], body))
+        {
+            query->out_of_memory = true;
+            query->bodies_count = 0;
+        }
+    }
+    query->step++;
+
+    //This step's events all come after the earlier steps'
+    if (query->event_count - first_event > 1)
+        qsort(query->events + first_event, query->event_count - first_event, sizeof(CloseApproach),
+              compareApproaches);
+    query->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Called by collisions after compacting bodies away: moves each
+ * target to wherever its body went, or drops it if it was taken out
+ *
+ * @param query The query
+ * @param movedTo Where each body of the step went, COLLISION_BODY_REMOVED
+ *                if it was taken out
+ */
+void remapApproachTargets(ApproachQuery *query, const unsigned int *movedTo)
+{
+    for (unsigned int t = 0; t < query->target_count; t++)
+    {
+        if (query->targets[t].body != COLLISION_BODY_REMOVED)
+            query->targets[t].body = movedTo[query->targets[t].body];
+    }
+}
+
+/**
+ * @brief Writes every close approach found so far as CSV, in time order
+ *
+ * @return false if the file can't be written
+ */
+bool writeCloseApproaches(const ApproachQuery *query, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    fprintf(file, "time,body,target,target_name,distance,relative_speed\n");
+    for (unsigned int i = 0; i < query->event_count; i++)
+    {
+        const CloseApproach *event = &query->events[i];
+        fprintf(file, "%.17g,%u,%u,%s,%.17g,%.9g\n", event->time, event->body, event->target,
+                event->target_name != NULL ? event->target_name : "",
+                event->distance, event->speed);
+    }
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
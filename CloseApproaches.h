@@ -0,0 +1,134 @@
+/**
+ * @brief Close approach queries: which bodies pass within a distance of a target
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef CLOSEAPPROACHES_H
+#define CLOSEAPPROACHES_H
+
+struct OrbitalSim;
+
+/**
+ * Most target bodies a query watches
+ */
+#define APPROACH_MAX_TARGETS 16
+
+/**
+ * Bisections that place a minimum within a step, down to 2^-48 of it
+ */
+#define APPROACH_REFINE_ITERATIONS 48
+
+/**
+ * Most steps a body goes unchecked, however far it is from every target.
+ * Speeds are only bounded for that long, so shorter is safer.
+ */
+#define APPROACH_MAX_SKIP 64
+
+/**
+ * How much faster than now, relative to the simulation's frame, a body and
+ * a target may get while a body goes unchecked
+ */
+#define APPROACH_SPEED_MARGIN 1.5
+
+/**
+ * @brief A body to find close approaches to
+ */
+struct ApproachTarget
+{
+    unsigned int body;
+    double threshold;           // [m], between centers
+};
+
+/**
+ * @brief A body at its closest to a target, within the target's threshold
+ */
+struct CloseApproach
+{
+    unsigned int body, target;  // by their index during that step
+    const char *target_name;    // NULL if unnamed
+    double time;                // [s]
+    double distance;            // [m], between centers
+    double speed;               // [m/s], relative
+};
+
+/**
+ * @brief A body under watch this step: where it started it
+ */
+struct WatchedBody
+{
+    unsigned int body;
+    double x, y, z, vx, vy, vz;
+};
+
+/**
+ * @brief A list of bodies due for a check at a step
+ */
+struct ApproachBucket
+{
+    unsigned int *bodies;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+/**
+ * @brief Close approach queries attached to a simulation. Each body is only
+ * checked against the targets now and then: how many steps it can't reach
+ * any target's threshold in, at APPROACH_SPEED_MARGIN times the sum of its
+ * speed and the target's, plus the target's escape speed at the threshold,
+ * is how long it waits for the next check (up to APPROACH_MAX_SKIP), in a
+ * ring of per-step buckets. A step only pays for the bodies due.
+ *
+ * Bodies that could reach a threshold during the next step are watched
+ * through it. Their start is kept, and after the step their distance to
+ * each target is interpolated between the two ends with a cubic Hermite on
+ * positions and velocities; a minimum falls where the relative radial speed
+ * turns positive, and is found on the cubic by bisection.
+ *
+ * Bodies on orbits eccentric enough to speed up by more than the margin
+ * within a skip may be checked too late and missed.
+ *
+ * Events name bodies by their index during the step. Targets follow their
+ * bodies as collisions compact others away; a target taken out is dropped.
+ * Every body is checked afresh after a compaction.
+ */
+struct ApproachQuery
+{
+    OrbitalSim *sim;
+    ApproachTarget targets[APPROACH_MAX_TARGETS];
+    unsigned int target_count;
+
+    ApproachBucket buckets[APPROACH_MAX_SKIP + 1];  // the bodies due at each step, a ring
+    unsigned long long step;    // steps since the bodies were last all checked
+    unsigned int bodies_count;  // sim->bodies_count then, 0: check them all before the next step
+
+    unsigned char *safe_steps;  // of each body due this step, as screened
+    unsigned int safe_steps_capacity;
+
+    double start_time;          // [s], of the current step
+    WatchedBody *watched;       // through the current step, grown as needed
+    unsigned int watched_count;
+    unsigned int watched_capacity;
+    double target_start[APPROACH_MAX_TARGETS][6];   // x, y, z, vx, vy, vz at the start of the step
+
+    CloseApproach *events;      // since construction, in time order
+    unsigned int event_count;
+    unsigned int event_capacity;
+    bool out_of_memory;         // events may have been missed
+
+    // Since construction
+    unsigned long long checks;      // body checks against all targets
+    unsigned long long watches;     // bodies watched through a step
+    double seconds;                 // screening and refinement took
+};
+
+ApproachQuery *constructApproachQuery(OrbitalSim *sim);
+void destroyApproachQuery(ApproachQuery *query);
+bool addApproachTarget(ApproachQuery *query, unsigned int body, double threshold);
+void beginApproachStep(ApproachQuery *query);
+void findCloseApproaches(ApproachQuery *query);
+void remapApproachTargets(ApproachQuery *query, const unsigned int *movedTo);
+bool writeCloseApproaches(const ApproachQuery *query, const char *path);
+
+#endif
@@ -0,0 +1,808 @@
+/**
+ * @brief Collision and close encounter detection, through a spatial hash
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Each step, the path of every body is swept into a box, and the boxes are
+ * entered in the cells of a uniform grid they cover. The entries are radix
+ * sorted by a hash of their cell, with as many hash values as entries, so
+ * building the list is O(n). Two bodies are only tested if they share a
+ * cell, and only in the cell holding the low corner of where their boxes
+ * overlap, so no pair is tested twice.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+#include <algorithm>
+
+#include "Collisions.h"
+#include "OrbitalSim.h"
+
+/**
+ * Most cells along an axis, so cell coordinates fit an unsigned int however
+ * far apart the bodies are
+ */
+#define COLLISION_MAX_CELLS 1048576.0
+
+/**
+ * Events a pool thread gathers before handing them over
+ */
+#define COLLISION_EVENT_BATCH 32
+
+static const char *const responseNames[] = {
+    "merge",
+    "remove",
+    "log",
+};
+
+/**
+ * @brief What the pool threads need to scan the hash
+ */
+struct CollisionScan
+{
+    CollisionDetector *detector;
+    double origin[3];           // [m], the low corner of all the boxes
+    double cell_size;           // [m]
+    unsigned int bucket_count;
+};
+
+static unsigned int hashCell(const unsigned int *cell, unsigned int bucketCount)
+{
+    return (cell[0] * 73856093u ^ cell[1] * 19349663u ^ cell[2] * 83492791u) & (bucketCount - 1);
+}
+
+static void getCell(const CollisionScan *scan, const double *point, unsigned int *cell)
+{
+    for (int axis = 0; axis < 3; axis++)
+        cell[axis] = (unsigned int)((point[axis] - scan->origin[axis]) / scan->cell_size);
+}
+
+/**
+ * @brief Does a body's swept box hold only finite numbers?
+ */
+static bool isBoxValid(const double *box)
+{
+    return box[0] <= box[3] && box[1] <= box[4] && box[2] <= box[5];
+}
+
+static bool doBoxesOverlap(const double *a, const double *b)
+{
+    return a[0] <= b[3] && b[0] <= a[3] && a[1] <= b[4] && b[1] <= a[4] && a[2] <= b[5] && b[2] <= a[5];
+}
+
+/**
+ * @brief Which body of a pair prevails: planets over asteroids, then the
+ * heavier one, then the lower index
+ */
+static bool prevails(const OrbitalSim *sim, unsigned int a, unsigned int b)
+{
+    bool a_planet = a < sim->planets_range, b_planet = b < sim->planets_range;
+
+    if (a_planet != b_planet)
+        return a_planet;
+    if (sim->bodies.mass[a] != sim->bodies.mass[b])
+        return sim->bodies.mass[a] > sim->bodies.mass[b];
+    return a < b;
+}
+
+/**
+ * @brief Checks whether two bodies came within reach of each other anywhere
+ * along their paths through the step, both taken as straight lines
+ *
+ * @return true if they did, with the event filled in
+ */
+static bool testPair(const CollisionDetector *detector, unsigned int a, unsigned int b,
+                     CollisionEvent *event)
+{
+    const OrbitalSim *sim = detector->sim;
+    const OrbitalBodies *bodies = &sim->bodies;
+    double start[3] = {detector->start_x[a] - detector->start_x[b],
+                       detector->start_y[a] - detector->start_y[b],
+                       detector->start_z[a] - detector->start_z[b]};
+    double motion[3] = {bodies->x[a] - bodies->x[b] - start[0],
+                        bodies->y[a] - bodies->y[b] - start[1],
+                        bodies->z[a] - bodies->z[b] - start[2]};
+    double reach = (double)bodies->radius[a] + bodies->radius[b];
+    double outer = reach + detector->encounter_distance;
+
+    double motion_sqr = motion[0] * motion[0] + motion[1] * motion[1] + motion[2] * motion[2];
+    double start_motion = start[0] * motion[0] + start[1] * motion[1] + start[2] * motion[2];
+    double start_sqr = start[0] * start[0] + start[1] * start[1] + start[2] * start[2];
+
+    // Closest approach, at a fraction of the step
+    double closest = motion_sqr > 0 ? -start_motion / motion_sqr : 0;
+    closest = closest > 0 ? (closest < 1 ? closest : 1) : 0;
+    double distance_sqr = start_sqr + closest * (2 * start_motion + closest * motion_sqr);
+    distance_sqr = distance_sqr > 0 ? distance_sqr : 0;
+    if (!(distance_sqr < outer * outer))
+        return false;
+
+    double fraction = closest;
+    if (distance_sqr < reach * reach)
+    {
+        // First contact, the earlier root of |start + motion t| = reach
+        event->type = COLLISION_EVENT_COLLISION;
+        if (start_sqr > reach * reach && motion_sqr > 0)
+        {
+            double discriminant = start_motion * start_motion - motion_sqr * (start_sqr - reach * reach);
+            fraction = fmin(fmax((-start_motion - sqrt(fmax(discriminant, 0.0))) / motion_sqr, 0.0), closest);
+        }
+        else
+            fraction = 0;
+    }
+    else
+        event->type = COLLISION_EVENT_ENCOUNTER;
+
+    bool a_first = prevails(sim, a, b);
+    event->a = a_first ? a : b;
+    event->b = a_first ? b : a;
+    event->time = sim->time_elapsed - (1 - fraction) * sim->time_step;
+    event->distance = sqrt(distance_sqr);
+    event->speed = sim->time_step > 0 ? sqrt(motion_sqr) / sim->time_step : 0;
+    return true;
+}
+
+/**
+ * @brief Adds events to the step's list
+ */
+static void addEvents(CollisionDetector *detector, const CollisionEvent *events, unsigned int count)
+{
+    std::lock_guard<std::mutex> lock(detector->event_mutex);
+
+    if (detector->event_count + count > detector->event_capacity)
+    {
+        unsigned int capacity = 2 * (detector->event_count + count);
+        CollisionEvent *grown = (CollisionEvent *)realloc(detector->events,
+                                                          capacity * sizeof(CollisionEvent));
+        if (grown == NULL)
+        {
+            detector->out_of_memory = true;
+            return;
+        }
+        detector->events = grown;
+        detector->event_capacity = capacity;
+    }
+    memcpy(detector->events + detector->event_count, events, count * sizeof(CollisionEvent));
+    detector->event_count += count;
+}
+
+/**
+ * @brief Tests the bodies sharing each cell of a range of buckets (a ThreadPoolTask)
+ */
+static void scanBuckets(void *context, unsigned int begin, unsigned int end)
+{
+    CollisionScan *scan = (CollisionScan *)context;
+    CollisionDetector *detector = scan->detector;
+    const CollisionEntry *sorted = detector->sorted;
+    CollisionEvent batch[COLLISION_EVENT_BATCH];
+    unsigned int batch_count = 0;
+
+    for (unsigned int bucket = begin; bucket < end; bucket++)
+    {
+        unsigned int last = detector->bucket_starts[bucket + 1];
+
+        for (unsigned int i = detector->bucket_starts[bucket]; i < last; i++)
+            for (unsigned int j = i + 1; j < last; j++)
+            {
+                const CollisionEntry *p = &sorted[i], *q = &sorted[j];
+                if (p->cell[0] != q->cell[0] || p->cell[1] != q->cell[1] || p->cell[2] != q->cell[2])
+                    continue;
+
+                const double *a = detector->boxes + 6 * (size_t)p->body;
+                const double *b = detector->boxes + 6 * (size_t)q->body;
+                if (!doBoxesOverlap(a, b))
+                    continue;
+
+                // Only the cell with the low corner of the overlap tests the pair
+                double corner[3] = {a[0] > b[0] ? a[0] : b[0], a[1] > b[1] ? a[1] : b[1],
+                                    a[2] > b[2] ? a[2] : b[2]};
+                unsigned int cell[3];
+                getCell(scan, corner, cell);
+                if (cell[0] != p->cell[0] || cell[1] != p->cell[1] || cell[2] != p->cell[2])
+                    continue;
+
+                if (testPair(detector, p->body, q->body, &batch[batch_count]) &&
+                    ++batch_count == COLLISION_EVENT_BATCH)
+                {
+                    addEvents(detector, batch, batch_count);
+                    batch_count = 0;
+                }
+            }
+    }
+
+    if (batch_count)
+        addEvents(detector, batch, batch_count);
+}
+
+/**
+ * @brief Tests a body too big for the cell list against every body in it whose
+ * box overlaps its own
+ */
+static void testAgainstAll(CollisionDetector *detector, unsigned int i)
+{
+    const double *a = detector->boxes + 6 * (size_t)i;
+    unsigned int count = detector->sim->bodies_count;
+    CollisionEvent event;
+
+    for (unsigned int j = 0; j < count; j++)
+    {
+        const double *b = detector->boxes + 6 * (size_t)j;
+        if ((detector->flags[j] & COLLISION_FLAG_OVERSIZED) || !isBoxValid(b) || !doBoxesOverlap(a, b))
+            continue;
+        if (testPair(detector, i, j, &event))
+            addEvents(detector, &event, 1);
+    }
+}
+
+/**
+ * @brief Tests a range of the bodies too big for the cell list (a
+ * ThreadPoolTask): against the other big ones, then against the ones in the
+ * list. A big box mostly comes from a long path, so the path is walked in
+ * pieces about a cell long, and only the cells around each piece are looked
+ * up; bodies found more than once are tested once. Paths crossing more cells
+ * than there are bodies go through them all instead.
+ */
+static void scanOversized(void *context, unsigned int begin, unsigned int end)
+{
+    CollisionScan *scan = (CollisionScan *)context;
+    CollisionDetector *detector = scan->detector;
+    const OrbitalBodies *bodies = &detector->sim->bodies;
+    double margin = 0.5 * detector->encounter_distance;
+    unsigned int *candidates = NULL;
+    unsigned int candidate_count, candidate_capacity = 0;
+    CollisionEvent event;
+
+    for (unsigned int n = begin; n < end; n++)
+    {
+        unsigned int i = detector->oversized[n];
+        const double *a = detector->boxes + 6 * (size_t)i;
+
+        for (unsigned int m = n + 1; m < detector->oversized_count; m++)
+        {
+            unsigned int j = detector->oversized[m];
+            if (doBoxesOverlap(a, detector->boxes + 6 * (size_t)j) && testPair(detector, i, j, &event))
+                addEvents(detector, &event, 1);
+        }
+
+        double start[3] = {detector->start_x[i], detector->start_y[i], detector->start_z[i]};
+        double motion[3] = {bodies->x[i] - start[0], bodies->y[i] - start[1], bodies->z[i] - start[2]};
+        double reach = bodies->radius[i] + margin;
+        double length = 0;
+        for (int axis = 0; axis < 3; axis++)
+            length = fabs(motion[axis]) > length ? fabs(motion[axis]) : length;
+
+        // Pieces a cell long span at most 2 + 2 reach / cell_size cells along each axis
+        double pieces = ceil(length / scan->cell_size);
+        double span = 3 + 2 * ceil(reach / scan->cell_size);
+        if (!(pieces * span * span * span <= detector->sim->bodies_count))
+        {
+            testAgainstAll(detector, i);
+            continue;
+        }
+        if (pieces < 1)
+            pieces = 1;
+
+        candidate_count = 0;
+        for (unsigned int piece = 0; piece < pieces; piece++)
+        {
+            double from = piece / pieces, to = (piece + 1) / pieces;
+            double piece_box[6];
+            unsigned int low[3], high[3], cell[3];
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                double p = start[axis] + from * motion[axis], q = start[axis] + to * motion[axis];
+                piece_box[axis] = (p < q ? p : q) - reach;
+                piece_box[axis + 3] = (p < q ? q : p) + reach;
+
+                // Rounding may leave the piece a hair outside the grid
+                piece_box[axis] = piece_box[axis] > a[axis] ? piece_box[axis] : a[axis];
+                piece_box[axis + 3] = piece_box[axis + 3] < a[axis + 3] ? piece_box[axis + 3] : a[axis + 3];
+            }
+            getCell(scan, piece_box, low);
+            getCell(scan, piece_box + 3, high);
+
+            for (cell[0] = low[0]; cell[0] <= high[0]; cell[0]++)
+                for (cell[1] = low[1]; cell[1] <= high[1]; cell[1]++)
+                    for (cell[2] = low[2]; cell[2] <= high[2]; cell[2]++)
+                    {
+                        unsigned int bucket = hashCell(cell, scan->bucket_count);
+                        unsigned int last = detector->bucket_starts[bucket + 1];
+
+                        for (unsigned int k = detector->bucket_starts[bucket]; k < last; k++)
+                        {
+                            const CollisionEntry *entry = &detector->sorted[k];
+                            if (entry->cell[0] != cell[0] || entry->cell[1] != cell[1] ||
+                                entry->cell[2] != cell[2] ||
+                                !doBoxesOverlap(piece_box, detector->boxes + 6 * (size_t)entry->body))
+                                continue;
+
+                            if (candidate_count == candidate_capacity)
+                            {
+                                unsigned int capacity = candidate_capacity ? 2 * candidate_capacity : 256;
+                                unsigned int *grown = (unsigned int *)realloc(candidates,
+                                                                              capacity * sizeof(unsigned int));
+                                if (grown == NULL)
+                                {
+                                    detector->out_of_memory = true;
+                                    continue;
+                                }
+                                candidates = grown;
+                                candidate_capacity = capacity;
+                            }
+                            candidates[candidate_count++] = entry->body;
+                        }
+                    }
+        }
+
+        std::sort(candidates, candidates + candidate_count);
+        candidate_count = (unsigned int)(std::unique(candidates, candidates + candidate_count) - candidates);
+        for (unsigned int k = 0; k < candidate_count; k++)
+            if (testPair(detector, i, candidates[k], &event))
+                addEvents(detector, &event, 1);
+    }
+
+    free(candidates);
+}
+
+/**
+ * @brief Makes room for the cell list
+ *
+ * @return false if out of memory
+ */
+static bool reserveCellList(CollisionDetector *detector, unsigned int entryCount, unsigned int bucketCount)
+{
+    if (entryCount > detector->entry_capacity)
+    {
+        free(detector->entries);
+        free(detector->scratch);
+        detector->entries = (CollisionEntry *)malloc(entryCount * sizeof(CollisionEntry));
+        detector->scratch = (CollisionEntry *)malloc(entryCount * sizeof(CollisionEntry));
+        detector->entry_capacity = entryCount;
+        if (detector->entries == NULL || detector->scratch == NULL)
+        {
+            detector->entry_capacity = 0;
+            return false;
+        }
+    }
+    if (bucketCount + 1 > detector->bucket_capacity)
+    {
+        free(detector->bucket_starts);
+        detector->bucket_starts = (unsigned int *)malloc((bucketCount + 1) * sizeof(unsigned int));
+        detector->bucket_capacity = detector->bucket_starts ? bucketCount + 1 : 0;
+        if (detector->bucket_starts == NULL)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Sorts the entries by key, COLLISION_RADIX_BITS at a time, into
+ * detector->sorted
+ *
+ * @param keyBits How many low bits the keys may have set
+ */
+static void sortEntries(CollisionDetector *detector, unsigned int count, unsigned int keyBits)
+{
+    CollisionEntry *from = detector->entries, *to = detector->scratch;
+    unsigned int offsets[1 << COLLISION_RADIX_BITS];
+
+    for (unsigned int shift = 0; shift < keyBits; shift += COLLISION_RADIX_BITS)
+    {
+        unsigned int mask = (1 << COLLISION_RADIX_BITS) - 1;
+
+        memset(offsets, 0, sizeof(offsets));
+        for (unsigned int n = 0; n < count; n++)
+            offsets[(from[n].key >> shift) & mask]++;
+        unsigned int offset = 0;
+        for (unsigned int digit = 0; digit <= mask; digit++)
+        {
+            unsigned int size = offsets[digit];
+            offsets[digit] = offset;
+            offset += size;
+        }
+        for (unsigned int n = 0; n < count; n++)
+            to[offsets[(from[n].key >> shift) & mask]++] = from[n];
+
+        CollisionEntry *swap = from;
+        from = to;
+        to = swap;
+    }
+    detector->sorted = from;
+}
+
+/**
+ * @brief Sweeps every body's path into a box, builds the cell list and fills
+ * in the step's events
+ *
+ * @return false if out of memory
+ */
+static bool detectCollisions(CollisionDetector *detector)
+{
+    const OrbitalSim *sim = detector->sim;
+    const OrbitalBodies *bodies = &sim->bodies;
+    unsigned int count = sim->bodies_count;
+    double margin = 0.5 * detector->encounter_distance;
+    double low[3] = {INFINITY, INFINITY, INFINITY}, high[3] = {-INFINITY, -INFINITY, -INFINITY};
+    unsigned int valid = 0;
+    CollisionScan scan;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        double *box = detector->boxes + 6 * (size_t)i;
+        double start[3] = {detector->start_x[i], detector->start_y[i], detector->start_z[i]};
+        double end[3] = {bodies->x[i], bodies->y[i], bodies->z[i]};
+        double reach = bodies->radius[i] + margin;
+        double size = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            bool forward = start[axis] < end[axis];
+            box[axis] = (forward ? start[axis] : end[axis]) - reach;
+            box[axis + 3] = (forward ? end[axis] : start[axis]) + reach;
+            size = box[axis + 3] - box[axis] > size ? box[axis + 3] - box[axis] : size;
+        }
+        if (!isfinite(size) || !isBoxValid(box))
+        {
+            box[0] = NAN;       // lost bodies aren't tested
+            continue;
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            low[axis] = box[axis] < low[axis] ? box[axis] : low[axis];
+            high[axis] = box[axis + 3] > high[axis] ? box[axis + 3] : high[axis];
+        }
+        detector->sizes[valid++] = size;
+    }
+    if (valid < 2)
+        return true;
+
+    // The median: a few bodies racing past the star mustn't blow every cell up
+    std::nth_element(detector->sizes, detector->sizes + valid / 2, detector->sizes + valid);
+    scan.detector = detector;
+    scan.cell_size = COLLISION_CELL_SCALE * detector->sizes[valid / 2];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        scan.origin[axis] = low[axis];
+        scan.cell_size = fmax(scan.cell_size, (high[axis] - low[axis]) / COLLISION_MAX_CELLS);
+    }
+    if (!(scan.cell_size > 0))
+        scan.cell_size = 1;
+
+    // Counts the entries, and sets the bodies too big for the cell list aside
+    unsigned long long entry_count = 0;
+    detector->oversized_count = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const double *box = detector->boxes + 6 * (size_t)i;
+        unsigned int low_cell[3], high_cell[3];
+        if (!isBoxValid(box))
+            continue;
+
+        getCell(&scan, box, low_cell);
+        getCell(&scan, box + 3, high_cell);
+        if (high_cell[0] - low_cell[0] >= COLLISION_MAX_CELL_SPAN ||
+            high_cell[1] - low_cell[1] >= COLLISION_MAX_CELL_SPAN ||
+            high_cell[2] - low_cell[2] >= COLLISION_MAX_CELL_SPAN)
+        {
+            detector->flags[i] |= COLLISION_FLAG_OVERSIZED;
+            detector->oversized[detector->oversized_count++] = i;
+            continue;
+        }
+        entry_count += (unsigned long long)(high_cell[0] - low_cell[0] + 1) * (high_cell[1] - low_cell[1] + 1) *
+                       (high_cell[2] - low_cell[2] + 1);
+    }
+
+    // As many buckets as entries, so most cells get a bucket of their own
+    unsigned int bucket_count = 1, key_bits = 0;
+    while (bucket_count < entry_count && bucket_count < 0x80000000u)
+    {
+        bucket_count <<= 1;
+        key_bits++;
+    }
+    if (entry_count >= 0xFFFFFFFFu || !reserveCellList(detector, (unsigned int)entry_count + 1, bucket_count))
+        return false;
+
+    unsigned int entry = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const double *box = detector->boxes + 6 * (size_t)i;
+        unsigned int low_cell[3], high_cell[3];
+        if (!isBoxValid(box) || (detector->flags[i] & COLLISION_FLAG_OVERSIZED))
+            continue;
+
+        getCell(&scan, box, low_cell);
+        getCell(&scan, box + 3, high_cell);
+        for (unsigned int cx = low_cell[0]; cx <= high_cell[0]; cx++)
+            for (unsigned int cy = low_cell[1]; cy <= high_cell[1]; cy++)
+                for (unsigned int cz = low_cell[2]; cz <= high_cell[2]; cz++)
+                {
+                    CollisionEntry *e = &detector->entries[entry++];
+                    e->body = i;
+                    e->cell[0] = cx;
+                    e->cell[1] = cy;
+                    e->cell[2] = cz;
+                    e->key = hashCell(e->cell, bucket_count);
+                }
+    }
+    sortEntries(detector, entry, key_bits);
+
+    // Where each bucket starts, and where the last one ends
+    unsigned int n = 0;
+    for (unsigned int bucket = 0; bucket <= bucket_count; bucket++)
+    {
+        while (n < entry && detector->sorted[n].key < bucket)
+            n++;
+        detector->bucket_starts[bucket] = n;
+    }
+
+    scan.bucket_count = bucket_count;
+    runThreadPool(sim->pool, scanBuckets, &scan, 0, bucket_count, COLLISION_BUCKET_CHUNK_SIZE);
+
+    // Bodies too big for the cell list
+    runThreadPool(sim->pool, scanOversized, &scan, 0, detector->oversized_count, 1);
+    return true;
+}
+
+static int compareEvents(const void *a, const void *b)
+{
+    const CollisionEvent *p = (const CollisionEvent *)a, *q = (const CollisionEvent *)b;
+
+    if (p->time != q->time)
+        return p->time < q->time ? -1 : 1;
+    if (p->a != q->a)
+        return p->a < q->a ? -1 : 1;
+    return (p->b > q->b) - (p->b < q->b);
+}
+
+/**
+ * @brief Turns two bodies into the first one: both masses, their momentum,
+ * at their center of mass, with both volumes
+ */
+static void mergeBodies(OrbitalBodies *bodies, unsigned int a, unsigned int b)
+{
+    double mass_a = bodies->mass[a], mass_b = bodies->mass[b];
+    double mass = mass_a + mass_b;
+
+    if (mass > 0)
+    {
+        bodies->x[a] = (mass_a * bodies->x[a] + mass_b * bodies->x[b]) / mass;
+        bodies->y[a] = (mass_a * bodies->y[a] + mass_b * bodies->y[b]) / mass;
+        bodies->z[a] = (mass_a * bodies->z[a] + mass_b * bodies->z[b]) / mass;
+        bodies->vx[a] = (mass_a * bodies->vx[a] + mass_b * bodies->vx[b]) / mass;
+        bodies->vy[a] = (mass_a * bodies->vy[a] + mass_b * bodies->vy[b]) / mass;
+        bodies->vz[a] = (mass_a * bodies->vz[a] + mass_b * bodies->vz[b]) / mass;
+    }
+    bodies->mass[a] = mass;
+
+    float radius_a = bodies->radius[a], radius_b = bodies->radius[b];
+    bodies->radius[a] = cbrtf(radius_a * radius_a * radius_a + radius_b * radius_b * radius_b);
+}
+
+/**
+ * @brief Moves the bodies left down over the ones taken out, keeping their
+ * order, and tells whoever follows bodies by index where they went
+ */
+static void compactBodies(CollisionDetector *detector)
+{
+    OrbitalSim *sim = detector->sim;
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int kept = 0, planets = 0;
+
+    for (unsigned int i = 0; i < sim->bodies_count; i++)
+    {
+        if (detector->flags[i] & COLLISION_FLAG_REMOVED)
+        {
+            detector->moved_to[i] = COLLISION_BODY_REMOVED;
+            continue;
+        }
+        detector->moved_to[i] = kept;
+        if (i < sim->planets_range)
+            planets++;
+        if (kept != i)
+        {
+            bodies->x[kept] = bodies->x[i];
+            bodies->y[kept] = bodies->y[i];
+            bodies->z[kept] = bodies->z[i];
+            bodies->vx[kept] = bodies->vx[i];
+            bodies->vy[kept] = bodies->vy[i];
+            bodies->vz[kept] = bodies->vz[i];
+            bodies->ax[kept] = bodies->ax[i];
+            bodies->ay[kept] = bodies->ay[i];
+            bodies->az[kept] = bodies->az[i];
+            bodies->mass[kept] = bodies->mass[i];
+            bodies->level[kept] = bodies->level[i];
+            bodies->radius[kept] = bodies->radius[i];
+            bodies->color[kept] = bodies->color[i];
+            bodies->name[kept] = bodies->name[i];
+        }
+        kept++;
+    }
+
+    detector->bodies_removed += sim->bodies_count - kept;
+    sim->bodies_count = kept;
+    if (sim->planets_range != planets)
+    {
+        sim->planets_range = planets;
+        sim->asteroid_kernel = getAsteroidKernel(sim->force_kernel_isa, sim->force_precision, planets);
+    }
+
+    if (sim->trajectory != NULL)
+        remapTrajectory(sim->trajectory, detector->moved_to);
+    if (sim->approaches != NULL)
+        remapApproachTargets(sim->approaches, detector->moved_to);
+}
+
+/**
+ * @brief Writes an event to the log
+ */
+static void logEvent(CollisionDetector *detector, const CollisionEvent *event)
+{
+    const OrbitalBodies *bodies = &detector->sim->bodies;
+
+    fprintf(detector->log, "%.17g,%s,%u,%u,%.17g,%.17g,%.17g,%.9g\n", event->time,
+            event->type == COLLISION_EVENT_COLLISION ? "collision" : "encounter", event->a, event->b,
+            bodies->mass[event->a], bodies->mass[event->b], event->distance, event->speed);
+}
+
+/**
+ * @brief Attaches collision detection to a simulation, from its next step
+ * on. The simulation owns the detector from then on, destroyOrbitalSim
+ * destroys it.
+ *
+ * @param sim The simulation, which must not have a detector already
+ * @param response What happens to bodies that touch
+ * @param encounterDistance Bodies whose surfaces come this close are logged as
+ *                          close encounters [m], 0: none
+ * @param logPath Where to write every event as CSV, NULL: nowhere
+ * @return The detector, NULL on error (out of memory, log not writable)
+ */
+CollisionDetector *constructCollisionDetector(OrbitalSim *sim, CollisionResponse response,
+                                              double encounterDistance, const char *logPath)
+{
+    unsigned int count = sim->bodies_count;
+
+    if (sim->collisions != NULL || !(encounterDistance >= 0))
+        return NULL;
+
+    CollisionDetector *detector = new (std::nothrow) CollisionDetector();
+    if (detector == NULL)
+        return NULL;
+    detector->sim = sim;
+    detector->response = response;
+    detector->encounter_distance = encounterDistance;
+    detector->body_capacity = count;
+
+    // One block for the per-body arrays, flags last
+    detector->start_x = (double *)malloc((size_t)count * (10 * sizeof(double) + 2 * sizeof(unsigned int) + 1) + 1);
+    if (detector->start_x != NULL)
+    {
+        detector->start_y = detector->start_x + count;
+        detector->start_z = detector->start_y + count;
+        detector->boxes = detector->start_z + count;
+        detector->sizes = detector->boxes + 6 * (size_t)count;
+        detector->oversized = (unsigned int *)(detector->sizes + count);
+        detector->moved_to = detector->oversized + count;
+        detector->flags = (unsigned char *)(detector->moved_to + count);
+    }
+
+    if (detector->start_x != NULL && logPath != NULL)
+    {
+        detector->log = fopen(logPath, "w");
+        if (detector->log != NULL)
+            fprintf(detector->log, "time,event,a,b,mass_a,mass_b,distance,relative_speed\n");
+    }
+    if (detector->start_x == NULL || (logPath != NULL && detector->log == NULL))
+    {
+        free(detector->start_x);
+        delete detector;
+        return NULL;
+    }
+
+    sim->collisions = detector;
+    return detector;
+}
+
+/**
+ * @brief Closes the log and detaches the detector from its simulation
+ *
+ * @return false if the log couldn't be written whole
+ */
+bool destroyCollisionDetector(CollisionDetector *detector)
+{
+    bool ok = true;
+
+    if (detector->log != NULL)
+        ok = !ferror(detector->log) && fclose(detector->log) == 0;
+    detector->sim->collisions = NULL;
+
+    free(detector->start_x);
+    free(detector->entries);
+    free(detector->scratch);
+    free(detector->bucket_starts);
+    free(detector->events);
+    delete detector;
+    return ok;
+}
+
+/**
+ * @brief Records where every body starts a step. Called by updateOrbitalSim.
+ */
+void beginCollisionStep(CollisionDetector *detector)
+{
+    const OrbitalSim *sim = detector->sim;
+    size_t size = sim->bodies_count * sizeof(double);
+
+    memcpy(detector->start_x, sim->bodies.x, size);
+    memcpy(detector->start_y, sim->bodies.y, size);
+    memcpy(detector->start_z, sim->bodies.z, size);
+}
+
+/**
+ * @brief Finds the bodies that met during the step just taken, and applies
+ * the response to them in the order they met. A body taken out by an earlier
+ * event plays no part in later ones. Called by updateOrbitalSim.
+ */
+void resolveCollisions(CollisionDetector *detector)
+{
+    OrbitalSim *sim = detector->sim;
+    unsigned int removed = 0;
+
+    memset(detector->flags, 0, sim->bodies_count);
+    detector->event_count = 0;
+    detector->out_of_memory = false;
+    if (!detectCollisions(detector))
+    {
+        detector->out_of_memory = true;
+        return;
+    }
+    if (detector->event_count > 1)
+        qsort(detector->events, detector->event_count, sizeof(CollisionEvent), compareEvents);
+
+    for (unsigned int n = 0; n < detector->event_count; n++)
+    {
+        CollisionEvent *event = &detector->events[n];
+        if ((detector->flags[event->a] | detector->flags[event->b]) & COLLISION_FLAG_REMOVED)
+            continue;
+
+        if (event->type == COLLISION_EVENT_ENCOUNTER)
+            detector->encounters++;
+        else
+        {
+            detector->collisions++;
+
+            // Earlier merges may have changed which one prevails
+            if (!prevails(sim, event->a, event->b))
+            {
+                unsigned int a = event->a;
+                event->a = event->b;
+                event->b = a;
+            }
+        }
+
+        if (detector->log != NULL)
+            logEvent(detector, event);
+
+        if (event->type == COLLISION_EVENT_COLLISION && detector->response != COLLISION_LOG)
+        {
+            if (detector->response == COLLISION_MERGE)
+                mergeBodies(&sim->bodies, event->a, event->b);
+            detector->flags[event->b] |= COLLISION_FLAG_REMOVED;
+            removed++;
+        }
+    }
+
+    if (removed)
+    {
+        compactBodies(detector);
+        sim->accelerations_valid = false;
+    }
+}
+
+const char *getCollisionResponseName(CollisionResponse response)
+{
+    return responseNames[response];
+}
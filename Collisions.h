@@ -0,0 +1,145 @@
+/**
+ * @brief Collision and close encounter detection, through a spatial hash
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef COLLISIONS_H
+#define COLLISIONS_H
+
+#include <stdio.h>
+#include <mutex>
+
+struct OrbitalSim;
+
+/**
+ * Bodies whose swept box spans more than this many cells along an axis stay
+ * out of the cell list; their paths are walked through it instead
+ */
+#define COLLISION_MAX_CELL_SPAN 4
+
+/**
+ * Bits of the cell keys each pass of the radix sort takes
+ */
+#define COLLISION_RADIX_BITS 11
+
+/**
+ * Cells are this many times the median swept box of a body
+ */
+#define COLLISION_CELL_SCALE 2.0
+
+/**
+ * Buckets the pool threads scan at a time
+ */
+#define COLLISION_BUCKET_CHUNK_SIZE 4096
+
+/**
+ * What a step found of each body
+ */
+#define COLLISION_FLAG_REMOVED 1    // taken out, compacted away at the end of the step
+#define COLLISION_FLAG_OVERSIZED 2  // kept out of the cell list
+
+/**
+ * Where moved_to sends the bodies taken out
+ */
+#define COLLISION_BODY_REMOVED 0xFFFFFFFFu
+
+/**
+ * @brief What happens to two bodies that touch
+ */
+enum CollisionResponse
+{
+    COLLISION_MERGE,            // one body, with both masses and their momentum
+    COLLISION_REMOVE,           // the lighter one is taken out, the other goes on untouched
+    COLLISION_LOG,              // nothing, they are only logged
+};
+
+enum CollisionEventType
+{
+    COLLISION_EVENT_COLLISION,  // closer than the sum of their radii
+    COLLISION_EVENT_ENCOUNTER,  // closer than that plus encounter_distance
+};
+
+/**
+ * @brief A body in one cell of the cell list
+ */
+struct CollisionEntry
+{
+    unsigned int key;           // hash of the cell, what the list is sorted by
+    unsigned int body;
+    unsigned int cell[3];       // counted from the low corner of all the boxes
+};
+
+/**
+ * @brief Two bodies that met during a step
+ */
+struct CollisionEvent
+{
+    CollisionEventType type;
+    double time;                // [s], when they touched, or came closest
+    unsigned int a, b;          // bodies, by their index during that step; a survives a collision
+    double distance;            // [m], between centers, at closest approach
+    double speed;               // [m/s], relative
+};
+
+/**
+ * @brief Collision detection attached to a simulation. updateOrbitalSim
+ * records where every body starts each step; after the step, each body's
+ * path is swept into a box, the boxes are entered in the cells of a uniform
+ * grid they cover, the entries are radix sorted by cell, and the bodies
+ * sharing a cell are tested for contact anywhere along their (straight)
+ * paths, so fast bodies don't skip through each other. Bodies with boxes too
+ * big for the grid walk their path through it instead. Bodies taken out are
+ * compacted away, keeping the order of the rest: planets stay first, and
+ * later steps only pay for the bodies left.
+ *
+ * Bodies move to lower indices as others are compacted away. A trajectory
+ * being recorded and the targets of close approach queries are told where
+ * each body went, so they keep following the same bodies.
+ */
+struct CollisionDetector
+{
+    OrbitalSim *sim;
+    CollisionResponse response;
+    double encounter_distance;  // [m] between surfaces, 0: no encounters
+    FILE *log;                  // CSV, an event per row, NULL if not logging
+
+    // Per body
+    double *start_x, *start_y, *start_z;    // [m], at the start of the step
+    double *boxes;              // swept box: low x, y, z, then high x, y, z [m]
+    double *sizes;              // longest edge of each valid box [m], in no order
+    unsigned char *flags;       // COLLISION_FLAG_*, this step
+    unsigned int *oversized;    // bodies kept out of the cell list
+    unsigned int *moved_to;     // index each body was compacted to, COLLISION_BODY_REMOVED if taken out
+    unsigned int oversized_count;
+    unsigned int body_capacity; // sim->bodies_count at construction, which only goes down
+
+    // The cell list
+    CollisionEntry *entries;    // and room to radix sort them
+    CollisionEntry *scratch;
+    CollisionEntry *sorted;     // whichever of the two ended up sorted
+    unsigned int entry_capacity;
+    unsigned int *bucket_starts;    // where each key starts in sorted, bucket_count + 1 of them
+    unsigned int bucket_capacity;
+
+    CollisionEvent *events;     // this step's, in time order
+    unsigned int event_count;
+    unsigned int event_capacity;
+    std::mutex event_mutex;
+    bool out_of_memory;         // detection was skipped this step, or events were lost
+
+    // Since construction
+    unsigned long long collisions;
+    unsigned long long encounters;
+    unsigned long long bodies_removed;
+};
+
+CollisionDetector *constructCollisionDetector(OrbitalSim *sim, CollisionResponse response,
+                                              double encounterDistance = 0, const char *logPath = NULL);
+bool destroyCollisionDetector(CollisionDetector *detector);
+void beginCollisionStep(CollisionDetector *detector);
+void resolveCollisions(CollisionDetector *detector);
+const char *getCollisionResponseName(CollisionResponse response);
+
+#endif
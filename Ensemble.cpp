@@ -0,0 +1,339 @@
+/**
+ * @brief Ensembles: many variants of a simulation, run side by side
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Each member runs on a single thread, and the pool runs as many members at
+ * once as it has threads: members are small and many, so running them side
+ * by side scales better than splitting each one's asteroids.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include "Ensemble.h"
+
+static const char *const scenarioNames[ENSEMBLE_SCENARIO_COUNT] = {
+    "solar",
+    "alphacentauri",
+};
+
+/**
+ * @brief Fills in every combination of a sweep's lists, the seeds varying
+ * fastest
+ *
+ * @param sweep The sweep spec
+ * @param parameters Filled in with a member each, NULL to only count them
+ * @return How many members the sweep has
+ */
+unsigned int expandEnsembleSweep(const EnsembleSweep *sweep, EnsembleParameters *parameters)
+{
+    unsigned long long count = (unsigned long long)sweep->scenario_count * sweep->integrator_count *
+                               sweep->time_step_count * sweep->seed_count;
+    for (unsigned int m = 0; m < sweep->mass_count; m++)
+        count *= sweep->masses[m].factor_count;
+    if (count > 0xFFFFFFFFu)
+        return 0;
+    if (parameters == NULL)
+        return (unsigned int)count;
+
+    for (unsigned int member = 0; member < count; member++)
+    {
+        EnsembleParameters *p = &parameters[member];
+        unsigned int rest = member;
+
+        p->seed = sweep->seeds[rest % sweep->seed_count];
+        rest /= sweep->seed_count;
+        p->mass_scale_count = sweep->mass_count;
+        for (unsigned int m = sweep->mass_count; m-- > 0;)
+        {
+            const EnsembleMassSweep *mass = &sweep->masses[m];
+            p->mass_scales[m].body = mass->body;
+            p->mass_scales[m].factor = mass->factors[rest % mass->factor_count];
+            rest /= mass->factor_count;
+        }
+        p->time_step = sweep->time_steps[rest % sweep->time_step_count];
+        rest /= sweep->time_step_count;
+        p->integrator = sweep->integrators[rest % sweep->integrator_count];
+        rest /= sweep->integrator_count;
+        p->scenario = sweep->scenarios[rest];
+
+        p->asteroid_count = sweep->asteroid_count;
+        p->steps = sweep->steps;
+    }
+    return (unsigned int)count;
+}
+
+/**
+ * @brief Finds the body a mass scale names. Only planets and stars can be
+ * scaled: each member draws its asteroids again, masses included.
+ *
+ * @return The body index, -1 if it isn't a planet or star of the simulation
+ */
+static int findMassScaleBody(const OrbitalSim *sim, const char *body)
+{
+    int index = findOrbitalSimBody(sim, body);
+    return index < (int)sim->planets_range ? index : -1;
+}
+
+/**
+ * @brief The belt a member's seed picks, and nothing else does
+ */
+static void getMemberBelt(const EnsembleParameters *parameters, AsteroidBelt *belt)
+{
+    setDefaultAsteroidBelt(belt);
+    belt->seed = parameters->seed;
+}
+
+/**
+ * @brief The base a member starts from, built if no earlier member needed it
+ *
+ * @return Its index, or -1 if out of memory
+ */
+static int getBase(Ensemble *ensemble, const EnsembleParameters *parameters)
+{
+    for (unsigned int n = 0; n < ensemble->base_count; n++)
+    {
+        const EnsembleParameters *built = &ensemble->parameters[ensemble->member_bases[n]];
+        if (built->scenario == parameters->scenario && built->asteroid_count == parameters->asteroid_count)
+            return (int)n;
+    }
+
+    // Its belt only gives the asteroids their radii and colors: each member draws its own
+    OrbitalSim *base;
+    AsteroidBelt belt;
+    getMemberBelt(parameters, &belt);
+    if (parameters->scenario == ENSEMBLE_SCENARIO_ALPHA_CENTAURI)
+        base = constructOrbitalSim_BONUS(parameters->time_step, 1, parameters->asteroid_count, &belt);
+    else
+        base = constructOrbitalSim(parameters->time_step, 1, parameters->asteroid_count, &belt);
+    if (base == NULL)
+        return -1;
+
+    ensemble->bases[ensemble->base_count] = base;
+    return (int)ensemble->base_count++;
+}
+
+/**
+ * @brief Builds an ensemble: the bases its members start from, and the pool
+ * that runs them
+ *
+ * @param parameters What makes each member different, copied
+ * @param memberCount How many members
+ * @param threadCount Members run at once, 0 for one per hardware thread
+ * @return The ensemble, NULL if out of memory or a mass scale names a body
+ *         that isn't a planet or star of its member's scenario
+ */
+Ensemble *constructEnsemble(const EnsembleParameters *parameters, unsigned int memberCount,
+                            unsigned int threadCount)
+{
+    Ensemble *ensemble = (Ensemble *)calloc(1, sizeof(Ensemble));
+    if (ensemble == NULL)
+        return NULL;
+
+    ensemble->member_count = memberCount;
+    ensemble->parameters = (EnsembleParameters *)malloc(memberCount * sizeof(EnsembleParameters) + 1);
+    ensemble->results = (EnsembleResult *)calloc(memberCount + 1, sizeof(EnsembleResult));
+    ensemble->member_bases = (unsigned int *)malloc(memberCount * sizeof(unsigned int) + 1);
+    ensemble->bases = (OrbitalSim **)malloc(memberCount * sizeof(OrbitalSim *) + 1);
+    if (ensemble->parameters == NULL || ensemble->results == NULL || ensemble->member_bases == NULL ||
+        ensemble->bases == NULL)
+    {
+        destroyEnsemble(ensemble);
+        return NULL;
+    }
+    memcpy(ensemble->parameters, parameters, memberCount * sizeof(EnsembleParameters));
+
+    /*
+     * member_bases[n] first holds the member that built base n, then, once
+     * every base is built, it holds the base of member n
+     */
+    unsigned int *bases = (unsigned int *)malloc(memberCount * sizeof(unsigned int) + 1);
+    bool valid = bases != NULL;
+    for (unsigned int member = 0; valid && member < memberCount; member++)
+    {
+        const EnsembleParameters *p = &ensemble->parameters[member];
+        unsigned int built = ensemble->base_count;
+
+        valid = p->scenario < ENSEMBLE_SCENARIO_COUNT && p->integrator < INTEGRATOR_COUNT && p->time_step > 0 &&
+                p->mass_scale_count <= ENSEMBLE_MAX_MASS_SCALES;
+        int base = valid ? getBase(ensemble, p) : -1;
+        if (base < 0)
+        {
+            valid = false;
+            break;
+        }
+        if (ensemble->base_count != built)
+            ensemble->member_bases[base] = member;
+        bases[member] = (unsigned int)base;
+
+        for (unsigned int m = 0; valid && m < p->mass_scale_count; m++)
+            valid = findMassScaleBody(ensemble->bases[base], p->mass_scales[m].body) >= 0;
+    }
+    if (valid)
+        memcpy(ensemble->member_bases, bases, memberCount * sizeof(unsigned int));
+    free(bases);
+
+    if (valid && threadCount == 0)
+        threadCount = getHardwareThreadCount();
+    if (valid && threadCount > 1)
+    {
+        ensemble->pool = constructThreadPool(threadCount);
+        valid = ensemble->pool != NULL;
+    }
+    if (!valid)
+    {
+        destroyEnsemble(ensemble);
+        return NULL;
+    }
+    return ensemble;
+}
+
+void destroyEnsemble(Ensemble *ensemble)
+{
+    if (ensemble->pool != NULL)
+        destroyThreadPool(ensemble->pool);
+
+    for (unsigned int n = 0; n < ensemble->base_count; n++)
+        destroyOrbitalSim(ensemble->bases[n]);
+
+    free(ensemble->parameters);
+    free(ensemble->results);
+    free(ensemble->member_bases);
+    free(ensemble->bases);
+    free(ensemble);
+}
+
+/**
+ * @brief Counts the bodies that are unbound at the end of a run. A planet
+ * is unbound from the barycenter of the other planets, taking their total
+ * mass; an asteroid, from the barycenter of all the planets.
+ */
+static void countEjected(const OrbitalSim *sim, EnsembleResult *result)
+{
+    const OrbitalBodies *bodies = &sim->bodies;
+    double mass = 0, moment[3] = {0, 0, 0}, momentum[3] = {0, 0, 0};
+
+    for (unsigned int i = 0; i < sim->planets_range; i++)
+    {
+        double m = bodies->mass[i];
+        mass += m;
+        moment[0] += m * bodies->x[i];
+        moment[1] += m * bodies->y[i];
+        moment[2] += m * bodies->z[i];
+        momentum[0] += m * bodies->vx[i];
+        momentum[1] += m * bodies->vy[i];
+        momentum[2] += m * bodies->vz[i];
+    }
+
+    result->ejected_planets = 0;
+    result->ejected_asteroids = 0;
+    for (unsigned int i = 0; i < sim->bodies_count; i++)
+    {
+        bool planet = i < sim->planets_range;
+        double m = planet ? bodies->mass[i] : 0;
+        double others = mass - m;
+        if (!(others > 0))
+            continue;
+
+        double dx = bodies->x[i] - (moment[0] - m * bodies->x[i]) / others;
+        double dy = bodies->y[i] - (moment[1] - m * bodies->y[i]) / others;
+        double dz = bodies->z[i] - (moment[2] - m * bodies->z[i]) / others;
+        double dvx = bodies->vx[i] - (momentum[0] - m * bodies->vx[i]) / others;
+        double dvy = bodies->vy[i] - (momentum[1] - m * bodies->vy[i]) / others;
+        double dvz = bodies->vz[i] - (momentum[2] - m * bodies->vz[i]) / others;
+        double distance = sqrt(dx * dx + dy * dy + dz * dz);
+
+        // Specific energy of the two-body problem with the others
+        double energy = 0.5 * (dvx * dvx + dvy * dvy + dvz * dvz) -
+                        GRAVITATIONAL_CONSTANT * (others + m) / distance;
+        if (energy >= 0 || !isfinite(energy))
+        {
+            if (planet)
+                result->ejected_planets++;
+            else
+                result->ejected_asteroids++;
+        }
+    }
+}
+
+/**
+ * @brief Builds, runs and summarizes a member, and lets its simulation go
+ */
+static void runMember(Ensemble *ensemble, unsigned int member)
+{
+    const EnsembleParameters *p = &ensemble->parameters[member];
+    const OrbitalSim *base = ensemble->bases[ensemble->member_bases[member]];
+    EnsembleResult *result = &ensemble->results[member];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    OrbitalSim *sim = cloneOrbitalSim(base, 1);
+    if (sim == NULL)
+    {
+        result->completed = false;
+        return;
+    }
+
+    // Drawn while the clone still has cold arrays of its own: the belt writes them too
+    AsteroidBelt belt;
+    getMemberBelt(p, &belt);
+    generateAsteroidBelt(&belt, &sim->bodies, sim->planets_range, sim->bodies_count, sim->bodies.mass[0],
+                         sim->pool);
+    shareOrbitalBodiesColdArrays(&sim->bodies, &base->bodies);
+
+    sim->time_step = p->time_step;
+    setOrbitalSimIntegrator(sim, p->integrator);
+    for (unsigned int m = 0; m < p->mass_scale_count; m++)
+        sim->bodies.mass[findMassScaleBody(sim, p->mass_scales[m].body)] *= p->mass_scales[m].factor;
+
+    double energy, initial_energy, angular_momentum[3], initial_angular_momentum[3];
+    computeOrbitalSimInvariants(sim, &initial_energy, initial_angular_momentum);
+
+    // Falls back to single steps unless it can tile them
+    for (unsigned long done = 0; done < p->steps;)
+    {
+        unsigned int steps = p->steps - done < TILE_MAX_STEPS ? (unsigned int)(p->steps - done) : TILE_MAX_STEPS;
+        updateOrbitalSimTiled(sim, steps);
+        done += steps;
+    }
+
+    computeOrbitalSimInvariants(sim, &energy, angular_momentum);
+    double dx = angular_momentum[0] - initial_angular_momentum[0];
+    double dy = angular_momentum[1] - initial_angular_momentum[1];
+    double dz = angular_momentum[2] - initial_angular_momentum[2];
+    double scale = sqrt(initial_angular_momentum[0] * initial_angular_momentum[0] +
+                        initial_angular_momentum[1] * initial_angular_momentum[1] +
+                        initial_angular_momentum[2] * initial_angular_momentum[2]);
+    result->energy_error = fabs(energy - initial_energy) / (initial_energy != 0 ? fabs(initial_energy) : 1);
+    result->angular_momentum_error = sqrt(dx * dx + dy * dy + dz * dz) / (scale > 0 ? scale : 1);
+    countEjected(sim, result);
+
+    destroyOrbitalSim(sim);
+    result->completed = true;
+    result->wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Runs a range of members. Run by the thread pool.
+ */
+static void runMembers(void *context, unsigned int begin, unsigned int end)
+{
+    for (unsigned int member = begin; member < end; member++)
+        runMember((Ensemble *)context, member);
+}
+
+/**
+ * @brief Runs every member to its last step, filling in ensemble->results
+ */
+void runEnsemble(Ensemble *ensemble)
+{
+    runThreadPool(ensemble->pool, runMembers, ensemble, 0, ensemble->member_count, 1);
+}
+
+const char *getEnsembleScenarioName(EnsembleScenario scenario)
+{
+    return scenarioNames[scenario];
+}
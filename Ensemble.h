@@ -0,0 +1,117 @@
+/**
+ * @brief Ensembles: many variants of a simulation, run side by side
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "OrbitalSim.h"
+
+/**
+ * Most bodies whose masses a member scales
+ */
+#define ENSEMBLE_MAX_MASS_SCALES 4
+
+enum EnsembleScenario
+{
+    ENSEMBLE_SCENARIO_SOLAR,            // constructOrbitalSim
+    ENSEMBLE_SCENARIO_ALPHA_CENTAURI,   // constructOrbitalSim_BONUS
+    ENSEMBLE_SCENARIO_COUNT
+};
+
+/**
+ * @brief A body whose mass a member multiplies, before its first step
+ */
+struct EnsembleMassScale
+{
+    const char *body;           // its name (any case), or its index: a planet or star
+    double factor;
+};
+
+/**
+ * @brief What makes a member different from the others
+ */
+struct EnsembleParameters
+{
+    EnsembleScenario scenario;
+    unsigned int asteroid_count;
+    unsigned int seed;          // of the asteroid belt
+    double time_step;           // [s]
+    unsigned long steps;
+    IntegratorType integrator;
+    EnsembleMassScale mass_scales[ENSEMBLE_MAX_MASS_SCALES];
+    unsigned int mass_scale_count;
+};
+
+/**
+ * @brief How a member's run went
+ */
+struct EnsembleResult
+{
+    bool completed;             // false if it ran out of memory
+    unsigned int ejected_planets;   // unbound from the other planets at the end
+    unsigned int ejected_asteroids; // unbound from the planets at the end
+    double energy_error;        // relative, from the first step to the last
+    double angular_momentum_error;
+    double wall_time;           // [s]
+};
+
+/**
+ * @brief A sweep spec: every combination of its lists is a member
+ */
+struct EnsembleMassSweep
+{
+    const char *body;           // as in EnsembleMassScale
+    const double *factors;
+    unsigned int factor_count;
+};
+
+struct EnsembleSweep
+{
+    const EnsembleScenario *scenarios;
+    unsigned int scenario_count;
+    const IntegratorType *integrators;
+    unsigned int integrator_count;
+    const double *time_steps;   // [s]
+    unsigned int time_step_count;
+    const unsigned int *seeds;
+    unsigned int seed_count;
+    EnsembleMassSweep masses[ENSEMBLE_MAX_MASS_SCALES];
+    unsigned int mass_count;
+
+    unsigned int asteroid_count;    // the same for every member
+    unsigned long steps;
+};
+
+/**
+ * @brief The members, and what they share. Members with the same scenario
+ * and asteroid count start as copies of one base simulation, built once,
+ * and share its radii, colors and names; each member then draws its own
+ * belt, from its seed, over the copy. A member's simulation only exists
+ * while it runs, so memory grows with the threads and the scenarios, not
+ * with the members or the seeds.
+ */
+struct Ensemble
+{
+    EnsembleParameters *parameters;
+    EnsembleResult *results;
+    unsigned int *member_bases; // the base each member starts from
+    unsigned int member_count;
+
+    OrbitalSim **bases;
+    unsigned int base_count;
+
+    ThreadPool *pool;           // runs the members, one per thread; NULL: one at a time
+};
+
+unsigned int expandEnsembleSweep(const EnsembleSweep *sweep, EnsembleParameters *parameters);
+Ensemble *constructEnsemble(const EnsembleParameters *parameters, unsigned int memberCount,
+                            unsigned int threadCount = 0);
+void destroyEnsemble(Ensemble *ensemble);
+void runEnsemble(Ensemble *ensemble);
+const char *getEnsembleScenarioName(EnsembleScenario scenario);
+
+#endif
@@ -0,0 +1,857 @@
+/**
+ * @brief Vectorized asteroid-vs-planet force kernels
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Asteroids only feel the planets, so the asteroid loop is just the same few
+ * planets swept against a long run of independent bodies. Each kernel loads as
+ * many asteroids as fit in a register and walks the planets once for all of them.
+ *
+ * Every kernel does the exact same operations, in the same order, as the scalar
+ * one (no fused multiply-add), so all of them give bit-identical results.
+ *
+ * The mixed precision kernels take each asteroid's offset from a planet in
+ * double, where the subtraction loses nothing, and do the rest in float:
+ * twice the asteroids per register, and much cheaper square roots and
+ * divisions. Each float term is good to about 1E-7; the terms are summed in
+ * double, so summing them costs nothing on top of that.
+ *
+ * Every kernel also comes in a version for each planet count up to
+ * FORCE_KERNEL_FIXED_PLANETS, a template on the count: the planets are
+ * copied out once per call, with -G * mass already worked out, and the
+ * planet loop is unrolled whole. Same operations in the same order, so the
+ * results are the same bits too.
+ */
+
+#include <math.h>
+
+#include "ForceKernel.h"
+#include "ephemerides.h"
+
+static_assert(SOLARSYSTEM_BODYNUM <= FORCE_KERNEL_FIXED_PLANETS &&
+                  ALPHACENTAURISYSTEM_BODYNUM <= FORCE_KERNEL_FIXED_PLANETS,
+              "both scenarios should get fixed kernels");
+
+//The planet loop of a fixed kernel, unrolled whole
+#if defined(__GNUC__)
+#define FORCE_KERNEL_UNROLL _Pragma("GCC unroll 16")
+#else
+#define FORCE_KERNEL_UNROLL
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FORCE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief The planets a fixed kernel sweeps, copied out of the body store
+ */
+template <unsigned int Planets>
+struct FixedPlanets
+{
+    double x[Planets], y[Planets], z[Planets];
+    double gm[Planets];         // -G * mass
+    float mixed_gm[Planets];    // the same, in the units of the mixed precision kernels
+};
+
+/**
+ * @brief -G * mass of a planet, in the units of the mixed precision kernels
+ */
+static inline float getMixedGm(const OrbitalBodies *bodies, unsigned int walker)
+{
+    return (float)(-GRAVITATIONAL_CONSTANT * bodies->mass[walker] *
+                   (MIXED_PRECISION_SCALE * MIXED_PRECISION_SCALE));
+}
+
+template <unsigned int Planets>
+static inline void loadFixedPlanets(const OrbitalBodies *bodies, FixedPlanets<Planets> *planets)
+{
+    for (unsigned int walker = 0; walker < Planets; walker++)
+    {
+        planets->x[walker] = bodies->x[walker];
+        planets->y[walker] = bodies->y[walker];
+        planets->z[walker] = bodies->z[walker];
+        planets->gm[walker] = -GRAVITATIONAL_CONSTANT * bodies->mass[walker];
+        planets->mixed_gm[walker] = getMixedGm(bodies, walker);
+    }
+}
+
+/**
+ * @brief Adds one planet's pull on an asteroid
+ */
+static inline void accumulatePlanet(double x, double y, double z, double planetX, double planetY,
+                                    double planetZ, double gm, double *ax, double *ay, double *az)
+{
+    double dx = x - planetX;
+    double dy = y - planetY;
+    double dz = z - planetZ;
+    double distance_sqr = dx * dx + dy * dy + dz * dz;
+    double coefficient = gm / (distance_sqr * sqrt(distance_sqr));
+
+    *ax += coefficient * dx;
+    *ay += coefficient * dy;
+    *az += coefficient * dz;
+}
+
+/**
+ * @brief Acceleration on a single asteroid. Used on its own by the scalar kernel,
+ *        and for the remainder that doesn't fill a whole register by the others.
+ */
+static inline void accelerateAsteroid(OrbitalBodies *bodies, unsigned int planetsRange,
+                                      unsigned int current)
+{
+    double ax = 0.0, ay = 0.0, az = 0.0;
+
+    for (unsigned int walker = 0; walker < planetsRange; walker++)
+        accumulatePlanet(bodies->x[current], bodies->y[current], bodies->z[current],
+                         bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                         -GRAVITATIONAL_CONSTANT * bodies->mass[walker], &ax, &ay, &az);
+    bodies->ax[current] = ax;
+    bodies->ay[current] = ay;
+    bodies->az[current] = az;
+}
+
+template <unsigned int Planets>
+static inline void accelerateAsteroidFixed(OrbitalBodies *bodies, const FixedPlanets<Planets> *planets,
+                                           unsigned int current)
+{
+    double ax = 0.0, ay = 0.0, az = 0.0;
+
+    FORCE_KERNEL_UNROLL
+    for (unsigned int walker = 0; walker < Planets; walker++)
+        accumulatePlanet(bodies->x[current], bodies->y[current], bodies->z[current],
+                         planets->x[walker], planets->y[walker], planets->z[walker],
+                         planets->gm[walker], &ax, &ay, &az);
+    bodies->ax[current] = ax;
+    bodies->ay[current] = ay;
+    bodies->az[current] = az;
+}
+
+static void asteroidKernelScalar(OrbitalBodies *bodies, unsigned int planetsRange,
+                                 unsigned int begin, unsigned int end)
+{
+    for (unsigned int i = begin; i < end; i++)
+        accelerateAsteroid(bodies, planetsRange, i);
+}
+
+/**
+ * @brief The scalar kernel, for exactly Planets planets. Fixed kernels called
+ * with any other count hand over to the general one.
+ */
+template <unsigned int Planets>
+static void asteroidKernelScalarFixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                      unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelScalar(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    for (unsigned int i = begin; i < end; i++)
+        accelerateAsteroidFixed(bodies, &planets, i);
+}
+
+/**
+ * @brief Adds one planet's pull on an asteroid, in mixed precision
+ */
+static inline void accumulatePlanetMixed(const OrbitalBodies *bodies, unsigned int current,
+                                         double planetX, double planetY, double planetZ, float gm,
+                                         double sum[3])
+{
+    float dx = (float)(bodies->x[current] - planetX) * MIXED_PRECISION_SCALE;
+    float dy = (float)(bodies->y[current] - planetY) * MIXED_PRECISION_SCALE;
+    float dz = (float)(bodies->z[current] - planetZ) * MIXED_PRECISION_SCALE;
+    float distance_sqr = dx * dx + dy * dy + dz * dz;
+    float coefficient = gm / (distance_sqr * sqrtf(distance_sqr));
+
+    sum[0] += (double)(coefficient * dx);
+    sum[1] += (double)(coefficient * dy);
+    sum[2] += (double)(coefficient * dz);
+}
+
+/**
+ * @brief Mixed precision acceleration on a single asteroid
+ */
+static inline void accelerateAsteroidMixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                           unsigned int current)
+{
+    double sum[3] = {0.0, 0.0, 0.0};
+
+    for (unsigned int walker = 0; walker < planetsRange; walker++)
+        accumulatePlanetMixed(bodies, current, bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                              getMixedGm(bodies, walker), sum);
+    bodies->ax[current] = sum[0];
+    bodies->ay[current] = sum[1];
+    bodies->az[current] = sum[2];
+}
+
+template <unsigned int Planets>
+static inline void accelerateAsteroidMixedFixed(OrbitalBodies *bodies, const FixedPlanets<Planets> *planets,
+                                                unsigned int current)
+{
+    double sum[3] = {0.0, 0.0, 0.0};
+
+    FORCE_KERNEL_UNROLL
+    for (unsigned int walker = 0; walker < Planets; walker++)
+        accumulatePlanetMixed(bodies, current, planets->x[walker], planets->y[walker], planets->z[walker],
+                              planets->mixed_gm[walker], sum);
+    bodies->ax[current] = sum[0];
+    bodies->ay[current] = sum[1];
+    bodies->az[current] = sum[2];
+}
+
+static void asteroidKernelMixedScalar(OrbitalBodies *bodies, unsigned int planetsRange,
+                                      unsigned int begin, unsigned int end)
+{
+    for (unsigned int i = begin; i < end; i++)
+        accelerateAsteroidMixed(bodies, planetsRange, i);
+}
+
+template <unsigned int Planets>
+static void asteroidKernelMixedScalarFixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                           unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelMixedScalar(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    for (unsigned int i = begin; i < end; i++)
+        accelerateAsteroidMixedFixed(bodies, &planets, i);
+}
+
+#ifdef FORCE_KERNEL_X86
+
+/**
+ * @brief Adds one planet's pull on a register of asteroids
+ */
+__attribute__((target("sse2")))
+static inline void accumulatePlanetSSE2(__m128d x, __m128d y, __m128d z, double planetX, double planetY,
+                                        double planetZ, double gm, __m128d *ax, __m128d *ay, __m128d *az)
+{
+    __m128d dx = _mm_sub_pd(x, _mm_set1_pd(planetX));
+    __m128d dy = _mm_sub_pd(y, _mm_set1_pd(planetY));
+    __m128d dz = _mm_sub_pd(z, _mm_set1_pd(planetZ));
+    __m128d distance_sqr = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)),
+                                      _mm_mul_pd(dz, dz));
+    __m128d coefficient = _mm_div_pd(_mm_set1_pd(gm), _mm_mul_pd(distance_sqr, _mm_sqrt_pd(distance_sqr)));
+
+    *ax = _mm_add_pd(*ax, _mm_mul_pd(coefficient, dx));
+    *ay = _mm_add_pd(*ay, _mm_mul_pd(coefficient, dy));
+    *az = _mm_add_pd(*az, _mm_mul_pd(coefficient, dz));
+}
+
+__attribute__((target("sse2")))
+static void asteroidKernelSSE2(OrbitalBodies *bodies, unsigned int planetsRange,
+                               unsigned int begin, unsigned int end)
+{
+    unsigned int i = begin;
+
+    for (; i + 2 <= end; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(bodies->x + i);
+        __m128d y = _mm_loadu_pd(bodies->y + i);
+        __m128d z = _mm_loadu_pd(bodies->z + i);
+        __m128d ax = _mm_setzero_pd(), ay = _mm_setzero_pd(), az = _mm_setzero_pd();
+
+        for (unsigned int walker = 0; walker < planetsRange; walker++)
+            accumulatePlanetSSE2(x, y, z, bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                                 -GRAVITATIONAL_CONSTANT * bodies->mass[walker], &ax, &ay, &az);
+        _mm_storeu_pd(bodies->ax + i, ax);
+        _mm_storeu_pd(bodies->ay + i, ay);
+        _mm_storeu_pd(bodies->az + i, az);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroid(bodies, planetsRange, i);
+}
+
+template <unsigned int Planets>
+__attribute__((target("sse2")))
+static void asteroidKernelSSE2Fixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                    unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelSSE2(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    unsigned int i = begin;
+
+    for (; i + 2 <= end; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(bodies->x + i);
+        __m128d y = _mm_loadu_pd(bodies->y + i);
+        __m128d z = _mm_loadu_pd(bodies->z + i);
+        __m128d ax = _mm_setzero_pd(), ay = _mm_setzero_pd(), az = _mm_setzero_pd();
+
+        FORCE_KERNEL_UNROLL
+        for (unsigned int walker = 0; walker < Planets; walker++)
+            accumulatePlanetSSE2(x, y, z, planets.x[walker], planets.y[walker], planets.z[walker],
+                                 planets.gm[walker], &ax, &ay, &az);
+        _mm_storeu_pd(bodies->ax + i, ax);
+        _mm_storeu_pd(bodies->ay + i, ay);
+        _mm_storeu_pd(bodies->az + i, az);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidFixed(bodies, &planets, i);
+}
+
+/**
+ * @brief Adds one planet's pull on a register of asteroids
+ */
+__attribute__((target("avx2")))
+static inline void accumulatePlanetAVX2(__m256d x, __m256d y, __m256d z, double planetX, double planetY,
+                                        double planetZ, double gm, __m256d *ax, __m256d *ay, __m256d *az)
+{
+    __m256d dx = _mm256_sub_pd(x, _mm256_set1_pd(planetX));
+    __m256d dy = _mm256_sub_pd(y, _mm256_set1_pd(planetY));
+    __m256d dz = _mm256_sub_pd(z, _mm256_set1_pd(planetZ));
+    __m256d distance_sqr = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                                         _mm256_mul_pd(dz, dz));
+    __m256d coefficient = _mm256_div_pd(_mm256_set1_pd(gm), _mm256_mul_pd(distance_sqr, _mm256_sqrt_pd(distance_sqr)));
+
+    *ax = _mm256_add_pd(*ax, _mm256_mul_pd(coefficient, dx));
+    *ay = _mm256_add_pd(*ay, _mm256_mul_pd(coefficient, dy));
+    *az = _mm256_add_pd(*az, _mm256_mul_pd(coefficient, dz));
+}
+
+__attribute__((target("avx2")))
+static void asteroidKernelAVX2(OrbitalBodies *bodies, unsigned int planetsRange,
+                               unsigned int begin, unsigned int end)
+{
+    unsigned int i = begin;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(bodies->x + i);
+        __m256d y = _mm256_loadu_pd(bodies->y + i);
+        __m256d z = _mm256_loadu_pd(bodies->z + i);
+        __m256d ax = _mm256_setzero_pd(), ay = _mm256_setzero_pd(), az = _mm256_setzero_pd();
+
+        for (unsigned int walker = 0; walker < planetsRange; walker++)
+            accumulatePlanetAVX2(x, y, z, bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                                 -GRAVITATIONAL_CONSTANT * bodies->mass[walker], &ax, &ay, &az);
+        _mm256_storeu_pd(bodies->ax + i, ax);
+        _mm256_storeu_pd(bodies->ay + i, ay);
+        _mm256_storeu_pd(bodies->az + i, az);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroid(bodies, planetsRange, i);
+}
+
+template <unsigned int Planets>
+__attribute__((target("avx2")))
+static void asteroidKernelAVX2Fixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                    unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelAVX2(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    unsigned int i = begin;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(bodies->x + i);
+        __m256d y = _mm256_loadu_pd(bodies->y + i);
+        __m256d z = _mm256_loadu_pd(bodies->z + i);
+        __m256d ax = _mm256_setzero_pd(), ay = _mm256_setzero_pd(), az = _mm256_setzero_pd();
+
+        FORCE_KERNEL_UNROLL
+        for (unsigned int walker = 0; walker < Planets; walker++)
+            accumulatePlanetAVX2(x, y, z, planets.x[walker], planets.y[walker], planets.z[walker],
+                                 planets.gm[walker], &ax, &ay, &az);
+        _mm256_storeu_pd(bodies->ax + i, ax);
+        _mm256_storeu_pd(bodies->ay + i, ay);
+        _mm256_storeu_pd(bodies->az + i, az);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidFixed(bodies, &planets, i);
+}
+
+/**
+ * @brief Adds one planet's pull on a register of asteroids
+ */
+__attribute__((target("avx512f")))
+static inline void accumulatePlanetAVX512(__m512d x, __m512d y, __m512d z, double planetX, double planetY,
+                                          double planetZ, double gm, __m512d *ax, __m512d *ay, __m512d *az)
+{
+    __m512d dx = _mm512_sub_pd(x, _mm512_set1_pd(planetX));
+    __m512d dy = _mm512_sub_pd(y, _mm512_set1_pd(planetY));
+    __m512d dz = _mm512_sub_pd(z, _mm512_set1_pd(planetZ));
+    __m512d distance_sqr = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)),
+                                         _mm512_mul_pd(dz, dz));
+    __m512d coefficient = _mm512_div_pd(_mm512_set1_pd(gm), _mm512_mul_pd(distance_sqr, _mm512_sqrt_pd(distance_sqr)));
+
+    *ax = _mm512_add_pd(*ax, _mm512_mul_pd(coefficient, dx));
+    *ay = _mm512_add_pd(*ay, _mm512_mul_pd(coefficient, dy));
+    *az = _mm512_add_pd(*az, _mm512_mul_pd(coefficient, dz));
+}
+
+__attribute__((target("avx512f")))
+static void asteroidKernelAVX512(OrbitalBodies *bodies, unsigned int planetsRange,
+                                 unsigned int begin, unsigned int end)
+{
+    unsigned int i = begin;
+
+    for (; i + 8 <= end; i += 8)
+    {
+        __m512d x = _mm512_loadu_pd(bodies->x + i);
+        __m512d y = _mm512_loadu_pd(bodies->y + i);
+        __m512d z = _mm512_loadu_pd(bodies->z + i);
+        __m512d ax = _mm512_setzero_pd(), ay = _mm512_setzero_pd(), az = _mm512_setzero_pd();
+
+        for (unsigned int walker = 0; walker < planetsRange; walker++)
+            accumulatePlanetAVX512(x, y, z, bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                                   -GRAVITATIONAL_CONSTANT * bodies->mass[walker], &ax, &ay, &az);
+        _mm512_storeu_pd(bodies->ax + i, ax);
+        _mm512_storeu_pd(bodies->ay + i, ay);
+        _mm512_storeu_pd(bodies->az + i, az);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroid(bodies, planetsRange, i);
+}
+
+template <unsigned int Planets>
+__attribute__((target("avx512f")))
+static void asteroidKernelAVX512Fixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                      unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelAVX512(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    unsigned int i = begin;
+
+    for (; i + 8 <= end; i += 8)
+    {
+        __m512d x = _mm512_loadu_pd(bodies->x + i);
+        __m512d y = _mm512_loadu_pd(bodies->y + i);
+        __m512d z = _mm512_loadu_pd(bodies->z + i);
+        __m512d ax = _mm512_setzero_pd(), ay = _mm512_setzero_pd(), az = _mm512_setzero_pd();
+
+        FORCE_KERNEL_UNROLL
+        for (unsigned int walker = 0; walker < Planets; walker++)
+            accumulatePlanetAVX512(x, y, z, planets.x[walker], planets.y[walker], planets.z[walker],
+                                   planets.gm[walker], &ax, &ay, &az);
+        _mm512_storeu_pd(bodies->ax + i, ax);
+        _mm512_storeu_pd(bodies->ay + i, ay);
+        _mm512_storeu_pd(bodies->az + i, az);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidFixed(bodies, &planets, i);
+}
+
+/**
+ * Mixed precision kernels. Each register of floats holds the offsets of two
+ * registers' worth of doubles, converted and joined together; each term
+ * goes back to two registers of doubles to be summed.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128 joinOffsetsSSE2(__m128d low, __m128d high, __m128d planet)
+{
+    return _mm_mul_ps(_mm_movelh_ps(_mm_cvtpd_ps(_mm_sub_pd(low, planet)),
+                                    _mm_cvtpd_ps(_mm_sub_pd(high, planet))),
+                      _mm_set1_ps(MIXED_PRECISION_SCALE));
+}
+
+__attribute__((target("sse2")))
+static inline void addTermSSE2(__m128d sum[2], __m128 term)
+{
+    sum[0] = _mm_add_pd(sum[0], _mm_cvtps_pd(term));
+    sum[1] = _mm_add_pd(sum[1], _mm_cvtps_pd(_mm_movehl_ps(term, term)));
+}
+
+__attribute__((target("sse2")))
+static inline void storeSumSSE2(double *destination, const __m128d sum[2])
+{
+    _mm_storeu_pd(destination, sum[0]);
+    _mm_storeu_pd(destination + 2, sum[1]);
+}
+
+/**
+ * @brief Adds one planet's pull on a register of asteroids, in mixed precision
+ */
+__attribute__((target("sse2")))
+static inline void accumulatePlanetMixedSSE2(__m128d x0, __m128d x1, __m128d y0, __m128d y1, __m128d z0, __m128d z1,
+                                             double planetX, double planetY, double planetZ, float gm,
+                                             __m128d sum[3][2])
+{
+    __m128 dx = joinOffsetsSSE2(x0, x1, _mm_set1_pd(planetX));
+    __m128 dy = joinOffsetsSSE2(y0, y1, _mm_set1_pd(planetY));
+    __m128 dz = joinOffsetsSSE2(z0, z1, _mm_set1_pd(planetZ));
+    __m128 distance_sqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                     _mm_mul_ps(dz, dz));
+    __m128 coefficient = _mm_div_ps(_mm_set1_ps(gm), _mm_mul_ps(distance_sqr, _mm_sqrt_ps(distance_sqr)));
+
+    addTermSSE2(sum[0], _mm_mul_ps(coefficient, dx));
+    addTermSSE2(sum[1], _mm_mul_ps(coefficient, dy));
+    addTermSSE2(sum[2], _mm_mul_ps(coefficient, dz));
+}
+
+__attribute__((target("sse2")))
+static void asteroidKernelMixedSSE2(OrbitalBodies *bodies, unsigned int planetsRange,
+                                    unsigned int begin, unsigned int end)
+{
+    unsigned int i = begin;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128d x0 = _mm_loadu_pd(bodies->x + i), x1 = _mm_loadu_pd(bodies->x + i + 2);
+        __m128d y0 = _mm_loadu_pd(bodies->y + i), y1 = _mm_loadu_pd(bodies->y + i + 2);
+        __m128d z0 = _mm_loadu_pd(bodies->z + i), z1 = _mm_loadu_pd(bodies->z + i + 2);
+        __m128d sum[3][2] = {{_mm_setzero_pd(), _mm_setzero_pd()}, {_mm_setzero_pd(), _mm_setzero_pd()},
+                             {_mm_setzero_pd(), _mm_setzero_pd()}};
+
+        for (unsigned int walker = 0; walker < planetsRange; walker++)
+            accumulatePlanetMixedSSE2(x0, x1, y0, y1, z0, z1, bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                                      getMixedGm(bodies, walker), sum);
+        storeSumSSE2(bodies->ax + i, sum[0]);
+        storeSumSSE2(bodies->ay + i, sum[1]);
+        storeSumSSE2(bodies->az + i, sum[2]);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidMixed(bodies, planetsRange, i);
+}
+
+template <unsigned int Planets>
+__attribute__((target("sse2")))
+static void asteroidKernelMixedSSE2Fixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                         unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelMixedSSE2(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    unsigned int i = begin;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128d x0 = _mm_loadu_pd(bodies->x + i), x1 = _mm_loadu_pd(bodies->x + i + 2);
+        __m128d y0 = _mm_loadu_pd(bodies->y + i), y1 = _mm_loadu_pd(bodies->y + i + 2);
+        __m128d z0 = _mm_loadu_pd(bodies->z + i), z1 = _mm_loadu_pd(bodies->z + i + 2);
+        __m128d sum[3][2] = {{_mm_setzero_pd(), _mm_setzero_pd()}, {_mm_setzero_pd(), _mm_setzero_pd()},
+                             {_mm_setzero_pd(), _mm_setzero_pd()}};
+
+        FORCE_KERNEL_UNROLL
+        for (unsigned int walker = 0; walker < Planets; walker++)
+            accumulatePlanetMixedSSE2(x0, x1, y0, y1, z0, z1, planets.x[walker], planets.y[walker], planets.z[walker],
+                                      planets.mixed_gm[walker], sum);
+        storeSumSSE2(bodies->ax + i, sum[0]);
+        storeSumSSE2(bodies->ay + i, sum[1]);
+        storeSumSSE2(bodies->az + i, sum[2]);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidMixedFixed(bodies, &planets, i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 joinOffsetsAVX2(__m256d low, __m256d high, __m256d planet)
+{
+    return _mm256_mul_ps(_mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_sub_pd(low, planet))),
+                                              _mm256_cvtpd_ps(_mm256_sub_pd(high, planet)), 1),
+                         _mm256_set1_ps(MIXED_PRECISION_SCALE));
+}
+
+__attribute__((target("avx2")))
+static inline void addTermAVX2(__m256d sum[2], __m256 term)
+{
+    sum[0] = _mm256_add_pd(sum[0], _mm256_cvtps_pd(_mm256_castps256_ps128(term)));
+    sum[1] = _mm256_add_pd(sum[1], _mm256_cvtps_pd(_mm256_extractf128_ps(term, 1)));
+}
+
+__attribute__((target("avx2")))
+static inline void storeSumAVX2(double *destination, const __m256d sum[2])
+{
+    _mm256_storeu_pd(destination, sum[0]);
+    _mm256_storeu_pd(destination + 4, sum[1]);
+}
+
+/**
+ * @brief Adds one planet's pull on a register of asteroids, in mixed precision
+ */
+__attribute__((target("avx2")))
+static inline void accumulatePlanetMixedAVX2(__m256d x0, __m256d x1, __m256d y0, __m256d y1, __m256d z0, __m256d z1,
+                                             double planetX, double planetY, double planetZ, float gm,
+                                             __m256d sum[3][2])
+{
+    __m256 dx = joinOffsetsAVX2(x0, x1, _mm256_set1_pd(planetX));
+    __m256 dy = joinOffsetsAVX2(y0, y1, _mm256_set1_pd(planetY));
+    __m256 dz = joinOffsetsAVX2(z0, z1, _mm256_set1_pd(planetZ));
+    __m256 distance_sqr = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                        _mm256_mul_ps(dz, dz));
+    __m256 coefficient = _mm256_div_ps(_mm256_set1_ps(gm), _mm256_mul_ps(distance_sqr, _mm256_sqrt_ps(distance_sqr)));
+
+    addTermAVX2(sum[0], _mm256_mul_ps(coefficient, dx));
+    addTermAVX2(sum[1], _mm256_mul_ps(coefficient, dy));
+    addTermAVX2(sum[2], _mm256_mul_ps(coefficient, dz));
+}
+
+__attribute__((target("avx2")))
+static void asteroidKernelMixedAVX2(OrbitalBodies *bodies, unsigned int planetsRange,
+                                    unsigned int begin, unsigned int end)
+{
+    unsigned int i = begin;
+
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256d x0 = _mm256_loadu_pd(bodies->x + i), x1 = _mm256_loadu_pd(bodies->x + i + 4);
+        __m256d y0 = _mm256_loadu_pd(bodies->y + i), y1 = _mm256_loadu_pd(bodies->y + i + 4);
+        __m256d z0 = _mm256_loadu_pd(bodies->z + i), z1 = _mm256_loadu_pd(bodies->z + i + 4);
+        __m256d sum[3][2] = {{_mm256_setzero_pd(), _mm256_setzero_pd()}, {_mm256_setzero_pd(), _mm256_setzero_pd()},
+                             {_mm256_setzero_pd(), _mm256_setzero_pd()}};
+
+        for (unsigned int walker = 0; walker < planetsRange; walker++)
+            accumulatePlanetMixedAVX2(x0, x1, y0, y1, z0, z1, bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                                      getMixedGm(bodies, walker), sum);
+        storeSumAVX2(bodies->ax + i, sum[0]);
+        storeSumAVX2(bodies->ay + i, sum[1]);
+        storeSumAVX2(bodies->az + i, sum[2]);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidMixed(bodies, planetsRange, i);
+}
+
+template <unsigned int Planets>
+__attribute__((target("avx2")))
+static void asteroidKernelMixedAVX2Fixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                         unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelMixedAVX2(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    unsigned int i = begin;
+
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256d x0 = _mm256_loadu_pd(bodies->x + i), x1 = _mm256_loadu_pd(bodies->x + i + 4);
+        __m256d y0 = _mm256_loadu_pd(bodies->y + i), y1 = _mm256_loadu_pd(bodies->y + i + 4);
+        __m256d z0 = _mm256_loadu_pd(bodies->z + i), z1 = _mm256_loadu_pd(bodies->z + i + 4);
+        __m256d sum[3][2] = {{_mm256_setzero_pd(), _mm256_setzero_pd()}, {_mm256_setzero_pd(), _mm256_setzero_pd()},
+                             {_mm256_setzero_pd(), _mm256_setzero_pd()}};
+
+        FORCE_KERNEL_UNROLL
+        for (unsigned int walker = 0; walker < Planets; walker++)
+            accumulatePlanetMixedAVX2(x0, x1, y0, y1, z0, z1, planets.x[walker], planets.y[walker], planets.z[walker],
+                                      planets.mixed_gm[walker], sum);
+        storeSumAVX2(bodies->ax + i, sum[0]);
+        storeSumAVX2(bodies->ay + i, sum[1]);
+        storeSumAVX2(bodies->az + i, sum[2]);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidMixedFixed(bodies, &planets, i);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 joinOffsetsAVX512(__m512d low, __m512d high, __m512d planet)
+{
+    __m256 lowOffsets = _mm512_cvtpd_ps(_mm512_sub_pd(low, planet));
+    __m256 highOffsets = _mm512_cvtpd_ps(_mm512_sub_pd(high, planet));
+    __m512d joined = _mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(lowOffsets)),
+                                        _mm256_castps_pd(highOffsets), 1);
+    return _mm512_mul_ps(_mm512_castpd_ps(joined), _mm512_set1_ps(MIXED_PRECISION_SCALE));
+}
+
+__attribute__((target("avx512f")))
+static inline void addTermAVX512(__m512d sum[2], __m512 term)
+{
+    __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(term), 1));
+
+    sum[0] = _mm512_add_pd(sum[0], _mm512_cvtps_pd(_mm512_castps512_ps256(term)));
+    sum[1] = _mm512_add_pd(sum[1], _mm512_cvtps_pd(high));
+}
+
+__attribute__((target("avx512f")))
+static inline void storeSumAVX512(double *destination, const __m512d sum[2])
+{
+    _mm512_storeu_pd(destination, sum[0]);
+    _mm512_storeu_pd(destination + 8, sum[1]);
+}
+
+/**
+ * @brief Adds one planet's pull on a register of asteroids, in mixed precision
+ */
+__attribute__((target("avx512f")))
+static inline void accumulatePlanetMixedAVX512(__m512d x0, __m512d x1, __m512d y0, __m512d y1, __m512d z0, __m512d z1,
+                                               double planetX, double planetY, double planetZ, float gm,
+                                               __m512d sum[3][2])
+{
+    __m512 dx = joinOffsetsAVX512(x0, x1, _mm512_set1_pd(planetX));
+    __m512 dy = joinOffsetsAVX512(y0, y1, _mm512_set1_pd(planetY));
+    __m512 dz = joinOffsetsAVX512(z0, z1, _mm512_set1_pd(planetZ));
+    __m512 distance_sqr = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+                                        _mm512_mul_ps(dz, dz));
+    __m512 coefficient = _mm512_div_ps(_mm512_set1_ps(gm), _mm512_mul_ps(distance_sqr, _mm512_sqrt_ps(distance_sqr)));
+
+    addTermAVX512(sum[0], _mm512_mul_ps(coefficient, dx));
+    addTermAVX512(sum[1], _mm512_mul_ps(coefficient, dy));
+    addTermAVX512(sum[2], _mm512_mul_ps(coefficient, dz));
+}
+
+__attribute__((target("avx512f")))
+static void asteroidKernelMixedAVX512(OrbitalBodies *bodies, unsigned int planetsRange,
+                                      unsigned int begin, unsigned int end)
+{
+    unsigned int i = begin;
+
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512d x0 = _mm512_loadu_pd(bodies->x + i), x1 = _mm512_loadu_pd(bodies->x + i + 8);
+        __m512d y0 = _mm512_loadu_pd(bodies->y + i), y1 = _mm512_loadu_pd(bodies->y + i + 8);
+        __m512d z0 = _mm512_loadu_pd(bodies->z + i), z1 = _mm512_loadu_pd(bodies->z + i + 8);
+        __m512d sum[3][2] = {{_mm512_setzero_pd(), _mm512_setzero_pd()}, {_mm512_setzero_pd(), _mm512_setzero_pd()},
+                             {_mm512_setzero_pd(), _mm512_setzero_pd()}};
+
+        for (unsigned int walker = 0; walker < planetsRange; walker++)
+            accumulatePlanetMixedAVX512(x0, x1, y0, y1, z0, z1, bodies->x[walker], bodies->y[walker], bodies->z[walker],
+                                        getMixedGm(bodies, walker), sum);
+        storeSumAVX512(bodies->ax + i, sum[0]);
+        storeSumAVX512(bodies->ay + i, sum[1]);
+        storeSumAVX512(bodies->az + i, sum[2]);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidMixed(bodies, planetsRange, i);
+}
+
+template <unsigned int Planets>
+__attribute__((target("avx512f")))
+static void asteroidKernelMixedAVX512Fixed(OrbitalBodies *bodies, unsigned int planetsRange,
+                                           unsigned int begin, unsigned int end)
+{
+    if (planetsRange != Planets)
+        return asteroidKernelMixedAVX512(bodies, planetsRange, begin, end);
+
+    FixedPlanets<Planets> planets;
+    loadFixedPlanets(bodies, &planets);
+    unsigned int i = begin;
+
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512d x0 = _mm512_loadu_pd(bodies->x + i), x1 = _mm512_loadu_pd(bodies->x + i + 8);
+        __m512d y0 = _mm512_loadu_pd(bodies->y + i), y1 = _mm512_loadu_pd(bodies->y + i + 8);
+        __m512d z0 = _mm512_loadu_pd(bodies->z + i), z1 = _mm512_loadu_pd(bodies->z + i + 8);
+        __m512d sum[3][2] = {{_mm512_setzero_pd(), _mm512_setzero_pd()}, {_mm512_setzero_pd(), _mm512_setzero_pd()},
+                             {_mm512_setzero_pd(), _mm512_setzero_pd()}};
+
+        FORCE_KERNEL_UNROLL
+        for (unsigned int walker = 0; walker < Planets; walker++)
+            accumulatePlanetMixedAVX512(x0, x1, y0, y1, z0, z1, planets.x[walker], planets.y[walker], planets.z[walker],
+                                        planets.mixed_gm[walker], sum);
+        storeSumAVX512(bodies->ax + i, sum[0]);
+        storeSumAVX512(bodies->ay + i, sum[1]);
+        storeSumAVX512(bodies->az + i, sum[2]);
+    }
+
+    for (; i < end; i++)
+        accelerateAsteroidMixedFixed(bodies, &planets, i);
+}
+
+#endif
+
+/**
+ * @brief Finds the fastest instruction set this CPU runs
+ *
+ * @return The instruction set
+ */
+ForceKernelIsa detectForceKernelIsa()
+{
+#ifdef FORCE_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return FORCE_KERNEL_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return FORCE_KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return FORCE_KERNEL_SSE2;
+#endif
+    return FORCE_KERNEL_SCALAR;
+}
+
+/**
+ * Every kernel of an instruction set and precision: the general one, then
+ * one for each planet count, 1 to FORCE_KERNEL_FIXED_PLANETS
+ */
+#define FIXED_KERNELS(general, fixed)                                                \
+    {general, fixed<1>, fixed<2>, fixed<3>, fixed<4>, fixed<5>, fixed<6>, fixed<7>, \
+     fixed<8>, fixed<9>}
+
+static_assert(FORCE_KERNEL_FIXED_PLANETS == 9, "FIXED_KERNELS lists a kernel per planet count");
+
+static const AsteroidKernel asteroidKernels[FORCE_KERNEL_ISA_COUNT][FORCE_PRECISION_COUNT]
+                                           [FORCE_KERNEL_FIXED_PLANETS + 1] = {
+    {FIXED_KERNELS(asteroidKernelScalar, asteroidKernelScalarFixed),
+     FIXED_KERNELS(asteroidKernelMixedScalar, asteroidKernelMixedScalarFixed)},
+#ifdef FORCE_KERNEL_X86
+    {FIXED_KERNELS(asteroidKernelSSE2, asteroidKernelSSE2Fixed),
+     FIXED_KERNELS(asteroidKernelMixedSSE2, asteroidKernelMixedSSE2Fixed)},
+    {FIXED_KERNELS(asteroidKernelAVX2, asteroidKernelAVX2Fixed),
+     FIXED_KERNELS(asteroidKernelMixedAVX2, asteroidKernelMixedAVX2Fixed)},
+    {FIXED_KERNELS(asteroidKernelAVX512, asteroidKernelAVX512Fixed),
+     FIXED_KERNELS(asteroidKernelMixedAVX512, asteroidKernelMixedAVX512Fixed)},
+#endif
+};
+
+/**
+ * @brief Gets the asteroid kernel for an instruction set
+ *
+ * @param isa The instruction set. It must be supported by this CPU.
+ * @param precision Double, or mixed precision
+ * @param planetsRange The planet count it will be called with: up to
+ *                     FORCE_KERNEL_FIXED_PLANETS get a kernel unrolled for
+ *                     exactly that many. 0 for the general kernel.
+ * @return The kernel. The scalar one if isa wasn't built into this binary.
+ */
+AsteroidKernel getAsteroidKernel(ForceKernelIsa isa, ForcePrecision precision, unsigned int planetsRange)
+{
+#ifndef FORCE_KERNEL_X86
+    isa = FORCE_KERNEL_SCALAR;
+#endif
+    if (planetsRange > FORCE_KERNEL_FIXED_PLANETS)
+        planetsRange = 0;
+    return asteroidKernels[isa][precision][planetsRange];
+}
+
+/**
+ * @brief Gets a printable name for an instruction set
+ */
+const char *getForceKernelIsaName(ForceKernelIsa isa)
+{
+    switch (isa)
+    {
+    case FORCE_KERNEL_SSE2:
+        return "sse2";
+    case FORCE_KERNEL_AVX2:
+        return "avx2";
+    case FORCE_KERNEL_AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+/**
+ * @brief Gets a printable name for a force precision
+ */
+const char *getForcePrecisionName(ForcePrecision precision)
+{
+    return precision == FORCE_PRECISION_MIXED ? "mixed" : "double";
+}
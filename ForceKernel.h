@@ -0,0 +1,64 @@
+/**
+ * @brief Vectorized asteroid-vs-planet force kernels
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef FORCEKERNEL_H
+#define FORCEKERNEL_H
+
+#include "OrbitalBodies.h"
+
+#define GRAVITATIONAL_CONSTANT 6.6743E-11
+
+/**
+ * @brief Instruction sets a kernel can be built for, from slowest to fastest
+ */
+enum ForceKernelIsa
+{
+    FORCE_KERNEL_SCALAR,
+    FORCE_KERNEL_SSE2,      // 2 asteroids per instruction
+    FORCE_KERNEL_AVX2,      // 4 asteroids per instruction
+    FORCE_KERNEL_AVX512,    // 8 asteroids per instruction
+    FORCE_KERNEL_ISA_COUNT
+};
+
+/**
+ * @brief Precision of the per-pair force math
+ */
+enum ForcePrecision
+{
+    FORCE_PRECISION_DOUBLE,
+    FORCE_PRECISION_MIXED,  // float offsets from each planet, compensated float sums: twice the lanes
+    FORCE_PRECISION_COUNT
+};
+
+/**
+ * Mixed precision works in units of 2^30 m (about a million km), so the cube
+ * of any distance in the simulation fits in a float. Being a power of two,
+ * scaling by it is exact.
+ */
+#define MIXED_PRECISION_SCALE (1.0F / 1073741824.0F)
+
+/**
+ * Planet counts up to this one get kernels unrolled for exactly that many
+ * planets: every one of the built-in scenarios
+ */
+#define FORCE_KERNEL_FIXED_PLANETS 9
+
+/**
+ * @brief Fills in ax/ay/az of the bodies in [begin, end) with the acceleration
+ * the first planetsRange bodies cause on them. The range must not overlap the planets.
+ * A kernel for a fixed planet count takes any other count too, only not unrolled.
+ */
+typedef void (*AsteroidKernel)(OrbitalBodies *bodies, unsigned int planetsRange,
+                               unsigned int begin, unsigned int end);
+
+ForceKernelIsa detectForceKernelIsa();
+AsteroidKernel getAsteroidKernel(ForceKernelIsa isa, ForcePrecision precision = FORCE_PRECISION_DOUBLE,
+                                unsigned int planetsRange = 0);
+const char *getForceKernelIsaName(ForceKernelIsa isa);
+const char *getForcePrecisionName(ForcePrecision precision);
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * @brief Frame scheduler: as many simulation steps per frame as fit in it
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * The simulation's time step stays put: a faster machine, or a faster
+ * target, only means more steps per frame, so the view's frame rate and the
+ * step size no longer decide how fast the simulation goes.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <new>
+
+#include "FrameScheduler.h"
+
+/**
+ * @brief Folds a measurement into a smoothed one. The first one is taken as is.
+ */
+static void smooth(std::atomic<double> *smoothed, double measured)
+{
+    double previous = smoothed->load(std::memory_order_relaxed);
+
+    smoothed->store(previous > 0 ? previous + FRAME_COST_SMOOTHING * (measured - previous) : measured,
+                    std::memory_order_relaxed);
+}
+
+/**
+ * @brief Constructs a frame scheduler
+ *
+ * @param fps Frames per second the simulation publishes at, usually the view's
+ * @param targetSpeed Simulated seconds per wall second
+ * @return The scheduler, NULL if out of memory
+ */
+FrameScheduler *constructFrameScheduler(int fps, double targetSpeed)
+{
+    FrameScheduler *scheduler = new (std::nothrow) FrameScheduler();
+    if (scheduler == NULL)
+        return NULL;
+
+    scheduler->frame_period = 1.0 / fps;
+    scheduler->target_speed = targetSpeed;
+    scheduler->render_cost = 0;
+    scheduler->step_cost = 0;
+    scheduler->publish_cost = 0;
+    scheduler->achieved_speed = 0;
+    scheduler->frame_steps = 0;
+    scheduler->limited = false;
+    scheduler->owed_steps = 0;
+    return scheduler;
+}
+
+/**
+ * @brief Destroys a frame scheduler
+ */
+void destroyFrameScheduler(FrameScheduler *scheduler)
+{
+    delete scheduler;
+}
+
+/**
+ * @brief How many steps to run this frame: those the target speed asks for,
+ * up to what the frame's budget fits. Until the step cost is known, one.
+ *
+ * @param scheduler The scheduler
+ * @param timeStep The simulation's time step [s]
+ * @return The steps, 0 if none are owed yet
+ */
+unsigned int planFrameSteps(FrameScheduler *scheduler, double timeStep)
+{
+    double speed = scheduler->target_speed.load(std::memory_order_relaxed);
+    double step_cost = scheduler->step_cost.load(std::memory_order_relaxed);
+
+    scheduler->owed_steps += speed * scheduler->frame_period / timeStep;
+    double owed = floor(scheduler->owed_steps);
+
+    //Rendering and publishing come out of the same frame; at least a step fits, or nothing would move
+    double budget = scheduler->frame_period * (1 - FRAME_BUDGET_MARGIN) -
+                    scheduler->render_cost.load(std::memory_order_relaxed) -
+                    scheduler->publish_cost.load(std::memory_order_relaxed);
+    double fit = step_cost > 0 ? floor(budget / step_cost) : 1;
+    if (fit < 1)
+        fit = 1;
+
+    bool limited = owed > fit;
+    double steps = limited ? fit : owed;
+    scheduler->owed_steps = limited ? 0 : scheduler->owed_steps - steps;
+    scheduler->limited.store(limited, std::memory_order_relaxed);
+    return steps < UINT_MAX ? (unsigned int)steps : UINT_MAX;
+}
+
+/**
+ * @brief Records how long a frame's steps took
+ *
+ * @param scheduler The scheduler
+ * @param steps How many were run
+ * @param seconds How long they took [s]
+ * @param timeStep The simulation's time step [s]
+ */
+void measureFrameSteps(FrameScheduler *scheduler, unsigned int steps, double seconds, double timeStep)
+{
+    if (steps > 0)
+        smooth(&scheduler->step_cost, seconds / steps);
+
+    //A frame lasts its period, or longer if it ran over
+    double frame = seconds + scheduler->publish_cost.load(std::memory_order_relaxed);
+    if (frame < scheduler->frame_period)
+        frame = scheduler->frame_period;
+    smooth(&scheduler->achieved_speed, steps * timeStep / frame);
+    scheduler->frame_steps.store(steps, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Records how long publishing a frame's snapshot took
+ */
+void measureFramePublish(FrameScheduler *scheduler, double seconds)
+{
+    smooth(&scheduler->publish_cost, seconds);
+}
+
+/**
+ * @brief Records how long the view took to render a frame, not counting its
+ * wait for the next one
+ */
+void measureFrameRender(FrameScheduler *scheduler, double seconds)
+{
+    smooth(&scheduler->render_cost, seconds);
+}
+
+/**
+ * @brief Speeds the simulation up or slows it down, within FRAME_MIN_SPEED
+ * and FRAME_MAX_SPEED
+ *
+ * @param scheduler The scheduler
+ * @param factor What to multiply the target speed by
+ */
+void changeFrameSpeed(FrameScheduler *scheduler, double factor)
+{
+    double speed = scheduler->target_speed.load(std::memory_order_relaxed) * factor;
+
+    speed = speed < FRAME_MIN_SPEED ? FRAME_MIN_SPEED : speed > FRAME_MAX_SPEED ? FRAME_MAX_SPEED : speed;
+    scheduler->target_speed.store(speed, std::memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+/**
+ * @brief Frame scheduler: as many simulation steps per frame as fit in it
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <atomic>
+
+/**
+ * Share of each frame left free of steps and rendering, for the snapshot
+ * copy and for jitter
+ */
+#define FRAME_BUDGET_MARGIN 0.1
+
+/**
+ * Weight of the newest measurement in the smoothed costs and speed
+ */
+#define FRAME_COST_SMOOTHING 0.1
+
+/**
+ * Slowest and fastest simulated speed the controls reach [s per s]
+ */
+#define FRAME_MIN_SPEED 3600.0
+#define FRAME_MAX_SPEED (1000 * 365.25 * 86400.0)
+
+/**
+ * @brief Paces a simulation by simulated time per wall time, not by steps
+ * per frame. Each frame the simulation owes target_speed * frame_period of
+ * simulated time, in steps of its own, fixed time_step; the scheduler runs
+ * as many of them as the frame has room for, after what rendering it costs,
+ * at the step cost it has measured. What doesn't fit is dropped rather than
+ * owed, so a slow machine runs slower instead of falling ever further behind.
+ *
+ * The simulation thread plans and measures the steps; the view reports its
+ * render cost and changes the speed. Any thread may read the rest.
+ */
+struct FrameScheduler
+{
+    double frame_period;                // [s], 1 / fps
+
+    std::atomic<double> target_speed;   // simulated seconds per wall second, 0: paused
+    std::atomic<double> render_cost;    // [s] per frame, smoothed, from the view
+
+    std::atomic<double> step_cost;      // [s] per step, smoothed
+    std::atomic<double> publish_cost;   // [s] per snapshot, smoothed
+    std::atomic<double> achieved_speed; // simulated seconds per wall second, smoothed
+    std::atomic<unsigned int> frame_steps;  // run in the last frame
+    std::atomic<bool> limited;          // the last frame had no room for all it owed
+
+    double owed_steps;                  // simulation thread only: carried to the next frame
+};
+
+FrameScheduler *constructFrameScheduler(int fps, double targetSpeed);
+void destroyFrameScheduler(FrameScheduler *scheduler);
+unsigned int planFrameSteps(FrameScheduler *scheduler, double timeStep);
+void measureFrameSteps(FrameScheduler *scheduler, unsigned int steps, double seconds, double timeStep);
+void measureFramePublish(FrameScheduler *scheduler, double seconds);
+void measureFrameRender(FrameScheduler *scheduler, double seconds);
+void changeFrameSpeed(FrameScheduler *scheduler, double factor);
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * @brief Instrumentation: per-phase timers, pair counters and conservation diagnostics
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * The hooks in the simulation only add to counters; everything that takes
+ * longer (the invariants, the CSV rows) happens every diagnostics_interval
+ * steps, on the simulation thread, between steps.
+ */
+
+#include <math.h>
+#include <new>
+#include <thread>
+
+#include "Instrumentation.h"
+#include "OrbitalSim.h"
+
+/**
+ * How long readInstrumentationClock is timed against steady_clock at
+ * construction [ms]
+ */
+#define CLOCK_CALIBRATION_TIME 20
+
+static const char *const phaseNames[PHASE_COUNT] = {
+    "force",
+    "integrate",
+    "render-prep",
+    "draw",
+};
+
+/**
+ * @brief How many readInstrumentationClock ticks there are in a second
+ */
+static double calibrateInstrumentationClock()
+{
+#ifdef INSTRUMENTATION_TSC
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned long long ticks = readInstrumentationClock();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(CLOCK_CALIBRATION_TIME));
+
+    ticks = readInstrumentationClock() - ticks;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ticks / seconds;
+#else
+    return 1E9;
+#endif
+}
+
+/**
+ * @brief Constructs the instrumentation of a simulation. Takes a few
+ * milliseconds, to calibrate the clock.
+ *
+ * @param diagnosticsInterval Steps between energy and angular momentum samples, 0: never
+ * @return The instrumentation, NULL if out of memory
+ */
+Instrumentation *constructInstrumentation(unsigned int diagnosticsInterval)
+{
+    Instrumentation *instrumentation = new (std::nothrow) Instrumentation();
+    if (instrumentation == NULL)
+        return NULL;
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        instrumentation->cycles[phase] = 0;
+    instrumentation->pair_interactions = 0;
+    instrumentation->steps = 0;
+    instrumentation->cycles_per_second = calibrateInstrumentationClock();
+    instrumentation->diagnostics_interval = diagnosticsInterval;
+    instrumentation->energy_error = 0;
+    instrumentation->angular_momentum_error = 0;
+    instrumentation->steps_per_second = 0;
+    instrumentation->ns_per_interaction = 0;
+    instrumentation->csv = NULL;
+    return instrumentation;
+}
+
+/**
+ * @brief Destroys the instrumentation, closing its CSV file. Whatever it is
+ * attached to must not step again.
+ */
+void destroyInstrumentation(Instrumentation *instrumentation)
+{
+    if (instrumentation->csv != NULL)
+        fclose(instrumentation->csv);
+    delete instrumentation;
+}
+
+/**
+ * @brief Makes a simulation feed an instrumentation from its next step on,
+ * and records the energy and angular momentum the errors are relative to
+ *
+ * @param sim The simulation. Only holds on to the instrumentation, which
+ *            must outlive it.
+ * @param instrumentation The instrumentation, NULL to stop
+ */
+void attachInstrumentation(OrbitalSim *sim, Instrumentation *instrumentation)
+{
+    sim->instrumentation = instrumentation;
+    if (instrumentation == NULL)
+        return;
+
+    computeOrbitalSimInvariants(sim, &instrumentation->initial_energy,
+                                instrumentation->initial_angular_momentum);
+    instrumentation->last_sample_time = std::chrono::steady_clock::now();
+    instrumentation->last_sample_steps = instrumentation->steps;
+    instrumentation->last_sample_pairs = instrumentation->pair_interactions;
+    instrumentation->last_sample_force_cycles = instrumentation->cycles[PHASE_FORCE];
+}
+
+/**
+ * @brief Writes a row to a CSV file at every sample from now on, after a
+ * header row
+ *
+ * @return false if the file can't be written
+ */
+bool openInstrumentationCsv(Instrumentation *instrumentation, const char *path)
+{
+    FILE *csv = fopen(path, "w");
+    if (csv == NULL)
+        return false;
+
+    fprintf(csv, "step,time_elapsed");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        fprintf(csv, ",%s_seconds", phaseNames[phase]);
+    fprintf(csv, ",pair_interactions,steps_per_second,ns_per_interaction,"
+                 "energy,energy_error,angular_momentum,angular_momentum_error\n");
+
+    if (instrumentation->csv != NULL)
+        fclose(instrumentation->csv);
+    instrumentation->csv = csv;
+    return !ferror(csv);
+}
+
+/**
+ * @brief Counts steps a simulation took, and samples it if they crossed a
+ * multiple of the diagnostics interval. Called by the simulation after its steps.
+ */
+void recordInstrumentationSteps(OrbitalSim *sim, unsigned int steps)
+{
+    Instrumentation *instrumentation = sim->instrumentation;
+    if (instrumentation == NULL)
+        return;
+
+    unsigned long long before = instrumentation->steps.fetch_add(steps, std::memory_order_relaxed);
+    unsigned int interval = instrumentation->diagnostics_interval;
+    if (interval && before / interval != (before + steps) / interval)
+        sampleInstrumentation(sim);
+}
+
+/**
+ * @brief Computes the energy and angular momentum errors, the step rate and
+ * the cost of an interaction since the last sample, and writes a CSV row
+ *
+ * @param sim The simulation, attached to an instrumentation
+ */
+void sampleInstrumentation(OrbitalSim *sim)
+{
+    Instrumentation *instrumentation = sim->instrumentation;
+    double energy, angular_momentum[3];
+    const double *initial = instrumentation->initial_angular_momentum;
+
+    computeOrbitalSimInvariants(sim, &energy, angular_momentum);
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    unsigned long long steps = instrumentation->steps;
+    unsigned long long pairs = instrumentation->pair_interactions;
+    unsigned long long force_cycles = instrumentation->cycles[PHASE_FORCE];
+    double seconds = std::chrono::duration<double>(now - instrumentation->last_sample_time).count();
+
+    if (steps > instrumentation->last_sample_steps && seconds > 0)
+        instrumentation->steps_per_second = (steps - instrumentation->last_sample_steps) / seconds;
+    if (pairs > instrumentation->last_sample_pairs)
+        instrumentation->ns_per_interaction = 1E9 * (force_cycles - instrumentation->last_sample_force_cycles) /
+                                              instrumentation->cycles_per_second /
+                                              (pairs - instrumentation->last_sample_pairs);
+
+    double energy_scale = fabs(instrumentation->initial_energy);
+    double momentum_scale = sqrt(initial[0] * initial[0] + initial[1] * initial[1] + initial[2] * initial[2]);
+    double dx = angular_momentum[0] - initial[0];
+    double dy = angular_momentum[1] - initial[1];
+    double dz = angular_momentum[2] - initial[2];
+    instrumentation->energy_error = fabs(energy - instrumentation->initial_energy) /
+                                    (energy_scale > 0 ? energy_scale : 1);
+    instrumentation->angular_momentum_error = sqrt(dx * dx + dy * dy + dz * dz) /
+                                              (momentum_scale > 0 ? momentum_scale : 1);
+
+    instrumentation->last_sample_time = now;
+    instrumentation->last_sample_steps = steps;
+    instrumentation->last_sample_pairs = pairs;
+    instrumentation->last_sample_force_cycles = force_cycles;
+
+    if (instrumentation->csv != NULL)
+    {
+        FILE *csv = instrumentation->csv;
+
+        fprintf(csv, "%llu,%.17g", steps, sim->time_elapsed);
+        for (int phase = 0; phase < PHASE_COUNT; phase++)
+            fprintf(csv, ",%.9g", getInstrumentationSeconds(instrumentation, (InstrumentationPhase)phase));
+        fprintf(csv, ",%llu,%.6g,%.6g,%.17g,%.6g,%.17g,%.6g\n", pairs,
+                instrumentation->steps_per_second.load(), instrumentation->ns_per_interaction.load(),
+                energy, instrumentation->energy_error.load(),
+                sqrt(angular_momentum[0] * angular_momentum[0] + angular_momentum[1] * angular_momentum[1] +
+                     angular_momentum[2] * angular_momentum[2]),
+                instrumentation->angular_momentum_error.load());
+    }
+}
+
+/**
+ * @brief CPU time spent in a phase so far, over all threads [s]
+ */
+double getInstrumentationSeconds(const Instrumentation *instrumentation, InstrumentationPhase phase)
+{
+    return instrumentation->cycles[phase] / instrumentation->cycles_per_second;
+}
+
+const char *getInstrumentationPhaseName(InstrumentationPhase phase)
+{
+    return phaseNames[phase];
+}
@@ -0,0 +1,149 @@
+/**
+ * @brief Instrumentation: per-phase timers, pair counters and conservation diagnostics
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define INSTRUMENTATION_TSC
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define INSTRUMENTATION_TSC
+#endif
+
+struct OrbitalSim;
+
+/**
+ * Default steps between energy and angular momentum samples
+ */
+#define DEFAULT_DIAGNOSTICS_INTERVAL 100
+
+/**
+ * @brief What the timers split the work into
+ */
+enum InstrumentationPhase
+{
+    PHASE_FORCE,            // accelerations
+    PHASE_INTEGRATE,        // kicks, drifts, Kepler drifts
+    PHASE_RENDER_PREP,      // prepareDrawList
+    PHASE_DRAW,             // raylib, BeginDrawing to EndDrawing
+    PHASE_COUNT
+};
+
+/**
+ * @brief Counters and diagnostics of a simulation, and of the view drawing it.
+ *
+ * Phase cycles are summed over the threads that ran each phase, so they are
+ * CPU time, not wall time. The simulation thread writes everything but the
+ * render phases; any thread may read.
+ */
+struct Instrumentation
+{
+    std::atomic<unsigned long long> cycles[PHASE_COUNT];
+    std::atomic<unsigned long long> pair_interactions;  // body-on-body force terms
+    std::atomic<unsigned long long> steps;
+    double cycles_per_second;       // of readInstrumentationClock, calibrated at construction
+
+    unsigned int diagnostics_interval;  // steps between samples, 0: never
+    double initial_energy;              // [J], when attached
+    double initial_angular_momentum[3]; // [kg m^2/s]
+
+    // Last sample
+    std::atomic<double> energy_error;           // relative to initial_energy
+    std::atomic<double> angular_momentum_error; // relative to |initial_angular_momentum|
+    std::atomic<double> steps_per_second;       // since the sample before
+    std::atomic<double> ns_per_interaction;     // force cycles per pair since the sample before, in ns
+
+    // Simulation thread only
+    std::chrono::steady_clock::time_point last_sample_time;
+    unsigned long long last_sample_steps;
+    unsigned long long last_sample_pairs;
+    unsigned long long last_sample_force_cycles;
+
+    FILE *csv;                  // a row per sample, NULL if not exporting
+};
+
+#ifdef ORBITALSIM_INSTRUMENTATION
+
+#define INSTRUMENTATION_ENABLED true
+
+/**
+ * Hooks. Compiled out entirely without ORBITALSIM_INSTRUMENTATION.
+ */
+#define INSTRUMENT_START(timer) unsigned long long timer = readInstrumentationClock()
+#define INSTRUMENT_STOP(instrumentation, phase, timer)                                      \
+    do                                                                                      \
+    {                                                                                       \
+        if ((instrumentation) != NULL)                                                      \
+            (instrumentation)->cycles[phase].fetch_add(readInstrumentationClock() - (timer), \
+                                                       std::memory_order_relaxed);          \
+    } while (0)
+#define INSTRUMENT_PAIRS(instrumentation, count)                                                 \
+    do                                                                                           \
+    {                                                                                            \
+        if ((instrumentation) != NULL)                                                           \
+            (instrumentation)->pair_interactions.fetch_add((count), std::memory_order_relaxed); \
+    } while (0)
+#define INSTRUMENT_STEPS(sim, count) recordInstrumentationSteps((sim), (count))
+
+/**
+ * For loops too tight for an atomic add per pass: laps add up in a local
+ * counter, which goes to the phase once at the end.
+ */
+#define INSTRUMENT_COUNTER(counter) unsigned long long counter = 0
+#define INSTRUMENT_LAP(counter, timer) (counter) += readInstrumentationClock() - (timer)
+#define INSTRUMENT_ADD(instrumentation, phase, counter)                                    \
+    do                                                                                     \
+    {                                                                                      \
+        if ((instrumentation) != NULL)                                                     \
+            (instrumentation)->cycles[phase].fetch_add((counter), std::memory_order_relaxed); \
+    } while (0)
+
+#else
+
+#define INSTRUMENTATION_ENABLED false
+
+#define INSTRUMENT_START(timer)
+#define INSTRUMENT_STOP(instrumentation, phase, timer)
+#define INSTRUMENT_PAIRS(instrumentation, count) ((void)(count))
+#define INSTRUMENT_STEPS(sim, count)
+#define INSTRUMENT_COUNTER(counter)
+#define INSTRUMENT_LAP(counter, timer)
+#define INSTRUMENT_ADD(instrumentation, phase, counter)
+
+#endif
+
+/**
+ * @brief A cheap, steady clock: the time stamp counter where there is one,
+ * nanoseconds otherwise
+ */
+inline unsigned long long readInstrumentationClock()
+{
+#ifdef INSTRUMENTATION_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+Instrumentation *constructInstrumentation(unsigned int diagnosticsInterval = DEFAULT_DIAGNOSTICS_INTERVAL);
+void destroyInstrumentation(Instrumentation *instrumentation);
+void attachInstrumentation(OrbitalSim *sim, Instrumentation *instrumentation);
+bool openInstrumentationCsv(Instrumentation *instrumentation, const char *path);
+void recordInstrumentationSteps(OrbitalSim *sim, unsigned int steps);
+void sampleInstrumentation(OrbitalSim *sim);
+double getInstrumentationSeconds(const Instrumentation *instrumentation, InstrumentationPhase phase);
+const char *getInstrumentationPhaseName(InstrumentationPhase phase);
+
+#endif
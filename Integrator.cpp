@@ -0,0 +1,392 @@
+/**
+ * @brief Pluggable time integrators for the orbital simulation
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Every integrator is built from the same three blocks: a force evaluation
+ * (evaluateOrbitalSimForces), a kick (velocities) and a drift (positions).
+ * The force evaluation is what costs, so what sets them apart is how much
+ * accuracy each one gets out of it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mutex>
+
+#include "OrbitalSim.h"
+#include "Integrator.h"
+
+/**
+ * Scales for the adaptive error estimate: errors below these are always accepted
+ */
+#define POSITION_ERROR_FLOOR 1E6    // [m]
+#define VELOCITY_ERROR_FLOOR 1.0    // [m/s]
+
+/**
+ * Sub-step control of the adaptive integrator
+ */
+#define ADAPTIVE_SAFETY 0.9
+#define ADAPTIVE_MIN_FACTOR 0.2
+#define ADAPTIVE_MAX_FACTOR 5.0
+#define ADAPTIVE_MIN_STEP 1E-9      // fraction of time_step, below it sub-steps are always accepted
+
+static void stepLeapfrog(OrbitalSim *sim);
+static void stepYoshida4(OrbitalSim *sim);
+static void stepDormandPrince(OrbitalSim *sim);
+
+static const Integrator integrators[INTEGRATOR_COUNT] = {
+    {"euler", 1, 1, eulerStepOrbitalSim},
+    {"leapfrog", 2, 1, stepLeapfrog},
+    {"yoshida4", 4, 3, stepYoshida4},
+    {"dopri45", 5, 6, stepDormandPrince},
+    {"block", 2, 1, stepBlockTimeStep},
+    {"wisdom-holman", 2, 1, stepWisdomHolman},
+};
+
+/**
+ * @brief Gets an integrator
+ *
+ * @param type Which one
+ * @return The integrator
+ */
+const Integrator *getIntegrator(IntegratorType type)
+{
+    return &integrators[type < INTEGRATOR_COUNT ? type : INTEGRATOR_EULER];
+}
+
+/**
+ * @brief Finds an integrator by its name
+ *
+ * @param name The name, as in Integrator::name
+ * @return The integrator, NULL if there is none by that name
+ */
+const Integrator *findIntegrator(const char *name)
+{
+    for (unsigned int i = 0; i < INTEGRATOR_COUNT; i++)
+        if (strcmp(integrators[i].name, name) == 0)
+            return &integrators[i];
+    return NULL;
+}
+
+/**
+ * @brief Makes a simulation use an integrator from the next step on
+ *
+ * @param sim The simulation
+ * @param type The integrator
+ */
+void setOrbitalSimIntegrator(OrbitalSim *sim, IntegratorType type)
+{
+    sim->integrator = getIntegrator(type);
+    sim->accelerations_valid = false;
+    sim->adaptive_step = sim->time_step;
+    if (sim->block != NULL)
+        sim->block->initialized = false;
+}
+
+/**
+ * @brief Kick-drift-kick leapfrog. The closing kick's accelerations are the
+ *        opening kick's of the next step, so it costs one evaluation per step.
+ */
+static void stepLeapfrog(OrbitalSim *sim)
+{
+    double dt = sim->time_step;
+
+    if (!sim->accelerations_valid)
+        evaluateOrbitalSimForces(sim);
+
+    kickOrbitalSim(sim, 0.5 * dt);
+    driftOrbitalSim(sim, dt);
+    evaluateOrbitalSimForces(sim);
+    kickOrbitalSim(sim, 0.5 * dt);
+
+    sim->accelerations_valid = true;
+}
+
+/**
+ * @brief Yoshida's 4th order composition, as drift-kick-drift-kick-drift-kick-drift
+ *        https://doi.org/10.1016/0375-9601(90)90092-3
+ */
+static void stepYoshida4(OrbitalSim *sim)
+{
+    static const double cbrt2 = cbrt(2.0);
+    static const double w1 = 1.0 / (2.0 - cbrt2);
+    static const double w0 = -cbrt2 / (2.0 - cbrt2);
+    static const double c[4] = {0.5 * w1, 0.5 * (w0 + w1), 0.5 * (w0 + w1), 0.5 * w1};
+    static const double d[3] = {w1, w0, w1};
+    double dt = sim->time_step;
+
+    for (int i = 0; i < 3; i++)
+    {
+        driftOrbitalSim(sim, c[i] * dt);
+        evaluateOrbitalSimForces(sim);
+        kickOrbitalSim(sim, d[i] * dt);
+    }
+    driftOrbitalSim(sim, c[3] * dt);
+
+    sim->accelerations_valid = false;
+}
+
+/**
+ * Dormand-Prince tableau
+ * https://en.wikipedia.org/wiki/Dormand%E2%80%93Prince_method
+ * The last row is the 5th order solution, and the error weights are the
+ * difference between it and the embedded 4th order one.
+ */
+#define DOPRI_STAGES 7
+
+static const double dopri_a[DOPRI_STAGES][DOPRI_STAGES - 1] = {
+    {0},
+    {1.0 / 5},
+    {3.0 / 40, 9.0 / 40},
+    {44.0 / 45, -56.0 / 15, 32.0 / 9},
+    {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+    {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656},
+    {35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84},
+};
+
+static const double dopri_e[DOPRI_STAGES] = {
+    71.0 / 57600, 0, -71.0 / 16695, 71.0 / 1920, -17253.0 / 339200, 22.0 / 525, -1.0 / 40,
+};
+
+/**
+ * Workspace layout, one array of bodies_count doubles each: the starting state,
+ * then the velocity (derivative of position) and acceleration (derivative of
+ * velocity) at every stage.
+ */
+#define RK_X0(ws, n, axis) ((ws) + (size_t)(axis) * (n))
+#define RK_V0(ws, n, axis) ((ws) + (size_t)(3 + (axis)) * (n))
+#define RK_KX(ws, n, stage, axis) ((ws) + (size_t)(6 + 6 * (stage) + (axis)) * (n))
+#define RK_KV(ws, n, stage, axis) ((ws) + (size_t)(9 + 6 * (stage) + (axis)) * (n))
+#define RK_ARRAYS (6 + 6 * DOPRI_STAGES)
+
+/**
+ * @brief What the pool threads need for a Runge-Kutta stage
+ */
+struct RungeKuttaChunk
+{
+    OrbitalSim *sim;
+    unsigned int stage;
+    double h;               // [s], the sub-step
+    double error;           // largest scaled error of any body
+    std::mutex mutex;       // guards error
+};
+
+/**
+ * @brief Saves the state at the start of a sub-step, and its derivatives as stage 0
+ */
+static void saveStartChunk(void *context, unsigned int begin, unsigned int end)
+{
+    RungeKuttaChunk *chunk = (RungeKuttaChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    double *ws = chunk->sim->rk_workspace;
+    unsigned int n = chunk->sim->bodies_count;
+    size_t bytes = (end - begin) * sizeof(double);
+    const double *state[6] = {bodies->x, bodies->y, bodies->z, bodies->vx, bodies->vy, bodies->vz};
+    const double *acceleration[3] = {bodies->ax, bodies->ay, bodies->az};
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        memcpy(RK_X0(ws, n, axis) + begin, state[axis] + begin, bytes);
+        memcpy(RK_V0(ws, n, axis) + begin, state[3 + axis] + begin, bytes);
+        memcpy(RK_KX(ws, n, 0, axis) + begin, state[3 + axis] + begin, bytes);
+        memcpy(RK_KV(ws, n, 0, axis) + begin, acceleration[axis] + begin, bytes);
+    }
+}
+
+/**
+ * @brief Places the bodies at the positions of a stage, and keeps the stage velocities
+ */
+static void prepareStageChunk(void *context, unsigned int begin, unsigned int end)
+{
+    RungeKuttaChunk *chunk = (RungeKuttaChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    double *ws = chunk->sim->rk_workspace;
+    unsigned int n = chunk->sim->bodies_count;
+    unsigned int stage = chunk->stage;
+    double *position[3] = {bodies->x, bodies->y, bodies->z};
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double *x = position[axis];
+        double *kx = RK_KX(ws, n, stage, axis);
+        const double *x0 = RK_X0(ws, n, axis);
+        const double *v0 = RK_V0(ws, n, axis);
+
+        for (unsigned int i = begin; i < end; i++)
+        {
+            double dx = 0, dv = 0;
+            for (unsigned int j = 0; j < stage; j++)
+            {
+                dx += dopri_a[stage][j] * RK_KX(ws, n, j, axis)[i];
+                dv += dopri_a[stage][j] * RK_KV(ws, n, j, axis)[i];
+            }
+            x[i] = x0[i] + chunk->h * dx;
+            kx[i] = v0[i] + chunk->h * dv;
+        }
+    }
+}
+
+/**
+ * @brief Keeps the accelerations evaluated at a stage
+ */
+static void saveStageChunk(void *context, unsigned int begin, unsigned int end)
+{
+    RungeKuttaChunk *chunk = (RungeKuttaChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    double *ws = chunk->sim->rk_workspace;
+    unsigned int n = chunk->sim->bodies_count;
+    size_t bytes = (end - begin) * sizeof(double);
+
+    memcpy(RK_KV(ws, n, chunk->stage, 0) + begin, bodies->ax + begin, bytes);
+    memcpy(RK_KV(ws, n, chunk->stage, 1) + begin, bodies->ay + begin, bytes);
+    memcpy(RK_KV(ws, n, chunk->stage, 2) + begin, bodies->az + begin, bytes);
+}
+
+/**
+ * @brief Estimates the error of the sub-step, as the largest ratio of any body's
+ *        error to what the tolerance allows it
+ */
+static void estimateErrorChunk(void *context, unsigned int begin, unsigned int end)
+{
+    RungeKuttaChunk *chunk = (RungeKuttaChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    double *ws = chunk->sim->rk_workspace;
+    unsigned int n = chunk->sim->bodies_count;
+    double tolerance = chunk->sim->tolerance;
+    double worst = 0;
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        double ex[3], ev[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            ex[axis] = ev[axis] = 0;
+            for (unsigned int j = 0; j < DOPRI_STAGES; j++)
+            {
+                ex[axis] += dopri_e[j] * RK_KX(ws, n, j, axis)[i];
+                ev[axis] += dopri_e[j] * RK_KV(ws, n, j, axis)[i];
+            }
+        }
+
+        double x = sqrt(bodies->x[i] * bodies->x[i] + bodies->y[i] * bodies->y[i] + bodies->z[i] * bodies->z[i]);
+        double v = sqrt(RK_KX(ws, n, DOPRI_STAGES - 1, 0)[i] * RK_KX(ws, n, DOPRI_STAGES - 1, 0)[i] +
+                        RK_KX(ws, n, DOPRI_STAGES - 1, 1)[i] * RK_KX(ws, n, DOPRI_STAGES - 1, 1)[i] +
+                        RK_KX(ws, n, DOPRI_STAGES - 1, 2)[i] * RK_KX(ws, n, DOPRI_STAGES - 1, 2)[i]);
+        double position_error = chunk->h * sqrt(ex[0] * ex[0] + ex[1] * ex[1] + ex[2] * ex[2]) /
+                                (tolerance * (x + POSITION_ERROR_FLOOR));
+        double velocity_error = chunk->h * sqrt(ev[0] * ev[0] + ev[1] * ev[1] + ev[2] * ev[2]) /
+                                (tolerance * (v + VELOCITY_ERROR_FLOOR));
+
+        worst = fmax(worst, fmax(position_error, velocity_error));
+    }
+
+    std::lock_guard<std::mutex> lock(chunk->mutex);
+    chunk->error = fmax(chunk->error, worst);
+}
+
+/**
+ * @brief Finishes an accepted sub-step: the velocities of the last stage are
+ *        the 5th order solution (positions already are)
+ */
+static void acceptChunk(void *context, unsigned int begin, unsigned int end)
+{
+    RungeKuttaChunk *chunk = (RungeKuttaChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    double *ws = chunk->sim->rk_workspace;
+    unsigned int n = chunk->sim->bodies_count;
+    size_t bytes = (end - begin) * sizeof(double);
+
+    memcpy(bodies->vx + begin, RK_KX(ws, n, DOPRI_STAGES - 1, 0) + begin, bytes);
+    memcpy(bodies->vy + begin, RK_KX(ws, n, DOPRI_STAGES - 1, 1) + begin, bytes);
+    memcpy(bodies->vz + begin, RK_KX(ws, n, DOPRI_STAGES - 1, 2) + begin, bytes);
+}
+
+/**
+ * @brief Puts the bodies back where the rejected sub-step started
+ */
+static void rejectChunk(void *context, unsigned int begin, unsigned int end)
+{
+    RungeKuttaChunk *chunk = (RungeKuttaChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    double *ws = chunk->sim->rk_workspace;
+    unsigned int n = chunk->sim->bodies_count;
+    size_t bytes = (end - begin) * sizeof(double);
+
+    memcpy(bodies->x + begin, RK_X0(ws, n, 0) + begin, bytes);
+    memcpy(bodies->y + begin, RK_X0(ws, n, 1) + begin, bytes);
+    memcpy(bodies->z + begin, RK_X0(ws, n, 2) + begin, bytes);
+}
+
+/**
+ * @brief Adaptive Dormand-Prince RK45. Splits time_step into as many sub-steps
+ *        as it takes to keep the error of each under sim->tolerance. The last
+ *        stage is evaluated at the new state, so it's the first of the next
+ *        sub-step: 6 evaluations per attempted sub-step.
+ */
+static void stepDormandPrince(OrbitalSim *sim)
+{
+    unsigned int n = sim->bodies_count;
+    double remaining = sim->time_step;
+    double h = sim->adaptive_step > 0 ? sim->adaptive_step : sim->time_step;
+    RungeKuttaChunk chunk;
+
+    if (sim->rk_workspace_capacity < n)
+    {
+        free(sim->rk_workspace);
+        sim->rk_workspace = (double *)malloc((size_t)RK_ARRAYS * n * sizeof(double));
+        sim->rk_workspace_capacity = sim->rk_workspace ? n : 0;
+        if (sim->rk_workspace == NULL)
+        {
+            //Not enough memory for the stages, this step goes with leapfrog
+            stepLeapfrog(sim);
+            return;
+        }
+    }
+    chunk.sim = sim;
+
+    while (remaining > ADAPTIVE_MIN_STEP * sim->time_step)
+    {
+        double step = fmin(h, remaining);
+        bool clipped = h > remaining;   // cut short to land on time_step
+        double factor;
+
+        if (!sim->accelerations_valid)
+            evaluateOrbitalSimForces(sim);
+        runThreadPool(sim->pool, saveStartChunk, &chunk, 0, n, ASTEROIDS_CHUNK_SIZE);
+
+        for (;;)
+        {
+            chunk.h = step;
+            for (chunk.stage = 1; chunk.stage < DOPRI_STAGES; chunk.stage++)
+            {
+                runThreadPool(sim->pool, prepareStageChunk, &chunk, 0, n, ASTEROIDS_CHUNK_SIZE);
+                evaluateOrbitalSimForces(sim);
+                runThreadPool(sim->pool, saveStageChunk, &chunk, 0, n, ASTEROIDS_CHUNK_SIZE);
+            }
+
+            chunk.error = 0;
+            runThreadPool(sim->pool, estimateErrorChunk, &chunk, 0, n, ASTEROIDS_CHUNK_SIZE);
+
+            factor = chunk.error > 0 ? ADAPTIVE_SAFETY * pow(chunk.error, -0.2) : ADAPTIVE_MAX_FACTOR;
+            factor = fmin(ADAPTIVE_MAX_FACTOR, fmax(ADAPTIVE_MIN_FACTOR, factor));
+
+            if (chunk.error <= 1.0 || step <= ADAPTIVE_MIN_STEP * sim->time_step)
+                break;
+
+            runThreadPool(sim->pool, rejectChunk, &chunk, 0, n, ASTEROIDS_CHUNK_SIZE);
+            step *= factor;
+            clipped = false;
+        }
+
+        runThreadPool(sim->pool, acceptChunk, &chunk, 0, n, ASTEROIDS_CHUNK_SIZE);
+        sim->accelerations_valid = true;    // the last stage was evaluated at the new positions
+        remaining -= step;
+
+        //A sub-step cut short to land on time_step says little about the next one
+        h = clipped ? fmax(h, step * factor) : step * factor;
+    }
+
+    sim->adaptive_step = h;
+}
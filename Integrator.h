@@ -0,0 +1,45 @@
+/**
+ * @brief Pluggable time integrators for the orbital simulation
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+struct OrbitalSim;
+
+/**
+ * Default relative error per step for adaptive integrators
+ */
+#define DEFAULT_INTEGRATOR_TOLERANCE 1E-10
+
+enum IntegratorType
+{
+    INTEGRATOR_EULER,           // semi-implicit (symplectic) Euler, the original scheme
+    INTEGRATOR_LEAPFROG,        // kick-drift-kick leapfrog
+    INTEGRATOR_YOSHIDA4,        // 4th order Yoshida composition of leapfrog
+    INTEGRATOR_DORMAND_PRINCE,  // adaptive RK45, Dormand-Prince pair
+    INTEGRATOR_BLOCK,           // leapfrog with per-body power-of-two time steps
+    INTEGRATOR_WISDOM_HOLMAN,   // Kepler orbits around bodies[0], planets as kicks
+    INTEGRATOR_COUNT
+};
+
+/**
+ * @brief An integrator. Each one advances a simulation a whole time_step,
+ * and declares how many force evaluations that takes.
+ */
+struct Integrator
+{
+    const char *name;
+    unsigned int order;
+    unsigned int force_evaluations;     // per step, per attempted sub-step if adaptive
+    void (*step)(OrbitalSim *sim);
+};
+
+const Integrator *getIntegrator(IntegratorType type);
+const Integrator *findIntegrator(const char *name);
+void setOrbitalSimIntegrator(OrbitalSim *sim, IntegratorType type);
+
+#endif
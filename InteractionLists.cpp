@@ -0,0 +1,303 @@
+/**
+ * @brief Interaction pruning: each asteroid only feels the planets that matter to it
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * A group's perturbers are copied, in order, to a small body store of their
+ * own, followed by the group's asteroids, and that store goes through the
+ * simulation's asteroid kernel for that many planets, as if those were all
+ * the planets there are: every instruction set and precision prunes the
+ * same way.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+
+#include "OrbitalSim.h"
+#include "InteractionLists.h"
+
+/**
+ * @brief A refresh's tallies, for the asteroids of one pool chunk
+ */
+struct RefreshTally
+{
+    unsigned long long kept_pairs;
+    unsigned long long full_pairs;
+    double max_error;
+    double error_sum;
+    unsigned long long error_count;
+};
+
+/**
+ * @brief Acceleration a planet causes on a body, the same pair math as the kernels
+ */
+static inline void getPlanetAcceleration(const OrbitalBodies *bodies, unsigned int planet,
+                                         unsigned int body, double acceleration[3])
+{
+    double dx = bodies->x[body] - bodies->x[planet];
+    double dy = bodies->y[body] - bodies->y[planet];
+    double dz = bodies->z[body] - bodies->z[planet];
+    double distance_sqr = dx * dx + dy * dy + dz * dz;
+    double coefficient = -GRAVITATIONAL_CONSTANT * bodies->mass[planet] / (distance_sqr * sqrt(distance_sqr));
+
+    acceleration[0] = coefficient * dx;
+    acceleration[1] = coefficient * dy;
+    acceleration[2] = coefficient * dz;
+}
+
+/**
+ * @brief The planets an asteroid can't do without: all of them, less the
+ * weakest, for as long as their accelerations add up to at most tolerance
+ * times the whole
+ */
+static unsigned long long getAsteroidMask(const InteractionLists *lists, unsigned int body)
+{
+    const OrbitalBodies *bodies = &lists->sim->bodies;
+    unsigned int planets = lists->sim->planets_range;
+    double magnitudes[INTERACTION_MAX_PLANETS];
+    unsigned int order[INTERACTION_MAX_PLANETS];
+    double total[3] = {0, 0, 0};
+
+    for (unsigned int p = 0; p < planets; p++)
+    {
+        double acceleration[3];
+        getPlanetAcceleration(bodies, p, body, acceleration);
+        for (int axis = 0; axis < 3; axis++)
+            total[axis] += acceleration[axis];
+        magnitudes[p] = sqrt(acceleration[0] * acceleration[0] + acceleration[1] * acceleration[1] +
+                             acceleration[2] * acceleration[2]);
+
+        // Insertion sort, weakest first: there are only a few planets
+        unsigned int k = p;
+        for (; k > 0 && magnitudes[order[k - 1]] > magnitudes[p]; k--)
+            order[k] = order[k - 1];
+        order[k] = p;
+    }
+
+    double budget = lists->tolerance * sqrt(total[0] * total[0] + total[1] * total[1] + total[2] * total[2]);
+    unsigned long long mask = planets < 64 ? (1ULL << planets) - 1 : ~0ULL;
+    double dropped = 0;
+    for (unsigned int k = 0; k < planets && dropped + magnitudes[order[k]] <= budget; k++)
+    {
+        dropped += magnitudes[order[k]];
+        mask &= ~(1ULL << order[k]);
+    }
+    return mask;
+}
+
+/**
+ * @brief Ranks the perturbers of a chunk of asteroids, a group at a time,
+ * and measures the error of each group's list. Run by the thread pool.
+ */
+static void refreshChunk(void *context, unsigned int begin, unsigned int end)
+{
+    InteractionLists *lists = (InteractionLists *)context;
+    const OrbitalBodies *bodies = &lists->sim->bodies;
+    unsigned int planets = lists->sim->planets_range;
+    RefreshTally tally = {0, 0, 0, 0, 0};
+
+    for (unsigned int first = begin; first < end; first += INTERACTION_GROUP_SIZE)
+    {
+        unsigned int last = end - first < INTERACTION_GROUP_SIZE ? end : first + INTERACTION_GROUP_SIZE;
+        unsigned long long mask = 0;
+
+        for (unsigned int i = first; i < last; i++)
+            mask |= getAsteroidMask(lists, i);
+        lists->masks[(first - planets) / INTERACTION_GROUP_SIZE] = mask;
+
+        unsigned int kept = 0;
+        for (unsigned int p = 0; p < planets; p++)
+            kept += (mask >> p) & 1;
+        tally.kept_pairs += (unsigned long long)kept * (last - first);
+        tally.full_pairs += (unsigned long long)planets * (last - first);
+
+        // What the group's list leaves out, against the whole
+        for (unsigned int i = first; i < last; i++)
+        {
+            double total[3] = {0, 0, 0}, missing[3] = {0, 0, 0};
+            for (unsigned int p = 0; p < planets; p++)
+            {
+                double acceleration[3];
+                getPlanetAcceleration(bodies, p, i, acceleration);
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    total[axis] += acceleration[axis];
+                    missing[axis] += (mask >> p) & 1 ? 0 : acceleration[axis];
+                }
+            }
+
+            double error = sqrt((missing[0] * missing[0] + missing[1] * missing[1] + missing[2] * missing[2]) /
+                                (total[0] * total[0] + total[1] * total[1] + total[2] * total[2]));
+            tally.max_error = error > tally.max_error ? error : tally.max_error;
+            tally.error_sum += error;
+            tally.error_count++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(lists->mutex);
+    lists->kept_pairs += tally.kept_pairs;
+    lists->full_pairs += tally.full_pairs;
+    lists->max_error = tally.max_error > lists->max_error ? tally.max_error : lists->max_error;
+    lists->error_sum += tally.error_sum;
+    lists->error_count += tally.error_count;
+}
+
+/**
+ * @brief Attaches perturber lists to a simulation. They are first ranked
+ * before its next step.
+ *
+ * @param sim The simulation, with up to INTERACTION_MAX_PLANETS planets
+ * @param tolerance How much acceleration each asteroid may lose, relative
+ *                  to its whole, between 0 and 1
+ * @param refreshInterval Steps between rankings
+ * @return The lists, NULL if out of memory or the arguments are out of range
+ */
+InteractionLists *constructInteractionLists(OrbitalSim *sim, double tolerance, unsigned int refreshInterval)
+{
+    unsigned int asteroids = sim->bodies_count - sim->planets_range;
+
+    if (sim->interactions != NULL || sim->planets_range > INTERACTION_MAX_PLANETS ||
+        !(tolerance > 0 && tolerance < 1) || refreshInterval == 0)
+        return NULL;
+
+    InteractionLists *lists = new (std::nothrow) InteractionLists();
+    if (lists == NULL)
+        return NULL;
+    lists->sim = sim;
+    lists->tolerance = tolerance;
+    lists->refresh_interval = refreshInterval;
+    lists->group_capacity = (asteroids + INTERACTION_GROUP_SIZE - 1) / INTERACTION_GROUP_SIZE;
+    lists->masks = (unsigned long long *)malloc((lists->group_capacity + 1) * sizeof(unsigned long long));
+    if (lists->masks == NULL)
+    {
+        delete lists;
+        return NULL;
+    }
+
+    sim->interactions = lists;
+    return lists;
+}
+
+/**
+ * @brief Detaches the lists from their simulation: every asteroid feels every planet again
+ */
+void destroyInteractionLists(InteractionLists *lists)
+{
+    lists->sim->interactions = NULL;
+    free(lists->masks);
+    delete lists;
+}
+
+/**
+ * @brief Ranks the perturbers again if it's time to (or if bodies were taken
+ * out since, regrouping the asteroids), before some steps
+ *
+ * @param lists The lists
+ * @param steps How many steps are about to run
+ * @return How many of them may run before the next refresh, at least 1
+ */
+unsigned int beginInteractionSteps(InteractionLists *lists, unsigned int steps)
+{
+    OrbitalSim *sim = lists->sim;
+
+    if (lists->steps_left == 0 || lists->bodies_count != sim->bodies_count)
+    {
+        lists->kept_pairs = 0;
+        lists->full_pairs = 0;
+        runThreadPool(sim->pool, refreshChunk, lists, sim->planets_range, sim->bodies_count,
+                      ASTEROIDS_CHUNK_SIZE);
+        lists->refreshes++;
+        lists->bodies_count = sim->bodies_count;
+        lists->steps_left = lists->refresh_interval;
+    }
+
+    if (steps > lists->steps_left)
+        steps = lists->steps_left;
+    lists->steps_left -= steps;
+    return steps;
+}
+
+/**
+ * @brief Lists the perturbers of the group an asteroid is in
+ *
+ * @param lists The lists
+ * @param first The asteroid
+ * @param perturbers Filled in with the planets, in order
+ * @return How many
+ */
+unsigned int getInteractionPerturbers(const InteractionLists *lists, unsigned int first,
+                                      unsigned int *perturbers)
+{
+    unsigned int planets = lists->sim->planets_range;
+    unsigned long long mask = lists->masks[(first - planets) / INTERACTION_GROUP_SIZE];
+    unsigned int count = 0;
+
+    for (unsigned int p = 0; p < planets; p++)
+        if ((mask >> p) & 1)
+            perturbers[count++] = p;
+    return count;
+}
+
+/**
+ * @brief Fills in the acceleration of a range of asteroids, each from its
+ * group's perturbers only
+ *
+ * @param lists The lists, ranked for the current step
+ * @param begin First asteroid
+ * @param end One past the last asteroid
+ * @return How many asteroid-planet pairs were evaluated
+ */
+unsigned long long accelerateWithInteractionLists(InteractionLists *lists, unsigned int begin,
+                                                  unsigned int end)
+{
+    OrbitalSim *sim = lists->sim;
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int planets = sim->planets_range;
+    unsigned long long pairs = 0;
+
+    // x, y, z, ax, ay, az: the perturbers first, then the group's asteroids
+    double store[6][INTERACTION_MAX_PLANETS + INTERACTION_GROUP_SIZE];
+    double masses[INTERACTION_MAX_PLANETS];
+    unsigned int perturbers[INTERACTION_MAX_PLANETS];
+    OrbitalBodies group;
+
+    memset(&group, 0, sizeof(group));
+    group.x = store[0];
+    group.y = store[1];
+    group.z = store[2];
+    group.ax = store[3];
+    group.ay = store[4];
+    group.az = store[5];
+    group.mass = masses;
+
+    for (unsigned int first = begin; first < end;)
+    {
+        unsigned int group_end = planets + ((first - planets) / INTERACTION_GROUP_SIZE + 1) * INTERACTION_GROUP_SIZE;
+        unsigned int last = group_end < end ? group_end : end;
+        unsigned int count = last - first;
+        unsigned int kept = getInteractionPerturbers(lists, first, perturbers);
+
+        for (unsigned int k = 0; k < kept; k++)
+        {
+            group.x[k] = bodies->x[perturbers[k]];
+            group.y[k] = bodies->y[perturbers[k]];
+            group.z[k] = bodies->z[perturbers[k]];
+            masses[k] = bodies->mass[perturbers[k]];
+        }
+        memcpy(group.x + kept, bodies->x + first, count * sizeof(double));
+        memcpy(group.y + kept, bodies->y + first, count * sizeof(double));
+        memcpy(group.z + kept, bodies->z + first, count * sizeof(double));
+
+        getAsteroidKernel(sim->force_kernel_isa, sim->force_precision, kept)(&group, kept, kept, kept + count);
+
+        memcpy(bodies->ax + first, group.ax + kept, count * sizeof(double));
+        memcpy(bodies->ay + first, group.ay + kept, count * sizeof(double));
+        memcpy(bodies->az + first, group.az + kept, count * sizeof(double));
+        pairs += (unsigned long long)kept * count;
+        first = last;
+    }
+    return pairs;
+}
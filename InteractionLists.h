@@ -0,0 +1,75 @@
+/**
+ * @brief Interaction pruning: each asteroid only feels the planets that matter to it
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef INTERACTIONLISTS_H
+#define INTERACTIONLISTS_H
+
+#include <mutex>
+
+struct OrbitalSim;
+
+/**
+ * Asteroids that share a perturber list, as many as a tile of
+ * updateOrbitalSimTiled (ASTEROIDS_TILE_SIZE), so a tile never mixes lists
+ */
+#define INTERACTION_GROUP_SIZE 128
+
+/**
+ * Most planets a perturber list can pick from: one bit each
+ */
+#define INTERACTION_MAX_PLANETS 64
+
+/**
+ * Default steps between refreshes of the lists
+ */
+#define DEFAULT_INTERACTION_REFRESH 100
+
+/**
+ * @brief Perturber lists attached to a simulation. Every refresh_interval
+ * steps, each asteroid's planets are ranked by the acceleration they cause
+ * on it, and the weakest are dropped for as long as what they add up to
+ * stays under tolerance times the asteroid's whole acceleration. A group of
+ * INTERACTION_GROUP_SIZE asteroids keeps every planet any of them needs, and
+ * until the next refresh the asteroid kernel only walks those.
+ *
+ * The error each refresh measures is exact at that moment; between
+ * refreshes it drifts as asteroids move, so a shorter interval keeps it
+ * closer to the tolerance.
+ */
+struct InteractionLists
+{
+    OrbitalSim *sim;
+    double tolerance;           // dropped acceleration per asteroid, relative to its whole
+    unsigned int refresh_interval;  // steps between refreshes
+    unsigned int steps_left;    // until the next refresh, 0: refresh before the next step
+    unsigned int bodies_count;  // sim->bodies_count at the last refresh
+
+    unsigned long long *masks;  // the perturbers of each group, bit p for planet p
+    unsigned int group_capacity;
+
+    // At the last refresh
+    unsigned long long kept_pairs;  // asteroid-planet pairs each step evaluates
+    unsigned long long full_pairs;  // and those it would without the lists
+
+    // Since construction, measured at every refresh
+    unsigned long long refreshes;
+    double max_error;           // relative, the worst asteroid's
+    double error_sum;           // relative, over every asteroid of every refresh
+    unsigned long long error_count;
+    std::mutex mutex;           // merges the pool threads' tallies
+};
+
+InteractionLists *constructInteractionLists(OrbitalSim *sim, double tolerance,
+                                            unsigned int refreshInterval = DEFAULT_INTERACTION_REFRESH);
+void destroyInteractionLists(InteractionLists *lists);
+unsigned int beginInteractionSteps(InteractionLists *lists, unsigned int steps);
+unsigned int getInteractionPerturbers(const InteractionLists *lists, unsigned int first,
+                                      unsigned int *perturbers);
+unsigned long long accelerateWithInteractionLists(InteractionLists *lists, unsigned int begin,
+                                                  unsigned int end);
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @brief Orbital body store
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "OrbitalBodies.h"
+
+#define HOT_ARRAYS_COUNT 10 // x, y, z, vx, vy, vz, ax, ay, az, mass
+
+/**
+ * @brief Rounds a byte count up to the next multiple of ORBITALBODIES_ALIGNMENT
+ */
+static size_t alignSize(size_t size)
+{
+    return (size + ORBITALBODIES_ALIGNMENT - 1) & ~(size_t)(ORBITALBODIES_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Aligns a pointer to ORBITALBODIES_ALIGNMENT
+ */
+static char *alignPointer(void *pointer)
+{
+    uintptr_t address = (uintptr_t)pointer;
+    address = (address + ORBITALBODIES_ALIGNMENT - 1) & ~(uintptr_t)(ORBITALBODIES_ALIGNMENT - 1);
+    return (char *)address;
+}
+
+/**
+ * @brief Sizes of the two images a body store is carved from. Each is a
+ * sequence of arrays, each padded to ORBITALBODIES_ALIGNMENT.
+ *
+ * @param capacity How many bodies each array holds
+ * @param hotSize Bytes of x, y, z, vx, vy, vz, ax, ay, az, mass and level
+ * @param coldSize Bytes of radius, color and name
+ */
+void getOrbitalBodiesImageSizes(unsigned int capacity, size_t *hotSize, size_t *coldSize)
+{
+    *hotSize = HOT_ARRAYS_COUNT * alignSize(capacity * sizeof(double)) +
+               alignSize(capacity * sizeof(unsigned char));
+    *coldSize = alignSize(capacity * sizeof(float)) + alignSize(capacity * sizeof(BodyColor)) +
+                alignSize(capacity * sizeof(const char *));
+}
+
+/**
+ * @brief Points every array of a body store into two images, laid out as
+ * getOrbitalBodiesImageSizes describes. Doesn't touch the ownership fields.
+ *
+ * @param bodies The store to fill in
+ * @param capacity How many bodies each array holds
+ * @param hotImage Hot arrays, aligned to ORBITALBODIES_ALIGNMENT
+ * @param coldImage Cold arrays, aligned to ORBITALBODIES_ALIGNMENT
+ */
+void bindOrbitalBodies(OrbitalBodies *bodies, unsigned int capacity, void *hotImage, void *coldImage)
+{
+    size_t hot_array_size = alignSize(capacity * sizeof(double));
+    size_t radius_size = alignSize(capacity * sizeof(float));
+    size_t color_size = alignSize(capacity * sizeof(BodyColor));
+    char *walker;
+
+    walker = (char *)hotImage;
+    bodies->x = (double *)walker;       walker += hot_array_size;
+    bodies->y = (double *)walker;       walker += hot_array_size;
+    bodies->z = (double *)walker;       walker += hot_array_size;
+    bodies->vx = (double *)walker;      walker += hot_array_size;
+    bodies->vy = (double *)walker;      walker += hot_array_size;
+    bodies->vz = (double *)walker;      walker += hot_array_size;
+    bodies->ax = (double *)walker;      walker += hot_array_size;
+    bodies->ay = (double *)walker;      walker += hot_array_size;
+    bodies->az = (double *)walker;      walker += hot_array_size;
+    bodies->mass = (double *)walker;    walker += hot_array_size;
+    bodies->level = (unsigned char *)walker;
+
+    walker = (char *)coldImage;
+    bodies->radius = (float *)walker;           walker += radius_size;
+    bodies->color = (BodyColor *)walker;        walker += color_size;
+    bodies->name = (const char **)walker;
+
+    bodies->capacity = capacity;
+}
+
+/**
+ * @brief Allocates every array of a body store. Arrays are zero-filled.
+ *
+ * @param bodies The store to fill in
+ * @param count How many bodies it must hold
+ * @return true on success, false if malloc failed (nothing is left allocated)
+ */
+bool allocateOrbitalBodies(OrbitalBodies *bodies, unsigned int count)
+{
+    size_t hot_size, cold_size;
+
+    memset(bodies, 0, sizeof(OrbitalBodies));
+    getOrbitalBodiesImageSizes(count, &hot_size, &cold_size);
+
+    //The extra alignment bytes leave room to align the start of the block
+    bodies->hot_block = calloc(1, hot_size + ORBITALBODIES_ALIGNMENT);
+    bodies->cold_block = calloc(1, cold_size + ORBITALBODIES_ALIGNMENT);
+    if (bodies->hot_block == NULL || bodies->cold_block == NULL)
+    {
+        freeOrbitalBodies(bodies);
+        return false;
+    }
+
+    bindOrbitalBodies(bodies, count, alignPointer(bodies->hot_block), alignPointer(bodies->cold_block));
+    return true;
+}
+
+/**
+ * @brief Points a store's cold arrays (radius, color, name) into another's,
+ * freeing its own. Stores built alike (same bodies, same capacity) can then
+ * share a single copy: the view data is never written while stepping.
+ *
+ * @param bodies The store, allocated by allocateOrbitalBodies
+ * @param source The store that keeps the cold arrays; it must outlive bodies,
+ *               and neither may change a radius, color or name from then on
+ */
+void shareOrbitalBodiesColdArrays(OrbitalBodies *bodies, const OrbitalBodies *source)
+{
+    free(bodies->cold_block);
+    bodies->cold_block = NULL;
+    bodies->radius = source->radius;
+    bodies->color = source->color;
+    bodies->name = source->name;
+}
+
+/**
+ * @brief Frees a body store, whether allocated by allocateOrbitalBodies or
+ * mapped from a checkpoint
+ */
+void freeOrbitalBodies(OrbitalBodies *bodies)
+{
+    free(bodies->hot_block);
+    free(bodies->cold_block);
+    free(bodies->names);
+#ifndef _WIN32
+    if (bodies->mapping != NULL)
+        munmap(bodies->mapping, bodies->mapping_size);
+#endif
+    memset(bodies, 0, sizeof(OrbitalBodies));
+}
@@ -0,0 +1,69 @@
+/**
+ * @brief Orbital body store
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef ORBITALBODIES_H
+#define ORBITALBODIES_H
+
+#include <stddef.h>
+
+#include "OrbitalTypes.h"
+
+/**
+ * Every array is aligned to this many bytes (a cache line), so vector loads
+ * never straddle two lines.
+ */
+#define ORBITALBODIES_ALIGNMENT 64
+
+/**
+ * @brief Body store, in structure-of-arrays layout
+ * Each physical quantity lives in its own contiguous array, indexed by body.
+ * The hot arrays are the ones updateOrbitalSim walks every step, all of them in
+ * double precision. The cold ones are only needed by the view, so they are
+ * kept in a separate block and never pulled through the cache while integrating.
+ */
+struct OrbitalBodies
+{
+    // Hot data
+    double *x, *y, *z;          // [m], distance from origin on each axis
+    double *vx, *vy, *vz;       // [m/s]
+    double *ax, *ay, *az;       // [m/s^2]
+    double *mass;               // [kg]
+    unsigned char *level;       // block time step level: the body moves in steps of time_step / 2^level
+
+    // Cold data
+    float *radius;              // [m]
+    BodyColor *color;           // raylib color
+    const char **name;          // NULL for unnamed bodies (asteroids)
+
+    unsigned int capacity;      // how many bodies each array can hold
+
+    void *hot_block;            // the allocations every array is carved from
+    void *cold_block;           // NULL if the cold arrays are another store's
+    void *mapping;              // or the file mapping they point into (see Checkpoint.h)
+    size_t mapping_size;
+    char *names;                // the strings name points into, NULL if static or another store's
+};
+
+bool allocateOrbitalBodies(OrbitalBodies *bodies, unsigned int count);
+void freeOrbitalBodies(OrbitalBodies *bodies);
+void getOrbitalBodiesImageSizes(unsigned int capacity, size_t *hotSize, size_t *coldSize);
+void bindOrbitalBodies(OrbitalBodies *bodies, unsigned int capacity, void *hotImage, void *coldImage);
+void shareOrbitalBodiesColdArrays(OrbitalBodies *bodies, const OrbitalBodies *source);
+
+/**
+ * @brief Float view of a body's position, laid out as raylib expects it
+ *
+ * @param bodies The body store
+ * @param index The body index
+ * @return The position {[m],[m],[m]}
+ */
+inline BodyVector3 getOrbitalBodyPosition(const OrbitalBodies *bodies, unsigned int index)
+{
+    return {(float)bodies->x[index], (float)bodies->y[index], (float)bodies->z[index]};
+}
+
+#endif
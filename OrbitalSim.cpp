@@ -11,253 +11,973 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <math.h>
 
 
 
 #include "OrbitalSim.h"
+#include "ForceKernel.h"
+#include "Catalog.h"
 #include "ephemerides.h"
 
-#define GRAVITATIONAL_CONSTANT 6.6743E-11F
+static void translateBody(const EphemeridesBody * const _ephemerid_body, 
+                          OrbitalBodies * const _bodies, unsigned int _index);
+static OrbitalSim *constructStarSystem(double timeStep,
+                                       const EphemeridesBody *system,
+                                       unsigned int systemBodies,
+                                       unsigned int threadCount,
+                                       unsigned int asteroidCount,
+                                       const AsteroidBelt *belt,
+                                       const Catalog *catalog);
+
 
 /**
- * This value was originally 2E11F, was changed to have greater sparsity between asteroids,
- * all of them would be cluttered and close to the Sun otherwise.
-*/
-#define ASTEROIDS_MEAN_RADIUS 9E11F 
+ * @brief Constructs an orbital simulation
+ *
+ * @param timeStep: floating point value, ideally should be a multiple of the FPS,
+ *                  will still work fine otherwise.
+ * @param threadCount: how many threads update the simulation, 0 for one per hardware thread
+ * @param asteroidCount: how many asteroids orbit the system
+ * @param belt: how the asteroids are drawn, NULL for the default belt
+ * @return The constructed orbital simulation. Returns NULL on error.
+ */
+OrbitalSim *constructOrbitalSim(double timeStep, unsigned int threadCount, unsigned int asteroidCount,
+                                const AsteroidBelt *belt)
+{
+    return constructStarSystem(timeStep, solarSystem, SOLARSYSTEM_BODYNUM, threadCount, asteroidCount, belt, NULL);
+}
 
+/**
+ * @brief Constructs an orbital simulation
+ *
+ * @param timeStep: floating point value, ideally should be a multiple of the FPS,
+ *                  will still work fine otherwise.
+ * @param threadCount: how many threads update the simulation, 0 for one per hardware thread
+ * @param asteroidCount: how many asteroids orbit the system
+ * @param belt: how the asteroids are drawn, NULL for the default belt
+ * @return The constructed orbital simulation. Returns NULL on error.
+ */
+OrbitalSim *constructOrbitalSim_BONUS(double timeStep, unsigned int threadCount, unsigned int asteroidCount,
+                                      const AsteroidBelt *belt)
+{
+    return constructStarSystem(timeStep, alphaCentauriSystem, ALPHACENTAURISYSTEM_BODYNUM, threadCount, asteroidCount, belt, NULL);
+}
 
+/**
+ * @brief Constructs the solar system, with the bodies of a catalog in place
+ * of the asteroid belt, at the date of the ephemerides
+ *
+ * @param timeStep: the simulation time step [s]
+ * @param path: JPL Horizons vector tables or MPCORB orbital elements (see Catalog.h)
+ * @param threadCount: how many threads update the simulation, 0 for one per hardware thread
+ * @return The constructed orbital simulation. Returns NULL on error.
+ */
+OrbitalSim *constructOrbitalSimFromCatalog(double timeStep, const char *path, unsigned int threadCount)
+{
+    Catalog *catalog = openCatalog(path);
+    if(catalog == NULL)
+        return NULL;
 
-static void translateBody(const EphemeridesBody * const _ephemerid_body, 
-                          OrbitalBody * const _orbital_body);
+    OrbitalSim *simulation = constructStarSystem(timeStep, solarSystem, SOLARSYSTEM_BODYNUM, threadCount,
+                                                 catalog->body_count, NULL, catalog);
+    if(simulation == NULL)
+        fprintf(stderr, "%s: not enough memory, or malformed rows\n", path);
+
+    closeCatalog(catalog);
+    return simulation;
+}
 
 
 /**
- * @brief Gets a uniform random value in a range
+ * @brief Makes an independent copy of a simulation: same bodies, same
+ * settings, same integrator. Integrator state built on the fly (block levels,
+ * Barnes-Hut tree) is rebuilt on the copy's first step.
  *
- * @param min Minimum value
- * @param max Maximum value
- * @return The random value
+ * @param sim The simulation. Body names are shared, not copied, so it must
+ *            outlive the copy.
+ * @param threadCount How many threads update the copy, 0 for one per hardware thread
+ * @return The copy, NULL if out of memory
  */
-float getRandomFloat(float min, float max)
+OrbitalSim *cloneOrbitalSim(const OrbitalSim *sim, unsigned int threadCount)
 {
-    
-    
-    return min + (max - min) * rand() / (float)RAND_MAX;
+    OrbitalBodies bodies;
+    size_t hot_size, cold_size;
+
+    if (!allocateOrbitalBodies(&bodies, sim->bodies.capacity))
+        return NULL;
+    getOrbitalBodiesImageSizes(sim->bodies.capacity, &hot_size, &cold_size);
+    memcpy(bodies.x, sim->bodies.x, hot_size);
+    memcpy(bodies.radius, sim->bodies.radius, cold_size);
+
+    OrbitalSim *clone = constructOrbitalSimFromBodies(sim->time_step, &bodies, sim->bodies_count,
+                                                      sim->planets_range, threadCount);
+    if (clone == NULL)
+    {
+        freeOrbitalBodies(&bodies);
+        return NULL;
+    }
+
+    clone->time_elapsed = sim->time_elapsed;
+    clone->force_model = sim->force_model;
+    clone->opening_angle = sim->opening_angle;
+    clone->tolerance = sim->tolerance;
+    setOrbitalSimPrecision(clone, sim->force_precision);
+    setOrbitalSimIntegrator(clone, (IntegratorType)(sim->integrator - getIntegrator(INTEGRATOR_EULER)));
+    clone->accelerations_valid = sim->accelerations_valid;
+    clone->adaptive_step = sim->adaptive_step;
+    clone->force_evaluations = sim->force_evaluations;
+    return clone;
+}
+
+/**
+ * @brief Compares two strings, ignoring case
+ */
+static bool equalsIgnoringCase(const char *a, const char *b)
+{
+    for (; *a != '\0' && *b != '\0'; a++, b++)
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b))
+            return false;
+    return *a == *b;
 }
 
 /**
- * @brief Configures an asteroid
+ * @brief Finds a body by its name, in any case, or by its index
  *
- * @param body An orbital body
- * @param centerMass The mass of the most massive object in the star system
+ * @return The index, -1 if there is no such body
  */
-void configureAsteroid(OrbitalBody *body, float centerMass)
+int findOrbitalSimBody(const OrbitalSim *sim, const char *body)
 {
-    // Logit distribution
-    float x = getRandomFloat(0, 1);
-    float l = logf(x) - logf(1 - x) + 1;
+    char *end;
+    unsigned long index = strtoul(body, &end, 10);
+
+    if (*body != '\0' && *end == '\0')
+        return index < sim->bodies_count ? (int)index : -1;
 
-    // https://mathworld.wolfram.com/DiskPointPicking.html
-    float r = ASTEROIDS_MEAN_RADIUS * sqrtf(fabsf(l));
-    float phi = getRandomFloat(0, 2.0F * (float)M_PI);
+    for (unsigned int i = 0; i < sim->bodies_count; i++)
+        if (sim->bodies.name[i] != NULL && equalsIgnoringCase(sim->bodies.name[i], body))
+            return (int)i;
+    return -1;
+}
 
-    // Surprise!
-    //phi = 0;
+/**
+ * @brief Makes a simulation compute asteroid forces in double or mixed
+ * precision from the next step on. Planets always move in double.
+ *
+ * @param sim The simulation
+ * @param precision The precision
+ */
+void setOrbitalSimPrecision(OrbitalSim *sim, ForcePrecision precision)
+{
+    sim->force_precision = precision;
+    sim->asteroid_kernel = getAsteroidKernel(sim->force_kernel_isa, precision, sim->planets_range);
+}
 
-    // https://en.wikipedia.org/wiki/Circular_orbit#Velocity
-    float v = sqrtf(GRAVITATIONAL_CONSTANT * centerMass / r) * getRandomFloat(0.6F, 1.2F);
-    float vy = getRandomFloat(-1E2F, 1E2F);
+/**
+ * @brief Destroys an orbital simulation
+ */
+void destroyOrbitalSim(OrbitalSim *sim)
+{
+    if (sim->trajectory != NULL)
+        destroyTrajectoryWriter(sim->trajectory);
+    if (sim->collisions != NULL)
+        destroyCollisionDetector(sim->collisions);
+    if (sim->interactions != NULL)
+        destroyInteractionLists(sim->interactions);
+    if (sim->approaches != NULL)
+        destroyApproachQuery(sim->approaches);
+    if (sim->pool != NULL)
+        destroyThreadPool(sim->pool);
+    if (sim->tree != NULL)
+        destroyBarnesHutTree(sim->tree);
+    free(sim->rk_workspace);
+    free(sim->tile_planets);
+    if (sim->block != NULL)
+        destroyBlockTimeStep(sim->block);
+    if (sim->wisdom_holman != NULL)
+        destroyWisdomHolman(sim->wisdom_holman);
 
-    // Fill in with your own fields:
-    body->mass = 1E12F;  // Typical asteroid weight: 1 billion tons
-    body->radius = 2E3F; // Typical asteroid radius: 2km
-    body->color = GRAY;
-    body->position = {r * cosf(phi), 0, r * sinf(phi)};
-    body->velocity = {-v * sinf(phi), vy, v * cosf(phi)};
+    //Both were malloc'ed
+    freeOrbitalBodies(&sim->bodies);
+    free(sim);
 }
 
+
+
 /**
- * @brief Constructs an orbital simulation
+ * @brief Calculates the acceleration of a range of planets due to the other planets
  *
- * @param timeStep: floating point value, ideally should be a multiple of the FPS,
- *                  will still work fine otherwise.
- * @return The constructed orbital simulation. Returns NULL on error.
+ * Every acceleration is computed from the positions at the start of the step,
+ * so the order in which bodies are visited doesn't change the result.
+ * Asteroids go through sim->asteroid_kernel instead.
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param begin: first body of the range
+ * @param end: one past the last body of the range
+ * @return nothing
  */
-OrbitalSim *constructOrbitalSim(double timeStep)
+static void computeAccelerations(OrbitalSim *sim, unsigned int begin, unsigned int end)
 {
-    OrbitalSim * simulation = NULL;
-    
-    unsigned int i; //index
-    
-    simulation = (OrbitalSim*) malloc(sizeof(OrbitalSim));
-    if(simulation == NULL) //malloc failed, return NULL
-        return NULL;
-    
-    //Loads the count of how many bodies are there on the simulation
-    simulation->bodies_count = SOLARSYSTEM_BODYNUM + ASTEROIDS_COUNT;
-    
-    //The first SOLARSYSTEM_BODYNUM bodies are the planets, the ones after this mark are asteroids
-    simulation->planets_range = SOLARSYSTEM_BODYNUM;
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int current, walker;
+    double dx, dy, dz, distance_sqr, coefficient;
+    double ax, ay, az;
+    INSTRUMENT_START(timer);
 
+    for(current = begin; current < end; current++)
+    {
+        ax = ay = az = 0.0;
+        for(walker = 0; walker < sim->planets_range; walker++)
+        {
+            if (current == walker)
+                continue;
 
-    simulation->bodies = (OrbitalBody*) malloc(simulation->bodies_count * sizeof(OrbitalBody));
-    if(simulation->bodies == NULL) //malloc failed, return NULL
-        return NULL;
-    
+            dx = bodies->x[current] - bodies->x[walker];
+            dy = bodies->y[current] - bodies->y[walker];
+            dz = bodies->z[current] - bodies->z[walker];
+            distance_sqr = dx * dx + dy * dy + dz * dz;
 
-    for(i = 0; i < simulation->planets_range; i++)
-    {
-        translateBody(&solarSystem[i],&simulation->bodies[i]);
+            // -G * m / |r|^2, along the unit vector r / |r|: a single sqrt per pair
+            coefficient = -GRAVITATIONAL_CONSTANT * bodies->mass[walker] /
+                          (distance_sqr * sqrt(distance_sqr));
+
+            ax += coefficient * dx;
+            ay += coefficient * dy;
+            az += coefficient * dz;
+        }
+        bodies->ax[current] = ax;
+        bodies->ay[current] = ay;
+        bodies->az[current] = az;
     }
 
-    for(i = simulation->planets_range; i < simulation->bodies_count; i++)
-        configureAsteroid(&simulation->bodies[i],simulation->bodies[0].mass);
+    INSTRUMENT_STOP(sim->instrumentation, PHASE_FORCE, timer);
+    INSTRUMENT_PAIRS(sim->instrumentation, (unsigned long long)(end - begin) * sim->planets_range -
+                                               (end < sim->planets_range ? end : sim->planets_range) +
+                                               (begin < sim->planets_range ? begin : sim->planets_range));
+}
 
-    for(i = 0; i < simulation->bodies_count; ++i)
+/**
+ * @brief Fills in the acceleration of a range of asteroids due to the
+ * planets, only those in their perturber lists if the simulation has them
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param begin: first asteroid of the range
+ * @param end: one past the last asteroid of the range
+ * @return how many asteroid-planet pairs were evaluated
+ */
+static unsigned long long accelerateAsteroids(OrbitalSim *sim, unsigned int begin, unsigned int end)
+{
+    if (sim->interactions != NULL && sim->force_model == FORCE_MODEL_PLANETS)
+        return accelerateWithInteractionLists(sim->interactions, begin, end);
+
+    sim->asteroid_kernel(&sim->bodies, sim->planets_range, begin, end);
+    return (unsigned long long)(end - begin) * sim->planets_range;
+}
+
+/**
+ * @brief What the pool threads need to move a chunk of bodies
+ */
+struct StepChunk
+{
+    OrbitalSim *sim;
+    double dt;      // [s]
+};
+
+/**
+ * @brief Advances a range of bodies one step with semi-implicit Euler
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param begin: first body of the range
+ * @param end: one past the last body of the range
+ * @param dt: the step [s]
+ * @return nothing
+ */
+static void integrateBodies(OrbitalSim *sim, unsigned int begin, unsigned int end, double dt)
+{
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int i;
+    INSTRUMENT_START(timer);
+
+    for(i = begin; i < end; i++)
     {
-        simulation->bodies[i].applied_force = (Vector3){0.0f, 0.0f, 0.0f};
+        bodies->vx[i] += bodies->ax[i] * dt;
+        bodies->vy[i] += bodies->ay[i] * dt;
+        bodies->vz[i] += bodies->az[i] * dt;
+
+        bodies->x[i] += bodies->vx[i] * dt;
+        bodies->y[i] += bodies->vy[i] * dt;
+        bodies->z[i] += bodies->vz[i] * dt;
     }
-    simulation->time_step = timeStep;
-    return simulation; 
+
+    INSTRUMENT_STOP(sim->instrumentation, PHASE_INTEGRATE, timer);
 }
 
 /**
- * @brief Constructs an orbital simulation
+ * @brief Moves a chunk of asteroids one step. Run by the thread pool.
  *
- * @param timeStep: floating point value, ideally should be a multiple of the FPS,
- *                  will still work fine otherwise.
- * @return The constructed orbital simulation. Returns NULL on error.
+ * @param context: the StepChunk
+ * @param begin: first asteroid of the chunk
+ * @param end: one past the last asteroid of the chunk
+ * @return nothing
  */
-OrbitalSim *constructOrbitalSim_BONUS(double timeStep)
+static void updateAsteroids(void *context, unsigned int begin, unsigned int end)
 {
-    OrbitalSim * simulation = NULL;
-    
-    unsigned int i; //index
-    
-    simulation = (OrbitalSim*) malloc(sizeof(OrbitalSim));
-    if(simulation == NULL) //malloc failed, return NULL
-        return NULL;
-    
-    //Loads the count of how many bodies are there on the simulation
-    simulation->bodies_count = ALPHACENTAURISYSTEM_BODYNUM + ASTEROIDS_COUNT;
-    
-    //The first SOLARSYSTEM_BODYNUM bodies are the planets, the ones after this mark are asteroids
-    simulation->planets_range = ALPHACENTAURISYSTEM_BODYNUM;
+    StepChunk *chunk = (StepChunk *)context;
+    OrbitalSim *sim = chunk->sim;
+    INSTRUMENT_START(timer);
+
+    unsigned long long pairs = accelerateAsteroids(sim, begin, end);
+    INSTRUMENT_STOP(sim->instrumentation, PHASE_FORCE, timer);
+    INSTRUMENT_PAIRS(sim->instrumentation, pairs);
+    integrateBodies(sim, begin, end, chunk->dt);
+}
 
+/**
+ * @brief Chunk versions of the building blocks below. Run by the thread pool.
+ */
+static void integrateChunk(void *context, unsigned int begin, unsigned int end)
+{
+    StepChunk *chunk = (StepChunk *)context;
+    integrateBodies(chunk->sim, begin, end, chunk->dt);
+}
 
-    simulation->bodies = (OrbitalBody*) malloc(simulation->bodies_count * sizeof(OrbitalBody));
-    if(simulation->bodies == NULL) //malloc failed, return NULL
-        return NULL;
-    
+static void accelerateAsteroidsChunk(void *context, unsigned int begin, unsigned int end)
+{
+    OrbitalSim *sim = (OrbitalSim *)context;
+    INSTRUMENT_START(timer);
 
-    for(i = 0; i < simulation->planets_range; i++)
+    unsigned long long pairs = accelerateAsteroids(sim, begin, end);
+    INSTRUMENT_STOP(sim->instrumentation, PHASE_FORCE, timer);
+    INSTRUMENT_PAIRS(sim->instrumentation, pairs);
+}
+
+static void kickChunk(void *context, unsigned int begin, unsigned int end)
+{
+    StepChunk *chunk = (StepChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    INSTRUMENT_START(timer);
+
+    for (unsigned int i = begin; i < end; i++)
     {
-        translateBody(&alphaCentauriSystem[i],&simulation->bodies[i]);
+        bodies->vx[i] += bodies->ax[i] * chunk->dt;
+        bodies->vy[i] += bodies->ay[i] * chunk->dt;
+        bodies->vz[i] += bodies->az[i] * chunk->dt;
     }
 
-    for(i = simulation->planets_range; i < simulation->bodies_count; i++)
-        configureAsteroid(&simulation->bodies[i],simulation->bodies[0].mass);
+    INSTRUMENT_STOP(chunk->sim->instrumentation, PHASE_INTEGRATE, timer);
+}
 
-    for(i = 0; i < simulation->bodies_count; ++i)
+static void driftChunk(void *context, unsigned int begin, unsigned int end)
+{
+    StepChunk *chunk = (StepChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    INSTRUMENT_START(timer);
+
+    for (unsigned int i = begin; i < end; i++)
     {
-        simulation->bodies[i].applied_force = (Vector3){0.0f, 0.0f, 0.0f};
+        bodies->x[i] += bodies->vx[i] * chunk->dt;
+        bodies->y[i] += bodies->vy[i] * chunk->dt;
+        bodies->z[i] += bodies->vz[i] * chunk->dt;
     }
-    simulation->time_step = timeStep;
-    return simulation; 
-}
 
+    INSTRUMENT_STOP(chunk->sim->instrumentation, PHASE_INTEGRATE, timer);
+}
 
 /**
- * @brief Destroys an orbital simulation
+ * @brief Fills in the acceleration of every body, at the current positions,
+ *        under sim->force_model
+ *
+ * @param sim: a pointer to the simulation instance
+ * @return nothing
  */
-void destroyOrbitalSim(OrbitalSim *sim)
+void evaluateOrbitalSimForces(OrbitalSim *sim)
 {
-    //Both were malloc'ed
-    free(sim->bodies);
-    free(sim);
-}
+    sim->force_evaluations++;
 
+    //If the tree can't be built (out of memory), falls back to planets-only forces
+    if (sim->force_model == FORCE_MODEL_BARNES_HUT)
+    {
+        if (sim->tree == NULL)
+            sim->tree = constructBarnesHutTree();
+        //Tree building and walking count as force time; their pairs aren't counted
+        INSTRUMENT_START(timer);
+        if (sim->tree != NULL && buildBarnesHutTree(sim->tree, &sim->bodies, sim->bodies_count, sim->pool))
+        {
+            computeBarnesHutAccelerations(sim->tree, &sim->bodies, sim->opening_angle, sim->pool);
+            INSTRUMENT_STOP(sim->instrumentation, PHASE_FORCE, timer);
+            return;
+        }
+    }
 
+    computeAccelerations(sim, 0, sim->planets_range);
+    runThreadPool(sim->pool, accelerateAsteroidsChunk, sim,
+                  sim->planets_range, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+}
 
+/**
+ * @brief Fills in the acceleration of the planets alone, due to each other
+ *
+ * @param sim: a pointer to the simulation instance
+ * @return nothing
+ */
+void computePlanetAccelerations(OrbitalSim *sim)
+{
+    computeAccelerations(sim, 0, sim->planets_range);
+}
 
+/**
+ * @brief Changes every velocity by its acceleration times dt
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param dt: the kick [s]
+ * @return nothing
+ */
+void kickOrbitalSim(OrbitalSim *sim, double dt)
+{
+    StepChunk chunk = {sim, dt};
+    runThreadPool(sim->pool, kickChunk, &chunk, 0, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+}
 
+/**
+ * @brief Changes every position by its velocity times dt
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param dt: the drift [s]
+ * @return nothing
+ */
+void driftOrbitalSim(OrbitalSim *sim, double dt)
+{
+    StepChunk chunk = {sim, dt};
+    runThreadPool(sim->pool, driftChunk, &chunk, 0, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+}
 
 /**
- * @brief updates a simulation instance
+ * @brief Advances a simulation one time_step with first-order semi-implicit Euler
  *
  * @param sim: a pointer to the simulation instance
  * @return nothing
  */
-void updateOrbitalSim(OrbitalSim *sim)
+void eulerStepOrbitalSim(OrbitalSim *sim)
 {
-  
-     
-    unsigned int current,walker;
-    Vector3 single_force,inverted_single_force;
-    Vector3 vec_diff,vec_diff_normalized;
-    Vector3 target_delta_velocity,target_delta_position;
-    double vec_diff_length_sqr, coefficient;
+    StepChunk chunk = {sim, sim->time_step};
+
+    sim->accelerations_valid = false;
+    if (sim->force_model != FORCE_MODEL_PLANETS)
+    {
+        evaluateOrbitalSimForces(sim);
+        runThreadPool(sim->pool, integrateChunk, &chunk, 0, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+        return;
+    }
 
     /**
      * Calculates the interaction between every body and all the planets, which are the most significant bodies.
      * Since an asteroid's mass is much smaller than of the planets, the effect on other bodies' orbit is insignificant.
-     * So, the outer loop iterates through all the bodies, and the inner one calculates the interaction between the planets
-     * and itself.
+     * So, every body only feels the planets, and only then all of them are moved.
+     *
+     * Asteroids only read the planets, and never each other, so they can all be moved at once
+     * by the thread pool, as long as the planets stay put until they are done.
      */
-    for(current = 0; current < sim->bodies_count; current++)
-    {    
-        sim->bodies[current].applied_force = (Vector3){0.0, 0.0, 0.0};
-        for(walker = 0; walker < sim->planets_range; walker++)
+    sim->force_evaluations++;
+    computeAccelerations(sim, 0, sim->planets_range);
+    runThreadPool(sim->pool, updateAsteroids, &chunk,
+                  sim->planets_range, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+    integrateBodies(sim, 0, sim->planets_range, sim->time_step);
+}
+
+/**
+ * @brief updates a simulation instance
+ *
+ * @param sim: a pointer to the simulation instance
+ * @return nothing
+ */
+void updateOrbitalSim(OrbitalSim *sim)
+{
+    if (sim->collisions != NULL)
+        beginCollisionStep(sim->collisions);
+    if (sim->interactions != NULL && sim->force_model == FORCE_MODEL_PLANETS)
+        beginInteractionSteps(sim->interactions, 1);
+    if (sim->approaches != NULL)
+        beginApproachStep(sim->approaches);
+
+    sim->integrator->step(sim);
+
+    sim->time_elapsed += sim->time_step;    
+
+    //Close approaches are found by the indices the step started with
+    if (sim->approaches != NULL)
+        findCloseApproaches(sim->approaches);
+
+    //Bodies taken out are gone before anything else sees the step
+    if (sim->collisions != NULL)
+        resolveCollisions(sim->collisions);
+    if (sim->trajectory != NULL)
+        sampleTrajectory(sim->trajectory);
+
+    INSTRUMENT_STEPS(sim, 1);
+}
+
+static_assert(INTERACTION_GROUP_SIZE == ASTEROIDS_TILE_SIZE, "a tile must be a group of the perturber lists");
+
+/**
+ * @brief What the pool threads need to move asteroids through a tile
+ */
+struct TileChunk
+{
+    OrbitalSim *sim;
+    const double *planet_positions;     // x, y, z of each planet at each step
+    unsigned int steps;
+};
+
+/**
+ * @brief Moves a chunk of asteroids through every step of a tile, a few at a
+ * time (a ThreadPoolTask)
+ *
+ * The asteroids of a tile are copied to a small body store of their own, after
+ * room for the planets. Each step, the planets' positions at that step are
+ * copied in, and the tile goes through the same asteroid kernel and the same
+ * integration as in eulerStepOrbitalSim: the results are identical, but only
+ * the planets are read from memory at every step.
+ */
+static void advanceTileChunk(void *context, unsigned int begin, unsigned int end)
+{
+    TileChunk *chunk = (TileChunk *)context;
+    OrbitalSim *sim = chunk->sim;
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int planets = sim->planets_range;
+    double dt = sim->time_step;
+
+    // x, y, z, vx, vy, vz, ax, ay, az: planets first, then the tile's asteroids
+    double store[9][TILE_MAX_PLANETS + ASTEROIDS_TILE_SIZE];
+    double masses[TILE_MAX_PLANETS];
+    unsigned int perturbers[TILE_MAX_PLANETS];
+    OrbitalBodies tile;
+    double **arrays[9] = {&tile.x, &tile.y, &tile.z, &tile.vx, &tile.vy, &tile.vz,
+                          &tile.ax, &tile.ay, &tile.az};
+    double *sources[9] = {bodies->x, bodies->y, bodies->z, bodies->vx, bodies->vy, bodies->vz,
+                          bodies->ax, bodies->ay, bodies->az};
+
+    memset(&tile, 0, sizeof(tile));
+    for (int array = 0; array < 9; array++)
+        *arrays[array] = store[array];
+    tile.mass = masses;
+    unsigned long long pairs = 0;
+
+    //Everything but the kernel counts as integration
+    INSTRUMENT_COUNTER(force_cycles);
+    INSTRUMENT_COUNTER(total_cycles);
+    INSTRUMENT_START(start);
+
+    for (unsigned int first = begin; first < end; first += ASTEROIDS_TILE_SIZE)
+    {
+        unsigned int count = end - first < ASTEROIDS_TILE_SIZE ? end - first : ASTEROIDS_TILE_SIZE;
+
+        //A tile is a group of the perturber lists: only its perturbers are copied in, first
+        unsigned int kept = planets;
+        AsteroidKernel kernel = sim->asteroid_kernel;
+        if (sim->interactions != NULL)
         {
-            if (current == walker)
-                continue;
-            
-            vec_diff = Vector3Subtract(sim->bodies[current].position,sim->bodies[walker].position);
-            vec_diff_normalized = Vector3Normalize(vec_diff);
-           
-            vec_diff_length_sqr = (double) Vector3LengthSqr(vec_diff);
-
-            coefficient = (double) (-GRAVITATIONAL_CONSTANT) * 
-                                    (sim->bodies[current].mass * sim->bodies[walker].mass) /
-                                    vec_diff_length_sqr;
-
-            single_force = Vector3Scale(vec_diff_normalized,coefficient);
-            
-            sim->bodies[current].applied_force = Vector3Add(single_force,sim->bodies[current].applied_force);
+            kept = getInteractionPerturbers(sim->interactions, first, perturbers);
+            kernel = getAsteroidKernel(sim->force_kernel_isa, sim->force_precision, kept);
         }
+        else
+            for (unsigned int p = 0; p < planets; p++)
+                perturbers[p] = p;
+        for (unsigned int k = 0; k < kept; k++)
+            masses[k] = bodies->mass[perturbers[k]];
+        pairs += (unsigned long long)kept * count * chunk->steps;
 
-        //Calculates body acceleration based on force
-        sim->bodies[current].acceleration = Vector3Scale(sim->bodies[current].applied_force,(double)1/sim->bodies[current].mass);
-        
-        target_delta_velocity = Vector3Scale(sim->bodies[current].acceleration, sim->time_step);
-        sim->bodies[current].velocity = Vector3Add(sim->bodies[current].velocity,target_delta_velocity);
-        
-        target_delta_position = Vector3Scale(sim->bodies[current].velocity,sim->time_step);
-        sim->bodies[current].position = Vector3Add(sim->bodies[current].position, target_delta_position);
-
-        //Resets the applied force since the next calculation loop expects it like that
-        sim->bodies[current].applied_force = (Vector3){0.0, 0.0, 0.0};      
+        for (int array = 0; array < 6; array++)
+            memcpy(store[array] + planets, sources[array] + first, count * sizeof(double));
+
+        for (unsigned int step = 0; step < chunk->steps; step++)
+        {
+            const double *positions = chunk->planet_positions + 3 * (size_t)step * planets;
+            for (unsigned int k = 0; k < kept; k++)
+            {
+                tile.x[k] = positions[perturbers[k]];
+                tile.y[k] = positions[planets + perturbers[k]];
+                tile.z[k] = positions[2 * planets + perturbers[k]];
+            }
+
+            INSTRUMENT_START(timer);
+            kernel(&tile, kept, planets, planets + count);
+            INSTRUMENT_LAP(force_cycles, timer);
+            for (unsigned int i = planets; i < planets + count; i++)
+            {
+                tile.vx[i] += tile.ax[i] * dt;
+                tile.vy[i] += tile.ay[i] * dt;
+                tile.vz[i] += tile.az[i] * dt;
+
+                tile.x[i] += tile.vx[i] * dt;
+                tile.y[i] += tile.vy[i] * dt;
+                tile.z[i] += tile.vz[i] * dt;
+            }
+        }
+
+        for (int array = 0; array < 9; array++)
+            memcpy(sources[array] + first, store[array] + planets, count * sizeof(double));
     }
 
-    sim->time_elapsed += sim->time_step;    
+    INSTRUMENT_LAP(total_cycles, start);
+    INSTRUMENT_ADD(sim->instrumentation, PHASE_FORCE, force_cycles);
+    INSTRUMENT_ADD(sim->instrumentation, PHASE_INTEGRATE, total_cycles - force_cycles);
+    INSTRUMENT_PAIRS(sim->instrumentation, pairs);
+}
+
+/**
+ * @brief Advances the planets alone several steps with the Euler integrator,
+ * recording their positions at the start of each one. The asteroids stay put.
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param planetPositions: room for 3 * planets_range doubles per step: x, y
+ *                         and z of each planet
+ * @param steps: how many steps to advance
+ * @return nothing
+ */
+void advanceOrbitalSimPlanets(OrbitalSim *sim, double *planetPositions, unsigned int steps)
+{
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int planets = sim->planets_range;
+
+    for (unsigned int step = 0; step < steps; step++)
+    {
+        double *positions = planetPositions + 3 * (size_t)step * planets;
+        memcpy(positions, bodies->x, planets * sizeof(double));
+        memcpy(positions + planets, bodies->y, planets * sizeof(double));
+        memcpy(positions + 2 * planets, bodies->z, planets * sizeof(double));
+
+        computeAccelerations(sim, 0, planets);
+        integrateBodies(sim, 0, planets, sim->time_step);
+    }
+}
+
+/**
+ * @brief Moves the asteroids through several Euler steps, against the
+ * planets' positions at each one as advanceOrbitalSimPlanets records them.
+ * The planets themselves stay put. Needs up to TILE_MAX_PLANETS planets.
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param planetPositions: x, y, z of each planet at each step
+ * @param steps: how many steps to advance
+ * @return nothing
+ */
+void advanceOrbitalSimAsteroids(OrbitalSim *sim, const double *planetPositions, unsigned int steps)
+{
+    TileChunk chunk = {sim, planetPositions, steps};
+
+    runThreadPool(sim->pool, advanceTileChunk, &chunk, sim->planets_range, sim->bodies_count,
+                  ASTEROIDS_CHUNK_SIZE);
+}
+
+/**
+ * @brief Advances a simulation several steps, as that many updateOrbitalSim
+ * calls would, with identical results
+ *
+ * Asteroids never pull on planets, so the planets go through all the steps
+ * first, their positions at each one recorded in sim->tile_planets. Then
+ * each tile of ASTEROIDS_TILE_SIZE asteroids goes through all the steps
+ * while it stays in L1, instead of every asteroid streaming through memory
+ * once per step.
+ *
+ * Only the Euler integrator under FORCE_MODEL_PLANETS, with up to
+ * TILE_MAX_PLANETS planets, no trajectory recording, no collision
+ * detection and no close approach query, runs tiled; anything else steps
+ * as usual.
+ *
+ * @param sim: a pointer to the simulation instance
+ * @param steps: how many steps to advance
+ * @return nothing
+ */
+void updateOrbitalSimTiled(OrbitalSim *sim, unsigned int steps)
+{
+    unsigned int planets = sim->planets_range;
+
+    if (!canAdvanceOrbitalSimTiled(sim))
+    {
+        for (unsigned int step = 0; step < steps; step++)
+            updateOrbitalSim(sim);
+        return;
+    }
+
+    while (steps > 0)
+    {
+        unsigned int count = steps < TILE_MAX_STEPS ? steps : TILE_MAX_STEPS;
+        if (sim->interactions != NULL)
+            count = beginInteractionSteps(sim->interactions, count);
+        if (sim->tile_planets_capacity < count)
+        {
+            free(sim->tile_planets);
+            sim->tile_planets = (double *)malloc(3 * (size_t)count * planets * sizeof(double));
+            sim->tile_planets_capacity = sim->tile_planets ? count : 0;
+            if (sim->tile_planets == NULL)
+            {
+                //Not enough memory for the planets' trajectory, step by step then
+                for (unsigned int step = 0; step < steps; step++)
+                    updateOrbitalSim(sim);
+                return;
+            }
+        }
+
+        advanceOrbitalSimPlanets(sim, sim->tile_planets, count);
+        advanceOrbitalSimAsteroids(sim, sim->tile_planets, count);
+
+        for (unsigned int step = 0; step < count; step++)
+            sim->time_elapsed += sim->time_step;
+        sim->force_evaluations += count;
+        sim->accelerations_valid = false;
+        steps -= count;
+        INSTRUMENT_STEPS(sim, count);
+    }
+}
+
+/**
+ * @brief Whether updateOrbitalSimTiled (and so advanceOrbitalSimPlanets and
+ * advanceOrbitalSimAsteroids) can run a simulation as it stands
+ */
+bool canAdvanceOrbitalSimTiled(const OrbitalSim *sim)
+{
+    return sim->integrator == getIntegrator(INTEGRATOR_EULER) && sim->force_model == FORCE_MODEL_PLANETS &&
+           sim->planets_range <= TILE_MAX_PLANETS && sim->trajectory == NULL && sim->collisions == NULL &&
+           sim->approaches == NULL;
+}
+
+/**
+ * @brief What the pool threads need to add up the invariants of the asteroids
+ */
+struct InvariantsChunk
+{
+    const OrbitalSim *sim;
+    double *partials;       // energy and angular momentum x, y, z of each ASTEROIDS_CHUNK_SIZE asteroids
+};
+
+/**
+ * @brief Adds a body's share of the invariants to sums: its kinetic energy,
+ * its potential energy with the first planets bodies, and m r x v
+ */
+static void addBodyInvariants(const OrbitalSim *sim, unsigned int index, unsigned int planets,
+                              double *sums)
+{
+    const OrbitalBodies *bodies = &sim->bodies;
+    double mass = bodies->mass[index];
+    double x = bodies->x[index], y = bodies->y[index], z = bodies->z[index];
+    double vx = bodies->vx[index], vy = bodies->vy[index], vz = bodies->vz[index];
+    double potential = 0;
+
+    for (unsigned int p = 0; p < planets; p++)
+    {
+        double dx = x - bodies->x[p], dy = y - bodies->y[p], dz = z - bodies->z[p];
+        potential += bodies->mass[p] / sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    sums[0] += 0.5 * mass * (vx * vx + vy * vy + vz * vz) - GRAVITATIONAL_CONSTANT * mass * potential;
+    sums[1] += mass * (y * vz - z * vy);
+    sums[2] += mass * (z * vx - x * vz);
+    sums[3] += mass * (x * vy - y * vx);
+}
+
+/**
+ * @brief Adds up a chunk of asteroids, ASTEROIDS_CHUNK_SIZE at a time, each
+ * to its own partial sum: however the pool splits the range, the sums match.
+ * Run by the thread pool.
+ */
+static void addInvariantsChunk(void *context, unsigned int begin, unsigned int end)
+{
+    InvariantsChunk *chunk = (InvariantsChunk *)context;
+    const OrbitalSim *sim = chunk->sim;
+
+    for (unsigned int first = begin; first < end; first += ASTEROIDS_CHUNK_SIZE)
+    {
+        unsigned int last = end - first < ASTEROIDS_CHUNK_SIZE ? end : first + ASTEROIDS_CHUNK_SIZE;
+        double *sums = chunk->partials + 4 * (size_t)((first - sim->planets_range) / ASTEROIDS_CHUNK_SIZE);
+
+        sums[0] = sums[1] = sums[2] = sums[3] = 0;
+        for (unsigned int i = first; i < last; i++)
+            addBodyInvariants(sim, i, sim->planets_range, sums);
+    }
+}
+
+/**
+ * @brief Total energy and angular momentum of a simulation, under the force
+ * model the planets-only steps follow: the potential of every pair of
+ * planets, and of every asteroid with every planet, but none between
+ * asteroids. Barycentric frame or not, whatever the bodies are in.
+ *
+ * @param sim The simulation
+ * @param energy Filled in with the kinetic plus potential energy [J]
+ * @param angularMomentum Filled in with the sum of m r x v [kg m^2/s]
+ */
+void computeOrbitalSimInvariants(const OrbitalSim *sim, double *energy, double angularMomentum[3])
+{
+    unsigned int asteroids = sim->bodies_count - sim->planets_range;
+    unsigned int chunks = (asteroids + ASTEROIDS_CHUNK_SIZE - 1) / ASTEROIDS_CHUNK_SIZE;
+    double sums[4] = {0, 0, 0, 0};
+
+    //Each planet's potential with the ones before it: every pair once
+    for (unsigned int i = 0; i < sim->planets_range; i++)
+        addBodyInvariants(sim, i, i, sums);
+
+    double *partials = chunks ? (double *)malloc(4 * (size_t)chunks * sizeof(double)) : NULL;
+    if (partials != NULL)
+    {
+        InvariantsChunk chunk = {sim, partials};
+        runThreadPool(sim->pool, addInvariantsChunk, &chunk, sim->planets_range, sim->bodies_count,
+                      ASTEROIDS_CHUNK_SIZE);
+        for (unsigned int n = 0; n < chunks; n++)
+            for (int k = 0; k < 4; k++)
+                sums[k] += partials[4 * n + k];
+        free(partials);
+    }
+    else
+    {
+        //Not enough memory for the partial sums, on this thread then
+        for (unsigned int i = sim->planets_range; i < sim->bodies_count; i++)
+            addBodyInvariants(sim, i, sim->planets_range, sums);
+    }
+
+    *energy = sums[0];
+    angularMomentum[0] = sums[1];
+    angularMomentum[1] = sums[2];
+    angularMomentum[2] = sums[3];
+}
+
+/**
+ * @brief Constructs a star system, followed by its asteroids
+ *
+ * @param timeStep: the simulation time step [s]
+ * @param system: the ephemerides of the star system
+ * @param systemBodies: how many bodies the star system has
+ * @param threadCount: how many threads update the simulation, 0 for one per hardware thread
+ * @param asteroidCount: how many asteroids orbit the system
+ * @param belt: how the asteroids are drawn, NULL for the default belt
+ * @param catalog: where the asteroids come from instead, NULL to draw them
+ * @return The constructed orbital simulation. Returns NULL on error.
+ */
+static OrbitalSim *constructStarSystem(double timeStep,
+                                       const EphemeridesBody *system,
+                                       unsigned int systemBodies,
+                                       unsigned int threadCount,
+                                       unsigned int asteroidCount,
+                                       const AsteroidBelt *belt,
+                                       const Catalog *catalog)
+{
+    OrbitalSim * simulation = NULL;
+    OrbitalBodies bodies;
+    AsteroidBelt default_belt;
+    unsigned int bodies_count = systemBodies + asteroidCount;
+    
+    unsigned int i; //index
+
+    if(!allocateOrbitalBodies(&bodies, bodies_count))
+        return NULL;
+
+    //The first systemBodies bodies are the planets, the ones after this mark are asteroids
+    for(i = 0; i < systemBodies; i++)
+        translateBody(&system[i], &bodies, i);
+
+    simulation = constructOrbitalSimFromBodies(timeStep, &bodies, bodies_count, systemBodies, threadCount);
+    if(simulation == NULL)
+    {
+        freeOrbitalBodies(&bodies);
+        return NULL;
+    }
+
+    //The belt, or the catalog, is built by the simulation's own pool
+    if(catalog != NULL)
+    {
+        if(!loadCatalogBodies(catalog, &simulation->bodies, systemBodies, EPHEMERIDES_EPOCH, simulation->pool))
+        {
+            destroyOrbitalSim(simulation);
+            return NULL;
+        }
+        return simulation;
+    }
+    if(belt == NULL)
+    {
+        setDefaultAsteroidBelt(&default_belt);
+        belt = &default_belt;
+    }
+    generateAsteroidBelt(belt, &simulation->bodies, systemBodies, bodies_count,
+                         simulation->bodies.mass[0], simulation->pool);
+    return simulation;
+}
+
+/**
+ * @brief Constructs an orbital simulation around an already filled body store
+ *
+ * @param timeStep: the simulation time step [s]
+ * @param bodies: the body store; on success the simulation takes it over
+ * @param bodiesCount: how many bodies of the store are in use
+ * @param planetsRange: the first planetsRange bodies are the planets
+ * @param threadCount: how many threads update the simulation, 0 for one per hardware thread
+ * @return The constructed orbital simulation. Returns NULL on error, leaving bodies to the caller.
+ */
+OrbitalSim *constructOrbitalSimFromBodies(double timeStep, OrbitalBodies *bodies,
+                                          unsigned int bodiesCount, unsigned int planetsRange,
+                                          unsigned int threadCount)
+{
+    OrbitalSim * simulation = NULL;
+    
+    simulation = (OrbitalSim*) malloc(sizeof(OrbitalSim));
+    if(simulation == NULL) //malloc failed, return NULL
+        return NULL;
+    
+    simulation->bodies = *bodies;
+    
+    //Loads the count of how many bodies are there on the simulation
+    simulation->bodies_count = bodiesCount;
+    simulation->planets_range = planetsRange;
+
+    simulation->time_step = timeStep;
+    simulation->time_elapsed = 0;
+
+    simulation->force_kernel_isa = detectForceKernelIsa();
+    setOrbitalSimPrecision(simulation, FORCE_PRECISION_DOUBLE);
+
+    if (threadCount == 0)
+        threadCount = getHardwareThreadCount();
+    simulation->pool = threadCount > 1 ? constructThreadPool(threadCount) : NULL;
+
+    simulation->block = NULL;
+    simulation->wisdom_holman = NULL;
+    simulation->rk_workspace = NULL;
+    simulation->rk_workspace_capacity = 0;
+    simulation->tile_planets = NULL;
+    simulation->tile_planets_capacity = 0;
+    simulation->tolerance = DEFAULT_INTEGRATOR_TOLERANCE;
+    simulation->force_evaluations = 0;
+    setOrbitalSimIntegrator(simulation, INTEGRATOR_EULER);
+
+    simulation->force_model = FORCE_MODEL_PLANETS;
+    simulation->opening_angle = DEFAULT_OPENING_ANGLE;
+    simulation->tree = NULL;
+    simulation->trajectory = NULL;
+    simulation->collisions = NULL;
+    simulation->interactions = NULL;
+    simulation->approaches = NULL;
+    simulation->instrumentation = NULL;
+    return simulation; 
 }
 
 /** 
- * @brief translates the members of type EphemeridesBody to type OrbitalBody
+ * @brief translates the members of type EphemeridesBody to an entry of the body store
  * @param _ephemerid_body a ptr to an EphemeridBody (source)
- * @param _orbital_body a ptr to an OrbitalBody (destination)
+ * @param _bodies a ptr to the body store (destination)
+ * @param _index the index of the destination body
  * @return nothing
  */
 static void translateBody(const EphemeridesBody * const _ephemerid_body, 
-                          OrbitalBody * const _orbital_body)
-{
-    _orbital_body->acceleration = (Vector3){.x = 0.0F, .y = 0.0F, .z = 0.0F};
-    _orbital_body->mass = (double) _ephemerid_body->mass;
-    _orbital_body->position = _ephemerid_body->position; //both are Vector3
-    _orbital_body->radius = (double) _ephemerid_body->radius;
-    _orbital_body->velocity = _ephemerid_body->velocity; //both are Vector3
-    _orbital_body->color = _ephemerid_body->color;
-    _orbital_body->one_over_mass = 1/_orbital_body->mass;
+                          OrbitalBodies * const _bodies, unsigned int _index)
+{
+    _bodies->mass[_index] = (double) _ephemerid_body->mass;
+    _bodies->radius[_index] = _ephemerid_body->radius;
+    _bodies->color[_index] = _ephemerid_body->color;
+    _bodies->name[_index] = _ephemerid_body->name;
+    _bodies->x[_index] = _ephemerid_body->position.x;
+    _bodies->y[_index] = _ephemerid_body->position.y;
+    _bodies->z[_index] = _ephemerid_body->position.z;
+    _bodies->vx[_index] = _ephemerid_body->velocity.x;
+    _bodies->vy[_index] = _ephemerid_body->velocity.y;
+    _bodies->vz[_index] = _ephemerid_body->velocity.z;
     return;
 }   
\ No newline at end of file
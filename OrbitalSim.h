@@ -1,55 +1,143 @@
-﻿/**
- * @brief Orbital simulation
- * @author Marc S. Ressl
- * @modifiers Matteo Ginhson, Nicanor Otamendi
- * @copyright Copyright (c) 2022-2023
- */
-
-#ifndef ORBITALSIM_H
-#define ORBITALSIM_H
-
-#include "raylib.h"
-#include "raymath.h"
-
-#define ASTEROIDS_COUNT 1000
-
-/**
- * @brief OrbitalBody definition
- * A few physical parameters each body has.
- */
-struct OrbitalBody
-{
-    
-    double mass;            // [kg]
-    double one_over_mass;   // 1/[kg]
-    double radius;          // [m]
-    Vector3 position;       // {[m],[m],[m]}, distance from origin on each axis
-    Vector3 acceleration;   // {[m/s^2],[m/s^2],[m/s^2]}
-    Vector3 velocity;       // {[m/s],[m/s],[m/s]}
-    Vector3 applied_force;  // [N]
-    Color color;            // raylib color
-};
-
-/**
- * @brief 
- * The object defining a simulation instance. It has a list of its bodies,
- * its timestep
- * This already feels like Outer Wilds!
- */
-struct OrbitalSim
-{
-    OrbitalBody * bodies;
-    unsigned int bodies_count;
-    unsigned int planets_range;  
-    double time_step;           //[s]
-    double time_elapsed;        //[s], defining 0 seconds as the start of the simulation   
-
-};
-
-OrbitalSim *constructOrbitalSim(double timeStep);
-OrbitalSim *constructOrbitalSim_BONUS(double timeStep);
-void destroyOrbitalSim(OrbitalSim *sim);
-void updateOrbitalSim(OrbitalSim *sim);
-
-
-#endif
\ No newline at end of file
+/**
+ * @brief Orbital simulation
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef ORBITALSIM_H
+#define ORBITALSIM_H
+
+#include "OrbitalBodies.h"
+#include "ForceKernel.h"
+#include "ThreadPool.h"
+#include "BarnesHut.h"
+#include "Integrator.h"
+#include "BlockTimeStep.h"
+#include "WisdomHolman.h"
+#include "TrajectoryWriter.h"
+#include "Instrumentation.h"
+#include "Collisions.h"
+#include "AsteroidBelt.h"
+#include "InteractionLists.h"
+#include "CloseApproaches.h"
+
+/**
+ * Default asteroid count, when none is given at construction
+ */
+#define ASTEROIDS_COUNT 1000
+
+/**
+ * Asteroids are handed out to the pool threads this many at a time
+ */
+#define ASTEROIDS_CHUNK_SIZE 4096
+
+/**
+ * Asteroids updateOrbitalSimTiled moves together through all of a tile's
+ * steps, small enough for their state to stay in L1
+ */
+#define ASTEROIDS_TILE_SIZE 128
+
+/**
+ * Most steps and planets a tile of updateOrbitalSimTiled covers; longer runs
+ * are split into several tiles, more planets go step by step
+ */
+#define TILE_MAX_STEPS 1024
+#define TILE_MAX_PLANETS 64
+
+/**
+ * Default Barnes-Hut opening angle, theta
+ */
+#define DEFAULT_OPENING_ANGLE 0.5
+
+/**
+ * @brief Which bodies pull on which
+ */
+enum ForceModel
+{
+    FORCE_MODEL_PLANETS,        // only the first planets_range bodies exert force, O(n)
+    FORCE_MODEL_BARNES_HUT,     // every body pulls on every other one, through an octree, O(n log n)
+};
+
+/**
+ * @brief
+ * The object defining a simulation instance. It has a list of its bodies,
+ * its timestep
+ * This already feels like Outer Wilds!
+ */
+struct OrbitalSim
+{
+    OrbitalBodies bodies;
+    unsigned int bodies_count;
+    unsigned int planets_range;
+    double time_step;           //[s]
+    double time_elapsed;        //[s], defining 0 seconds as the start of the simulation
+
+    ForceKernelIsa force_kernel_isa;    // picked at construction, the best the CPU runs
+    ForcePrecision force_precision;     // set with setOrbitalSimPrecision
+    AsteroidKernel asteroid_kernel;     // asteroid-vs-planet forces, vectorized for force_kernel_isa
+
+    ThreadPool *pool;           // moves the asteroids in parallel, NULL when running on one thread
+
+    ForceModel force_model;
+    double opening_angle;       // theta, for FORCE_MODEL_BARNES_HUT
+    BarnesHutTree *tree;        // built on the first FORCE_MODEL_BARNES_HUT step
+
+    const Integrator *integrator;       // set with setOrbitalSimIntegrator
+    bool accelerations_valid;           // ax/ay/az match the current positions, so a step may reuse them
+    double tolerance;                   // relative error per step, for adaptive integrators
+    double adaptive_step;               // [s], the last sub-step an adaptive integrator settled on
+    double *rk_workspace;               // stages of the Runge-Kutta integrators
+    unsigned int rk_workspace_capacity; // bodies the workspace holds
+    BlockTimeStep *block;               // state of INTEGRATOR_BLOCK, built on its first step
+    WisdomHolman *wisdom_holman;        // state of INTEGRATOR_WISDOM_HOLMAN, built on its first step
+    unsigned long long force_evaluations;   // total, since construction
+
+    double *tile_planets;               // x, y, z of each planet at each step of a tile
+    unsigned int tile_planets_capacity; // steps it holds
+
+    TrajectoryWriter *trajectory;       // records positions after each step, NULL if not recording
+    CollisionDetector *collisions;      // finds bodies that touch after each step, NULL if they never do
+    InteractionLists *interactions;     // the planets each asteroid feels, NULL if it feels them all
+    ApproachQuery *approaches;          // close approaches looked for after each step, NULL if none
+    Instrumentation *instrumentation;   // timers and diagnostics, NULL if not instrumented; not owned
+};
+
+OrbitalSim *constructOrbitalSim(double timeStep, unsigned int threadCount = 0,
+                                unsigned int asteroidCount = ASTEROIDS_COUNT,
+                                const AsteroidBelt *belt = NULL);
+OrbitalSim *constructOrbitalSim_BONUS(double timeStep, unsigned int threadCount = 0,
+                                      unsigned int asteroidCount = ASTEROIDS_COUNT,
+                                      const AsteroidBelt *belt = NULL);
+OrbitalSim *constructOrbitalSimFromCatalog(double timeStep, const char *path, unsigned int threadCount = 0);
+OrbitalSim *constructOrbitalSimFromBodies(double timeStep, OrbitalBodies *bodies,
+                                          unsigned int bodiesCount, unsigned int planetsRange,
+                                          unsigned int threadCount = 0);
+OrbitalSim *cloneOrbitalSim(const OrbitalSim *sim, unsigned int threadCount = 0);
+void destroyOrbitalSim(OrbitalSim *sim);
+void setOrbitalSimPrecision(OrbitalSim *sim, ForcePrecision precision);
+int findOrbitalSimBody(const OrbitalSim *sim, const char *body);
+void updateOrbitalSim(OrbitalSim *sim);
+void updateOrbitalSimTiled(OrbitalSim *sim, unsigned int steps);
+bool canAdvanceOrbitalSimTiled(const OrbitalSim *sim);
+void advanceOrbitalSimPlanets(OrbitalSim *sim, double *planetPositions, unsigned int steps);
+void advanceOrbitalSimAsteroids(OrbitalSim *sim, const double *planetPositions, unsigned int steps);
+void computeOrbitalSimInvariants(const OrbitalSim *sim, double *energy, double angularMomentum[3]);
+
+// Building blocks for the integrators
+void evaluateOrbitalSimForces(OrbitalSim *sim);
+void computePlanetAccelerations(OrbitalSim *sim);
+void kickOrbitalSim(OrbitalSim *sim, double dt);
+void driftOrbitalSim(OrbitalSim *sim, double dt);
+void eulerStepOrbitalSim(OrbitalSim *sim);
+
+/**
+ * @brief Float view of a body's position, for the view
+ */
+inline BodyVector3 getOrbitalSimPosition(const OrbitalSim *sim, unsigned int index)
+{
+    return getOrbitalBodyPosition(&sim->bodies, index);
+}
+
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * @brief Basic types shared by the simulation core, free of any graphics library
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef ORBITALTYPES_H
+#define ORBITALTYPES_H
+
+/**
+ * @brief Body color. Laid out like raylib's Color, so the view converts it member by member.
+ */
+struct BodyColor
+{
+    unsigned char r, g, b, a;
+};
+
+/**
+ * @brief Single precision vector. Laid out like raylib's Vector3.
+ */
+struct BodyVector3
+{
+    float x, y, z;
+};
+
+/**
+ * The raylib palette colors the star systems use
+ */
+#define COLOR_YELLOW    {253, 249, 0, 255}
+#define COLOR_GOLD      {255, 203, 0, 255}
+#define COLOR_RED       {230, 41, 55, 255}
+#define COLOR_SKYBLUE   {102, 191, 255, 255}
+#define COLOR_BLUE      {0, 121, 241, 255}
+#define COLOR_DARKBLUE  {0, 82, 172, 255}
+#define COLOR_BEIGE     {211, 176, 131, 255}
+#define COLOR_LIGHTGRAY {200, 200, 200, 255}
+#define COLOR_GRAY      {130, 130, 130, 255}
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * @brief Render preparation: culling, level of detail and batching
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Turns a snapshot into a draw list without touching raylib, so how many
+ * bodies end up where can be checked without a window.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "RenderPrep.h"
+#include "SimulationThread.h"
+
+#define DEG2RAD_F 0.017453292F
+
+/**
+ * Spheres a sphere bucket starts with
+ */
+#define INITIAL_SPHERE_CAPACITY 256
+
+static BodyVector3 subtract(BodyVector3 a, BodyVector3 b)
+{
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static float dot(BodyVector3 a, BodyVector3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static BodyVector3 cross(BodyVector3 a, BodyVector3 b)
+{
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+static BodyVector3 normalize(BodyVector3 a)
+{
+    float length = sqrtf(dot(a, a));
+    if (length == 0)
+        return a;
+    return {a.x / length, a.y / length, a.z / length};
+}
+
+/**
+ * @brief The camera's frame, and the slopes of the frustum's side planes
+ */
+struct Frustum
+{
+    BodyVector3 position;
+    BodyVector3 forward, right, up;
+    float tan_x, tan_y;         // half-width and half-height of the view, per unit of depth
+    float sec_x, sec_y;         // how much a sphere's radius widens the side planes
+    float near_plane, far_plane;
+};
+
+static void buildFrustum(Frustum *frustum, const RenderCamera *camera)
+{
+    frustum->position = camera->position;
+    frustum->forward = normalize(subtract(camera->target, camera->position));
+    frustum->right = normalize(cross(frustum->forward, camera->up));
+    frustum->up = cross(frustum->right, frustum->forward);
+    frustum->tan_y = tanf(0.5F * camera->fovy * DEG2RAD_F);
+    frustum->tan_x = frustum->tan_y * camera->aspect;
+    frustum->sec_x = sqrtf(1 + frustum->tan_x * frustum->tan_x);
+    frustum->sec_y = sqrtf(1 + frustum->tan_y * frustum->tan_y);
+    frustum->near_plane = camera->near_plane;
+    frustum->far_plane = camera->far_plane;
+}
+
+/**
+ * @brief Is a sphere at least partly inside the frustum?
+ *
+ * @param offset Sphere center minus camera position
+ * @param radius Sphere radius, 0 for a point
+ */
+static bool isInFrustum(const Frustum *frustum, BodyVector3 offset, float radius)
+{
+    float depth = dot(offset, frustum->forward);
+
+    if (depth < frustum->near_plane - radius || depth > frustum->far_plane + radius)
+        return false;
+    if (fabsf(dot(offset, frustum->right)) > depth * frustum->tan_x + radius * frustum->sec_x)
+        return false;
+    return fabsf(dot(offset, frustum->up)) <= depth * frustum->tan_y + radius * frustum->sec_y;
+}
+
+/**
+ * @brief Is a point inside the frustum? Same as isInFrustum with no radius,
+ * but with no branches: about a third of the bodies fail it, in no order
+ * a branch predictor could learn.
+ *
+ * @param offset Point minus camera position
+ */
+static bool isPointInFrustum(const Frustum *frustum, BodyVector3 offset)
+{
+    float depth = dot(offset, frustum->forward);
+
+    return (depth >= frustum->near_plane) & (depth <= frustum->far_plane) &
+           (fabsf(dot(offset, frustum->right)) <= depth * frustum->tan_x) &
+           (fabsf(dot(offset, frustum->up)) <= depth * frustum->tan_y);
+}
+
+/**
+ * @brief Appends a sphere to one of the sphere buckets
+ *
+ * @return false if out of memory
+ */
+static bool pushSphere(DrawList *list, int lod, BodyVector3 position, float radius, BodyColor color)
+{
+    if (list->sphere_counts[lod] == list->sphere_capacities[lod])
+    {
+        unsigned int capacity = list->sphere_capacities[lod] ? 2 * list->sphere_capacities[lod]
+                                                             : INITIAL_SPHERE_CAPACITY;
+        RenderSphere *spheres = (RenderSphere *)realloc(list->spheres[lod],
+                                                        capacity * sizeof(RenderSphere));
+        if (spheres == NULL)
+            return false;
+        list->spheres[lod] = spheres;
+        list->sphere_capacities[lod] = capacity;
+    }
+
+    RenderSphere *sphere = &list->spheres[lod][list->sphere_counts[lod]++];
+    sphere->position = position;
+    sphere->radius = radius;
+    sphere->color = color;
+    return true;
+}
+
+/**
+ * @brief Makes the point bucket able to hold every body
+ *
+ * @return false if out of memory
+ */
+static bool reservePoints(DrawList *list, unsigned int count)
+{
+    if (count <= list->point_capacity)
+        return true;
+
+    float *points = (float *)realloc(list->points, 3 * (size_t)count * sizeof(float));
+    if (points == NULL)
+        return false;
+    list->points = points;
+
+    BodyColor *colors = (BodyColor *)realloc(list->point_colors, count * sizeof(BodyColor));
+    if (colors == NULL)
+        return false;
+    list->point_colors = colors;
+
+    list->point_capacity = count;
+    return true;
+}
+
+/**
+ * @brief Constructs an empty draw list
+ *
+ * @return The draw list, NULL if out of memory
+ */
+DrawList *constructDrawList()
+{
+    return (DrawList *)calloc(1, sizeof(DrawList));
+}
+
+void destroyDrawList(DrawList *list)
+{
+    for (int lod = 0; lod < RENDER_LOD_POINT; lod++)
+        free(list->spheres[lod]);
+    free(list->points);
+    free(list->point_colors);
+    free(list);
+}
+
+/**
+ * @brief Fills a draw list from a snapshot. Bodies outside the camera's view
+ * are dropped; the rest go to a bucket by their distance to the camera.
+ * Planets are always drawn as detailed spheres.
+ *
+ * @param list The draw list, emptied first
+ * @param snapshot What to draw
+ * @param camera Where from
+ * @return false if out of memory; the list then holds only part of the bodies
+ */
+bool prepareDrawList(DrawList *list, const SimulationSnapshot *snapshot, const RenderCamera *camera)
+{
+    Frustum frustum;
+    float sphere_distance_sqr = RENDER_SPHERE_DISTANCE * RENDER_SPHERE_DISTANCE;
+    float detailed_distance_sqr = RENDER_DETAILED_DISTANCE * RENDER_DETAILED_DISTANCE;
+    bool ok = true;
+
+    buildFrustum(&frustum, camera);
+    memset(list->sphere_counts, 0, sizeof(list->sphere_counts));
+    list->point_count = 0;
+    memset(&list->stats, 0, sizeof(list->stats));
+    list->stats.bodies = snapshot->bodies_count;
+
+    for (unsigned int i = 0; ok && i < snapshot->planets_range; i++)
+    {
+        BodyVector3 position = {snapshot->x[i] * RENDER_SCALE, snapshot->y[i] * RENDER_SCALE,
+                                snapshot->z[i] * RENDER_SCALE};
+        float radius = getRenderRadius(snapshot->radius[i]);
+
+        if (!isInFrustum(&frustum, subtract(position, frustum.position), radius))
+            list->stats.culled++;
+        else
+            ok = pushSphere(list, RENDER_LOD_DETAILED_SPHERE, position, radius, snapshot->color[i]);
+    }
+
+    ok = ok && reservePoints(list, snapshot->bodies_count - snapshot->planets_range);
+    for (unsigned int i = snapshot->planets_range; ok && i < snapshot->bodies_count; i++)
+    {
+        BodyVector3 position = {snapshot->x[i] * RENDER_SCALE, snapshot->y[i] * RENDER_SCALE,
+                                snapshot->z[i] * RENDER_SCALE};
+        BodyVector3 offset = subtract(position, frustum.position);
+        float distance_sqr = dot(offset, offset);
+
+        if (distance_sqr >= sphere_distance_sqr)
+        {
+            // Written either way; only kept if visible
+            bool visible = isPointInFrustum(&frustum, offset);
+            float *point = list->points + 3 * (size_t)list->point_count;
+            point[0] = position.x;
+            point[1] = position.y;
+            point[2] = position.z;
+            list->point_colors[list->point_count] = snapshot->color[i];
+            list->point_count += visible;
+            list->stats.culled += !visible;
+            continue;
+        }
+
+        float radius = getRenderRadius(snapshot->radius[i]);
+        if (!isInFrustum(&frustum, offset, radius))
+            list->stats.culled++;
+        else
+            ok = pushSphere(list, distance_sqr < detailed_distance_sqr ? RENDER_LOD_DETAILED_SPHERE
+                                                                       : RENDER_LOD_SPHERE,
+                            position, radius, snapshot->color[i]);
+    }
+
+    list->stats.points = list->point_count;
+    list->stats.detailed_spheres = list->sphere_counts[RENDER_LOD_DETAILED_SPHERE];
+    list->stats.spheres = list->stats.detailed_spheres + list->sphere_counts[RENDER_LOD_SPHERE];
+    return ok;
+}
@@ -0,0 +1,112 @@
+/**
+ * @brief Render preparation: culling, level of detail and batching
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef RENDERPREP_H
+#define RENDERPREP_H
+
+#include <math.h>
+
+#include "OrbitalTypes.h"
+
+struct SimulationSnapshot;
+
+/**
+ * World units per meter: 1 unit is 100 million km
+ */
+#define RENDER_SCALE 1E-11F
+
+/**
+ * Asteroids closer to the camera than this [units] are drawn as spheres,
+ * the rest as points. Under RENDER_DETAILED_DISTANCE, as detailed spheres.
+ */
+#define RENDER_SPHERE_DISTANCE 5.0F
+#define RENDER_DETAILED_DISTANCE 1.5F
+
+/**
+ * Rings and slices of a detailed sphere (DrawSphere's) and of a coarse one
+ */
+#define RENDER_DETAILED_SPHERE_RINGS 16
+#define RENDER_COARSE_SPHERE_RINGS 6
+
+/**
+ * @brief Levels of detail, nearest first
+ */
+enum RenderLod
+{
+    RENDER_LOD_DETAILED_SPHERE,     // planets, and asteroids right in front of the camera
+    RENDER_LOD_SPHERE,              // coarse spheres
+    RENDER_LOD_POINT,               // one batched point cloud
+    RENDER_LOD_COUNT
+};
+
+/**
+ * @brief Camera, as raylib's Camera3D with a perspective projection
+ */
+struct RenderCamera
+{
+    BodyVector3 position;       // [units]
+    BodyVector3 target;
+    BodyVector3 up;
+    float fovy;                 // vertical field of view [degrees]
+    float aspect;               // width / height
+    float near_plane, far_plane;    // [units]
+};
+
+/**
+ * @brief A sphere to draw, in world units
+ */
+struct RenderSphere
+{
+    BodyVector3 position;
+    float radius;
+    BodyColor color;
+};
+
+/**
+ * @brief What prepareDrawList did with the bodies
+ */
+struct RenderStats
+{
+    unsigned int bodies;
+    unsigned int culled;
+    unsigned int points;
+    unsigned int spheres;           // coarse and detailed
+    unsigned int detailed_spheres;
+};
+
+/**
+ * @brief The bodies to draw, bucketed by level of detail. Each bucket is drawn
+ * batched: one unit sphere mesh scaled and moved per body, or a single point
+ * cloud. Arrays grow as needed and are kept from frame to frame.
+ */
+struct DrawList
+{
+    RenderSphere *spheres[RENDER_LOD_POINT];    // one array per sphere level
+    unsigned int sphere_counts[RENDER_LOD_POINT];
+    unsigned int sphere_capacities[RENDER_LOD_POINT];
+
+    float *points;              // x, y, z of each point, interleaved, as rlgl takes them
+    BodyColor *point_colors;
+    unsigned int point_count;
+    unsigned int point_capacity;
+
+    RenderStats stats;
+};
+
+DrawList *constructDrawList();
+void destroyDrawList(DrawList *list);
+bool prepareDrawList(DrawList *list, const SimulationSnapshot *snapshot, const RenderCamera *camera);
+
+/**
+ * @brief Radius a body is drawn with [units], from its actual radius [m]
+ */
+inline float getRenderRadius(float radius)
+{
+    return 0.015F * logf(radius);
+}
+
+#endif
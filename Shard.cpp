@@ -0,0 +1,742 @@
+/**
+ * @brief Sharded runs: one simulation split across processes over shared memory
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Asteroids never pull on planets, so the planets can go ahead on their own,
+ * as in updateOrbitalSimTiled: the coordinator moves them and writes their
+ * positions at the start of each step to a ring in the segment, then bumps
+ * a published step counter. Each worker moves its slice through every step
+ * published so far, and bumps its own progress counter, which frees those
+ * ring slots. The counters are the only synchronization: whoever gets ahead
+ * spins a while, then sleeps on a process-shared condition.
+ *
+ * Workers pin themselves to a NUMA node (worker i to the i-th node, round
+ * robin) before they allocate their slice, so their memory comes from that
+ * node too. Results are bit for bit those of updateOrbitalSimTiled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "OrbitalSim.h"
+#include "Shard.h"
+
+#ifndef _WIN32
+
+#define SHARD_MAGIC 0x445241485342524FULL   // "ORBSHARD"
+#define SHARD_VERSION 1
+
+/**
+ * Arrays of each asteroid the segment carries: x, y, z, vx, vy, vz, ax, ay, az
+ */
+#define SHARD_ARRAYS 9
+
+/**
+ * Checks of a counter before sleeping on its condition, and how long each
+ * sleep lasts before checking the other side is still alive [ms]
+ */
+#define SHARD_SPIN_COUNT 2000
+#define SHARD_SLEEP_SLICE 100
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "counters shared between processes must be lock-free");
+
+/**
+ * @brief What the segment knows of a worker, on a cache line of its own
+ */
+struct alignas(64) ShardWorkerState
+{
+    std::atomic<unsigned long long> progress;   // steps its slice has gone through
+    std::atomic<unsigned long long> synced;     // step its slice was last written back at
+    std::atomic<int> pid;       // 0 until it attaches
+    int node;                   // NUMA node it pinned itself to, -1: not pinned
+};
+
+/**
+ * @brief The start of the segment. Then come the planets' masses, the ring
+ * (SHARD_RING_STEPS steps of x, y and z of each planet) and each of the
+ * SHARD_ARRAYS arrays of the asteroids, all ORBITALBODIES_ALIGNMENT-aligned.
+ */
+struct ShardSegment
+{
+    unsigned long long magic;
+    unsigned int version;
+    unsigned int worker_count;
+    unsigned int planets_range;
+    unsigned int asteroid_count;
+    int force_precision;
+    int coordinator_pid;
+    double time_step;           // [s]
+    size_t masses_offset;
+    size_t ring_offset;
+    size_t arrays_offset;
+    size_t array_size;          // bytes between two arrays
+    size_t size;
+
+    pthread_mutex_t mutex;              // robust and process-shared, for the conditions only
+    pthread_cond_t published_changed;
+    pthread_cond_t progress_changed;    // or a worker attached, or wrote its slice back
+
+    std::atomic<unsigned long long> published;  // steps whose planet positions are in the ring
+    std::atomic<unsigned long long> target;     // the step the current run ends at
+    std::atomic<int> quit;
+    ShardWorkerState workers[SHARD_MAX_WORKERS];
+};
+
+/**
+ * @brief Rounds a byte count up to the next multiple of ORBITALBODIES_ALIGNMENT
+ */
+static size_t alignSize(size_t size)
+{
+    return (size + ORBITALBODIES_ALIGNMENT - 1) & ~(size_t)(ORBITALBODIES_ALIGNMENT - 1);
+}
+
+static double *getMasses(ShardSegment *segment)
+{
+    return (double *)((char *)segment + segment->masses_offset);
+}
+
+static double *getRing(ShardSegment *segment)
+{
+    return (double *)((char *)segment + segment->ring_offset);
+}
+
+static double *getArray(ShardSegment *segment, int array)
+{
+    return (double *)((char *)segment + segment->arrays_offset + array * segment->array_size);
+}
+
+/**
+ * @brief The asteroids of a worker, counted from the first asteroid. Slices
+ * are whole tiles, but for the last.
+ */
+static void getSlice(const ShardSegment *segment, unsigned int index, unsigned int *begin, unsigned int *end)
+{
+    unsigned int tiles = (segment->asteroid_count + ASTEROIDS_TILE_SIZE - 1) / ASTEROIDS_TILE_SIZE;
+    unsigned int per_worker = (tiles + segment->worker_count - 1) / segment->worker_count * ASTEROIDS_TILE_SIZE;
+
+    *begin = index * per_worker < segment->asteroid_count ? index * per_worker : segment->asteroid_count;
+    *end = *begin + per_worker < segment->asteroid_count ? *begin + per_worker : segment->asteroid_count;
+}
+
+static void lockSegment(ShardSegment *segment)
+{
+    //A process died holding it: nothing it guards can be half-written, go on
+    if (pthread_mutex_lock(&segment->mutex) == EOWNERDEAD)
+        pthread_mutex_consistent(&segment->mutex);
+}
+
+static void notifySegment(ShardSegment *segment, pthread_cond_t *condition)
+{
+    lockSegment(segment);
+    pthread_cond_broadcast(condition);
+    pthread_mutex_unlock(&segment->mutex);
+}
+
+/**
+ * @brief Whether a process is still running. A worker is the coordinator's
+ * child: dead, it stays a zombie until waited for, which kill() can't tell apart.
+ */
+static bool isProcessAlive(int pid)
+{
+    if (kill(pid, 0) != 0 && errno != EPERM)
+        return false;
+
+#ifdef __linux__
+    char path[32], stat[256];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return true;
+    size_t length = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[length] = '\0';
+
+    //The state follows the command name, which may hold anything, in parentheses
+    const char *name_end = strrchr(stat, ')');
+    if (name_end != NULL && name_end[1] == ' ' && (name_end[2] == 'Z' || name_end[2] == 'X'))
+        return false;
+#endif
+    return true;
+}
+
+/**
+ * @brief Something a side of the run waits for, and how to tell the other side is gone
+ */
+struct ShardWait
+{
+    bool (*ready)(ShardSegment *segment, void *context);
+    bool (*alive)(ShardSegment *segment, void *context);
+    void *context;
+};
+
+/**
+ * @brief Waits until wait->ready: spinning first, then sleeping on condition
+ *
+ * @return false if the other side died (or never showed up) first
+ */
+static bool waitSegment(ShardSegment *segment, pthread_cond_t *condition, const ShardWait *wait)
+{
+    for (int spin = 0; spin < SHARD_SPIN_COUNT; spin++)
+    {
+        if (wait->ready(segment, wait->context))
+            return true;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    bool ready = true;
+    lockSegment(segment);
+    while (!wait->ready(segment, wait->context))
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += SHARD_SLEEP_SLICE * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        int result = pthread_cond_timedwait(condition, &segment->mutex, &deadline);
+        if (result == EOWNERDEAD)
+            pthread_mutex_consistent(&segment->mutex);
+        else if (result == ETIMEDOUT && !wait->alive(segment, wait->context))
+        {
+            ready = wait->ready(segment, wait->context);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&segment->mutex);
+    return ready;
+}
+
+/**
+ * @brief The coordinator's waits: until every worker is past a step
+ */
+struct CoordinatorWait
+{
+    const ShardCoordinator *coordinator;
+    unsigned long long step;
+    bool synced;                // written back at step, not just past it
+    std::chrono::steady_clock::time_point start;
+};
+
+static bool areWorkersPast(ShardSegment *segment, void *context)
+{
+    CoordinatorWait *wait = (CoordinatorWait *)context;
+
+    for (unsigned int i = 0; i < segment->worker_count; i++)
+    {
+        const ShardWorkerState *worker = &segment->workers[i];
+        if ((wait->synced ? worker->synced : worker->progress).load(std::memory_order_acquire) < wait->step)
+            return false;
+    }
+    return true;
+}
+
+static bool areWorkersAlive(ShardSegment *segment, void *context)
+{
+    CoordinatorWait *wait = (CoordinatorWait *)context;
+    double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - wait->start).count();
+
+    for (unsigned int i = 0; i < segment->worker_count; i++)
+    {
+        int pid = segment->workers[i].pid.load(std::memory_order_acquire);
+        if (pid == 0 ? waited * 1E3 > SHARD_ATTACH_TIMEOUT : !isProcessAlive(pid))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Waits for every worker to be past a step, timing the wait
+ */
+static bool waitForWorkers(ShardCoordinator *coordinator, unsigned long long step, bool synced)
+{
+    ShardSegment *segment = (ShardSegment *)coordinator->segment;
+    CoordinatorWait context = {coordinator, step, synced, std::chrono::steady_clock::now()};
+    ShardWait wait = {areWorkersPast, areWorkersAlive, &context};
+
+    bool ok = waitSegment(segment, &segment->progress_changed, &wait);
+    coordinator->wait_seconds +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - context.start).count();
+    if (!ok)
+        fprintf(stderr, "shard worker lost (died, or never attached)\n");
+    return ok;
+}
+
+/**
+ * @brief Sets up a sharded run of a simulation: creates the shared memory
+ * segment, with the simulation's asteroids in it, for workerCount workers
+ * to attach to (runShardWorker). Starting them is up to the caller.
+ *
+ * @param sim The simulation. Only canAdvanceOrbitalSimTiled ones can be
+ *            sharded: Euler, planets force model. Not owned.
+ * @param workerCount How many workers, up to SHARD_MAX_WORKERS
+ * @return The coordinator, NULL if the simulation can't be sharded or the
+ *         segment can't be created
+ */
+ShardCoordinator *constructShardCoordinator(OrbitalSim *sim, unsigned int workerCount)
+{
+    if (!canAdvanceOrbitalSimTiled(sim) || sim->interactions != NULL || workerCount == 0 ||
+        workerCount > SHARD_MAX_WORKERS)
+        return NULL;
+
+    ShardCoordinator *coordinator = (ShardCoordinator *)malloc(sizeof(ShardCoordinator));
+    if (coordinator == NULL)
+        return NULL;
+    coordinator->sim = sim;
+    coordinator->worker_count = workerCount;
+    coordinator->wait_seconds = 0;
+    snprintf(coordinator->name, sizeof(coordinator->name), "/orbitalsim-%d", (int)getpid());
+
+    unsigned int planets = sim->planets_range;
+    unsigned int asteroids = sim->bodies_count - planets;
+    size_t masses_offset = alignSize(sizeof(ShardSegment));
+    size_t ring_offset = masses_offset + alignSize(planets * sizeof(double));
+    size_t arrays_offset = ring_offset + alignSize(SHARD_RING_STEPS * 3 * (size_t)planets * sizeof(double));
+    size_t array_size = alignSize((size_t)asteroids * sizeof(double));
+    coordinator->segment_size = arrays_offset + SHARD_ARRAYS * array_size;
+
+    //posix_fallocate: a full /dev/shm fails here, instead of as a SIGBUS later
+    int descriptor = shm_open(coordinator->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (descriptor < 0)
+    {
+        free(coordinator);
+        return NULL;
+    }
+    void *mapping = MAP_FAILED;
+    if (ftruncate(descriptor, (off_t)coordinator->segment_size) == 0 &&
+        posix_fallocate(descriptor, 0, (off_t)coordinator->segment_size) == 0)
+        mapping = mmap(NULL, coordinator->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        shm_unlink(coordinator->name);
+        free(coordinator);
+        return NULL;
+    }
+    coordinator->segment = mapping;
+
+    ShardSegment *segment = new (mapping) ShardSegment();
+    segment->version = SHARD_VERSION;
+    segment->worker_count = workerCount;
+    segment->planets_range = planets;
+    segment->asteroid_count = asteroids;
+    segment->force_precision = sim->force_precision;
+    segment->coordinator_pid = (int)getpid();
+    segment->time_step = sim->time_step;
+    segment->masses_offset = masses_offset;
+    segment->ring_offset = ring_offset;
+    segment->arrays_offset = arrays_offset;
+    segment->array_size = array_size;
+    segment->size = coordinator->segment_size;
+    for (unsigned int i = 0; i < SHARD_MAX_WORKERS; i++)
+        segment->workers[i].node = -1;
+
+    pthread_mutexattr_t mutex_attributes;
+    pthread_mutexattr_init(&mutex_attributes);
+    pthread_mutexattr_setpshared(&mutex_attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&segment->mutex, &mutex_attributes);
+    pthread_mutexattr_destroy(&mutex_attributes);
+
+    pthread_condattr_t condition_attributes;
+    pthread_condattr_init(&condition_attributes);
+    pthread_condattr_setpshared(&condition_attributes, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&condition_attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&segment->published_changed, &condition_attributes);
+    pthread_cond_init(&segment->progress_changed, &condition_attributes);
+    pthread_condattr_destroy(&condition_attributes);
+
+    const OrbitalBodies *bodies = &sim->bodies;
+    memcpy(getMasses(segment), bodies->mass, planets * sizeof(double));
+    const double *sources[SHARD_ARRAYS] = {bodies->x, bodies->y, bodies->z, bodies->vx, bodies->vy,
+                                           bodies->vz, bodies->ax, bodies->ay, bodies->az};
+    for (int array = 0; array < SHARD_ARRAYS; array++)
+        memcpy(getArray(segment, array), sources[array] + planets, asteroids * sizeof(double));
+
+    //Workers check the magic last: everything before it is in place
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->magic = SHARD_MAGIC;
+    return coordinator;
+}
+
+/**
+ * @brief Tells the workers to finish, and removes the segment. Workers
+ * already attached keep their mapping until they quit.
+ */
+void destroyShardCoordinator(ShardCoordinator *coordinator)
+{
+    ShardSegment *segment = (ShardSegment *)coordinator->segment;
+
+    segment->quit.store(1, std::memory_order_release);
+    notifySegment(segment, &segment->published_changed);
+    munmap(coordinator->segment, coordinator->segment_size);
+    shm_unlink(coordinator->name);
+    free(coordinator);
+}
+
+/**
+ * @brief Advances a sharded simulation several steps, as updateOrbitalSimTiled
+ * would, with identical results. Returns once every worker has written its
+ * slice back to the simulation.
+ *
+ * @param coordinator The coordinator
+ * @param steps How many steps to advance
+ * @return false if a worker died or never attached: the simulation is left
+ *         with its planets moved and its asteroids where they were
+ */
+bool runShardCoordinator(ShardCoordinator *coordinator, unsigned int steps)
+{
+    ShardSegment *segment = (ShardSegment *)coordinator->segment;
+    OrbitalSim *sim = coordinator->sim;
+    unsigned int planets = segment->planets_range;
+    unsigned long long published = segment->published.load(std::memory_order_relaxed);
+    unsigned long long target = published + steps;
+
+    if (steps == 0)
+        return true;
+    segment->target.store(target, std::memory_order_release);
+
+    while (published < target)
+    {
+        unsigned int slot = (unsigned int)(published % SHARD_RING_STEPS);
+        unsigned int count = SHARD_RING_STEPS - slot;
+        if (count > SHARD_PUBLISH_STEPS)
+            count = SHARD_PUBLISH_STEPS;
+        if (count > target - published)
+            count = (unsigned int)(target - published);
+
+        //Those slots must be free: the slowest worker past the steps they held
+        if (published + count > SHARD_RING_STEPS &&
+            !waitForWorkers(coordinator, published + count - SHARD_RING_STEPS, false))
+            return false;
+
+        advanceOrbitalSimPlanets(sim, getRing(segment) + 3 * (size_t)slot * planets, count);
+        published += count;
+        segment->published.store(published, std::memory_order_release);
+        notifySegment(segment, &segment->published_changed);
+    }
+
+    if (!waitForWorkers(coordinator, target, true))
+        return false;
+
+    OrbitalBodies *bodies = &sim->bodies;
+    double *destinations[SHARD_ARRAYS] = {bodies->x, bodies->y, bodies->z, bodies->vx, bodies->vy,
+                                          bodies->vz, bodies->ax, bodies->ay, bodies->az};
+    for (int array = 0; array < SHARD_ARRAYS; array++)
+        memcpy(destinations[array] + planets, getArray(segment, array),
+               segment->asteroid_count * sizeof(double));
+
+    for (unsigned int step = 0; step < steps; step++)
+        sim->time_elapsed += sim->time_step;
+    sim->force_evaluations += steps;
+    sim->accelerations_valid = false;
+    INSTRUMENT_STEPS(sim, steps);
+    return true;
+}
+
+/**
+ * @brief The NUMA node a worker pinned itself to
+ *
+ * @return The node, -1 if it didn't pin itself (no NUMA information) or hasn't attached yet
+ */
+int getShardWorkerNode(const ShardCoordinator *coordinator, unsigned int index)
+{
+    return ((const ShardSegment *)coordinator->segment)->workers[index].node;
+}
+
+/**
+ * @brief Parses a Linux CPU or node list, such as "0-3,8-11"
+ */
+static bool parseCpuList(const char *text, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (*text >= '0' && *text <= '9')
+    {
+        char *end;
+        unsigned long first = strtoul(text, &end, 10), last = first;
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        text = *end == ',' ? end + 1 : end;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+static bool readCpuList(const char *path, cpu_set_t *set)
+{
+    char text[4096];
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+    bool ok = fgets(text, sizeof(text), file) != NULL && parseCpuList(text, set);
+    fclose(file);
+    return ok;
+}
+
+/**
+ * @brief Pins the calling process to the CPUs of a NUMA node, the index-th
+ * of the online ones, round robin
+ *
+ * @param index The worker index
+ * @param workerCount How many workers there are
+ * @param threadCount Set to how many of the node's CPUs are this worker's:
+ *                    the node's, over the workers that share it
+ * @return The node, -1 if there is no NUMA information (nothing is pinned)
+ */
+static int pinToNumaNode(unsigned int index, unsigned int workerCount, unsigned int *threadCount)
+{
+    cpu_set_t nodes, cpus, allowed;
+    int online[CPU_SETSIZE];
+    unsigned int node_count = 0;
+
+    if (!readCpuList("/sys/devices/system/node/online", &nodes))
+        return -1;
+    for (int node = 0; node < CPU_SETSIZE; node++)
+        if (CPU_ISSET(node, &nodes))
+            online[node_count++] = node;
+
+    char path[64];
+    int node = online[index % node_count];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (!readCpuList(path, &cpus) || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return -1;
+
+    //Only the CPUs this process may run on to begin with (a container's, say)
+    CPU_AND(&cpus, &cpus, &allowed);
+    if (CPU_COUNT(&cpus) == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+        return -1;
+
+    unsigned int sharing = workerCount / node_count + (index % node_count < workerCount % node_count);
+    *threadCount = ((unsigned int)CPU_COUNT(&cpus) + sharing - 1) / sharing;
+    return node;
+}
+
+/**
+ * @brief The worker's waits: until the coordinator publishes, asks for the
+ * slice back or quits
+ */
+struct WorkerWait
+{
+    const ShardWorkerState *worker;
+};
+
+static bool hasWork(ShardSegment *segment, void *context)
+{
+    const ShardWorkerState *worker = ((WorkerWait *)context)->worker;
+    unsigned long long progress = worker->progress.load(std::memory_order_relaxed);
+
+    return segment->quit.load(std::memory_order_acquire) ||
+           segment->published.load(std::memory_order_acquire) > progress ||
+           (segment->target.load(std::memory_order_acquire) == progress &&
+            worker->synced.load(std::memory_order_relaxed) < progress);
+}
+
+static bool isCoordinatorAlive(ShardSegment *segment, void *context)
+{
+    (void)context;
+    return isProcessAlive(segment->coordinator_pid);
+}
+
+/**
+ * @brief Opens a coordinator's segment and checks it
+ *
+ * @return The segment, mapped, NULL on error
+ */
+static ShardSegment *openSegment(const char *name, size_t *size)
+{
+    int descriptor = shm_open(name, O_RDWR, 0);
+    if (descriptor < 0)
+        return NULL;
+
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && (size_t)status.st_size >= sizeof(ShardSegment))
+    {
+        *size = (size_t)status.st_size;
+        mapping = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    }
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+        return NULL;
+
+    ShardSegment *segment = (ShardSegment *)mapping;
+    if (segment->magic != SHARD_MAGIC || segment->version != SHARD_VERSION || segment->size != *size)
+    {
+        munmap(mapping, *size);
+        return NULL;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return segment;
+}
+
+/**
+ * @brief Runs a worker of a sharded run until the coordinator is done:
+ * pins itself to a NUMA node, copies its slice of the asteroids to memory
+ * of its own and moves them through every step the coordinator publishes
+ *
+ * @param name The coordinator's segment (ShardCoordinator::name)
+ * @param index Which worker this is, from 0
+ * @param threadCount Threads to move the slice with, 0 for one per CPU of
+ *                    its NUMA node (shared with the node's other workers)
+ * @return false if the segment can't be opened, there is no such worker, or
+ *         the coordinator died
+ */
+bool runShardWorker(const char *name, unsigned int index, unsigned int threadCount)
+{
+    size_t size;
+    ShardSegment *segment = openSegment(name, &size);
+    if (segment == NULL)
+    {
+        fprintf(stderr, "%s: not a sharded run\n", name);
+        return false;
+    }
+    ShardWorkerState *worker = &segment->workers[index < SHARD_MAX_WORKERS ? index : 0];
+    int expected = 0;
+    if (index >= segment->worker_count || !worker->pid.compare_exchange_strong(expected, (int)getpid()))
+    {
+        fprintf(stderr, "%s: no worker %u, or it's already running\n", name, index);
+        munmap(segment, size);
+        return false;
+    }
+
+    unsigned int node_threads = 0;
+    worker->node = pinToNumaNode(index, segment->worker_count, &node_threads);
+    if (threadCount == 0)
+        threadCount = node_threads;
+
+    //Allocated once pinned, so first touch puts the slice on this node
+    unsigned int planets = segment->planets_range;
+    unsigned int begin, end;
+    getSlice(segment, index, &begin, &end);
+
+    OrbitalBodies bodies;
+    OrbitalSim *sim = NULL;
+    if (allocateOrbitalBodies(&bodies, planets + (end - begin)))
+    {
+        //Their positions come from the ring
+        memcpy(bodies.mass, getMasses(segment), planets * sizeof(double));
+        sim = constructOrbitalSimFromBodies(segment->time_step, &bodies, planets + (end - begin), planets,
+                                            threadCount);
+        if (sim == NULL)
+            freeOrbitalBodies(&bodies);
+    }
+    if (sim == NULL)
+    {
+        fprintf(stderr, "worker %u: not enough memory for %u asteroids\n", index, end - begin);
+        munmap(segment, size);
+        return false;
+    }
+    setOrbitalSimPrecision(sim, (ForcePrecision)segment->force_precision);
+
+    double *arrays[SHARD_ARRAYS] = {bodies.x, bodies.y, bodies.z, bodies.vx, bodies.vy,
+                                    bodies.vz, bodies.ax, bodies.ay, bodies.az};
+    for (int array = 0; array < SHARD_ARRAYS; array++)
+        memcpy(arrays[array] + planets, getArray(segment, array) + begin, (end - begin) * sizeof(double));
+    notifySegment(segment, &segment->progress_changed);
+
+    WorkerWait context = {worker};
+    ShardWait wait = {hasWork, isCoordinatorAlive, &context};
+    bool ok = true;
+    while (ok)
+    {
+        if (!waitSegment(segment, &segment->published_changed, &wait))
+        {
+            fprintf(stderr, "worker %u: coordinator lost\n", index);
+            ok = false;
+            break;
+        }
+        if (segment->quit.load(std::memory_order_acquire))
+            break;
+
+        unsigned long long progress = worker->progress.load(std::memory_order_relaxed);
+        unsigned long long published = segment->published.load(std::memory_order_acquire);
+        if (published > progress)
+        {
+            unsigned int slot = (unsigned int)(progress % SHARD_RING_STEPS);
+            unsigned int count = SHARD_RING_STEPS - slot;
+            if (count > TILE_MAX_STEPS)
+                count = TILE_MAX_STEPS;
+            if (count > published - progress)
+                count = (unsigned int)(published - progress);
+
+            advanceOrbitalSimAsteroids(sim, getRing(segment) + 3 * (size_t)slot * planets, count);
+            progress += count;
+            worker->progress.store(progress, std::memory_order_release);
+        }
+
+        //Done with the run: the slice goes back for the coordinator to gather
+        if (segment->target.load(std::memory_order_acquire) == progress &&
+            worker->synced.load(std::memory_order_relaxed) < progress)
+        {
+            for (int array = 0; array < SHARD_ARRAYS; array++)
+                memcpy(getArray(segment, array) + begin, arrays[array] + planets,
+                       (end - begin) * sizeof(double));
+            worker->synced.store(progress, std::memory_order_release);
+        }
+        notifySegment(segment, &segment->progress_changed);
+    }
+
+    destroyOrbitalSim(sim);
+    munmap(segment, size);
+    return ok;
+}
+
+#else
+
+ShardCoordinator *constructShardCoordinator(OrbitalSim *sim, unsigned int workerCount)
+{
+    (void)sim;
+    (void)workerCount;
+    return NULL;
+}
+
+void destroyShardCoordinator(ShardCoordinator *coordinator)
+{
+    (void)coordinator;
+}
+
+bool runShardCoordinator(ShardCoordinator *coordinator, unsigned int steps)
+{
+    (void)coordinator;
+    (void)steps;
+    return false;
+}
+
+int getShardWorkerNode(const ShardCoordinator *coordinator, unsigned int index)
+{
+    (void)coordinator;
+    (void)index;
+    return -1;
+}
+
+bool runShardWorker(const char *name, unsigned int index, unsigned int threadCount)
+{
+    (void)name;
+    (void)index;
+    (void)threadCount;
+    fprintf(stderr, "sharded runs need POSIX shared memory\n");
+    return false;
+}
+
+#endif
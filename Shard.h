@@ -0,0 +1,63 @@
+/**
+ * @brief Sharded runs: one simulation split across processes over shared memory
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+
+struct OrbitalSim;
+
+/**
+ * Most worker processes a run can be split across
+ */
+#define SHARD_MAX_WORKERS 64
+
+/**
+ * Steps of planet positions the shared ring holds: how far the coordinator
+ * can run ahead of the slowest worker
+ */
+#define SHARD_RING_STEPS 1024
+
+/**
+ * Most steps the coordinator publishes at a time
+ */
+#define SHARD_PUBLISH_STEPS 64
+
+/**
+ * Milliseconds a worker has to attach before the run is given up
+ */
+#define SHARD_ATTACH_TIMEOUT 10000
+
+#define SHARD_NAME_SIZE 64
+
+/**
+ * @brief The coordinator side of a sharded run. It keeps moving the planets
+ * of its simulation and publishes their positions, step by step, in a
+ * shared memory segment; each worker process attaches to the segment, takes
+ * a slice of the asteroids to its own memory and moves them against those
+ * positions. The asteroids come back to the simulation at the end of each
+ * run, so between runs it can be saved or read as usual.
+ */
+struct ShardCoordinator
+{
+    OrbitalSim *sim;            // not owned
+    char name[SHARD_NAME_SIZE]; // of the shared memory segment, for the workers to open
+    unsigned int worker_count;
+
+    void *segment;              // the segment, mapped
+    size_t segment_size;
+    double wait_seconds;        // the coordinator spent waiting for workers, since construction
+};
+
+ShardCoordinator *constructShardCoordinator(OrbitalSim *sim, unsigned int workerCount);
+void destroyShardCoordinator(ShardCoordinator *coordinator);
+bool runShardCoordinator(ShardCoordinator *coordinator, unsigned int steps);
+int getShardWorkerNode(const ShardCoordinator *coordinator, unsigned int index);
+bool runShardWorker(const char *name, unsigned int index, unsigned int threadCount = 0);
+
+#endif
@@ -0,0 +1,307 @@
+/**
+ * @brief Runs a simulation on a thread of its own, publishing snapshots
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * The simulation steps as fast as it can, at a target rate, or as many steps
+ * a frame as a FrameScheduler fits, and now and then copies what the view
+ * draws into a snapshot. The view picks up the
+ * newest complete snapshot each frame, so a slow frame never holds up the
+ * simulation and a long step never holds up the view.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "OrbitalSim.h"
+#include "SimulationThread.h"
+#include "FrameScheduler.h"
+
+#define SNAPSHOT_INDEX_MASK 3
+#define SNAPSHOT_FRESH 4
+
+/**
+ * Longest nap between checks for quit or a new rate [s]
+ */
+#define MAX_SLEEP 0.01
+
+/**
+ * When the simulation falls this far behind its target rate [s], it stops
+ * trying to catch up
+ */
+#define MAX_LAG 0.1
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @brief Makes a snapshot able to hold some bodies. Keeps its contents if
+ * it already can.
+ *
+ * @return false if out of memory
+ */
+static bool reserveSnapshot(SimulationSnapshot *snapshot, unsigned int count)
+{
+    if (count <= snapshot->capacity && snapshot->block != NULL)
+        return true;
+
+    void *block = malloc(count * (4 * sizeof(float) + sizeof(BodyColor)) + 1);
+    if (block == NULL)
+        return false;
+
+    free(snapshot->block);
+    snapshot->block = block;
+    snapshot->capacity = count;
+    snapshot->x = (float *)block;
+    snapshot->y = snapshot->x + count;
+    snapshot->z = snapshot->y + count;
+    snapshot->radius = snapshot->z + count;
+    snapshot->color = (BodyColor *)(snapshot->radius + count);
+    return true;
+}
+
+/**
+ * @brief What copyChunk copies from and to
+ */
+struct SnapshotCopy
+{
+    const OrbitalSim *sim;
+    SimulationSnapshot *snapshot;
+};
+
+/**
+ * @brief Copies a range of bodies into a snapshot (a ThreadPoolTask)
+ */
+static void copyChunk(void *context, unsigned int begin, unsigned int end)
+{
+    SnapshotCopy *copy = (SnapshotCopy *)context;
+    const OrbitalBodies *bodies = &copy->sim->bodies;
+    SimulationSnapshot *snapshot = copy->snapshot;
+
+    for (unsigned int i = begin; i < end; i++)
+    {
+        snapshot->x[i] = (float)bodies->x[i];
+        snapshot->y[i] = (float)bodies->y[i];
+        snapshot->z[i] = (float)bodies->z[i];
+    }
+    memcpy(snapshot->radius + begin, bodies->radius + begin, (end - begin) * sizeof(float));
+    memcpy(snapshot->color + begin, bodies->color + begin, (end - begin) * sizeof(BodyColor));
+}
+
+/**
+ * @brief Copies a simulation into a snapshot, growing it if needed. Uses the
+ * simulation's thread pool, so call it from the thread that steps it.
+ *
+ * @param sim The simulation
+ * @param snapshot The snapshot; zero-filled, or filled in by an earlier call
+ * @return false if out of memory (the snapshot is left as it was)
+ */
+bool captureSimulationSnapshot(const OrbitalSim *sim, SimulationSnapshot *snapshot)
+{
+    SnapshotCopy copy = {sim, snapshot};
+
+    if (!reserveSnapshot(snapshot, sim->bodies_count))
+        return false;
+
+    runThreadPool(sim->pool, copyChunk, &copy, 0, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+    snapshot->bodies_count = sim->bodies_count;
+    snapshot->planets_range = sim->planets_range;
+    snapshot->time_elapsed = sim->time_elapsed;
+    snapshot->time_step = sim->time_step;
+    return true;
+}
+
+/**
+ * @brief Frees the arrays of a snapshot filled in by captureSimulationSnapshot
+ */
+void freeSimulationSnapshot(SimulationSnapshot *snapshot)
+{
+    free(snapshot->block);
+    memset(snapshot, 0, sizeof(SimulationSnapshot));
+}
+
+/**
+ * @brief Copies the simulation into the back snapshot and swaps it in as the
+ * newest one. Skipped while the previous one is unread and still recent.
+ */
+static void publishSnapshot(SimulationThread *thread, bool force)
+{
+    SnapshotBuffer *buffer = &thread->snapshots;
+    Clock::time_point now = Clock::now();
+
+    if (!force && (buffer->middle.load(std::memory_order_acquire) & SNAPSHOT_FRESH) &&
+        std::chrono::duration<double>(now - thread->last_publish).count() < SNAPSHOT_REFRESH_PERIOD)
+        return;
+
+    SimulationSnapshot *snapshot = &buffer->slots[buffer->back];
+    if (!captureSimulationSnapshot(thread->sim, snapshot))
+        return;
+    snapshot->steps = thread->steps.load(std::memory_order_relaxed);
+
+    buffer->back = buffer->middle.exchange(buffer->back | SNAPSHOT_FRESH, std::memory_order_acq_rel) &
+                   SNAPSHOT_INDEX_MASK;
+    thread->last_publish = now;
+}
+
+/**
+ * @brief Steps the simulation a frame at a time, as many steps as the
+ * scheduler plans, publishing a snapshot after each frame's
+ */
+static void runScheduledFrames(SimulationThread *thread)
+{
+    FrameScheduler *scheduler = thread->scheduler;
+    OrbitalSim *sim = thread->sim;
+    Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(scheduler->frame_period));
+    Clock::duration nap = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(MAX_SLEEP));
+    Clock::time_point deadline = Clock::now();
+
+    while (!thread->quit.load(std::memory_order_relaxed))
+    {
+        unsigned int steps = planFrameSteps(scheduler, sim->time_step);
+        Clock::time_point start = Clock::now();
+        if (steps > 0)
+        {
+            updateOrbitalSimTiled(sim, steps);
+            thread->steps.fetch_add(steps, std::memory_order_relaxed);
+        }
+        Clock::time_point stepped = Clock::now();
+        measureFrameSteps(scheduler, steps, std::chrono::duration<double>(stepped - start).count(),
+                          sim->time_step);
+
+        if (steps > 0)
+        {
+            publishSnapshot(thread, true);
+            measureFramePublish(scheduler, std::chrono::duration<double>(Clock::now() - stepped).count());
+        }
+
+        //A frame that ran over starts the next one late, rather than squeezing it
+        deadline += period;
+        Clock::time_point now = Clock::now();
+        if (now - deadline > period)
+            deadline = now;
+        while (now < deadline && !thread->quit.load(std::memory_order_relaxed))
+        {
+            std::this_thread::sleep_for(deadline - now < nap ? deadline - now : nap);
+            now = Clock::now();
+        }
+    }
+}
+
+static void simulationMain(SimulationThread *thread)
+{
+    if (thread->scheduler != NULL)
+    {
+        runScheduledFrames(thread);
+        return;
+    }
+
+    Clock::time_point deadline = Clock::now();
+
+    while (!thread->quit.load(std::memory_order_relaxed))
+    {
+        double rate = thread->target_rate.load(std::memory_order_relaxed);
+        if (rate > 0)
+        {
+            Clock::time_point now = Clock::now();
+            deadline += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / rate));
+            if (now - deadline > std::chrono::duration<double>(MAX_LAG))
+                deadline = now;
+
+            // In naps, so a new rate or quit is seen soon even at slow rates
+            while (now < deadline && !thread->quit.load(std::memory_order_relaxed) &&
+                   thread->target_rate.load(std::memory_order_relaxed) == rate)
+            {
+                Clock::duration nap = std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(MAX_SLEEP));
+                std::this_thread::sleep_for(deadline - now < nap ? deadline - now : nap);
+                now = Clock::now();
+            }
+            if (now < deadline)
+            {
+                deadline = now;
+                continue;
+            }
+        }
+        else
+            deadline = Clock::now();
+
+        updateOrbitalSim(thread->sim);
+        thread->steps.fetch_add(1, std::memory_order_relaxed);
+        publishSnapshot(thread, false);
+    }
+}
+
+/**
+ * @brief Starts stepping a simulation on a thread of its own. The first
+ * snapshot, of the simulation as it is now, is ready on return.
+ *
+ * @param sim The simulation. Don't touch it until destroySimulationThread.
+ * @param targetRate Steps per second, 0 to step as fast as possible
+ * @param scheduler If not NULL, paces the simulation instead of targetRate.
+ *                  Not owned: destroy it after the thread.
+ * @return The simulation thread, NULL if out of memory
+ */
+SimulationThread *constructSimulationThread(OrbitalSim *sim, double targetRate, FrameScheduler *scheduler)
+{
+    SimulationThread *thread = new (std::nothrow) SimulationThread();
+    if (thread == NULL)
+        return NULL;
+
+    thread->sim = sim;
+    thread->target_rate = targetRate;
+    thread->scheduler = scheduler;
+    thread->snapshots.front = 0;
+    thread->snapshots.middle = 1;
+    thread->snapshots.back = 2;
+
+    publishSnapshot(thread, true);
+    if (!(thread->snapshots.middle.load() & SNAPSHOT_FRESH))
+    {
+        destroySimulationThread(thread);
+        return NULL;
+    }
+
+    thread->thread = std::thread(simulationMain, thread);
+    return thread;
+}
+
+/**
+ * @brief Stops the simulation thread. The simulation is the caller's again,
+ * stopped after a whole step.
+ */
+void destroySimulationThread(SimulationThread *thread)
+{
+    thread->quit = true;
+    if (thread->thread.joinable())
+        thread->thread.join();
+
+    for (int i = 0; i < 3; i++)
+        freeSimulationSnapshot(&thread->snapshots.slots[i]);
+    delete thread;
+}
+
+/**
+ * @brief Changes how fast the simulation steps
+ *
+ * @param targetRate Steps per second, 0 to step as fast as possible
+ */
+void setSimulationRate(SimulationThread *thread, double targetRate)
+{
+    thread->target_rate.store(targetRate, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the newest complete snapshot. It stays valid, and unchanged,
+ * until the next call. Call from one thread only.
+ */
+const SimulationSnapshot *acquireSimulationSnapshot(SimulationThread *thread)
+{
+    SnapshotBuffer *buffer = &thread->snapshots;
+
+    if (buffer->middle.load(std::memory_order_relaxed) & SNAPSHOT_FRESH)
+        buffer->front = buffer->middle.exchange(buffer->front, std::memory_order_acq_rel) &
+                        SNAPSHOT_INDEX_MASK;
+    return &buffer->slots[buffer->front];
+}
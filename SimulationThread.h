@@ -0,0 +1,86 @@
+/**
+ * @brief Runs a simulation on a thread of its own, publishing snapshots
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef SIMULATIONTHREAD_H
+#define SIMULATIONTHREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "OrbitalTypes.h"
+
+struct OrbitalSim;
+struct FrameScheduler;
+
+/**
+ * While the last snapshot hasn't been picked up, a newer one replaces it
+ * only after this long [s]: enough to keep a 240 Hz display fresh without
+ * copying every body every step.
+ */
+#define SNAPSHOT_REFRESH_PERIOD (1.0 / 240)
+
+/**
+ * @brief What the view needs of a simulation at one instant
+ */
+struct SimulationSnapshot
+{
+    unsigned int bodies_count;
+    unsigned int planets_range;
+    double time_elapsed;        // [s]
+    double time_step;           // [s]
+    unsigned long long steps;   // taken by the simulation thread when this was copied
+
+    float *x, *y, *z;           // [m]
+    float *radius;              // [m]
+    BodyColor *color;
+
+    unsigned int capacity;      // bodies the arrays hold
+    void *block;                // the allocation the arrays are carved from
+};
+
+/**
+ * @brief Lock-free triple buffer of snapshots. The writer fills the back
+ * slot and swaps it with the middle one; the reader swaps its front slot
+ * with the middle one when the middle one is newer. Neither ever waits.
+ */
+struct SnapshotBuffer
+{
+    SimulationSnapshot slots[3];
+    std::atomic<unsigned int> middle;   // slot index, plus SNAPSHOT_FRESH if not read yet
+    unsigned int back;                  // writer only
+    unsigned int front;                 // reader only
+};
+
+/**
+ * @brief The simulation thread. Once it runs, it owns the simulation: other
+ * threads see it only through snapshots until destroySimulationThread.
+ */
+struct SimulationThread
+{
+    OrbitalSim *sim;
+    SnapshotBuffer snapshots;
+
+    std::thread thread;
+    std::atomic<bool> quit;
+    std::atomic<double> target_rate;    // steps per second, 0: as fast as it goes
+    FrameScheduler *scheduler;          // paces it instead of target_rate, NULL: none. Not owned.
+    std::atomic<unsigned long long> steps;
+
+    std::chrono::steady_clock::time_point last_publish;     // simulation thread only
+};
+
+SimulationThread *constructSimulationThread(OrbitalSim *sim, double targetRate = 0,
+                                           FrameScheduler *scheduler = NULL);
+void destroySimulationThread(SimulationThread *thread);
+void setSimulationRate(SimulationThread *thread, double targetRate);
+const SimulationSnapshot *acquireSimulationSnapshot(SimulationThread *thread);
+
+bool captureSimulationSnapshot(const OrbitalSim *sim, SimulationSnapshot *snapshot);
+void freeSimulationSnapshot(SimulationSnapshot *snapshot);
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * @brief Persistent worker pool for data-parallel loops
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * The chunks of a loop are dealt evenly between the threads up front. Each
+ * thread takes chunks from its own share and, once it runs dry, steals from
+ * the others. Taking a chunk is a single atomic increment, so there are no
+ * locks on the way; the mutex is only used to post a loop and to wait for it
+ * (the barrier at the end of each runThreadPool).
+ */
+
+#include <stdint.h>
+#include <new>
+
+#include "ThreadPool.h"
+
+static void workOnLoop(ThreadPool *pool, unsigned int id);
+static void workerMain(ThreadPool *pool, unsigned int id);
+
+/**
+ * @brief Gets how many threads the hardware runs at once
+ *
+ * @return The thread count, at least 1
+ */
+unsigned int getHardwareThreadCount()
+{
+    unsigned int count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+/**
+ * @brief Constructs a thread pool, and starts its threads
+ *
+ * @param threadCount How many threads work on each loop, counting the caller.
+ *                    0 means one per hardware thread.
+ * @return The pool
+ */
+ThreadPool *constructThreadPool(unsigned int threadCount)
+{
+    ThreadPool *pool = new ThreadPool();
+
+    if (threadCount == 0)
+        threadCount = getHardwareThreadCount();
+
+    pool->thread_count = threadCount;
+    // new only aligns to alignof(max_align_t) before C++17
+    pool->queues_memory = new char[(threadCount + 1) * sizeof(ThreadPoolQueue)];
+    uintptr_t address = (uintptr_t)pool->queues_memory + alignof(ThreadPoolQueue) - 1;
+    pool->queues = (ThreadPoolQueue *)(address - address % alignof(ThreadPoolQueue));
+    for (unsigned int i = 0; i < threadCount; i++)
+        new (&pool->queues[i]) ThreadPoolQueue();
+    pool->generation = 0;
+    pool->running = 0;
+    pool->quit = false;
+
+    pool->threads = new std::thread[threadCount - 1];
+    for (unsigned int i = 1; i < threadCount; i++)
+        pool->threads[i - 1] = std::thread(workerMain, pool, i);
+
+    return pool;
+}
+
+/**
+ * @brief Stops the threads of a pool, and destroys it
+ *
+ * @param pool The pool
+ */
+void destroyThreadPool(ThreadPool *pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->quit = true;
+    }
+    pool->wake.notify_all();
+
+    for (unsigned int i = 1; i < pool->thread_count; i++)
+        pool->threads[i - 1].join();
+
+    delete[] pool->threads;
+    delete[] pool->queues_memory;
+    delete pool;
+}
+
+/**
+ * @brief Runs a loop over [begin, end) on every thread of the pool, and
+ *        returns once all of it is done
+ *
+ * @param pool The pool, may be NULL to run the loop on the calling thread
+ * @param task The loop body
+ * @param context Passed on to task
+ * @param begin First index of the loop
+ * @param end One past the last index of the loop
+ * @param chunkSize How many indices are handed out at a time
+ */
+void runThreadPool(ThreadPool *pool, ThreadPoolTask task, void *context,
+                   unsigned int begin, unsigned int end, unsigned int chunkSize)
+{
+    unsigned int chunks, share, i;
+
+    if (begin >= end)
+        return;
+
+    chunks = (end - begin + chunkSize - 1) / chunkSize;
+    if (pool == NULL || pool->thread_count == 1 || chunks == 1)
+    {
+        task(context, begin, end);
+        return;
+    }
+
+    pool->task = task;
+    pool->context = context;
+    pool->begin = begin;
+    pool->end = end;
+    pool->chunk_size = chunkSize;
+
+    //Deals the chunks evenly, the first (chunks % thread_count) threads get one more
+    share = 0;
+    for (i = 0; i < pool->thread_count; i++)
+    {
+        unsigned int count = chunks / pool->thread_count + (i < chunks % pool->thread_count);
+        pool->queues[i].next.store(share, std::memory_order_relaxed);
+        pool->queues[i].end = share + count;
+        share += count;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->generation++;
+        pool->running = pool->thread_count - 1;
+    }
+    pool->wake.notify_all();
+
+    workOnLoop(pool, 0);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done.wait(lock, [pool] { return pool->running == 0; });
+}
+
+/**
+ * @brief Runs chunks of the current loop until there are none left, starting
+ *        with the thread's own share and then stealing from the others'
+ */
+static void workOnLoop(ThreadPool *pool, unsigned int id)
+{
+    for (unsigned int offset = 0; offset < pool->thread_count; offset++)
+    {
+        ThreadPoolQueue *queue = &pool->queues[(id + offset) % pool->thread_count];
+        unsigned int chunk;
+
+        while ((chunk = queue->next.fetch_add(1, std::memory_order_relaxed)) < queue->end)
+        {
+            unsigned int chunk_begin = pool->begin + chunk * pool->chunk_size;
+            unsigned int chunk_end = chunk_begin + pool->chunk_size;
+            if (chunk_end > pool->end || chunk_end < chunk_begin)
+                chunk_end = pool->end;
+
+            pool->task(pool->context, chunk_begin, chunk_end);
+        }
+    }
+}
+
+/**
+ * @brief Body of each pool thread: waits for loops, and works on them
+ */
+static void workerMain(ThreadPool *pool, unsigned int id)
+{
+    unsigned long seen = 0;
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    for (;;)
+    {
+        pool->wake.wait(lock, [pool, seen] { return pool->quit || pool->generation != seen; });
+        if (pool->quit)
+            return;
+        seen = pool->generation;
+
+        lock.unlock();
+        workOnLoop(pool, id);
+        lock.lock();
+
+        if (--pool->running == 0)
+            pool->done.notify_one();
+    }
+}
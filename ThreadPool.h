@@ -0,0 +1,61 @@
+/**
+ * @brief Persistent worker pool for data-parallel loops
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief A loop body. Called with disjoint [begin, end) sub-ranges of the loop.
+ */
+typedef void (*ThreadPoolTask)(void *context, unsigned int begin, unsigned int end);
+
+/**
+ * @brief Per-thread share of the chunks of a loop. Other threads steal from it
+ * once they run out of their own chunks. Each one has a cache line of its own.
+ */
+struct alignas(64) ThreadPoolQueue
+{
+    std::atomic<unsigned int> next;     // next chunk to take
+    unsigned int end;                   // one past the last chunk of this share
+};
+
+/**
+ * @brief The pool. The thread that calls runThreadPool works too, so a pool
+ * of thread_count threads only starts thread_count - 1 of them.
+ */
+struct ThreadPool
+{
+    unsigned int thread_count;
+    std::thread *threads;
+    ThreadPoolQueue *queues;
+    char *queues_memory;                // queues lives inside it, moved up to a cache line
+
+    std::mutex mutex;
+    std::condition_variable wake;       // a new loop was posted, or quit
+    std::condition_variable done;       // every worker finished the loop
+    unsigned long generation;           // how many loops were posted
+    unsigned int running;               // workers still inside the current loop
+    bool quit;
+
+    // The loop being run
+    ThreadPoolTask task;
+    void *context;
+    unsigned int begin, end, chunk_size;
+};
+
+ThreadPool *constructThreadPool(unsigned int threadCount);
+void destroyThreadPool(ThreadPool *pool);
+void runThreadPool(ThreadPool *pool, ThreadPoolTask task, void *context,
+                   unsigned int begin, unsigned int end, unsigned int chunkSize);
+unsigned int getHardwareThreadCount();
+
+#endif
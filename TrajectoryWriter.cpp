@@ -0,0 +1,450 @@
+/**
+ * @brief Trajectory recording: streams sampled body positions to disk
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * The simulation thread only copies positions; quantizing, encoding and
+ * writing happen on a thread of their own, one snapshot behind. Positions
+ * are quantized before they are differenced, so rounding errors never
+ * accumulate along the file: each frame is exact to quantum / 2.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "OrbitalSim.h"
+#include "TrajectoryWriter.h"
+
+/**
+ * Bytes of a frame before its varints: size, keyframe flag and time
+ */
+#define FRAME_HEADER_SIZE (sizeof(uint32_t) + 1 + sizeof(double))
+
+/**
+ * Longest varint of a 64-bit value
+ */
+#define MAX_VARINT_SIZE 10
+
+static uint64_t encodeZigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t decodeZigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static unsigned char *writeVarint(unsigned char *walker, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *walker++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *walker++ = (unsigned char)value;
+    return walker;
+}
+
+/**
+ * @return Past the varint, NULL if it runs past end
+ */
+static const unsigned char *readVarint(const unsigned char *walker, const unsigned char *end,
+                                       uint64_t *value)
+{
+    uint64_t result = 0;
+
+    for (int shift = 0; walker < end && shift < 64; shift += 7)
+    {
+        unsigned char byte = *walker++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return walker;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Quantizes, delta-encodes and writes a snapshot
+ */
+static void writeFrame(TrajectoryWriter *writer, const TrajectorySnapshot *snapshot)
+{
+    unsigned int count = writer->body_count;
+    bool keyframe = writer->frames_written % TRAJECTORY_KEYFRAME_INTERVAL == 0;
+    const double *axes[3] = {snapshot->x, snapshot->y, snapshot->z};
+    double scale = 1.0 / writer->quantum;
+    unsigned char *walker = writer->frame + FRAME_HEADER_SIZE;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const double *positions = axes[axis];
+        int64_t *previous = writer->previous + (size_t)axis * count;
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            // Rounds half away from zero, as llround, without the library call
+            double scaled = positions[i] * scale;
+            int64_t quantized = positions[i] == positions[i]
+                                    ? (int64_t)(scaled + (scaled >= 0 ? 0.5 : -0.5))
+                                    : TRAJECTORY_REMOVED;
+            // Wraps, not overflows, into and out of TRAJECTORY_REMOVED
+            int64_t delta = (int64_t)((uint64_t)quantized - (uint64_t)previous[i]);
+            walker = writeVarint(walker, encodeZigzag(keyframe ? quantized : delta));
+            previous[i] = quantized;
+        }
+    }
+
+    uint32_t payload = (uint32_t)(walker - writer->frame - sizeof(uint32_t));
+    unsigned char flag = keyframe;
+    memcpy(writer->frame, &payload, sizeof(payload));
+    memcpy(writer->frame + sizeof(uint32_t), &flag, 1);
+    memcpy(writer->frame + sizeof(uint32_t) + 1, &snapshot->time, sizeof(double));
+
+    size_t size = walker - writer->frame;
+    if (fwrite(writer->frame, 1, size, writer->file) != size)
+        writer->failed = true;
+    writer->bytes_written += size;
+    writer->frames_written++;
+}
+
+static void writerMain(TrajectoryWriter *writer)
+{
+    std::unique_lock<std::mutex> lock(writer->mutex);
+
+    while (true)
+    {
+        unsigned int index = writer->next_write;
+
+        writer->filled.wait(lock, [writer, index] { return writer->full[index] || writer->quit; });
+        if (!writer->full[index])
+            break;
+
+        lock.unlock();
+        writeFrame(writer, &writer->snapshots[index]);
+        lock.lock();
+
+        writer->full[index] = false;
+        writer->next_write = index ^ 1;
+        writer->written.notify_all();
+    }
+}
+
+static bool writeHeader(TrajectoryWriter *writer)
+{
+    uint32_t fields[2] = {TRAJECTORY_VERSION, writer->body_count};
+    uint32_t layout[2] = {writer->interval, writer->range_count};
+    bool ok = true;
+
+    ok = ok && fwrite(TRAJECTORY_MAGIC, 8, 1, writer->file) == 1;
+    ok = ok && fwrite(fields, sizeof(fields), 1, writer->file) == 1;
+    ok = ok && fwrite(&writer->quantum, sizeof(double), 1, writer->file) == 1;
+    ok = ok && fwrite(layout, sizeof(layout), 1, writer->file) == 1;
+    ok = ok && fwrite(writer->ranges, sizeof(TrajectoryRange), writer->range_count,
+                      writer->file) == writer->range_count;
+    return ok;
+}
+
+/**
+ * @brief Starts recording a simulation: records its current state, then
+ * a frame every interval steps. The simulation owns the writer from then on,
+ * destroyOrbitalSim destroys it.
+ *
+ * @param sim The simulation, which must not have a writer already
+ * @param path The file to write
+ * @param ranges Bodies to record; NULL records them all
+ * @param rangeCount How many ranges
+ * @param interval Steps between frames
+ * @param quantum Position resolution [m]
+ * @return The writer, NULL on error (bad ranges, out of memory, file not writable)
+ */
+TrajectoryWriter *constructTrajectoryWriter(OrbitalSim *sim, const char *path,
+                                            const TrajectoryRange *ranges, unsigned int rangeCount,
+                                            unsigned int interval, double quantum)
+{
+    TrajectoryRange everything = {0, sim->bodies_count};
+    unsigned int body_count = 0;
+
+    if (sim->trajectory != NULL || interval == 0 || !(quantum > 0))
+        return NULL;
+    if (ranges == NULL)
+    {
+        ranges = &everything;
+        rangeCount = 1;
+    }
+    for (unsigned int i = 0; i < rangeCount; i++)
+    {
+        if (ranges[i].begin > ranges[i].end || ranges[i].end > sim->bodies_count)
+            return NULL;
+        body_count += ranges[i].end - ranges[i].begin;
+    }
+
+    TrajectoryWriter *writer = new TrajectoryWriter();
+    writer->sim = sim;
+    writer->range_count = rangeCount;
+    writer->body_count = body_count;
+    writer->interval = interval;
+    writer->quantum = quantum;
+    writer->ranges = (TrajectoryRange *)malloc(rangeCount * sizeof(TrajectoryRange) + 1);
+    writer->bodies = (unsigned int *)malloc((size_t)body_count * sizeof(unsigned int) + 1);
+    writer->previous = (int64_t *)malloc(3 * (size_t)body_count * sizeof(int64_t) + 1);
+    writer->frame = (unsigned char *)malloc(FRAME_HEADER_SIZE +
+                                            3 * (size_t)body_count * MAX_VARINT_SIZE);
+    bool ok = writer->ranges != NULL && writer->bodies != NULL && writer->previous != NULL &&
+              writer->frame != NULL;
+    for (int i = 0; ok && i < 2; i++)
+    {
+        double *positions = (double *)malloc(3 * (size_t)body_count * sizeof(double) + 1);
+        writer->snapshots[i].x = positions;
+        writer->snapshots[i].y = positions + body_count;
+        writer->snapshots[i].z = positions + 2 * (size_t)body_count;
+        ok = positions != NULL;
+    }
+    if (ok)
+    {
+        memcpy(writer->ranges, ranges, rangeCount * sizeof(TrajectoryRange));
+        unsigned int *slot = writer->bodies;
+        for (unsigned int i = 0; i < rangeCount; i++)
+            for (unsigned int body = ranges[i].begin; body < ranges[i].end; body++)
+                *slot++ = body;
+        writer->file = fopen(path, "wb");
+        ok = writer->file != NULL && writeHeader(writer);
+    }
+    if (!ok)
+    {
+        if (writer->file != NULL)
+            fclose(writer->file);
+        free(writer->ranges);
+        free(writer->bodies);
+        free(writer->previous);
+        free(writer->frame);
+        free(writer->snapshots[0].x);
+        free(writer->snapshots[1].x);
+        delete writer;
+        return NULL;
+    }
+
+    writer->thread = std::thread(writerMain, writer);
+    sim->trajectory = writer;
+    sampleTrajectory(writer);
+    return writer;
+}
+
+/**
+ * @brief Writes the frames still pending, closes the file and detaches the
+ * writer from its simulation
+ *
+ * @return false if any write failed: the file is incomplete
+ */
+bool destroyTrajectoryWriter(TrajectoryWriter *writer)
+{
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->quit = true;
+    }
+    writer->filled.notify_all();
+    // The background thread drains both snapshots before it leaves
+    writer->thread.join();
+
+    bool ok = fclose(writer->file) == 0 && !writer->failed;
+    writer->sim->trajectory = NULL;
+
+    free(writer->ranges);
+    free(writer->bodies);
+    free(writer->previous);
+    free(writer->frame);
+    free(writer->snapshots[0].x);
+    free(writer->snapshots[1].x);
+    delete writer;
+    return ok;
+}
+
+/**
+ * @brief Called by updateOrbitalSim after every step. Every interval steps,
+ * copies the recorded positions into a free snapshot and hands it to the
+ * background thread. Waits only if both snapshots are still being written.
+ */
+void sampleTrajectory(TrajectoryWriter *writer)
+{
+    if (writer->steps++ % writer->interval != 0)
+        return;
+
+    const OrbitalBodies *bodies = &writer->sim->bodies;
+    unsigned int index = writer->next_fill;
+    TrajectorySnapshot *snapshot = &writer->snapshots[index];
+
+    {
+        std::unique_lock<std::mutex> lock(writer->mutex);
+        writer->written.wait(lock, [writer, index] { return !writer->full[index]; });
+    }
+
+    if (!writer->remapped)
+    {
+        size_t offset = 0;
+        for (unsigned int i = 0; i < writer->range_count; i++)
+        {
+            const TrajectoryRange *range = &writer->ranges[i];
+            size_t size = (range->end - range->begin) * sizeof(double);
+
+            memcpy(snapshot->x + offset, bodies->x + range->begin, size);
+            memcpy(snapshot->y + offset, bodies->y + range->begin, size);
+            memcpy(snapshot->z + offset, bodies->z + range->begin, size);
+            offset += range->end - range->begin;
+        }
+    }
+    else
+    {
+        for (unsigned int i = 0; i < writer->body_count; i++)
+        {
+            unsigned int body = writer->bodies[i];
+            bool removed = body == COLLISION_BODY_REMOVED;
+
+            snapshot->x[i] = removed ? NAN : bodies->x[body];
+            snapshot->y[i] = removed ? NAN : bodies->y[body];
+            snapshot->z[i] = removed ? NAN : bodies->z[body];
+        }
+    }
+    snapshot->time = writer->sim->time_elapsed;
+
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->full[index] = true;
+    }
+    writer->filled.notify_one();
+    writer->next_fill = index ^ 1;
+}
+
+/**
+ * @brief Called by collisions after compacting bodies away: from then on,
+ * each recorded body is copied from wherever it went, or recorded as
+ * removed
+ *
+ * @param writer The writer
+ * @param movedTo Where each body of the step went, COLLISION_BODY_REMOVED
+ *                if it was taken out
+ */
+void remapTrajectory(TrajectoryWriter *writer, const unsigned int *movedTo)
+{
+    for (unsigned int i = 0; i < writer->body_count; i++)
+    {
+        if (writer->bodies[i] != COLLISION_BODY_REMOVED)
+            writer->bodies[i] = movedTo[writer->bodies[i]];
+    }
+    writer->remapped = true;
+}
+
+/**
+ * @brief Opens a trajectory file for reading
+ *
+ * @return The reader, NULL if the file is missing or not a trajectory
+ */
+TrajectoryReader *openTrajectory(const char *path)
+{
+    char magic[8];
+    uint32_t fields[2], layout[2];
+    double quantum;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    if (fread(magic, 8, 1, file) != 1 || memcmp(magic, TRAJECTORY_MAGIC, 8) != 0 ||
+        fread(fields, sizeof(fields), 1, file) != 1 || fields[0] != TRAJECTORY_VERSION ||
+        fread(&quantum, sizeof(quantum), 1, file) != 1 ||
+        fread(layout, sizeof(layout), 1, file) != 1)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    TrajectoryReader *reader = (TrajectoryReader *)calloc(1, sizeof(TrajectoryReader));
+    if (reader == NULL)
+    {
+        fclose(file);
+        return NULL;
+    }
+    reader->file = file;
+    reader->body_count = fields[1];
+    reader->quantum = quantum;
+    reader->interval = layout[0];
+    reader->range_count = layout[1];
+    reader->ranges = (TrajectoryRange *)malloc(reader->range_count * sizeof(TrajectoryRange) + 1);
+    reader->previous = (int64_t *)calloc(3 * (size_t)reader->body_count + 1, sizeof(int64_t));
+    if (reader->ranges == NULL || reader->previous == NULL ||
+        fread(reader->ranges, sizeof(TrajectoryRange), reader->range_count, file) != reader->range_count)
+    {
+        closeTrajectory(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+/**
+ * @brief Reads the next frame
+ *
+ * @param reader The reader
+ * @param time Filled in with the frame's time [s]
+ * @param x, y, z Filled in with the positions [m], body_count each; NaN for
+ *                bodies collisions took out
+ * @return false at the end of the file, or on a damaged frame
+ */
+bool readTrajectoryFrame(TrajectoryReader *reader, double *time, double *x, double *y, double *z)
+{
+    uint32_t payload;
+    unsigned int count = reader->body_count;
+
+    if (fread(&payload, sizeof(payload), 1, reader->file) != 1 ||
+        payload < FRAME_HEADER_SIZE - sizeof(uint32_t))
+        return false;
+
+    if (reader->frame_capacity < payload)
+    {
+        unsigned char *frame = (unsigned char *)realloc(reader->frame, payload);
+        if (frame == NULL)
+            return false;
+        reader->frame = frame;
+        reader->frame_capacity = payload;
+    }
+    if (fread(reader->frame, 1, payload, reader->file) != payload)
+        return false;
+
+    bool keyframe = reader->frame[0] != 0;
+    if (keyframe)
+        reader->keyframes++;
+    memcpy(time, reader->frame + 1, sizeof(double));
+
+    const unsigned char *walker = reader->frame + 1 + sizeof(double);
+    const unsigned char *end = reader->frame + payload;
+    double *axes[3] = {x, y, z};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int64_t *previous = reader->previous + (size_t)axis * count;
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            uint64_t value;
+            walker = readVarint(walker, end, &value);
+            if (walker == NULL)
+                return false;
+
+            int64_t delta = decodeZigzag(value);
+            int64_t quantized = keyframe ? delta : (int64_t)((uint64_t)delta + (uint64_t)previous[i]);
+            previous[i] = quantized;
+            axes[axis][i] = quantized != TRAJECTORY_REMOVED ? quantized * reader->quantum : NAN;
+        }
+    }
+    return true;
+}
+
+void closeTrajectory(TrajectoryReader *reader)
+{
+    fclose(reader->file);
+    free(reader->ranges);
+    free(reader->previous);
+    free(reader->frame);
+    free(reader);
+}
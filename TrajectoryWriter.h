@@ -0,0 +1,134 @@
+/**
+ * @brief Trajectory recording: streams sampled body positions to disk
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef TRAJECTORYWRITER_H
+#define TRAJECTORYWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct OrbitalSim;
+
+#define TRAJECTORY_MAGIC "ORBTRAJ"      // 8 bytes, with the terminator
+#define TRAJECTORY_VERSION 2
+
+/**
+ * Default position resolution [m]
+ */
+#define DEFAULT_TRAJECTORY_QUANTUM 1E3
+
+/**
+ * Every so many frames, one is stored whole instead of as a delta, so a
+ * damaged frame doesn't spoil the rest of the file
+ */
+#define TRAJECTORY_KEYFRAME_INTERVAL 64
+
+/**
+ * Quantized position of a body collisions took out
+ */
+#define TRAJECTORY_REMOVED INT64_MIN
+
+/**
+ * @brief A range of bodies to record, [begin, end)
+ */
+struct TrajectoryRange
+{
+    unsigned int begin;
+    unsigned int end;
+};
+
+/**
+ * @brief Positions of the recorded bodies at one step
+ */
+struct TrajectorySnapshot
+{
+    double time;                // [s], sim->time_elapsed
+    double *x, *y, *z;          // [m], one per recorded body, in range order
+};
+
+/**
+ * @brief A trajectory recorder attached to a simulation. updateOrbitalSim
+ * copies the recorded positions into one of two snapshots every interval
+ * steps; a background thread quantizes the other one, delta-encodes it
+ * against the previous frame and writes it.
+ *
+ * Each recorded body keeps its place in every frame: when collisions compact
+ * bodies away, the writer is told where each one went, and a body taken out
+ * is recorded as TRAJECTORY_REMOVED from then on (read back as NaN).
+ *
+ * File layout: a header (magic, version, body count, quantum, interval, range
+ * count, ranges), then frames. A frame is a byte count, a keyframe flag, the
+ * time, and zigzag varints of each body's quantized x, then y, then z, minus
+ * those of the previous frame (or of zero, for keyframes).
+ */
+struct TrajectoryWriter
+{
+    OrbitalSim *sim;
+    FILE *file;
+    TrajectoryRange *ranges;
+    unsigned int range_count;
+    unsigned int body_count;    // recorded bodies, over all ranges
+    unsigned int *bodies;       // index of each recorded body now, COLLISION_BODY_REMOVED once taken out
+    bool remapped;              // bodies were compacted: copy through bodies, not by range
+    unsigned int interval;      // steps between frames
+    double quantum;             // [m], position resolution
+    unsigned long steps;        // since attached
+
+    TrajectorySnapshot snapshots[2];
+    bool full[2];               // handed to the background thread, not yet written
+    unsigned int next_fill;     // snapshot the simulation fills next
+    unsigned int next_write;    // snapshot the background thread writes next
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable filled;     // a snapshot was handed over, or quit
+    std::condition_variable written;    // a snapshot is free again
+    bool quit;
+
+    // Background thread only
+    int64_t *previous;          // quantized positions of the last frame written
+    unsigned char *frame;       // encoding buffer
+    unsigned long long frames_written;
+
+    std::atomic<unsigned long long> bytes_written;
+    std::atomic<bool> failed;   // a write failed, the file is incomplete
+};
+
+/**
+ * @brief Reads back a trajectory file, frame by frame
+ */
+struct TrajectoryReader
+{
+    FILE *file;
+    TrajectoryRange *ranges;
+    unsigned int range_count;
+    unsigned int body_count;
+    unsigned int interval;
+    double quantum;
+    int64_t *previous;
+    unsigned char *frame;
+    size_t frame_capacity;
+    unsigned long long keyframes;   // read so far
+};
+
+TrajectoryWriter *constructTrajectoryWriter(OrbitalSim *sim, const char *path,
+                                            const TrajectoryRange *ranges, unsigned int rangeCount,
+                                            unsigned int interval,
+                                            double quantum = DEFAULT_TRAJECTORY_QUANTUM);
+bool destroyTrajectoryWriter(TrajectoryWriter *writer);
+void sampleTrajectory(TrajectoryWriter *writer);
+void remapTrajectory(TrajectoryWriter *writer, const unsigned int *movedTo);
+
+TrajectoryReader *openTrajectory(const char *path);
+bool readTrajectoryFrame(TrajectoryReader *reader, double *time, double *x, double *y, double *z);
+void closeTrajectory(TrajectoryReader *reader);
+
+#endif
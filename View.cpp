@@ -6,13 +6,39 @@
  */
 
 #include <time.h>
+#include <stdlib.h>
+#include <math.h>
 #include <cstdio>
+#include <chrono>
+#include "rlgl.h"
 #include "View.h"
 
 
 #define WINDOW_WIDTH 1280
 #define WINDOW_HEIGHT 720
 
+#define SECONDS_PER_DAY 86400
+
+/**
+ * Points per rlgl batch; the batch is flushed between runs if it fills up
+ */
+#define POINT_BATCH_SIZE 4096
+
+/**
+ * Vertices per rlgl batch of spheres; at least one sphere goes in each
+ */
+#define SPHERE_BATCH_VERTICES 8192
+
+/**
+ * Length of the line a point is drawn as, as DrawPoint3D does [units]
+ */
+#define POINT_LENGTH 0.1f
+
+/**
+ * What + and - multiply and divide the simulation speed by
+ */
+#define SPEED_CONTROL_FACTOR 2.0
+
 /**
  * @brief Converts a timestamp (number of seconds since 1/1/2022)
  *        to an ISO date ("YYYY-MM-DD")
@@ -35,6 +61,148 @@ const char *getISODate(float timestamp)
                       1900 + localTM->tm_year, localTM->tm_mon + 1, localTM->tm_mday);
 }
 
+/**
+ * @brief Converts a position to a raylib Vector3
+ */
+static Vector3 toVector3(BodyVector3 position)
+{
+    return {position.x, position.y, position.z};
+}
+
+/**
+ * @brief Converts a color to a raylib Color
+ */
+static Color toColor(BodyColor color)
+{
+    return {color.r, color.g, color.b, color.a};
+}
+
+/**
+ * @brief Draws the point bucket of a draw list as batched lines: the same
+ * thing DrawPoint3D draws, without a matrix push and a draw call per point
+ */
+static void drawPoints(const DrawList *list)
+{
+    for (unsigned int begin = 0; begin < list->point_count; begin += POINT_BATCH_SIZE)
+    {
+        unsigned int end = begin + POINT_BATCH_SIZE < list->point_count
+                               ? begin + POINT_BATCH_SIZE
+                               : list->point_count;
+
+        rlCheckRenderBatchLimit(2 * (end - begin));
+        rlBegin(RL_LINES);
+        for (unsigned int i = begin; i < end; i++)
+        {
+            const float *point = list->points + 3 * (size_t)i;
+            BodyColor color = list->point_colors[i];
+
+            rlColor4ub(color.r, color.g, color.b, color.a);
+            rlVertex3f(point[0], point[1], point[2]);
+            rlVertex3f(point[0], point[1], point[2] + POINT_LENGTH);
+        }
+        rlEnd();
+    }
+}
+
+/**
+ * @brief Builds the triangles of a unit sphere, in the order DrawSphereEx
+ * draws them, so the sines and cosines are taken once and not per body
+ *
+ * @param rings Rings and slices of the sphere
+ * @param vertexCount Where to store how many vertices it has
+ * @return x, y, z of each vertex, interleaved; NULL if out of memory
+ */
+static float *buildSphereMesh(int rings, unsigned int *vertexCount)
+{
+    int slices = rings;
+    float *vertices = (float *)malloc((rings + 2) * slices * 6 * 3 * sizeof(float));
+    float *vertex = vertices;
+
+    *vertexCount = 0;
+    if (vertices == NULL)
+        return NULL;
+
+    for (int i = 0; i < rings + 2; i++)
+    {
+        float latitude = DEG2RAD * (270 + (180.0f / (rings + 1)) * i);
+        float next_latitude = DEG2RAD * (270 + (180.0f / (rings + 1)) * (i + 1));
+
+        for (int j = 0; j < slices; j++)
+        {
+            float longitude = DEG2RAD * (360.0f * j / slices);
+            float next_longitude = DEG2RAD * (360.0f * (j + 1) / slices);
+
+            //Two triangles per quad of the sphere
+            float corners[6][2] = {{latitude, longitude}, {next_latitude, next_longitude},
+                                   {next_latitude, longitude}, {latitude, longitude},
+                                   {latitude, next_longitude}, {next_latitude, next_longitude}};
+            for (int k = 0; k < 6; k++)
+            {
+                *vertex++ = cosf(corners[k][0]) * sinf(corners[k][1]);
+                *vertex++ = sinf(corners[k][0]);
+                *vertex++ = cosf(corners[k][0]) * cosf(corners[k][1]);
+            }
+        }
+    }
+
+    *vertexCount = (rings + 2) * slices * 6;
+    return vertices;
+}
+
+/**
+ * @brief Draws a sphere bucket of a draw list as batched triangles: the same
+ * thing DrawSphereEx draws, without a matrix push and the trigonometry per body
+ *
+ * @param view The view, holding the unit sphere meshes
+ * @param list The draw list
+ * @param lod The sphere level to draw
+ * @param rings Rings and slices of that level, if its mesh is missing
+ */
+static void drawSpheres(const View *view, const DrawList *list, int lod, int rings)
+{
+    const float *mesh = view->sphere_meshes[lod];
+    unsigned int mesh_vertices = view->sphere_mesh_vertices[lod];
+    unsigned int count = list->sphere_counts[lod];
+
+    if (mesh == NULL)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const RenderSphere *sphere = &list->spheres[lod][i];
+            DrawSphereEx(toVector3(sphere->position), sphere->radius, rings, rings,
+                         toColor(sphere->color));
+        }
+        return;
+    }
+
+    unsigned int batch_size = SPHERE_BATCH_VERTICES / mesh_vertices;
+    if (batch_size == 0)
+        batch_size = 1;
+
+    for (unsigned int begin = 0; begin < count; begin += batch_size)
+    {
+        unsigned int end = begin + batch_size < count ? begin + batch_size : count;
+
+        rlCheckRenderBatchLimit((end - begin) * mesh_vertices);
+        rlBegin(RL_TRIANGLES);
+        for (unsigned int i = begin; i < end; i++)
+        {
+            const RenderSphere *sphere = &list->spheres[lod][i];
+            float radius = sphere->radius;
+
+            rlColor4ub(sphere->color.r, sphere->color.g, sphere->color.b, sphere->color.a);
+            for (unsigned int k = 0; k < mesh_vertices; k++)
+            {
+                const float *vertex = mesh + 3 * k;
+                rlVertex3f(sphere->position.x + radius * vertex[0],
+                           sphere->position.y + radius * vertex[1],
+                           sphere->position.z + radius * vertex[2]);
+            }
+        }
+        rlEnd();
+    }
+}
+
 /**
  * @brief Constructs an orbital simulation view
  *
@@ -55,6 +223,15 @@ View *constructView(int fps)
     view->camera.fovy = 45.0f;
     view->camera.projection = CAMERA_PERSPECTIVE;
 
+    view->draw_list = constructDrawList();
+    view->sphere_meshes[RENDER_LOD_DETAILED_SPHERE] =
+        buildSphereMesh(RENDER_DETAILED_SPHERE_RINGS, &view->sphere_mesh_vertices[RENDER_LOD_DETAILED_SPHERE]);
+    view->sphere_meshes[RENDER_LOD_SPHERE] =
+        buildSphereMesh(RENDER_COARSE_SPHERE_RINGS, &view->sphere_mesh_vertices[RENDER_LOD_SPHERE]);
+    view->instrumentation = NULL;
+    view->show_instrumentation = true;
+    view->scheduler = NULL;
+
     return view;
 }
 
@@ -67,6 +244,10 @@ void destroyView(View *view)
 {
     CloseWindow();
 
+    if (view->draw_list != NULL)
+        destroyDrawList(view->draw_list);
+    for (int lod = 0; lod < RENDER_LOD_POINT; lod++)
+        free(view->sphere_meshes[lod]);
     delete view;
 }
 
@@ -84,42 +265,49 @@ bool isViewRendering(View *view)
  * Renders an orbital simulation
  *
  * @param view The view
- * @param sim The orbital sim
+ * @param snapshot The latest snapshot of the orbital sim
  */
-void renderView(View *view, OrbitalSim *sim)
+void renderView(View *view, const SimulationSnapshot *snapshot)
 {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
     UpdateCamera(&view->camera, CAMERA_FREE);
-    int i;
-    BeginDrawing();
+    if (IsKeyPressed(KEY_I))
+        view->show_instrumentation = !view->show_instrumentation;
 
-    ClearBackground(BLACK);
-    BeginMode3D(view->camera);
+    FrameScheduler *scheduler = view->scheduler;
+    if (scheduler != NULL && (IsKeyPressed(KEY_EQUAL) || IsKeyPressed(KEY_KP_ADD)))
+        changeFrameSpeed(scheduler, SPEED_CONTROL_FACTOR);
+    if (scheduler != NULL && (IsKeyPressed(KEY_MINUS) || IsKeyPressed(KEY_KP_SUBTRACT)))
+        changeFrameSpeed(scheduler, 1 / SPEED_CONTROL_FACTOR);
 
-    
+    RenderCamera camera;
+    camera.position = {view->camera.position.x, view->camera.position.y, view->camera.position.z};
+    camera.target = {view->camera.target.x, view->camera.target.y, view->camera.target.z};
+    camera.up = {view->camera.up.x, view->camera.up.y, view->camera.up.z};
+    camera.fovy = view->camera.fovy;
+    camera.aspect = (float)GetScreenWidth() / GetScreenHeight();
+    camera.near_plane = RL_CULL_DISTANCE_NEAR;
+    camera.far_plane = RL_CULL_DISTANCE_FAR;
 
-    Vector3 temp;
-    double dist;
+    DrawList *list = view->draw_list;
+    INSTRUMENT_START(prepare_timer);
+    bool prepared = list != NULL && prepareDrawList(list, snapshot, &camera);
+    INSTRUMENT_STOP(view->instrumentation, PHASE_RENDER_PREP, prepare_timer);
 
-    for (i=0; i < sim->planets_range  ; i++)
-    {
-        DrawSphere (Vector3Scale(sim->bodies[i].position, 1E-11) ,
-                    0.015 * logf(sim->bodies[i].radius), 
-                    sim->bodies[i].color);
-    }
+    INSTRUMENT_START(draw_timer);
+    BeginDrawing();
 
-        
-    for (i=10; i < sim->bodies_count  ; i++)
-    {
-        dist = Vector3Distance(view->camera.position,Vector3Scale(sim->bodies[i].position,1E-11));
-         
-        if(dist < 5.0)
-            DrawSphere (Vector3Scale(sim->bodies[i].position, 1E-11) ,0.015 * logf(sim->bodies[i].radius), sim->bodies[i].color);
-        else
-            DrawPoint3D (Vector3Scale(sim->bodies[i].position, 1E-11) , sim->bodies[i].color);
+    ClearBackground(BLACK);
+    BeginMode3D(view->camera);
 
+    if (prepared)
+    {
+        drawSpheres(view, list, RENDER_LOD_DETAILED_SPHERE, RENDER_DETAILED_SPHERE_RINGS);
+        drawSpheres(view, list, RENDER_LOD_SPHERE, RENDER_COARSE_SPHERE_RINGS);
+        drawPoints(list);
     }
 
-
     DrawGrid(10,10.0f);
     EndMode3D();
 
@@ -128,9 +316,38 @@ void renderView(View *view, OrbitalSim *sim)
     //Shows FPS and Date on ISO format on the upper left corner.
     
     DrawFPS (0,0);
-    DrawText (getISODate(sim->time_elapsed),0,40,22,WHITE);
+    DrawText (getISODate(snapshot->time_elapsed),0,40,22,WHITE);
 
-    
+    //And what was drawn of the bodies
+    if (prepared)
+        DrawText (TextFormat("%u bodies: %u culled, %u points, %u spheres",
+                             list->stats.bodies, list->stats.culled,
+                             list->stats.points, list->stats.spheres),
+                  0, 70, 16, GRAY);
+
+    //And how the simulation is doing, if it is instrumented
+    Instrumentation *instrumentation = view->instrumentation;
+    if (instrumentation != NULL && view->show_instrumentation)
+        DrawText (TextFormat("%.0f steps/s, %.2f ns/interaction, energy error %.2e",
+                             instrumentation->steps_per_second.load(),
+                             instrumentation->ns_per_interaction.load(),
+                             instrumentation->energy_error.load()),
+                  0, 90, 16, GRAY);
+
+    //And how fast it goes, against how fast it was asked to
+    if (scheduler != NULL)
+        DrawText (TextFormat("%.1f days/s (target %.1f, +/- to change), %u steps/frame of %.1f h%s",
+                             scheduler->achieved_speed.load() / SECONDS_PER_DAY,
+                             scheduler->target_speed.load() / SECONDS_PER_DAY,
+                             scheduler->frame_steps.load(), snapshot->time_step / 3600,
+                             scheduler->limited.load() ? ", at the frame budget" : ""),
+                  0, 110, 16, GRAY);
+
+    //The wait for the next frame isn't drawing
+    INSTRUMENT_STOP(view->instrumentation, PHASE_DRAW, draw_timer);
+    if (scheduler != NULL)
+        measureFrameRender(scheduler,
+                           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
     EndDrawing();
 
-}
\ No newline at end of file
+}
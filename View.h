@@ -11,6 +11,10 @@
 #include "raylib.h"
 #include "raymath.h"
 #include "OrbitalSim.h"
+#include "SimulationThread.h"
+#include "RenderPrep.h"
+#include "Instrumentation.h"
+#include "FrameScheduler.h"
 
 /**
  * The view data
@@ -18,12 +22,20 @@
 struct View
 {
     Camera3D camera;
+    DrawList *draw_list;        // refilled every frame
+    float *sphere_meshes[RENDER_LOD_POINT];     // unit sphere triangles of each sphere level, NULL if out of memory
+    unsigned int sphere_mesh_vertices[RENDER_LOD_POINT];
+
+    Instrumentation *instrumentation;   // of the simulation drawn, NULL if not instrumented
+    bool show_instrumentation;          // its overlay, toggled with I
+
+    FrameScheduler *scheduler;  // paces the simulation drawn, NULL if nothing does; + and - change its speed
 };
 
 View *constructView(int fps);
 void destroyView(View *view);
 
 bool isViewRendering(View *view);
-void renderView(View *view, OrbitalSim *sim);
+void renderView(View *view, const SimulationSnapshot *snapshot);
 
 #endif
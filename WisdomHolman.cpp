@@ -0,0 +1,609 @@
+/**
+ * @brief Wisdom-Holman mixed-variable integrator
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Almost all of a body's motion is its Kepler orbit around bodies[0]; the
+ * planets only nudge it. So instead of integrating the whole force, each body
+ * follows its Kepler orbit exactly, and the planets' pull is added as kicks:
+ *
+ *  kick(dt / 2), jump(dt / 2), Kepler drift(dt), jump(dt / 2), kick(dt / 2)
+ *
+ * in democratic heliocentric coordinates (Duncan, Levison & Lee, 1998,
+ * https://doi.org/10.1086/300541): positions relative to bodies[0],
+ * velocities relative to the barycenter of the planets. The kicks hold the
+ * pull of every planet but bodies[0]; the jumps, the motion of bodies[0]
+ * around the barycenter. The error then scales with the planets' masses
+ * instead of with the step, and the step can be a sizable fraction of the
+ * shortest orbit while energy stays bounded.
+ *
+ * The Kepler drift uses universal variables, so it's the same for elliptic
+ * and hyperbolic orbits: Stumpff functions by series and angle doubling, and
+ * Laguerre-Conway iterations on the universal Kepler equation. It works on
+ * batches of KEPLER_BATCH_SIZE bodies, in passes with no branches per body.
+ *
+ * The planets move first; the asteroids then only read where they were at
+ * the start and end of the step, and move in parallel. Only
+ * FORCE_MODEL_PLANETS is supported; with any other force model the step falls
+ * back to the plain leapfrog. ax/ay/az hold the kick accelerations, so the
+ * closing kick of one step is the opening one of the next.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+#include "OrbitalSim.h"
+#include "WisdomHolman.h"
+
+/**
+ * Stumpff series are summed once |beta * s^2| is under this, after quartering it
+ */
+#define STUMPFF_SERIES_LIMIT 0.1
+
+/**
+ * Quartering more often than this means the orbit went through more turns in
+ * a step than double precision can follow
+ */
+#define STUMPFF_MAX_QUARTERINGS 40
+
+#define STUMPFF_SERIES_TERMS 7
+
+/**
+ * 1 / (2k + 2)! and 1 / (2k + 3)!: the series of c2 and c3
+ */
+static const double c2_series[STUMPFF_SERIES_TERMS] = {
+    1.0 / 2, 1.0 / 24, 1.0 / 720, 1.0 / 40320, 1.0 / 3628800, 1.0 / 479001600, 1.0 / 87178291200,
+};
+static const double c3_series[STUMPFF_SERIES_TERMS] = {
+    1.0 / 6, 1.0 / 120, 1.0 / 5040, 1.0 / 362880, 1.0 / 39916800, 1.0 / 6227020800,
+    1.0 / 1307674368000,
+};
+
+/**
+ * @brief What the pool threads need to move asteroids through a step
+ */
+struct WisdomHolmanChunk
+{
+    OrbitalSim *sim;
+    WisdomHolman *wh;
+    double dt;                  // [s]
+    bool kicks_valid;           // ax/ay/az hold the opening kick
+    std::atomic<unsigned long long> iterations;
+    std::atomic<unsigned long long> batches;
+};
+
+/**
+ * @brief Heliocentric positions and barycentric velocities of a batch of bodies
+ */
+struct KeplerBatch
+{
+    unsigned int count;
+    double x[KEPLER_BATCH_SIZE], y[KEPLER_BATCH_SIZE], z[KEPLER_BATCH_SIZE];
+    double vx[KEPLER_BATCH_SIZE], vy[KEPLER_BATCH_SIZE], vz[KEPLER_BATCH_SIZE];
+    double ax[KEPLER_BATCH_SIZE], ay[KEPLER_BATCH_SIZE], az[KEPLER_BATCH_SIZE];
+};
+
+/**
+ * @brief Constructs the integrator state. Planet arrays are sized on its first step.
+ */
+WisdomHolman *constructWisdomHolman()
+{
+    return (WisdomHolman *)calloc(1, sizeof(WisdomHolman));
+}
+
+/**
+ * @brief Destroys the integrator state
+ */
+void destroyWisdomHolman(WisdomHolman *wh)
+{
+    free(wh->planet_gm);
+    free(wh->start_positions);
+    free(wh->end_positions);
+    free(wh);
+}
+
+/**
+ * @brief Makes the planet arrays hold every planet
+ *
+ * @return false if out of memory
+ */
+static bool reservePlanets(WisdomHolman *wh, unsigned int planets)
+{
+    if (planets <= wh->planet_capacity)
+        return true;
+
+    free(wh->planet_gm);
+    free(wh->start_positions);
+    free(wh->end_positions);
+    wh->planet_gm = (double *)malloc(planets * sizeof(double));
+    wh->start_positions = (double *)malloc(3 * (size_t)planets * sizeof(double));
+    wh->end_positions = (double *)malloc(3 * (size_t)planets * sizeof(double));
+    if (wh->planet_gm == NULL || wh->start_positions == NULL || wh->end_positions == NULL)
+    {
+        wh->planet_capacity = 0;
+        return false;
+    }
+    wh->planet_capacity = planets;
+    return true;
+}
+
+/**
+ * @brief Stumpff G-functions of a batch: G_k(s) = s^k c_k(beta * s^2)
+ *
+ * The series of c2 and c3 are summed at beta * s^2 / 4^n, small enough for
+ * 7 terms to reach double precision, and brought back up with the doubling
+ * formulas. n is the same for the whole batch, so every pass is one loop
+ * over it.
+ */
+static void computeStumpff(unsigned int count, const double *beta, const double *s,
+                           double *g0, double *g1, double *g2, double *g3)
+{
+    double z[KEPLER_BATCH_SIZE];
+    double largest = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        z[i] = beta[i] * s[i] * s[i];
+        largest = fmax(largest, fabs(z[i]));
+    }
+
+    unsigned int quarterings = 0;
+    double scale = 1;
+    while (largest * scale > STUMPFF_SERIES_LIMIT && quarterings < STUMPFF_MAX_QUARTERINGS)
+    {
+        scale *= 0.25;
+        quarterings++;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        double zr = z[i] * scale;
+        double c2 = c2_series[STUMPFF_SERIES_TERMS - 1];
+        double c3 = c3_series[STUMPFF_SERIES_TERMS - 1];
+        for (int k = STUMPFF_SERIES_TERMS - 2; k >= 0; k--)
+        {
+            c2 = c2_series[k] - zr * c2;
+            c3 = c3_series[k] - zr * c3;
+        }
+        g0[i] = 1 - zr * c2;
+        g1[i] = 1 - zr * c3;
+        g2[i] = c2;
+        g3[i] = c3;
+    }
+
+    // c(4z) from c(z)
+    for (unsigned int n = 0; n < quarterings; n++)
+        for (unsigned int i = 0; i < count; i++)
+        {
+            double c0 = g0[i], c1 = g1[i], c2 = g2[i], c3 = g3[i];
+            g0[i] = 2 * c0 * c0 - 1;
+            g1[i] = c0 * c1;
+            g2[i] = 0.5 * c1 * c1;
+            g3[i] = 0.25 * (c2 + c0 * c3);
+        }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        g1[i] *= s[i];
+        g2[i] *= s[i] * s[i];
+        g3[i] *= s[i] * s[i] * s[i];
+    }
+}
+
+/**
+ * @brief Moves a batch of bodies dt along their Kepler orbits around a body at
+ * the origin
+ *
+ * Solves the universal Kepler equation, r0 G1 + eta0 G2 + mu G3 = dt, for the
+ * universal anomaly s with Laguerre-Conway iterations (they converge even
+ * when dt is a good part of an orbit), then moves each body with the f and g
+ * functions.
+ *
+ * @param batch The bodies; velocities relative to the origin's
+ * @param mu G * mass of the body at the origin
+ * @param dt The drift [s]
+ * @return How many iterations it took
+ */
+static unsigned int driftKeplerBatch(KeplerBatch *batch, double mu, double dt)
+{
+    double r0[KEPLER_BATCH_SIZE], eta0[KEPLER_BATCH_SIZE], beta[KEPLER_BATCH_SIZE];
+    double s[KEPLER_BATCH_SIZE], ds[KEPLER_BATCH_SIZE];
+    double g0[KEPLER_BATCH_SIZE], g1[KEPLER_BATCH_SIZE], g2[KEPLER_BATCH_SIZE], g3[KEPLER_BATCH_SIZE];
+    unsigned int count = batch->count;
+    unsigned int iterations = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        double v2 = batch->vx[i] * batch->vx[i] + batch->vy[i] * batch->vy[i] + batch->vz[i] * batch->vz[i];
+        r0[i] = sqrt(batch->x[i] * batch->x[i] + batch->y[i] * batch->y[i] + batch->z[i] * batch->z[i]);
+        eta0[i] = batch->x[i] * batch->vx[i] + batch->y[i] * batch->vy[i] + batch->z[i] * batch->vz[i];
+        beta[i] = 2 * mu / r0[i] - v2;
+
+        // ds/dt = 1 / r, to second order in dt
+        s[i] = dt / r0[i] - 0.5 * eta0[i] * dt * dt / (r0[i] * r0[i] * r0[i]);
+    }
+
+    // The G-functions are always those of the current s: once the corrections
+    // are all under the tolerance, s is left as it is and they are used as they are
+    for (;;)
+    {
+        unsigned int pending = 0;
+
+        computeStumpff(count, beta, s, g0, g1, g2, g3);
+        iterations++;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            double f = r0[i] * g1[i] + eta0[i] * g2[i] + mu * g3[i] - dt;
+            double df = r0[i] * g0[i] + eta0[i] * g1[i] + mu * g2[i];
+            double ddf = eta0[i] * g0[i] + (mu - beta[i] * r0[i]) * g1[i];
+
+            // Laguerre's method, of degree 5
+            double root = sqrt(fabs(16 * df * df - 20 * f * ddf));
+            ds[i] = -5 * f / (df + copysign(root, df));
+            pending += fabs(ds[i]) > KEPLER_TOLERANCE * fabs(s[i]);
+        }
+        if (pending == 0 || iterations == KEPLER_MAX_ITERATIONS)
+            break;
+
+        for (unsigned int i = 0; i < count; i++)
+            s[i] += ds[i];
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        double r = r0[i] * g0[i] + eta0[i] * g1[i] + mu * g2[i];
+        double f = 1 - mu * g2[i] / r0[i];
+        double g = dt - mu * g3[i];
+        double df = -mu * g1[i] / (r0[i] * r);
+        double dg = 1 - mu * g2[i] / r;
+
+        double x = batch->x[i], y = batch->y[i], z = batch->z[i];
+        double vx = batch->vx[i], vy = batch->vy[i], vz = batch->vz[i];
+        batch->x[i] = f * x + g * vx;
+        batch->y[i] = f * y + g * vy;
+        batch->z[i] = f * z + g * vz;
+        batch->vx[i] = df * x + dg * vx;
+        batch->vy[i] = df * y + dg * vy;
+        batch->vz[i] = df * z + dg * vz;
+    }
+
+    return iterations;
+}
+
+/**
+ * @brief Fills in the acceleration of a batch of bodies due to every planet
+ * but bodies[0], from heliocentric positions
+ *
+ * @param positions x, y, z of each planet, bodies[0] included (at the origin)
+ * @param skip A planet to leave out (the body itself), or planets to leave none out
+ */
+static void accelerateBatch(KeplerBatch *batch, const double *gm, const double *positions,
+                            unsigned int planets, unsigned int skip)
+{
+    unsigned int count = batch->count;
+
+    for (unsigned int i = 0; i < count; i++)
+        batch->ax[i] = batch->ay[i] = batch->az[i] = 0;
+
+    for (unsigned int p = 1; p < planets; p++)
+    {
+        if (p == skip)
+            continue;
+
+        double px = positions[3 * p], py = positions[3 * p + 1], pz = positions[3 * p + 2];
+        for (unsigned int i = 0; i < count; i++)
+        {
+            double dx = px - batch->x[i];
+            double dy = py - batch->y[i];
+            double dz = pz - batch->z[i];
+            double distance_sqr = dx * dx + dy * dy + dz * dz;
+            double coefficient = gm[p] / (distance_sqr * sqrt(distance_sqr));
+
+            batch->ax[i] += coefficient * dx;
+            batch->ay[i] += coefficient * dy;
+            batch->az[i] += coefficient * dz;
+        }
+    }
+}
+
+static void kickBatch(KeplerBatch *batch, double dt)
+{
+    for (unsigned int i = 0; i < batch->count; i++)
+    {
+        batch->vx[i] += batch->ax[i] * dt;
+        batch->vy[i] += batch->ay[i] * dt;
+        batch->vz[i] += batch->az[i] * dt;
+    }
+}
+
+static void jumpBatch(KeplerBatch *batch, const double *velocity, double dt)
+{
+    for (unsigned int i = 0; i < batch->count; i++)
+    {
+        batch->x[i] += velocity[0] * dt;
+        batch->y[i] += velocity[1] * dt;
+        batch->z[i] += velocity[2] * dt;
+    }
+}
+
+/**
+ * @brief Moves a chunk of asteroids through the step, batch by batch (a ThreadPoolTask)
+ */
+static void advanceAsteroidsChunk(void *context, unsigned int begin, unsigned int end)
+{
+    WisdomHolmanChunk *chunk = (WisdomHolmanChunk *)context;
+    OrbitalBodies *bodies = &chunk->sim->bodies;
+    WisdomHolman *wh = chunk->wh;
+    unsigned int planets = chunk->sim->planets_range;
+    double half = 0.5 * chunk->dt;
+    const double *star = wh->start_star;
+    const double *velocity = wh->barycenter_velocity;
+    unsigned long long iterations = 0, batches = 0, accelerations = 0;
+    KeplerBatch batch;
+
+    //Kicks, jumps and Kepler drifts count as integration
+    INSTRUMENT_COUNTER(force_cycles);
+    INSTRUMENT_COUNTER(total_cycles);
+    INSTRUMENT_START(start);
+
+    for (unsigned int first = begin; first < end; first += KEPLER_BATCH_SIZE)
+    {
+        batch.count = end - first < KEPLER_BATCH_SIZE ? end - first : KEPLER_BATCH_SIZE;
+        for (unsigned int i = 0; i < batch.count; i++)
+        {
+            batch.x[i] = bodies->x[first + i] - star[0];
+            batch.y[i] = bodies->y[first + i] - star[1];
+            batch.z[i] = bodies->z[first + i] - star[2];
+            batch.vx[i] = bodies->vx[first + i] - velocity[0];
+            batch.vy[i] = bodies->vy[first + i] - velocity[1];
+            batch.vz[i] = bodies->vz[first + i] - velocity[2];
+        }
+
+        if (chunk->kicks_valid)
+        {
+            memcpy(batch.ax, bodies->ax + first, batch.count * sizeof(double));
+            memcpy(batch.ay, bodies->ay + first, batch.count * sizeof(double));
+            memcpy(batch.az, bodies->az + first, batch.count * sizeof(double));
+        }
+        else
+        {
+            INSTRUMENT_START(timer);
+            accelerateBatch(&batch, wh->planet_gm, wh->start_positions, planets, planets);
+            INSTRUMENT_LAP(force_cycles, timer);
+            accelerations += batch.count;
+        }
+
+        kickBatch(&batch, half);
+        jumpBatch(&batch, wh->jumps[0], half);
+        iterations += driftKeplerBatch(&batch, wh->mu, chunk->dt);
+        jumpBatch(&batch, wh->jumps[1], half);
+        INSTRUMENT_START(timer);
+        accelerateBatch(&batch, wh->planet_gm, wh->end_positions, planets, planets);
+        INSTRUMENT_LAP(force_cycles, timer);
+        accelerations += batch.count;
+        kickBatch(&batch, half);
+        batches++;
+
+        for (unsigned int i = 0; i < batch.count; i++)
+        {
+            bodies->x[first + i] = batch.x[i] + wh->end_star[0];
+            bodies->y[first + i] = batch.y[i] + wh->end_star[1];
+            bodies->z[first + i] = batch.z[i] + wh->end_star[2];
+            bodies->vx[first + i] = batch.vx[i] + velocity[0];
+            bodies->vy[first + i] = batch.vy[i] + velocity[1];
+            bodies->vz[first + i] = batch.vz[i] + velocity[2];
+        }
+        memcpy(bodies->ax + first, batch.ax, batch.count * sizeof(double));
+        memcpy(bodies->ay + first, batch.ay, batch.count * sizeof(double));
+        memcpy(bodies->az + first, batch.az, batch.count * sizeof(double));
+    }
+
+    chunk->iterations += iterations;
+    chunk->batches += batches;
+
+    INSTRUMENT_LAP(total_cycles, start);
+    INSTRUMENT_ADD(chunk->sim->instrumentation, PHASE_FORCE, force_cycles);
+    INSTRUMENT_ADD(chunk->sim->instrumentation, PHASE_INTEGRATE, total_cycles - force_cycles);
+    INSTRUMENT_PAIRS(chunk->sim->instrumentation, accelerations * (planets - 1));
+    (void)accelerations;
+}
+
+/**
+ * @brief Sum of G * m * v over a batch of planets, divided by G * m of bodies[0]:
+ * how fast the jumps move every heliocentric position
+ */
+static void computeJump(const KeplerBatch *batch, const double *gm, double mu, double *jump)
+{
+    jump[0] = jump[1] = jump[2] = 0;
+    for (unsigned int i = 0; i < batch->count; i++)
+    {
+        jump[0] += gm[i + 1] * batch->vx[i];
+        jump[1] += gm[i + 1] * batch->vy[i];
+        jump[2] += gm[i + 1] * batch->vz[i];
+    }
+    jump[0] /= mu;
+    jump[1] /= mu;
+    jump[2] /= mu;
+}
+
+/**
+ * @brief Records the heliocentric positions of a batch of planets, bodies[0] at the origin
+ */
+static void savePlanetPositions(const KeplerBatch *batch, double *positions)
+{
+    positions[0] = positions[1] = positions[2] = 0;
+    for (unsigned int i = 0; i < batch->count; i++)
+    {
+        positions[3 * (i + 1)] = batch->x[i];
+        positions[3 * (i + 1) + 1] = batch->y[i];
+        positions[3 * (i + 1) + 2] = batch->z[i];
+    }
+}
+
+/**
+ * @brief Kicks each planet of a batch by the others, bodies[0] aside
+ *
+ * @param positions Where the planets are, as savePlanetPositions records them
+ */
+static void kickPlanets(OrbitalSim *sim, WisdomHolman *wh, KeplerBatch *batch,
+                        const double *positions, double dt)
+{
+    KeplerBatch single;
+
+    single.count = 1;
+    for (unsigned int i = 0; i < batch->count; i++)
+    {
+        single.x[0] = batch->x[i];
+        single.y[0] = batch->y[i];
+        single.z[0] = batch->z[i];
+        accelerateBatch(&single, wh->planet_gm, positions, sim->planets_range, i + 1);
+        batch->ax[i] = single.ax[0];
+        batch->ay[i] = single.ay[0];
+        batch->az[i] = single.az[0];
+    }
+    kickBatch(batch, dt);
+}
+
+/**
+ * @brief Moves the planets through the step, and records what the asteroids
+ * need of them. Their count must be at most KEPLER_BATCH_SIZE + 1.
+ */
+static void advancePlanets(OrbitalSim *sim, WisdomHolman *wh, bool kicksValid)
+{
+    OrbitalBodies *bodies = &sim->bodies;
+    unsigned int planets = sim->planets_range;
+    double dt = sim->time_step;
+    double total_gm = 0, barycenter[3] = {0, 0, 0};
+    double *velocity = wh->barycenter_velocity;
+    KeplerBatch batch;
+
+    for (unsigned int p = 0; p < planets; p++)
+        wh->planet_gm[p] = GRAVITATIONAL_CONSTANT * bodies->mass[p];
+    wh->mu = wh->planet_gm[0];
+
+    velocity[0] = velocity[1] = velocity[2] = 0;
+    for (unsigned int p = 0; p < planets; p++)
+    {
+        total_gm += wh->planet_gm[p];
+        barycenter[0] += wh->planet_gm[p] * bodies->x[p];
+        barycenter[1] += wh->planet_gm[p] * bodies->y[p];
+        barycenter[2] += wh->planet_gm[p] * bodies->z[p];
+        velocity[0] += wh->planet_gm[p] * bodies->vx[p];
+        velocity[1] += wh->planet_gm[p] * bodies->vy[p];
+        velocity[2] += wh->planet_gm[p] * bodies->vz[p];
+    }
+    for (int axis = 0; axis < 3; axis++)
+    {
+        barycenter[axis] /= total_gm;
+        velocity[axis] /= total_gm;
+    }
+    wh->start_star[0] = bodies->x[0];
+    wh->start_star[1] = bodies->y[0];
+    wh->start_star[2] = bodies->z[0];
+
+    batch.count = planets - 1;
+    for (unsigned int i = 0; i < batch.count; i++)
+    {
+        batch.x[i] = bodies->x[i + 1] - wh->start_star[0];
+        batch.y[i] = bodies->y[i + 1] - wh->start_star[1];
+        batch.z[i] = bodies->z[i + 1] - wh->start_star[2];
+        batch.vx[i] = bodies->vx[i + 1] - velocity[0];
+        batch.vy[i] = bodies->vy[i + 1] - velocity[1];
+        batch.vz[i] = bodies->vz[i + 1] - velocity[2];
+    }
+    savePlanetPositions(&batch, wh->start_positions);
+
+    if (kicksValid)
+    {
+        memcpy(batch.ax, bodies->ax + 1, batch.count * sizeof(double));
+        memcpy(batch.ay, bodies->ay + 1, batch.count * sizeof(double));
+        memcpy(batch.az, bodies->az + 1, batch.count * sizeof(double));
+        kickBatch(&batch, 0.5 * dt);
+    }
+    else
+        kickPlanets(sim, wh, &batch, wh->start_positions, 0.5 * dt);
+
+    computeJump(&batch, wh->planet_gm, wh->mu, wh->jumps[0]);
+    jumpBatch(&batch, wh->jumps[0], 0.5 * dt);
+    driftKeplerBatch(&batch, wh->mu, dt);
+    computeJump(&batch, wh->planet_gm, wh->mu, wh->jumps[1]);
+    jumpBatch(&batch, wh->jumps[1], 0.5 * dt);
+
+    savePlanetPositions(&batch, wh->end_positions);
+    kickPlanets(sim, wh, &batch, wh->end_positions, 0.5 * dt);
+
+    // The barycenter drifts freely; bodies[0] goes wherever keeps it there
+    double star_velocity[3], offset[3] = {0, 0, 0};
+    computeJump(&batch, wh->planet_gm, wh->mu, star_velocity);
+    for (unsigned int i = 0; i < batch.count; i++)
+    {
+        offset[0] += wh->planet_gm[i + 1] * batch.x[i];
+        offset[1] += wh->planet_gm[i + 1] * batch.y[i];
+        offset[2] += wh->planet_gm[i + 1] * batch.z[i];
+    }
+    for (int axis = 0; axis < 3; axis++)
+        wh->end_star[axis] = barycenter[axis] + velocity[axis] * dt - offset[axis] / total_gm;
+
+    bodies->x[0] = wh->end_star[0];
+    bodies->y[0] = wh->end_star[1];
+    bodies->z[0] = wh->end_star[2];
+    bodies->vx[0] = velocity[0] - star_velocity[0];
+    bodies->vy[0] = velocity[1] - star_velocity[1];
+    bodies->vz[0] = velocity[2] - star_velocity[2];
+    bodies->ax[0] = bodies->ay[0] = bodies->az[0] = 0;
+    for (unsigned int i = 0; i < batch.count; i++)
+    {
+        bodies->x[i + 1] = batch.x[i] + wh->end_star[0];
+        bodies->y[i + 1] = batch.y[i] + wh->end_star[1];
+        bodies->z[i + 1] = batch.z[i] + wh->end_star[2];
+        bodies->vx[i + 1] = batch.vx[i] + velocity[0];
+        bodies->vy[i + 1] = batch.vy[i] + velocity[1];
+        bodies->vz[i + 1] = batch.vz[i] + velocity[2];
+        bodies->ax[i + 1] = batch.ax[i];
+        bodies->ay[i + 1] = batch.ay[i];
+        bodies->az[i + 1] = batch.az[i];
+    }
+}
+
+/**
+ * @brief Advances a simulation one time_step with the Wisdom-Holman map.
+ * bodies[0] is the central body; planets but it are perturbers, asteroids
+ * test particles.
+ *
+ * @param sim The simulation
+ */
+void stepWisdomHolman(OrbitalSim *sim)
+{
+    WisdomHolman *wh = sim->wisdom_holman;
+    unsigned int planets = sim->planets_range;
+    WisdomHolmanChunk chunk;
+
+    if (wh == NULL)
+        wh = sim->wisdom_holman = constructWisdomHolman();
+    if (wh == NULL || sim->force_model != FORCE_MODEL_PLANETS || planets == 0 ||
+        planets > KEPLER_BATCH_SIZE + 1 || !reservePlanets(wh, planets))
+    {
+        getIntegrator(INTEGRATOR_LEAPFROG)->step(sim);
+        return;
+    }
+
+    chunk.sim = sim;
+    chunk.wh = wh;
+    chunk.dt = sim->time_step;
+    chunk.kicks_valid = sim->accelerations_valid;
+    chunk.iterations = 0;
+    chunk.batches = 0;
+
+    INSTRUMENT_START(timer);
+    advancePlanets(sim, wh, sim->accelerations_valid);
+    INSTRUMENT_STOP(sim->instrumentation, PHASE_INTEGRATE, timer);
+    runThreadPool(sim->pool, advanceAsteroidsChunk, &chunk, planets, sim->bodies_count, ASTEROIDS_CHUNK_SIZE);
+
+    wh->kepler_iterations += chunk.iterations;
+    wh->kepler_batches += chunk.batches;
+    sim->force_evaluations++;
+    sim->accelerations_valid = true;
+}
@@ -0,0 +1,53 @@
+/**
+ * @brief Wisdom-Holman mixed-variable integrator
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef WISDOMHOLMAN_H
+#define WISDOMHOLMAN_H
+
+struct OrbitalSim;
+
+/**
+ * Bodies the Kepler solver works on at a time. Each pass of the solver runs
+ * over a whole batch, so the compiler can vectorize it.
+ */
+#define KEPLER_BATCH_SIZE 64
+
+/**
+ * The Kepler solver stops when no body's universal anomaly moved by more than
+ * this fraction in the last iteration, or after KEPLER_MAX_ITERATIONS
+ */
+#define KEPLER_TOLERANCE 1E-14
+#define KEPLER_MAX_ITERATIONS 16
+
+/**
+ * @brief State of the Wisdom-Holman integrator: what the asteroids need of
+ * the planets to follow them through a step. Bodies move in democratic
+ * heliocentric coordinates: positions relative to bodies[0], velocities
+ * relative to the barycenter of the planets.
+ */
+struct WisdomHolman
+{
+    unsigned int planet_capacity;   // planets the arrays hold
+    double *planet_gm;              // G * mass of each planet, bodies[0] included
+    double *start_positions;        // heliocentric x, y, z of each planet, start of the step
+    double *end_positions;          // and at its end
+
+    double mu;                      // G * mass of bodies[0]
+    double jumps[2][3];             // drift of every heliocentric position, before and after the Kepler drift [m/s]
+    double start_star[3];           // position of bodies[0], start of the step
+    double end_star[3];             // and at its end
+    double barycenter_velocity[3];
+
+    unsigned long long kepler_iterations;   // over all batches, since construction
+    unsigned long long kepler_batches;
+};
+
+WisdomHolman *constructWisdomHolman();
+void destroyWisdomHolman(WisdomHolman *wisdomHolman);
+void stepWisdomHolman(OrbitalSim *sim);
+
+#endif
@@ -1,38 +1,55 @@
-﻿/**
- * @brief Orbital simulation main module
- * @author Marc S. Ressl
- * @modifiers Matteo Ginhson, Nicanor Otamendi
- * @copyright Copyright (c) 2022-2023
- */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include "OrbitalSim.h"
-#include "View.h"
-
-#define SECONDS_PER_DAY 86400
-
-int main(int argc, char **argv)
-{
-    int fps = 60;                                 // Frames per second
-    double timeMultiplier = 100 * SECONDS_PER_DAY; // Simulation speed: 100 days per simulation second
-    double timeStep = timeMultiplier / fps;
-
-    // Change this line to contruct either AlfaCentauri or Solarsist     
-    
-    OrbitalSim *sim =constructOrbitalSim(timeStep);
-    View *view = constructView(fps);
-
-    while (isViewRendering(view))
-    {
-        for (int i = 0; i < 1; i++)
-            updateOrbitalSim(sim);
-
-        renderView(view, sim);
-    }
-
-    destroyView(view);
-    destroyOrbitalSim(sim);
-
-    return 0;
-}
+﻿/**
+ * @brief Orbital simulation main module
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "OrbitalSim.h"
+#include "SimulationThread.h"
+#include "FrameScheduler.h"
+#include "View.h"
+
+#define SECONDS_PER_DAY 86400
+
+int main(int argc, char **argv)
+{
+    int fps = 60;                                 // Frames per second
+    double timeMultiplier = 100 * SECONDS_PER_DAY; // Simulation speed: 100 days per simulation second
+    double timeStep = SECONDS_PER_DAY / 4;        // Fixed: each frame runs as many steps as it has room for
+
+    // Change this line to contruct either AlfaCentauri or Solarsist     
+    
+    OrbitalSim *sim =constructOrbitalSim(timeStep);
+    View *view = constructView(fps);
+
+    // Built with ORBITALSIM_INSTRUMENTATION, the view shows how the simulation is doing
+    Instrumentation *instrumentation = INSTRUMENTATION_ENABLED ? constructInstrumentation() : NULL;
+    if (instrumentation != NULL)
+        attachInstrumentation(sim, instrumentation);
+    view->instrumentation = instrumentation;
+
+    // The simulation steps on its own thread, a frame's worth of steps at a
+    // time; the view draws its latest snapshot, and changes the speed with + and -
+    FrameScheduler *scheduler = constructFrameScheduler(fps, timeMultiplier);
+    view->scheduler = scheduler;
+    SimulationThread *simulationThread = constructSimulationThread(sim, fps, scheduler);
+    if (simulationThread == NULL)
+        fprintf(stderr, "Not enough memory for the simulation thread\n");
+
+    while (simulationThread != NULL && isViewRendering(view))
+        renderView(view, acquireSimulationSnapshot(simulationThread));
+
+    if (simulationThread != NULL)
+        destroySimulationThread(simulationThread);
+    if (scheduler != NULL)
+        destroyFrameScheduler(scheduler);
+    destroyView(view);
+    destroyOrbitalSim(sim);
+    if (instrumentation != NULL)
+        destroyInstrumentation(instrumentation);
+
+    return 0;
+}
@@ -0,0 +1,363 @@
+/**
+ * @brief Orbital simulation, benchmark suite
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Times construction and updateOrbitalSim over a sweep of asteroid counts,
+ * for both scenarios, and writes the results as JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "OrbitalSim.h"
+
+#define SECONDS_PER_DAY 86400
+
+/**
+ * Smallest asteroid count of the sweep; each next one is 10 times larger
+ */
+#define BENCH_MIN_ASTEROIDS 1000
+
+/**
+ * Body-steps timed per repetition, so small runs last as long as large ones
+ */
+#define BENCH_BODY_STEPS 20000000
+
+struct BenchConfig
+{
+    unsigned int max_asteroids;
+    unsigned int repetitions;
+    unsigned long body_steps;   // per repetition
+    unsigned int threads;       // 0: one per hardware thread
+    const Integrator *integrator;
+    const char *output;         // NULL: stdout
+};
+
+/**
+ * @brief Summary of one measurement over all repetitions
+ */
+struct BenchStatistic
+{
+    double min;
+    double median;
+    double p99;
+};
+
+/**
+ * @brief Results of one scenario at one asteroid count
+ */
+struct BenchResult
+{
+    const char *scenario;
+    unsigned int asteroids;
+    unsigned int bodies;
+    unsigned int planets;
+    unsigned long steps;        // per repetition
+    BenchStatistic ns_per_body_step;
+    BenchStatistic interactions_per_second;
+    BenchStatistic construction_ms;
+    double body_evaluations_per_step;   // block time steps: single-body evaluations, last repetition
+    unsigned int level_histogram[BLOCK_MAX_LEVEL + 1];  // block time steps: asteroids per level, last step
+    unsigned long peak_rss_kb;  // process peak, after this run
+};
+
+static void printUsage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  --max-asteroids N    largest asteroid count of the sweep (default 10000000)\n"
+           "  --repetitions N      runs per configuration (default 5)\n"
+           "  --body-steps N       body-steps timed per run (default %d)\n"
+           "  --threads N          worker threads, 0 for one per hardware thread (default 0)\n"
+           "  --integrator NAME    euler | leapfrog | yoshida4 | dopri45 | block |\n"
+           "                       wisdom-holman (default euler)\n"
+           "  --output FILE        JSON destination (default stdout)\n",
+           program, BENCH_BODY_STEPS);
+}
+
+/**
+ * @brief Parses the command line
+ *
+ * @return false on a malformed or unknown option
+ */
+static bool parseArguments(int argc, char **argv, BenchConfig *config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(option, "--help") == 0)
+            return false;
+        if (value == NULL)
+        {
+            fprintf(stderr, "%s: missing value\n", option);
+            return false;
+        }
+        i++;
+
+        if (strcmp(option, "--max-asteroids") == 0)
+            config->max_asteroids = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--repetitions") == 0)
+            config->repetitions = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--body-steps") == 0)
+            config->body_steps = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--threads") == 0)
+            config->threads = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--integrator") == 0)
+        {
+            config->integrator = findIntegrator(value);
+            if (config->integrator == NULL)
+            {
+                fprintf(stderr, "unknown integrator: %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--output") == 0)
+            config->output = value;
+        else
+        {
+            fprintf(stderr, "unknown option: %s\n", option);
+            return false;
+        }
+    }
+
+    if (config->repetitions == 0 || config->body_steps == 0)
+    {
+        fprintf(stderr, "repetitions and body-steps must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Peak resident set size of the process so far
+ *
+ * @return Kilobytes, 0 if unknown
+ */
+static unsigned long getPeakRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return (unsigned long)(counters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (unsigned long)usage.ru_maxrss / 1024;   // bytes on macOS
+#else
+    return (unsigned long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+/**
+ * @brief Min, median and 99th percentile (nearest rank) of some samples
+ */
+static BenchStatistic summarize(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    size_t count = samples.size();
+    size_t p99Rank = (99 * count + 99) / 100;   // ceil(0.99 * count)
+
+    BenchStatistic statistic;
+    statistic.min = samples[0];
+    statistic.median = count % 2
+                           ? samples[count / 2]
+                           : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    statistic.p99 = samples[p99Rank - 1];
+    return statistic;
+}
+
+/**
+ * @brief Times one scenario at one asteroid count
+ *
+ * @return false if the simulation did not fit in memory
+ */
+static bool runBenchmark(const BenchConfig *config, bool alphaCentauri,
+                         unsigned int asteroids, BenchResult *result)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double timeStep = 100.0 * SECONDS_PER_DAY / 60;
+    std::vector<double> nsPerBodyStep, interactionsPerSecond, constructionMs;
+
+    result->scenario = alphaCentauri ? "alphacentauri" : "solar";
+    result->asteroids = asteroids;
+
+    for (unsigned int repetition = 0; repetition < config->repetitions; repetition++)
+    {
+        Clock::time_point start = Clock::now();
+        OrbitalSim *sim = alphaCentauri
+                              ? constructOrbitalSim_BONUS(timeStep, config->threads, asteroids)
+                              : constructOrbitalSim(timeStep, config->threads, asteroids);
+        double construction = std::chrono::duration<double>(Clock::now() - start).count();
+        if (sim == NULL)
+            return false;
+        setOrbitalSimIntegrator(sim, (IntegratorType)(config->integrator - getIntegrator(INTEGRATOR_EULER)));
+
+        unsigned long steps = config->body_steps / sim->bodies_count;
+        if (steps == 0)
+            steps = 1;
+        result->bodies = sim->bodies_count;
+        result->planets = sim->planets_range;
+        result->steps = steps;
+
+        // Planets attract each other; asteroids only feel the planets
+        double planets = sim->planets_range;
+        double interactionsPerEvaluation = planets * (planets - 1) +
+                                           (sim->bodies_count - planets) * planets;
+
+        // Warm up caches, page in the arrays and wake the pool
+        updateOrbitalSim(sim);
+
+        unsigned long long evaluations = sim->force_evaluations;
+        unsigned long long bodyEvaluations = sim->block ? sim->block->body_evaluations : 0;
+        start = Clock::now();
+        for (unsigned long i = 0; i < steps; i++)
+            updateOrbitalSim(sim);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        evaluations = sim->force_evaluations - evaluations;
+
+        double interactions = evaluations * interactionsPerEvaluation;
+        result->body_evaluations_per_step = 0;
+        memset(result->level_histogram, 0, sizeof(result->level_histogram));
+        if (sim->block != NULL)
+        {
+            // Only the bodies due in a sub-step feel the planets. Counts a
+            // planet's evaluation as one interaction too many.
+            bodyEvaluations = sim->block->body_evaluations - bodyEvaluations;
+            interactions = bodyEvaluations * planets;
+            result->body_evaluations_per_step = (double)bodyEvaluations / steps;
+            memcpy(result->level_histogram, sim->block->level_histogram, sizeof(result->level_histogram));
+        }
+
+        nsPerBodyStep.push_back(seconds * 1E9 / ((double)steps * sim->bodies_count));
+        interactionsPerSecond.push_back(interactions / seconds);
+        constructionMs.push_back(construction * 1E3);
+
+        destroyOrbitalSim(sim);
+    }
+
+    result->ns_per_body_step = summarize(nsPerBodyStep);
+    result->interactions_per_second = summarize(interactionsPerSecond);
+    result->construction_ms = summarize(constructionMs);
+    result->peak_rss_kb = getPeakRss();
+    return true;
+}
+
+static void writeStatistic(FILE *file, const char *name, const BenchStatistic *statistic,
+                           bool last)
+{
+    fprintf(file, "      \"%s\": {\"min\": %.6g, \"median\": %.6g, \"p99\": %.6g}%s\n",
+            name, statistic->min, statistic->median, statistic->p99, last ? "" : ",");
+}
+
+static void writeResults(FILE *file, const BenchConfig *config, const char *isa,
+                         unsigned int threads, const std::vector<BenchResult> &results)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"benchmark\": \"orbitalsim\",\n");
+    fprintf(file, "  \"force_kernel\": \"%s\",\n", isa);
+    fprintf(file, "  \"threads\": %u,\n", threads);
+    fprintf(file, "  \"integrator\": \"%s\",\n", config->integrator->name);
+    fprintf(file, "  \"repetitions\": %u,\n", config->repetitions);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult *result = &results[i];
+
+        fprintf(file, "    {\n");
+        fprintf(file, "      \"scenario\": \"%s\",\n", result->scenario);
+        fprintf(file, "      \"asteroids\": %u,\n", result->asteroids);
+        fprintf(file, "      \"bodies\": %u,\n", result->bodies);
+        fprintf(file, "      \"planets\": %u,\n", result->planets);
+        fprintf(file, "      \"steps\": %lu,\n", result->steps);
+        writeStatistic(file, "ns_per_body_step", &result->ns_per_body_step, false);
+        writeStatistic(file, "interactions_per_second", &result->interactions_per_second, false);
+        writeStatistic(file, "construction_ms", &result->construction_ms, false);
+        if (config->integrator == getIntegrator(INTEGRATOR_BLOCK))
+        {
+            fprintf(file, "      \"body_evaluations_per_step\": %.6g,\n", result->body_evaluations_per_step);
+            fprintf(file, "      \"level_histogram\": [");
+            for (unsigned int level = 0; level <= BLOCK_MAX_LEVEL; level++)
+                fprintf(file, level ? ", %u" : "%u", result->level_histogram[level]);
+            fprintf(file, "],\n");
+        }
+        fprintf(file, "      \"peak_rss_kb\": %lu\n", result->peak_rss_kb);
+        fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config = {
+        10000000,
+        5,
+        BENCH_BODY_STEPS,
+        0,
+        getIntegrator(INTEGRATOR_EULER),
+        NULL,
+    };
+
+    if (!parseArguments(argc, argv, &config))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    unsigned int threads = config.threads ? config.threads : getHardwareThreadCount();
+    const char *isa = getForceKernelIsaName(detectForceKernelIsa());
+
+    // Ascending counts, so the process peak RSS after each run is that run's
+    std::vector<BenchResult> results;
+    bool fits = true;
+    for (unsigned long asteroids = BENCH_MIN_ASTEROIDS;
+         fits && asteroids <= config.max_asteroids; asteroids *= 10)
+    {
+        for (int scenario = 0; fits && scenario < 2; scenario++)
+        {
+            BenchResult result;
+            if (!runBenchmark(&config, scenario == 1, (unsigned int)asteroids, &result))
+            {
+                fprintf(stderr, "not enough memory for %lu asteroids\n", asteroids);
+                fits = false;
+                continue;
+            }
+            fprintf(stderr, "%-14s %9lu asteroids: %.3f ns/body-step, %.3g interactions/s\n",
+                    result.scenario, asteroids, result.ns_per_body_step.median,
+                    result.interactions_per_second.median);
+            results.push_back(result);
+        }
+    }
+
+    FILE *file = config.output ? fopen(config.output, "w") : stdout;
+    if (file == NULL)
+    {
+        fprintf(stderr, "cannot write %s\n", config.output);
+        return 1;
+    }
+    writeResults(file, &config, isa, threads, results);
+    if (file != stdout)
+        fclose(file);
+
+    return 0;
+}
@@ -0,0 +1,304 @@
+/**
+ * @brief Orbital simulation, ensemble runs
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Runs every combination of a sweep spec (scenarios, integrators, time
+ * steps, asteroid seeds, body mass multipliers) side by side, and writes a
+ * CSV row per member: bodies ejected, energy and angular momentum drift,
+ * wall time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "Ensemble.h"
+
+#define SECONDS_PER_DAY 86400
+
+struct EnsembleConfig
+{
+    std::vector<EnsembleScenario> scenarios;
+    std::vector<IntegratorType> integrators;
+    std::vector<double> time_steps;     // [s]
+    std::vector<unsigned int> seeds;
+    std::vector<double> mass_factors[ENSEMBLE_MAX_MASS_SCALES];
+    char mass_bodies[ENSEMBLE_MAX_MASS_SCALES][64];
+    EnsembleSweep sweep;        // the rest of the spec, and the lists once parsed
+    unsigned int threads;       // 0: one per hardware thread
+    const char *output;         // NULL: stdout
+};
+
+static void printUsage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "Lists are comma separated; every combination of them is a member.\n"
+           "  --scenario LIST      solar | alphacentauri (default solar)\n"
+           "  --integrator LIST    euler | leapfrog | yoshida4 | dopri45 | block |\n"
+           "                       wisdom-holman (default euler)\n"
+           "  --time-step LIST     seconds per step (default 100 days / 60)\n"
+           "  --seed LIST          asteroid belt seeds, or first:last ranges (default 1)\n"
+           "  --mass BODY=LIST     multiply BODY's mass (a name or an index) by each factor;\n"
+           "                       planets and stars only, up to %d bodies\n"
+           "  --asteroids N        asteroids of every member (default %d)\n"
+           "  --steps N            steps every member runs (default 1000)\n"
+           "  --threads N          members run at once, 0 for one per hardware thread (default 0)\n"
+           "  --output FILE        CSV destination (default stdout)\n",
+           program, ENSEMBLE_MAX_MASS_SCALES, ASTEROIDS_COUNT);
+}
+
+/**
+ * @brief Splits a comma separated list, calling parse on each item
+ *
+ * @return false if any item is malformed
+ */
+template <typename Parse>
+static bool parseList(const char *list, Parse parse)
+{
+    char item[64];
+
+    while (*list != '\0')
+    {
+        size_t length = strcspn(list, ",");
+        if (length == 0 || length >= sizeof(item))
+            return false;
+        memcpy(item, list, length);
+        item[length] = '\0';
+        if (!parse(item))
+            return false;
+
+        list += length;
+        if (*list == ',' && *++list == '\0')
+            return false;
+    }
+    return true;
+}
+
+static bool parseDoubles(const char *list, std::vector<double> *values)
+{
+    return parseList(list, [values](const char *item) {
+        char *end;
+        double value = strtod(item, &end);
+        values->push_back(value);
+        return *end == '\0' && value > 0;
+    });
+}
+
+/**
+ * @brief Parses the command line
+ *
+ * @return false on a malformed or unknown option
+ */
+static bool parseArguments(int argc, char **argv, EnsembleConfig *config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool valid = true;
+
+        if (strcmp(option, "--help") == 0)
+            return false;
+        if (value == NULL)
+        {
+            fprintf(stderr, "%s: missing value\n", option);
+            return false;
+        }
+        i++;
+
+        if (strcmp(option, "--asteroids") == 0)
+            config->sweep.asteroid_count = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--steps") == 0)
+            config->sweep.steps = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--threads") == 0)
+            config->threads = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--output") == 0)
+            config->output = value;
+        else if (strcmp(option, "--time-step") == 0)
+            valid = parseDoubles(value, &config->time_steps);
+        else if (strcmp(option, "--scenario") == 0)
+            valid = parseList(value, [config](const char *item) {
+                for (int scenario = 0; scenario < ENSEMBLE_SCENARIO_COUNT; scenario++)
+                    if (strcmp(item, getEnsembleScenarioName((EnsembleScenario)scenario)) == 0)
+                    {
+                        config->scenarios.push_back((EnsembleScenario)scenario);
+                        return true;
+                    }
+                return false;
+            });
+        else if (strcmp(option, "--integrator") == 0)
+            valid = parseList(value, [config](const char *item) {
+                const Integrator *integrator = findIntegrator(item);
+                if (integrator != NULL)
+                    config->integrators.push_back((IntegratorType)(integrator - getIntegrator(INTEGRATOR_EULER)));
+                return integrator != NULL;
+            });
+        else if (strcmp(option, "--seed") == 0)
+            valid = parseList(value, [config](const char *item) {
+                char *end;
+                unsigned long first = strtoul(item, &end, 10), last = first;
+                if (*end == ':')
+                    last = strtoul(end + 1, &end, 10);
+                if (*end != '\0' || last < first || last - first >= 0xFFFFFFFFu)
+                    return false;
+                for (unsigned long seed = first; seed <= last; seed++)
+                    config->seeds.push_back((unsigned int)seed);
+                return true;
+            });
+        else if (strcmp(option, "--mass") == 0)
+        {
+            const char *factors = strchr(value, '=');
+            unsigned int count = config->sweep.mass_count;
+            if (count == ENSEMBLE_MAX_MASS_SCALES || factors == NULL || factors == value ||
+                factors - value >= (long)sizeof(config->mass_bodies[count]))
+                valid = false;
+            else
+            {
+                memcpy(config->mass_bodies[count], value, factors - value);
+                config->mass_bodies[count][factors - value] = '\0';
+                config->sweep.masses[count].body = config->mass_bodies[count];
+                config->sweep.mass_count++;
+                valid = parseDoubles(factors + 1, &config->mass_factors[count]);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "unknown option: %s\n", option);
+            return false;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "%s: malformed value: %s\n", option, value);
+            return false;
+        }
+    }
+
+    if (config->sweep.steps == 0)
+    {
+        fprintf(stderr, "steps must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Points the sweep at the parsed lists, filling in the defaults of
+ * the ones not given
+ */
+static void completeSweep(EnsembleConfig *config)
+{
+    EnsembleSweep *sweep = &config->sweep;
+
+    if (config->scenarios.empty())
+        config->scenarios.push_back(ENSEMBLE_SCENARIO_SOLAR);
+    if (config->integrators.empty())
+        config->integrators.push_back(INTEGRATOR_EULER);
+    if (config->time_steps.empty())
+        config->time_steps.push_back(100.0 * SECONDS_PER_DAY / 60);
+    if (config->seeds.empty())
+        config->seeds.push_back(1);
+
+    sweep->scenarios = config->scenarios.data();
+    sweep->scenario_count = (unsigned int)config->scenarios.size();
+    sweep->integrators = config->integrators.data();
+    sweep->integrator_count = (unsigned int)config->integrators.size();
+    sweep->time_steps = config->time_steps.data();
+    sweep->time_step_count = (unsigned int)config->time_steps.size();
+    sweep->seeds = config->seeds.data();
+    sweep->seed_count = (unsigned int)config->seeds.size();
+    for (unsigned int m = 0; m < sweep->mass_count; m++)
+    {
+        sweep->masses[m].factors = config->mass_factors[m].data();
+        sweep->masses[m].factor_count = (unsigned int)config->mass_factors[m].size();
+    }
+}
+
+static void writeResults(FILE *file, const Ensemble *ensemble)
+{
+    const EnsembleParameters *first = &ensemble->parameters[0];
+
+    fprintf(file, "member,scenario,integrator,time_step,seed");
+    for (unsigned int m = 0; m < first->mass_scale_count; m++)
+        fprintf(file, ",mass_%s", first->mass_scales[m].body);
+    fprintf(file, ",completed,ejected_planets,ejected_asteroids,energy_error,angular_momentum_error,"
+                  "wall_seconds\n");
+
+    for (unsigned int member = 0; member < ensemble->member_count; member++)
+    {
+        const EnsembleParameters *p = &ensemble->parameters[member];
+        const EnsembleResult *r = &ensemble->results[member];
+
+        fprintf(file, "%u,%s,%s,%.9g,%u", member, getEnsembleScenarioName(p->scenario),
+                getIntegrator(p->integrator)->name, p->time_step, p->seed);
+        for (unsigned int m = 0; m < p->mass_scale_count; m++)
+            fprintf(file, ",%.9g", p->mass_scales[m].factor);
+        fprintf(file, ",%d,%u,%u,%.6g,%.6g,%.6g\n", r->completed, r->ejected_planets, r->ejected_asteroids,
+                r->energy_error, r->angular_momentum_error, r->wall_time);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    EnsembleConfig config;
+    memset(&config.sweep, 0, sizeof(config.sweep));
+    config.sweep.asteroid_count = ASTEROIDS_COUNT;
+    config.sweep.steps = 1000;
+    config.threads = 0;
+    config.output = NULL;
+
+    if (!parseArguments(argc, argv, &config))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    completeSweep(&config);
+
+    unsigned int count = expandEnsembleSweep(&config.sweep, NULL);
+    std::vector<EnsembleParameters> parameters(count);
+    if (count == 0)
+    {
+        fprintf(stderr, "the sweep has too many members\n");
+        return 1;
+    }
+    expandEnsembleSweep(&config.sweep, parameters.data());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Ensemble *ensemble = constructEnsemble(parameters.data(), count, config.threads);
+    if (ensemble == NULL)
+    {
+        fprintf(stderr, "cannot build the ensemble: out of memory, or a --mass body isn't a planet or star of every scenario\n");
+        return 1;
+    }
+    double construction = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    runEnsemble(ensemble);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    unsigned int completed = 0;
+    for (unsigned int member = 0; member < count; member++)
+        completed += ensemble->results[member].completed;
+    fprintf(stderr, "%u members (%u bases, built in %.3f s) in %.3f s on %u threads, %u completed\n", count,
+            ensemble->base_count, construction, seconds,
+            ensemble->pool != NULL ? ensemble->pool->thread_count : 1, completed);
+
+    FILE *file = config.output ? fopen(config.output, "w") : stdout;
+    if (file == NULL)
+    {
+        fprintf(stderr, "cannot write %s\n", config.output);
+        destroyEnsemble(ensemble);
+        return 1;
+    }
+    writeResults(file, ensemble);
+    bool written = !ferror(file);
+    if (file != stdout)
+        written = fclose(file) == 0 && written;
+
+    destroyEnsemble(ensemble);
+    return written && completed == count ? 0 : 1;
+}
@@ -0,0 +1,1139 @@
+/**
+ * @brief Orbital simulation, headless batch runs
+ * @author Marc S. Ressl
+ * @modifiers Matteo Ginhson, Nicanor Otamendi
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Advances a simulation a fixed number of steps without opening a window,
+ * and reports how fast it went.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <float.h>
+#include <chrono>
+#include <vector>
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#endif
+
+#include "OrbitalSim.h"
+#include "Checkpoint.h"
+#include "TrajectoryWriter.h"
+#include "SimulationThread.h"
+#include "RenderPrep.h"
+#include "Instrumentation.h"
+#include "Shard.h"
+
+/**
+ * Most ranges --trajectory-bodies takes
+ */
+#define MAX_TRAJECTORY_RANGES 64
+
+#define SECONDS_PER_DAY 86400
+
+/**
+ * --precision-check fails if the median asteroid ends up further than this
+ * from the double precision run, relative to its distance from bodies[0]
+ */
+#define PRECISION_CHECK_TOLERANCE 1E-6
+
+/**
+ * @brief Run configuration, filled in from the command line
+ */
+struct HeadlessConfig
+{
+    unsigned int asteroids;
+    double time_step;           // [s], 0: the default, or the checkpoint's
+    unsigned long steps;
+    unsigned int tile_steps;    // steps per updateOrbitalSimTiled call, 0 or 1: one at a time
+    bool alpha_centauri;        // scenario: solar system otherwise
+    unsigned int threads;       // 0: one per hardware thread
+    const Integrator *integrator;   // NULL: euler, or the checkpoint's
+    int force_model;            // ForceModel, -1: planets, or the checkpoint's
+    int force_precision;        // ForcePrecision, -1: double
+    bool precision_check;       // also run a double precision copy, and compare
+    double opening_angle;       // 0: the default, or the checkpoint's
+    const char *load;           // checkpoint to restart from, instead of a scenario
+    const char *save;           // checkpoint to write at the end
+    unsigned long checkpoint_interval;  // also write it every so many steps, 0: never
+    bool verify;                // checksum the whole checkpoint on load
+
+    const char *trajectory;     // trajectory file to record, NULL: none
+    unsigned int trajectory_interval;
+    double trajectory_quantum;  // [m]
+    const char *trajectory_bodies;  // "planets", or begin:end ranges, comma separated. NULL: all
+    bool verify_trajectory;     // read the trajectory back at the end, and compare it with the positions
+
+    bool render_stats;          // prepare a draw list from the viewer's starting camera, at the end
+
+    int collisions;             // CollisionResponse, -1: bodies pass through each other
+    double encounter_distance;  // [m]
+    const char *collision_log;  // CSV of every event, NULL: none
+
+    bool instrument;            // time the phases, sample the invariants
+    unsigned int instrument_interval;   // steps between samples
+    const char *instrument_csv; // a row per sample, NULL: none
+
+    AsteroidBelt belt;          // how the scenario's asteroids are drawn
+    const char *catalog;        // bodies to load in place of the belt, NULL: none
+
+    double prune;               // acceleration asteroids may lose to perturber lists, 0: feel every planet
+    unsigned int prune_interval;    // steps between rankings, 0: the default
+
+    unsigned int shards;        // worker processes the asteroids are split across, 0: none
+    const char *shard_worker;   // NAME:INDEX, run as that worker of another run's shards. NULL: none
+
+    const char *approaches;     // TARGET:DISTANCE, comma separated, to find close approaches to. NULL: none
+    const char *approach_log;   // CSV of every close approach, NULL: none
+};
+
+static void printUsage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  --asteroids N        asteroid count (default %d)\n"
+           "  --time-step S        seconds per step (default 100 days / 60)\n"
+           "  --steps N            steps to run (default 1000)\n"
+           "  --tile K             move asteroids K steps at a time (euler only, default 1)\n"
+           "  --scenario NAME      solar | alphacentauri (default solar)\n"
+           "  --seed N             asteroid belt seed (default %d)\n"
+           "  --belt-radius M      mean asteroid distance in m (default %g)\n"
+           "  --belt-arc RAD       angle the belt spans (default 2 pi: all around)\n"
+           "  --belt-speed MIN:MAX asteroid speeds, times the circular orbit speed (default 0.6:1.2)\n"
+           "  --catalog FILE       solar system with the bodies of a Horizons vector table or an\n"
+           "                       MPCORB file in place of the belt; asteroids are ignored\n"
+           "  --prune TOL          asteroids only feel the planets that add up to all but TOL\n"
+           "                       of their acceleration, 0 < TOL < 1 (default off)\n"
+           "  --prune-every N      rank the planets again every N steps (default %d)\n"
+           "  --shards N           split the asteroids across N worker processes, up to %d\n"
+           "                       (euler, planets force model)\n"
+           "  --shard-worker NAME:INDEX\n"
+           "                       run as a worker of a sharded run; --shards starts these\n"
+           "  --approaches LIST    find bodies passing within DISTANCE m of TARGET, a name or an\n"
+           "                       index, for each TARGET:DISTANCE of LIST, comma separated\n"
+           "  --approach-log FILE  write every close approach to FILE, in time order\n"
+           "  --threads N          worker threads, 0 for one per hardware thread (default 0)\n"
+           "  --integrator NAME    euler | leapfrog | yoshida4 | dopri45 | block |\n"
+           "                       wisdom-holman (default euler)\n"
+           "  --force-model NAME   planets | barnes-hut (default planets)\n"
+           "  --theta X            Barnes-Hut opening angle (default %g)\n"
+           "  --precision NAME     double | mixed asteroid forces (default double)\n"
+           "  --precision-check    run a double precision copy alongside, and compare them\n"
+           "  --load FILE          restart from a checkpoint; scenario and asteroids are ignored\n"
+           "  --save FILE          write a checkpoint when done\n"
+           "  --checkpoint-every N also write it every N steps (default never)\n"
+           "  --verify             checksum the whole checkpoint when loading it\n"
+           "  --trajectory FILE    record positions to FILE\n"
+           "  --trajectory-every N one frame every N steps (default 1)\n"
+           "  --trajectory-bodies  planets, or begin:end ranges, comma separated (default all)\n"
+           "  --trajectory-quantum position resolution in m (default %g)\n"
+           "  --verify-trajectory  read the trajectory back at the end, and compare it with the\n"
+           "                       positions recorded (keeps them all in memory)\n"
+           "  --render-stats       at the end, report what the viewer would cull and draw\n"
+           "  --collisions NAME    merge | remove | log bodies that touch (default off)\n"
+           "  --encounter-distance M  also log bodies passing within M m of each other\n"
+           "  --collision-log FILE write every collision and encounter to FILE\n"
+           "  --instrument N       time each phase, and sample energy and angular momentum\n"
+           "                       every N steps (needs ORBITALSIM_INSTRUMENTATION)\n"
+           "  --instrument-csv F   write the samples to F (every %d steps without --instrument)\n",
+           program, ASTEROIDS_COUNT, DEFAULT_ASTEROID_SEED, (double)ASTEROIDS_MEAN_RADIUS,
+           DEFAULT_INTERACTION_REFRESH, SHARD_MAX_WORKERS, DEFAULT_OPENING_ANGLE,
+           DEFAULT_TRAJECTORY_QUANTUM, DEFAULT_DIAGNOSTICS_INTERVAL);
+}
+
+/**
+ * @brief Parses the command line
+ *
+ * @return false on a malformed or unknown option
+ */
+static bool parseArguments(int argc, char **argv, HeadlessConfig *config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(option, "--help") == 0)
+            return false;
+        if (strcmp(option, "--verify") == 0)
+        {
+            config->verify = true;
+            continue;
+        }
+        if (strcmp(option, "--render-stats") == 0)
+        {
+            config->render_stats = true;
+            continue;
+        }
+        if (strcmp(option, "--precision-check") == 0)
+        {
+            config->precision_check = true;
+            continue;
+        }
+        if (strcmp(option, "--verify-trajectory") == 0)
+        {
+            config->verify_trajectory = true;
+            continue;
+        }
+        if (value == NULL)
+        {
+            fprintf(stderr, "%s: missing value\n", option);
+            return false;
+        }
+        i++;
+
+        if (strcmp(option, "--asteroids") == 0)
+            config->asteroids = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--time-step") == 0)
+            config->time_step = strtod(value, NULL);
+        else if (strcmp(option, "--steps") == 0)
+            config->steps = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--tile") == 0)
+            config->tile_steps = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--threads") == 0)
+            config->threads = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--prune") == 0)
+        {
+            config->prune = strtod(value, NULL);
+            if (!(config->prune > 0 && config->prune < 1))
+            {
+                fprintf(stderr, "prune tolerance must be between 0 and 1\n");
+                return false;
+            }
+        }
+        else if (strcmp(option, "--prune-every") == 0)
+            config->prune_interval = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--shards") == 0)
+            config->shards = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--shard-worker") == 0)
+            config->shard_worker = value;
+        else if (strcmp(option, "--approaches") == 0)
+            config->approaches = value;
+        else if (strcmp(option, "--approach-log") == 0)
+            config->approach_log = value;
+        else if (strcmp(option, "--seed") == 0)
+            config->belt.seed = strtoull(value, NULL, 10);
+        else if (strcmp(option, "--belt-radius") == 0)
+            config->belt.mean_radius = strtof(value, NULL);
+        else if (strcmp(option, "--belt-arc") == 0)
+            config->belt.arc = strtof(value, NULL);
+        else if (strcmp(option, "--belt-speed") == 0)
+        {
+            char *end;
+            config->belt.min_speed = strtof(value, &end);
+            config->belt.max_speed = *end == ':' ? strtof(end + 1, &end) : 0;
+            if (*end != '\0')
+            {
+                fprintf(stderr, "--belt-speed: expected MIN:MAX, got %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--theta") == 0)
+            config->opening_angle = strtod(value, NULL);
+        else if (strcmp(option, "--load") == 0)
+            config->load = value;
+        else if (strcmp(option, "--catalog") == 0)
+            config->catalog = value;
+        else if (strcmp(option, "--save") == 0)
+            config->save = value;
+        else if (strcmp(option, "--checkpoint-every") == 0)
+            config->checkpoint_interval = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--trajectory") == 0)
+            config->trajectory = value;
+        else if (strcmp(option, "--trajectory-every") == 0)
+            config->trajectory_interval = (unsigned int)strtoul(value, NULL, 10);
+        else if (strcmp(option, "--trajectory-quantum") == 0)
+            config->trajectory_quantum = strtod(value, NULL);
+        else if (strcmp(option, "--trajectory-bodies") == 0)
+            config->trajectory_bodies = value;
+        else if (strcmp(option, "--encounter-distance") == 0)
+            config->encounter_distance = strtod(value, NULL);
+        else if (strcmp(option, "--collision-log") == 0)
+            config->collision_log = value;
+        else if (strcmp(option, "--collisions") == 0)
+        {
+            if (strcmp(value, "merge") == 0)
+                config->collisions = COLLISION_MERGE;
+            else if (strcmp(value, "remove") == 0)
+                config->collisions = COLLISION_REMOVE;
+            else if (strcmp(value, "log") == 0)
+                config->collisions = COLLISION_LOG;
+            else
+            {
+                fprintf(stderr, "unknown collision response: %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--instrument") == 0)
+        {
+            config->instrument = true;
+            config->instrument_interval = (unsigned int)strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--instrument-csv") == 0)
+        {
+            config->instrument = true;
+            config->instrument_csv = value;
+        }
+        else if (strcmp(option, "--scenario") == 0)
+        {
+            if (strcmp(value, "solar") == 0)
+                config->alpha_centauri = false;
+            else if (strcmp(value, "alphacentauri") == 0)
+                config->alpha_centauri = true;
+            else
+            {
+                fprintf(stderr, "unknown scenario: %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--integrator") == 0)
+        {
+            config->integrator = findIntegrator(value);
+            if (config->integrator == NULL)
+            {
+                fprintf(stderr, "unknown integrator: %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--precision") == 0)
+        {
+            if (strcmp(value, "double") == 0)
+                config->force_precision = FORCE_PRECISION_DOUBLE;
+            else if (strcmp(value, "mixed") == 0)
+                config->force_precision = FORCE_PRECISION_MIXED;
+            else
+            {
+                fprintf(stderr, "unknown precision: %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--force-model") == 0)
+        {
+            if (strcmp(value, "planets") == 0)
+                config->force_model = FORCE_MODEL_PLANETS;
+            else if (strcmp(value, "barnes-hut") == 0)
+                config->force_model = FORCE_MODEL_BARNES_HUT;
+            else
+            {
+                fprintf(stderr, "unknown force model: %s\n", value);
+                return false;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "unknown option: %s\n", option);
+            return false;
+        }
+    }
+
+    if (config->time_step < 0 || config->opening_angle < 0)
+    {
+        fprintf(stderr, "time step and theta must be positive\n");
+        return false;
+    }
+    if (!(config->belt.mean_radius > 0) || !(config->belt.arc >= 0) || !(config->belt.min_speed > 0) ||
+        config->belt.max_speed < config->belt.min_speed)
+    {
+        fprintf(stderr, "belt radius and speeds must be positive, the arc not negative, and MIN <= MAX\n");
+        return false;
+    }
+    if (config->trajectory_interval == 0 || !(config->trajectory_quantum > 0))
+    {
+        fprintf(stderr, "trajectory interval and quantum must be positive\n");
+        return false;
+    }
+    if (config->verify_trajectory && config->trajectory == NULL)
+    {
+        fprintf(stderr, "--verify-trajectory needs --trajectory\n");
+        return false;
+    }
+    if (config->catalog != NULL && (config->load != NULL || config->alpha_centauri))
+    {
+        fprintf(stderr, "--catalog goes with the solar scenario, not --load\n");
+        return false;
+    }
+    if (config->checkpoint_interval && config->save == NULL)
+    {
+        fprintf(stderr, "--checkpoint-every needs --save\n");
+        return false;
+    }
+    if (config->encounter_distance < 0)
+    {
+        fprintf(stderr, "encounter distance must be positive\n");
+        return false;
+    }
+    if ((config->encounter_distance > 0 || config->collision_log != NULL) && config->collisions < 0)
+    {
+        fprintf(stderr, "--encounter-distance and --collision-log need --collisions\n");
+        return false;
+    }
+    if (config->collisions >= 0 && config->precision_check)
+    {
+        fprintf(stderr, "--precision-check can't follow bodies taken out by --collisions\n");
+        return false;
+    }
+    if (config->prune_interval > 0 && config->prune == 0)
+    {
+        fprintf(stderr, "--prune-every needs --prune\n");
+        return false;
+    }
+    if (config->shards > SHARD_MAX_WORKERS)
+    {
+        fprintf(stderr, "at most %d shards\n", SHARD_MAX_WORKERS);
+        return false;
+    }
+    if (config->shards > 0 && (config->prune > 0 || config->collisions >= 0 || config->trajectory != NULL ||
+                               config->precision_check || config->instrument || config->approaches != NULL))
+    {
+        fprintf(stderr, "--shards doesn't go with --prune, --collisions, --trajectory, --precision-check, "
+                        "--instrument or --approaches\n");
+        return false;
+    }
+    if (config->approach_log != NULL && config->approaches == NULL)
+    {
+        fprintf(stderr, "--approach-log needs --approaches\n");
+        return false;
+    }
+    if (config->instrument && !INSTRUMENTATION_ENABLED)
+    {
+        fprintf(stderr, "built without ORBITALSIM_INSTRUMENTATION, cannot instrument\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parses a --trajectory-bodies list
+ *
+ * @return How many ranges, 0 if malformed
+ */
+static unsigned int parseTrajectoryBodies(const char *list, const OrbitalSim *sim,
+                                          TrajectoryRange *ranges)
+{
+    unsigned int count = 0;
+
+    if (strcmp(list, "planets") == 0)
+    {
+        ranges[0].begin = 0;
+        ranges[0].end = sim->planets_range;
+        return 1;
+    }
+
+    while (*list != '\0' && count < MAX_TRAJECTORY_RANGES)
+    {
+        char *end;
+        ranges[count].begin = (unsigned int)strtoul(list, &end, 10);
+        if (*end != ':')
+            return 0;
+        ranges[count].end = (unsigned int)strtoul(end + 1, &end, 10);
+        count++;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return 0;
+        list = end;
+    }
+    return *list == '\0' ? count : 0;
+}
+
+/**
+ * @brief Adds the targets of an --approaches list to a simulation's close
+ * approach query
+ *
+ * @return false if malformed, or a target isn't there
+ */
+static bool parseApproachTargets(const char *list, ApproachQuery *query)
+{
+    while (*list != '\0')
+    {
+        const char *separator = strchr(list, ':');
+        char target[64];
+        if (separator == NULL || (size_t)(separator - list) >= sizeof(target))
+            return false;
+        memcpy(target, list, separator - list);
+        target[separator - list] = '\0';
+
+        char *end;
+        double threshold = strtod(separator + 1, &end);
+        int body = findOrbitalSimBody(query->sim, target);
+        if (body < 0 || end == separator + 1 || !addApproachTarget(query, (unsigned int)body, threshold))
+            return false;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return false;
+        list = end;
+    }
+    return query->target_count > 0;
+}
+
+static int compareErrors(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Compares a simulation with its double precision reference: how far
+ * each asteroid ended up from where the reference has it, relative to its
+ * distance from bodies[0]
+ *
+ * @return false if the median error is over PRECISION_CHECK_TOLERANCE
+ */
+static bool comparePrecision(const OrbitalSim *sim, const OrbitalSim *reference)
+{
+    const OrbitalBodies *a = &sim->bodies, *b = &reference->bodies;
+    unsigned int count = sim->bodies_count - sim->planets_range;
+    double planet_error = 0;
+
+    for (unsigned int i = 0; i < sim->planets_range; i++)
+        planet_error = fmax(planet_error, sqrt((a->x[i] - b->x[i]) * (a->x[i] - b->x[i]) +
+                                               (a->y[i] - b->y[i]) * (a->y[i] - b->y[i]) +
+                                               (a->z[i] - b->z[i]) * (a->z[i] - b->z[i])));
+    if (count == 0)
+    {
+        printf("Precision: planets within %.3g m of double, no asteroids\n", planet_error);
+        return true;
+    }
+
+    double *errors = (double *)malloc(count * sizeof(double));
+    if (errors == NULL)
+    {
+        fprintf(stderr, "not enough memory for the precision check\n");
+        return false;
+    }
+    for (unsigned int n = 0; n < count; n++)
+    {
+        unsigned int i = sim->planets_range + n;
+        double dx = a->x[i] - b->x[i], dy = a->y[i] - b->y[i], dz = a->z[i] - b->z[i];
+        double rx = b->x[i] - b->x[0], ry = b->y[i] - b->y[0], rz = b->z[i] - b->z[0];
+        errors[n] = sqrt((dx * dx + dy * dy + dz * dz) / (rx * rx + ry * ry + rz * rz));
+    }
+    qsort(errors, count, sizeof(double), compareErrors);
+
+    double median = errors[count / 2];
+    bool accurate = median <= PRECISION_CHECK_TOLERANCE;
+    printf("Precision: asteroid position error vs double, median %.3g, 99th percentile %.3g, max %.3g "
+           "(relative to distance); planets within %.3g m: %s\n",
+           median, errors[(size_t)(0.99 * (count - 1))], errors[count - 1], planet_error,
+           accurate ? "ok" : "FAILED");
+    free(errors);
+    return accurate;
+}
+
+/**
+ * @brief Keeps the positions of the recorded bodies, for --verify-trajectory,
+ * if the writer just took a frame
+ *
+ * @param times The time of each frame
+ * @param positions x, then y, then z of each recorded body, frame after frame
+ */
+static void keepTrajectoryFrame(const OrbitalSim *sim, std::vector<double> &times, std::vector<double> &positions)
+{
+    const TrajectoryWriter *writer = sim->trajectory;
+    const OrbitalBodies *bodies = &sim->bodies;
+    const double *axes[3] = {bodies->x, bodies->y, bodies->z};
+
+    if ((writer->steps - 1) % writer->interval != 0)
+        return;
+
+    times.push_back(sim->time_elapsed);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (!writer->remapped)
+        {
+            for (unsigned int i = 0; i < writer->range_count; i++)
+                positions.insert(positions.end(), axes[axis] + writer->ranges[i].begin,
+                                 axes[axis] + writer->ranges[i].end);
+        }
+        else
+        {
+            for (unsigned int i = 0; i < writer->body_count; i++)
+            {
+                unsigned int body = writer->bodies[i];
+                positions.push_back(body != COLLISION_BODY_REMOVED ? axes[axis][body] : NAN);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reads a trajectory back, and checks every frame against the
+ * positions kept while recording: each one within quantum / 2, NaN where
+ * the body was taken out. Keyframes and deltas must both decode.
+ *
+ * @return false if the file doesn't read back as recorded
+ */
+static bool verifyTrajectory(const char *path, unsigned int bodyCount, double quantum,
+                             const std::vector<double> &times, const std::vector<double> &positions)
+{
+    TrajectoryReader *reader = openTrajectory(path);
+    if (reader == NULL || reader->body_count != bodyCount || reader->quantum != quantum)
+    {
+        fprintf(stderr, "%s: cannot read the trajectory back\n", path);
+        if (reader != NULL)
+            closeTrajectory(reader);
+        return false;
+    }
+
+    std::vector<double> frame(3 * (size_t)bodyCount + 1);
+    double *x = frame.data(), *y = x + bodyCount, *z = y + bodyCount;
+    double time, max_error = 0;
+    unsigned long long removed = 0;
+    size_t frames = 0;
+    bool ok = true;
+
+    while (ok && readTrajectoryFrame(reader, &time, x, y, z))
+    {
+        const double *expected = frames < times.size() ? &positions[frames * 3 * bodyCount] : NULL;
+        ok = expected != NULL && time == times[frames];
+        for (size_t i = 0; ok && i < 3 * (size_t)bodyCount; i++)
+        {
+            double error = fabs(frame[i] - expected[i]);
+            if (expected[i] != expected[i])
+            {
+                ok = frame[i] != frame[i];
+                removed++;
+            }
+            else
+            {
+                // Rounding the quantized position back to meters costs a few ulps
+                ok = error <= 0.5 * quantum + 4 * DBL_EPSILON * fabs(expected[i]);
+                max_error = fmax(max_error, error);
+            }
+        }
+        frames++;
+    }
+    ok = ok && frames == times.size() &&
+         reader->keyframes == (frames + TRAJECTORY_KEYFRAME_INTERVAL - 1) / TRAJECTORY_KEYFRAME_INTERVAL;
+
+    printf("Trajectory check: %lu of %lu frames read back (%llu keyframes), %llu removed positions, "
+           "max error %.3g m (quantum %g m): %s\n",
+           (unsigned long)frames, (unsigned long)times.size(), reader->keyframes, removed, max_error, quantum,
+           ok ? "ok" : "FAILED");
+    closeTrajectory(reader);
+    return ok;
+}
+
+/**
+ * @brief Reports how far energy and angular momentum drifted since the start
+ */
+static void printConservation(const OrbitalSim *sim, double initialEnergy, const double initialMomentum[3])
+{
+    double energy, momentum[3];
+    computeOrbitalSimInvariants(sim, &energy, momentum);
+
+    double dx = momentum[0] - initialMomentum[0];
+    double dy = momentum[1] - initialMomentum[1];
+    double dz = momentum[2] - initialMomentum[2];
+    double scale = sqrt(initialMomentum[0] * initialMomentum[0] + initialMomentum[1] * initialMomentum[1] +
+                        initialMomentum[2] * initialMomentum[2]);
+    printf("Conservation: energy error %.3g, angular momentum error %.3g (relative)\n",
+           fabs(energy - initialEnergy) / fabs(initialEnergy), sqrt(dx * dx + dy * dy + dz * dz) / scale);
+}
+
+/**
+ * @brief Reports how many single-body force evaluations the block time steps
+ * took, against one per body-step, and the levels the asteroids moved at
+ */
+static void printBlockTimeStep(const BlockTimeStep *block, double bodySteps)
+{
+    printf("Block time steps: %llu body evaluations, %.3g per body-step; asteroids per level:",
+           block->body_evaluations, bodySteps > 0 ? block->body_evaluations / bodySteps : 0.0);
+    for (unsigned int level = 0; level <= BLOCK_MAX_LEVEL; level++)
+        if (block->level_histogram[level])
+            printf(" %u:%u", level, block->level_histogram[level]);
+    printf("\n");
+}
+
+/**
+ * @brief Reports where the time went, in CPU time over all threads
+ */
+static void printInstrumentation(const Instrumentation *instrumentation)
+{
+    unsigned long long pairs = instrumentation->pair_interactions;
+
+    printf("Phases:");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        if (instrumentation->cycles[phase])
+            printf(" %s %.3f s", getInstrumentationPhaseName((InstrumentationPhase)phase),
+                   getInstrumentationSeconds(instrumentation, (InstrumentationPhase)phase));
+    printf(" (CPU time, all threads)\n");
+    if (pairs)
+        printf("Interactions: %llu pairs, %.3g ns each\n", pairs,
+               1E9 * getInstrumentationSeconds(instrumentation, PHASE_FORCE) / pairs);
+}
+
+/**
+ * @brief Prepares a draw list as the viewer does on its first frame, and
+ * reports where the bodies went
+ */
+static void printRenderStats(const OrbitalSim *sim)
+{
+    SimulationSnapshot snapshot;
+    RenderCamera camera = {
+        {10.0F, 10.0F, 10.0F},
+        {0.0F, 0.0F, 0.0F},
+        {0.0F, 1.0F, 0.0F},
+        45.0F,
+        1280.0F / 720.0F,
+        0.01F,
+        1000.0F,
+    };
+
+    memset(&snapshot, 0, sizeof(snapshot));
+    DrawList *list = constructDrawList();
+    if (list == NULL || !captureSimulationSnapshot(sim, &snapshot))
+    {
+        fprintf(stderr, "not enough memory for render stats\n");
+        if (list != NULL)
+            destroyDrawList(list);
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool prepared = prepareDrawList(list, &snapshot, &camera);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (prepared)
+        printf("Render: %u bodies, %u culled, %u points, %u spheres (%u detailed), prepared in %.3f ms\n",
+               list->stats.bodies, list->stats.culled, list->stats.points, list->stats.spheres,
+               list->stats.detailed_spheres, seconds * 1E3);
+    else
+        fprintf(stderr, "not enough memory for render stats\n");
+
+    destroyDrawList(list);
+    freeSimulationSnapshot(&snapshot);
+}
+
+/**
+ * @brief Runs this process as a worker of a sharded run, from its
+ * --shard-worker NAME:INDEX
+ *
+ * @return The exit code
+ */
+static int runShardWorkerOption(const char *option, unsigned int threadCount)
+{
+    const char *separator = strrchr(option, ':');
+    char name[SHARD_NAME_SIZE];
+
+    if (separator == NULL || separator == option || (size_t)(separator - option) >= sizeof(name) ||
+        separator[1] == '\0')
+    {
+        fprintf(stderr, "malformed --shard-worker: %s\n", option);
+        return 1;
+    }
+    memcpy(name, option, separator - option);
+    name[separator - option] = '\0';
+    return runShardWorker(name, (unsigned int)strtoul(separator + 1, NULL, 10), threadCount) ? 0 : 1;
+}
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+/**
+ * @brief Starts a coordinator's workers, as copies of this program
+ *
+ * @param coordinator The coordinator
+ * @param program argv[0], if this program can't be found otherwise
+ * @param threadCount Each worker's threads, 0: its share of its NUMA node
+ * @param pids Filled in with the workers' process ids
+ * @return How many were started
+ */
+static unsigned int startShardWorkers(const ShardCoordinator *coordinator, const char *program,
+                                      unsigned int threadCount, long *pids)
+{
+#ifndef _WIN32
+    unsigned int started = 0;
+
+    for (; started < coordinator->worker_count; started++)
+    {
+        char worker[SHARD_NAME_SIZE + 16], threads[16];
+        snprintf(worker, sizeof(worker), "%s:%u", coordinator->name, started);
+        snprintf(threads, sizeof(threads), "%u", threadCount);
+        char *arguments[] = {(char *)program, (char *)"--shard-worker", worker, (char *)"--threads", threads, NULL};
+
+        pid_t pid;
+        if (posix_spawn(&pid, "/proc/self/exe", NULL, NULL, arguments, environ) != 0 &&
+            posix_spawnp(&pid, program, NULL, NULL, arguments, environ) != 0)
+            break;
+        pids[started] = pid;
+    }
+    return started;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Waits for the workers startShardWorkers started to exit
+ */
+static void waitShardWorkers(const long *pids, unsigned int count)
+{
+#ifndef _WIN32
+    for (unsigned int i = 0; i < count; i++)
+        waitpid((pid_t)pids[i], NULL, 0);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    HeadlessConfig config;
+    memset(&config, 0, sizeof(config));
+    config.asteroids = ASTEROIDS_COUNT;
+    config.steps = 1000;
+    config.tile_steps = 1;
+    config.force_model = -1;
+    config.force_precision = -1;
+    config.trajectory_interval = 1;
+    config.trajectory_quantum = DEFAULT_TRAJECTORY_QUANTUM;
+    config.collisions = -1;
+    config.instrument_interval = DEFAULT_DIAGNOSTICS_INTERVAL;
+    setDefaultAsteroidBelt(&config.belt);
+
+    if (!parseArguments(argc, argv, &config))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (config.shard_worker != NULL)
+        return runShardWorkerOption(config.shard_worker, config.threads);
+
+    OrbitalSim *sim;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (config.load != NULL)
+    {
+        sim = loadCheckpoint(config.load, config.threads, config.verify ? CHECKPOINT_VERIFY : 0);
+        if (sim == NULL)
+            return 1;
+        printf("Loaded %s in %.3f ms, at day %.1f\n", config.load,
+               1E3 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+               sim->time_elapsed / SECONDS_PER_DAY);
+    }
+    else if (config.catalog != NULL)
+    {
+        double timeStep = config.time_step > 0 ? config.time_step : 100.0 * SECONDS_PER_DAY / 60;
+        sim = constructOrbitalSimFromCatalog(timeStep, config.catalog, config.threads);
+        if (sim == NULL)
+            return 1;
+        printf("Loaded %u bodies from %s in %.3f ms\n", sim->bodies_count - sim->planets_range, config.catalog,
+               1E3 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    else
+    {
+        double timeStep = config.time_step > 0 ? config.time_step : 100.0 * SECONDS_PER_DAY / 60;
+        sim = config.alpha_centauri
+                  ? constructOrbitalSim_BONUS(timeStep, config.threads, config.asteroids, &config.belt)
+                  : constructOrbitalSim(timeStep, config.threads, config.asteroids, &config.belt);
+        if (sim == NULL)
+        {
+            fprintf(stderr, "not enough memory for %u asteroids\n", config.asteroids);
+            return 1;
+        }
+        printf("Built %u asteroids (seed %llu) in %.3f ms\n", config.asteroids, config.belt.seed,
+               1E3 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    if (config.time_step > 0)
+        sim->time_step = config.time_step;
+    if (config.force_model >= 0)
+        sim->force_model = (ForceModel)config.force_model;
+    if (config.force_precision >= 0)
+        setOrbitalSimPrecision(sim, (ForcePrecision)config.force_precision);
+    if (config.opening_angle > 0)
+        sim->opening_angle = config.opening_angle;
+    if (config.integrator != NULL)
+        setOrbitalSimIntegrator(sim, (IntegratorType)(config.integrator - getIntegrator(INTEGRATOR_EULER)));
+
+    printf("%s, %u bodies (%u planets), %s integrator, %s %s kernel, %u threads\n",
+           config.load ? config.load : config.catalog ? config.catalog : config.alpha_centauri ? "Alpha Centauri" : "Solar system",
+           sim->bodies_count, sim->planets_range, sim->integrator->name,
+           getForcePrecisionName(sim->force_precision), getForceKernelIsaName(sim->force_kernel_isa),
+           sim->pool ? sim->pool->thread_count : 1);
+
+    //What --verify-trajectory expects to read back
+    std::vector<double> trajectory_times, trajectory_positions;
+    if (config.trajectory != NULL)
+    {
+        TrajectoryRange ranges[MAX_TRAJECTORY_RANGES];
+        unsigned int rangeCount = 0;
+
+        if (config.trajectory_bodies != NULL)
+        {
+            rangeCount = parseTrajectoryBodies(config.trajectory_bodies, sim, ranges);
+            if (rangeCount == 0)
+            {
+                fprintf(stderr, "malformed --trajectory-bodies: %s\n", config.trajectory_bodies);
+                destroyOrbitalSim(sim);
+                return 1;
+            }
+        }
+        if (constructTrajectoryWriter(sim, config.trajectory, rangeCount ? ranges : NULL, rangeCount,
+                                      config.trajectory_interval, config.trajectory_quantum) == NULL)
+        {
+            fprintf(stderr, "%s: cannot record trajectory (bodies out of range?)\n", config.trajectory);
+            destroyOrbitalSim(sim);
+            return 1;
+        }
+        if (config.verify_trajectory)
+            keepTrajectoryFrame(sim, trajectory_times, trajectory_positions);
+    }
+
+    if (config.collisions >= 0 &&
+        constructCollisionDetector(sim, (CollisionResponse)config.collisions, config.encounter_distance,
+                                   config.collision_log) == NULL)
+    {
+        fprintf(stderr, "cannot detect collisions (log not writable, or out of memory)\n");
+        destroyOrbitalSim(sim);
+        return 1;
+    }
+
+    if (config.prune > 0 &&
+        constructInteractionLists(sim, config.prune, config.prune_interval ? config.prune_interval
+                                                                           : DEFAULT_INTERACTION_REFRESH) == NULL)
+    {
+        fprintf(stderr, "cannot prune interactions (more than %d planets, or out of memory)\n",
+                INTERACTION_MAX_PLANETS);
+        destroyOrbitalSim(sim);
+        return 1;
+    }
+
+    if (config.approaches != NULL)
+    {
+        ApproachQuery *query = constructApproachQuery(sim);
+        if (query == NULL || !parseApproachTargets(config.approaches, query))
+        {
+            fprintf(stderr, "malformed --approaches, no such body, or more than %d targets: %s\n",
+                    APPROACH_MAX_TARGETS, config.approaches);
+            destroyOrbitalSim(sim);
+            return 1;
+        }
+    }
+
+    //The reference copy starts where the simulation does, before any step, and feels every planet
+    OrbitalSim *reference = NULL;
+    if (config.precision_check)
+    {
+        reference = cloneOrbitalSim(sim, config.threads);
+        if (reference == NULL)
+        {
+            fprintf(stderr, "not enough memory for the precision check\n");
+            destroyOrbitalSim(sim);
+            return 1;
+        }
+        setOrbitalSimPrecision(reference, FORCE_PRECISION_DOUBLE);
+    }
+
+    Instrumentation *instrumentation = NULL;
+    if (config.instrument)
+    {
+        instrumentation = constructInstrumentation(config.instrument_interval);
+        if (instrumentation == NULL)
+        {
+            fprintf(stderr, "not enough memory for the instrumentation\n");
+            if (reference != NULL)
+                destroyOrbitalSim(reference);
+            destroyOrbitalSim(sim);
+            return 1;
+        }
+        if (config.instrument_csv != NULL && !openInstrumentationCsv(instrumentation, config.instrument_csv))
+        {
+            fprintf(stderr, "%s: cannot write instrumentation\n", config.instrument_csv);
+            destroyInstrumentation(instrumentation);
+            if (reference != NULL)
+                destroyOrbitalSim(reference);
+            destroyOrbitalSim(sim);
+            return 1;
+        }
+        attachInstrumentation(sim, instrumentation);
+    }
+
+    //The workers take the asteroids from the segment: they start once it's filled in
+    ShardCoordinator *coordinator = NULL;
+    long shard_pids[SHARD_MAX_WORKERS];
+    unsigned int shards_started = 0;
+    if (config.shards > 0)
+    {
+        coordinator = constructShardCoordinator(sim, config.shards);
+        if (coordinator == NULL)
+        {
+            fprintf(stderr, "cannot shard: needs the euler integrator, the planets force model, at most %d "
+                            "planets, and room in shared memory\n", TILE_MAX_PLANETS);
+            destroyOrbitalSim(sim);
+            return 1;
+        }
+        shards_started = startShardWorkers(coordinator, argv[0], config.threads, shard_pids);
+        if (shards_started < config.shards)
+        {
+            fprintf(stderr, "cannot start shard worker %u\n", shards_started);
+            destroyShardCoordinator(coordinator);
+            waitShardWorkers(shard_pids, shards_started);
+            destroyOrbitalSim(sim);
+            return 1;
+        }
+    }
+
+    double initial_energy, initial_momentum[3];
+    computeOrbitalSimInvariants(sim, &initial_energy, initial_momentum);
+
+    bool saved = true, sharded = true;
+    start = std::chrono::steady_clock::now();
+    unsigned long steps_run = 0;
+    while (steps_run < config.steps)
+    {
+        //A tile never runs past the next checkpoint; sharded, the workers sync up at each
+        //Verifying a trajectory, the positions of each frame are kept as it's taken
+        unsigned long count = coordinator != NULL ? UINT_MAX : config.tile_steps > 1 && !config.verify_trajectory
+                                                                   ? config.tile_steps
+                                                                   : 1;
+        if (count > config.steps - steps_run)
+            count = config.steps - steps_run;
+        if (config.checkpoint_interval &&
+            count > config.checkpoint_interval - steps_run % config.checkpoint_interval)
+            count = config.checkpoint_interval - steps_run % config.checkpoint_interval;
+
+        if (coordinator != NULL)
+        {
+            if (!runShardCoordinator(coordinator, (unsigned int)count))
+            {
+                fprintf(stderr, "a shard worker died or never started: stopped at step %lu\n", steps_run);
+                sharded = false;
+                break;
+            }
+        }
+        else if (count > 1)
+            updateOrbitalSimTiled(sim, (unsigned int)count);
+        else
+            updateOrbitalSim(sim);
+        steps_run += count;
+        if (config.verify_trajectory)
+            keepTrajectoryFrame(sim, trajectory_times, trajectory_positions);
+
+        if (config.checkpoint_interval && steps_run % config.checkpoint_interval == 0 && steps_run < config.steps)
+            saved = saveCheckpoint(sim, config.save) && saved;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%lu steps in %.3f s: %.1f steps/s, %.3g body-steps/s, %llu force evaluations\n",
+           steps_run, seconds, steps_run / seconds, (double)steps_run * sim->bodies_count / seconds,
+           sim->force_evaluations);
+    printf("Simulated %.1f days\n", sim->time_elapsed / SECONDS_PER_DAY);
+    printConservation(sim, initial_energy, initial_momentum);
+    if (sim->block != NULL)
+        printBlockTimeStep(sim->block, (double)steps_run * sim->bodies_count);
+    if (sim->collisions != NULL)
+        printf("Collisions (%s): %llu collisions, %llu close encounters, %llu bodies removed, %u left\n",
+               getCollisionResponseName(sim->collisions->response), sim->collisions->collisions,
+               sim->collisions->encounters, sim->collisions->bodies_removed, sim->bodies_count);
+    if (sim->approaches != NULL)
+    {
+        const ApproachQuery *query = sim->approaches;
+        double steps = steps_run > 0 ? (double)steps_run : 1;
+        printf("Close approaches: %u found; per step, %.0f bodies checked and %.1f watched, "
+               "screening %.3f ms (%.1f%% of the run)\n",
+               query->event_count, query->checks / steps, query->watches / steps, 1E3 * query->seconds / steps,
+               seconds > 0 ? 100 * query->seconds / seconds : 0.0);
+
+        const CloseApproach *closest = NULL;
+        for (unsigned int i = 0; i < query->event_count; i++)
+            if (closest == NULL || query->events[i].distance < closest->distance)
+                closest = &query->events[i];
+        if (closest != NULL)
+            printf("Closest: body %u to body %u at day %.2f, %.6g m, %.6g m/s\n", closest->body,
+                   closest->target, closest->time / SECONDS_PER_DAY, closest->distance, closest->speed);
+        if (query->out_of_memory)
+            fprintf(stderr, "not enough memory for the close approach screening: some may be missing\n");
+    }
+    if (sim->interactions != NULL && sim->interactions->refreshes > 0)
+    {
+        const InteractionLists *lists = sim->interactions;
+        printf("Pruning: %llu of %llu asteroid-planet pairs per step (%.1f%%), %llu refreshes\n",
+               lists->kept_pairs, lists->full_pairs,
+               lists->full_pairs ? 100.0 * lists->kept_pairs / lists->full_pairs : 100.0, lists->refreshes);
+        printf("Pruning error at refresh: max %.3g, mean %.3g of the acceleration (tolerance %g)\n",
+               lists->max_error, lists->error_count ? lists->error_sum / lists->error_count : 0.0,
+               lists->tolerance);
+    }
+
+    if (coordinator != NULL)
+    {
+        printf("Sharded over %u worker processes, on NUMA nodes", coordinator->worker_count);
+        for (unsigned int i = 0; i < coordinator->worker_count; i++)
+            printf(i ? ",%d" : " %d", getShardWorkerNode(coordinator, i));
+        printf(" (-1: not pinned), the coordinator waited %.3f s\n", coordinator->wait_seconds);
+        destroyShardCoordinator(coordinator);
+        waitShardWorkers(shard_pids, shards_started);
+    }
+
+    if (instrumentation != NULL)
+    {
+        printInstrumentation(instrumentation);
+        attachInstrumentation(sim, NULL);
+        destroyInstrumentation(instrumentation);
+    }
+
+    bool accurate = true;
+    if (reference != NULL)
+    {
+        for (unsigned long i = 0; i < config.steps; i += config.tile_steps > 1 ? config.tile_steps : 1)
+        {
+            if (config.tile_steps > 1)
+                updateOrbitalSimTiled(reference, (unsigned int)(config.steps - i < config.tile_steps
+                                                                    ? config.steps - i
+                                                                    : config.tile_steps));
+            else
+                updateOrbitalSim(reference);
+        }
+        accurate = comparePrecision(sim, reference);
+        destroyOrbitalSim(reference);
+    }
+
+    if (config.render_stats)
+        printRenderStats(sim);
+
+    bool recorded = true;
+    if (sim->collisions != NULL && !destroyCollisionDetector(sim->collisions))
+    {
+        fprintf(stderr, "%s: cannot write collision log\n", config.collision_log);
+        recorded = false;
+    }
+    if (config.approach_log != NULL && !writeCloseApproaches(sim->approaches, config.approach_log))
+    {
+        fprintf(stderr, "%s: cannot write close approaches\n", config.approach_log);
+        recorded = false;
+    }
+    if (sim->trajectory != NULL)
+    {
+        TrajectoryWriter *writer = sim->trajectory;
+        unsigned long frames = (writer->steps - 1) / writer->interval + 1;
+        unsigned int body_count = writer->body_count;
+
+        if (destroyTrajectoryWriter(writer))
+        {
+            printf("Recorded %lu frames to %s\n", frames, config.trajectory);
+            if (config.verify_trajectory)
+                recorded = verifyTrajectory(config.trajectory, body_count, config.trajectory_quantum,
+                                            trajectory_times, trajectory_positions) && recorded;
+        }
+        else
+        {
+            fprintf(stderr, "%s: cannot write trajectory\n", config.trajectory);
+            recorded = false;
+        }
+    }
+
+    if (config.save != NULL)
+        saved = saveCheckpoint(sim, config.save) && saved;
+    if (!saved)
+        fprintf(stderr, "%s: cannot write checkpoint\n", config.save);
+
+    destroyOrbitalSim(sim);
+    return saved && recorded && accurate && sharded ? 0 : 1;
+}